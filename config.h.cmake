@@ -102,6 +102,12 @@ ${CMAKE_FUNCTION_EXISTS}
 /* Prefer separate OpenCL kernels or use build-in strings. */
 #cmakedefine PREFER_SEPARATE_OPENCL_SOURCE 1
 
+/* Use single-precision pyramids for single-precision images. */
+#cmakedefine PREFER_FLOAT_TO_DOUBLE_AS_PYRAMID_TYPE 1
+
+/* Use 16-bit pyramid storage for 16-bit images. */
+#cmakedefine PREFER_COMPACT_PYRAMID_TYPE 1
+
 /* MSVC compiler is using _DEBUG instead of DEBUG, so redefine here */
 #if defined _DEBUG && !defined DEBUG
 #define DEBUG 1
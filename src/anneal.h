@@ -28,6 +28,7 @@
 
 #include <algorithm>
 #include <limits>
+#include <utility>
 #include <vector>
 
 #ifdef _WIN32
@@ -43,7 +44,7 @@
 #include "muopt.h"
 #include "opencl.h"
 #include "opencl_anneal.h"
-#include "openmp_lock.h"
+#include "openmp_def.h"
 #include "timer.h"
 
 
@@ -316,8 +317,12 @@ public:
     }
 
 protected:
+    // Indices of points along with their new mean field estimates
+    typedef std::vector<std::pair<int, vigra::Point2D> > StrayEstimates;
+
     virtual void calculateStateProbabilities() {
         const int mf_size = static_cast<int>(mfEstimates.size());
+        const bool showTiming = parameter::as_boolean("time-state-probabilities", false);
 
 #ifdef OPENMP
 #pragma omp parallel
@@ -331,12 +336,9 @@ protected:
 #endif
             for (int index = 0; index < mf_size; ++index) {
                 // Skip updating points that have already converged.
-                convergedPointsLock.set();
                 if (convergedPoints[index]) {
-                    convergedPointsLock.unset();
                     continue;
                 }
-                convergedPointsLock.unset();
 
                 const std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
                 std::vector<double>* stateProbabilities = pointStateProbabilities[index];
@@ -391,7 +393,7 @@ protected:
                     (*stateProbabilities)[j] = Pi[j] / localK;
                 }
                 wall_clock.stop();
-                if (parameter::as_boolean("time-state-probabilities", false))
+                if (showTiming)
                 {
                     ocl::StowFormatFlags _;
 
@@ -411,23 +413,28 @@ protected:
     void iterate() {
         calculateStateProbabilities();
 
-        kMax = 1;
-        size_t kmax_local = 1;
+        // Each point is updated by exactly one thread, so its flag in
+        // convergedPoints needs no lock.  Each thread accumulates its
+        // own k_max and its own stray estimates; we combine them after
+        // the loop.
+        const int numberOfThreads = omp_get_max_threads();
+        std::vector<size_t> kmaxOfThread(numberOfThreads, 1U);
+        std::vector<StrayEstimates> strayEstimatesOfThread(numberOfThreads);
 
 #ifdef OPENMP
-#pragma omp parallel firstprivate(kmax_local)
+#pragma omp parallel
 #endif
         {
+            size_t kmax_local = 1;
+            StrayEstimates& strayEstimates = strayEstimatesOfThread[omp_get_thread_num()];
+
 #ifdef OPENMP
 #pragma omp for nowait schedule(guided)
 #endif
             for (int index = 0; index < static_cast<int>(pointStateSpaces.size()); ++index) {
-                convergedPointsLock.set();
                 if (convergedPoints[index]) {
-                    convergedPointsLock.unset();
                     continue;
                 }
-                convergedPointsLock.unset();
 
                 std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
                 std::vector<double>* stateProbabilities = pointStateProbabilities[index];
@@ -457,26 +464,10 @@ protected:
 
                 // Sanity check
                 if (!costImage->isInside(newEstimate)) {
-                    cerrLock.set();
-                    std::cerr << command
-                              << ": warning: new mean field estimate outside cost image"
-                              << std::endl;
-                    for (unsigned int state = 0; state < localK; ++state) {
-                        std::cerr << command
-                                  << ": note: state " << (*stateSpace)[state]
-                                  << " weight = "
-                                  << (*stateProbabilities)[state]
-                                  << std::endl;
-                    }
-                    std::cerr << command
-                              << ": note: new estimate = " << newEstimate
-                              << std::endl;
-                    cerrLock.unset();
+                    strayEstimates.push_back(std::make_pair(index, newEstimate));
 
                     // Skip this point from now on.
-                    convergedPointsLock.set();
                     convergedPoints[index] = true;
-                    convergedPointsLock.unset();
                     continue;
                 }
 
@@ -510,18 +501,48 @@ protected:
 
                 localK = stateSpace->size();
                 if (localK < 2) {
-                    convergedPointsLock.set();
                     convergedPoints[index] = true;
-                    convergedPointsLock.unset();
                 }
 
                 kmax_local = std::max(kmax_local, stateProbabilities->size());
             }
 
-            kMaxLock.set();
-            kMax = std::max(kMax, static_cast<unsigned int>(kmax_local));
-            kMaxLock.unset();
+            kmaxOfThread[omp_get_thread_num()] = kmax_local;
         } // omp parallel
+
+        kMax = static_cast<unsigned int>(*std::max_element(kmaxOfThread.begin(), kmaxOfThread.end()));
+        warnAboutStrayEstimates(strayEstimatesOfThread);
+    }
+
+    // Warn about the points whose new mean field estimates left the
+    // cost image, in the order of the points.
+    void warnAboutStrayEstimates(const std::vector<StrayEstimates>& someStrayEstimates) const {
+        StrayEstimates strayEstimates;
+        for (auto& s : someStrayEstimates) {
+            strayEstimates.insert(strayEstimates.end(), s.begin(), s.end());
+        }
+        std::sort(strayEstimates.begin(), strayEstimates.end(),
+                  [](const StrayEstimates::value_type& x, const StrayEstimates::value_type& y)
+                  {return x.first < y.first;});
+
+        for (auto& s : strayEstimates) {
+            const std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[s.first];
+            const std::vector<double>* stateProbabilities = pointStateProbabilities[s.first];
+
+            std::cerr << command
+                      << ": warning: new mean field estimate outside cost image"
+                      << std::endl;
+            for (unsigned int state = 0; state < stateSpace->size(); ++state) {
+                std::cerr << command
+                          << ": note: state " << (*stateSpace)[state]
+                          << " weight = "
+                          << (*stateProbabilities)[state]
+                          << std::endl;
+            }
+            std::cerr << command
+                      << ": note: new estimate = " << s.second
+                      << std::endl;
+        }
     }
 
     int costImageCost(const vigra::Point2D& start_point, const vigra::Point2D& end_point) const {
@@ -583,9 +604,10 @@ protected:
 
     std::vector<std::vector<int>*> pointStateDistances;
 
-    // Flags indicate which points have converged
-    std::vector<bool> convergedPoints;
-    omp::lock convergedPointsLock;
+    // Flags indicate which points have converged; one byte per point,
+    // because threads must not update neighboring bits of a
+    // std::vector<bool> at the same time.
+    std::vector<char> convergedPoints;
 
     // Initial Temperature
     double tInitial;
@@ -607,15 +629,12 @@ protected:
 
     // Largest state space over all points
     unsigned int kMax;
-    omp::lock kMaxLock;
 
     // Weight factors for the distance of a point from the initial
     // seam line and the total mismatch accumulated along the seam
     // line segment.
     double distanceWeight;
     double mismatchWeight;
-
-    omp::lock cerrLock;
 }; // class GDAConfiguration
 
 
@@ -652,6 +671,7 @@ protected:
         float* Pi;
         GPU::StateProbabilities->setup(maximum_probability_vector_size, static_cast<size_t>(super::kMax),
                                        E, Pi);
+        const bool showTiming = parameter::as_boolean("time-state-probabilities", false);
 
         for (int index = 0; index < mf_size; ++index)
         {
@@ -699,7 +719,7 @@ protected:
             GPU::StateProbabilities->run(localK, stateProbabilities, super::kMax, E, Pi);
             wall_clock.stop();
 
-            if (parameter::as_boolean("time-state-probabilities", false))
+            if (showTiming)
             {
                 ocl::StowFormatFlags _;
 
@@ -25,8 +25,11 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <exception>
 #include <iostream>
 #include <list>
+#include <memory>
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -44,19 +47,56 @@
 
 #include "common.h"
 #include "fixmath.h"
+#include "packed_alpha.h"
+#include "preview.h"
+#include "tiff_strip_writer.h"
 
 
 namespace enblend {
 
-template <typename T> struct IntegralSelect {typedef T Result;};
-template <> struct IntegralSelect<float> {typedef vigra::UInt32 Result;};
-template <> struct IntegralSelect<double> {typedef vigra::UInt32 Result;};
-template <> struct IntegralSelect<vigra::RGBValue<float> > {
-    typedef vigra::RGBValue<vigra::UInt32> Result;
-};
-template <> struct IntegralSelect<vigra::RGBValue<double> > {
-    typedef vigra::RGBValue<vigra::UInt32> Result;
-};
+/** Answer whether the output goes to a TIFF file that the strip
+ *  writer may produce. */
+inline bool
+isParallelTiffOutput(const vigra::ImageExportInfo& outputImageInfo)
+{
+    const std::string file_type(*outputImageInfo.getFileType() != 0 ?
+                                std::string(outputImageInfo.getFileType()) :
+                                enblend::getFileType(outputImageInfo.getFileName()));
+
+    return file_type == "TIFF" && parameter::as_boolean("parallel-tiff-writer", true); //< parallel-tiff-writer 1
+}
+
+
+/** Write the output mask if the user asked for one. */
+template <typename AlphaType>
+void
+exportOutputMask(const AlphaType* mask)
+{
+    if (OutputMaskFileName)
+    {
+        const std::string mask_filename(OutputMaskFileName.value());
+        vigra::ImageExportInfo mask_info(mask_filename.c_str());
+
+        if (!enblend::has_known_image_extension(mask_filename)) {
+            std::string fallback_file_type {parameter::as_string("fallback-output-mask-file-type",
+                                                                 DEFAULT_FALLBACK_OUTPUT_MASK_FILE_TYPE)};
+            if (mask_filename == "-")
+            {
+                mask_info.setFileName("/dev/stdout");
+            }
+            else
+            {
+                std::cerr <<
+                    command << ": warning: unknown filetype of mask output file \"" << mask_filename << "\"\n" <<
+                    command << ": note: will fall back to type \"" << fallback_file_type << "\"\n";
+            }
+            enblend::to_upper(fallback_file_type);
+            mask_info.setFileType(fallback_file_type.c_str());
+        }
+
+        vigra::exportImage(srcImageRange(*mask), mask_info);
+    }
+}
 
 
 template <typename ImageType, typename AlphaType, typename AlphaAccessor>
@@ -66,11 +106,32 @@ exportImagePreferablyWithAlpha(const ImageType* image,
                                const AlphaAccessor& mask_accessor,
                                const vigra::ImageExportInfo& outputImageInfo)
 {
+    bool is_written = false;
+
+    if (isParallelTiffOutput(outputImageInfo))
+    {
+        try
+        {
+            is_written = exportImageAlphaInStrips(srcImageRange(*image),
+                                                  srcIter(mask->upperLeft(), mask_accessor),
+                                                  outputImageInfo);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr <<
+                command << ": warning: parallel TIFF writer failed; falling back to serial writer\n" <<
+                command << ": note: " << e.what() << std::endl;
+        }
+    }
+
     try
     {
-        vigra::exportImageAlpha(srcImageRange(*image),
-                                srcIter(mask->upperLeft(), mask_accessor),
-                                outputImageInfo);
+        if (!is_written)
+        {
+            vigra::exportImageAlpha(srcImageRange(*image),
+                                    srcIter(mask->upperLeft(), mask_accessor),
+                                    outputImageInfo);
+        }
     }
     catch (std::exception& e)
     {
@@ -97,32 +158,196 @@ exportImagePreferablyWithAlpha(const ImageType* image,
         vigra::exportImage(srcImageRange(*image), outputImageInfo);
     }
 
-    if (OutputMaskFileName)
-    {
-        const std::string mask_filename(OutputMaskFileName.value());
-        vigra::ImageExportInfo mask_info(mask_filename.c_str());
+    exportOutputMask(mask);
 
-        if (!enblend::has_known_image_extension(mask_filename)) {
-            std::string fallback_file_type {parameter::as_string("fallback-output-mask-file-type",
-                                                                 DEFAULT_FALLBACK_OUTPUT_MASK_FILE_TYPE)};
-            if (mask_filename == "-")
-            {
-                mask_info.setFileName("/dev/stdout");
-            }
-            else
-            {
-                std::cerr <<
-                    command << ": warning: unknown filetype of mask output file \"" << mask_filename << "\"\n" <<
-                    command << ": note: will fall back to type \"" << fallback_file_type << "\"\n";
-            }
-            enblend::to_upper(fallback_file_type);
-            mask_info.setFileType(fallback_file_type.c_str());
+    OutputIsValid = true;
+}
+
+
+/** Call a_functor with a value of the component type that
+ *  aPixelType names and answer its result.  Answer false for pixel
+ *  types without such a component type. */
+template <typename Functor>
+bool
+withComponentTypeOf(const std::string& aPixelType, Functor a_functor)
+{
+    if (aPixelType == "UINT8") return a_functor(vigra::UInt8());
+    else if (aPixelType == "INT8") return a_functor(vigra::Int8());
+    else if (aPixelType == "UINT16") return a_functor(vigra::UInt16());
+    else if (aPixelType == "INT16") return a_functor(vigra::Int16());
+    else if (aPixelType == "UINT32") return a_functor(vigra::UInt32());
+    else if (aPixelType == "INT32") return a_functor(vigra::Int32());
+    else if (aPixelType == "FLOAT") return a_functor(float());
+    else if (aPixelType == "DOUBLE") return a_functor(double());
+    else return false;
+}
+
+
+/** Answer the functor that maps pixels of the blended image, whose
+ *  values span [inputMin, inputMax], to OutputPixelType, whose
+ *  values span outputRange.  The strip writer and the export of a
+ *  whole converted image both use it, so they write the same
+ *  pixels. */
+template <typename ImagePixelType, typename OutputPixelType>
+inline auto
+outputValueMapping(double inputMin, double inputMax, const range_t& outputRange)
+{
+    typedef typename TiffPixelTraits<ImagePixelType>::component_type ImagePixelComponentType;
+
+    return vigra::linearRangeMapping(ImagePixelType(static_cast<ImagePixelComponentType>(inputMin)),
+                                     ImagePixelType(static_cast<ImagePixelComponentType>(inputMax)),
+                                     OutputPixelType(outputRange.first),
+                                     OutputPixelType(outputRange.second));
+}
+
+
+/** Write the output image band by band as a striped TIFF.
+ *
+ *  The bands of the image with ImagePixelType pixels and its
+ *  AlphaPixelType mask come from a_band_producer.  It gets called
+ *  once with the number of rows per band and a callable, which it
+ *  calls for each band from top to bottom with the first row, the
+ *  band, and its mask as argument objects.  Every band but the last
+ *  has exactly the given number of rows.  The strip encoder maps the
+ *  pixel values with outputValueMapping() and narrows them in the
+ *  same pass, so neither the whole image nor a converted copy of it
+ *  needs to exist.  A band spans bandStrips strips; zero means the
+ *  whole image.
+ *
+ *  Answer false without touching the file system and without
+ *  calling a_band_producer if the strip writer cannot produce the
+ *  output; throw std::runtime_error if writing fails. */
+template <typename ImagePixelType, typename AlphaPixelType, typename BandProducer>
+bool
+exportBandsInStrips(const vigra::Diff2D& size,
+                    const vigra::ImageExportInfo& outputImageInfo,
+                    double inputMin, double inputMax,
+                    unsigned bandStrips,
+                    BandProducer a_band_producer)
+{
+    typedef TiffPixelTraits<ImagePixelType> pixel_traits;
+
+    const std::string pixel_type(outputImageInfo.getPixelType());
+    const range_t outputRange(enblend::rangeOfPixelType(pixel_type));
+
+    return withComponentTypeOf(pixel_type, [&](auto a_component) -> bool {
+        typedef decltype(a_component) OutputComponentType;
+        typedef typename pixel_traits::template rebind<OutputComponentType> OutputPixelType;
+
+        if (!canExportInStrips<OutputComponentType>(outputImageInfo))
+        {
+            return false;
         }
 
-        vigra::exportImage(srcImageRange(*mask), mask_info);
+        const auto mapping(outputValueMapping<ImagePixelType, OutputPixelType>(inputMin, inputMax, outputRange));
+        typedef vigra::Threshold<AlphaPixelType, OutputComponentType> Threshold;
+        const Threshold threshold(AlphaTraits<AlphaPixelType>::zero(),
+                                  AlphaTraits<AlphaPixelType>::zero(),
+                                  AlphaTraits<OutputComponentType>::max(),
+                                  AlphaTraits<OutputComponentType>::zero());
+
+        TiffStripWriter writer(outputImageInfo, stripLayout<OutputComponentType, ImagePixelType>(size));
+        const int bandRows = bandStrips == 0U ? size.y : static_cast<int>(bandStrips * writer.rows_per_strip());
+
+        a_band_producer(bandRows,
+                        [&](int firstRow, auto a_band, auto an_alpha) {
+                            typedef decltype(an_alpha.second) AlphaAccessor;
+                            writeBandInStrips<OutputComponentType>
+                                (writer, firstRow, a_band,
+                                 std::make_pair(an_alpha.first,
+                                                vigra_ext::ReadFunctorAccessor<Threshold, AlphaAccessor>
+                                                (threshold, an_alpha.second)),
+                                 mapping);
+                        });
+
+        writer.close();
+
+        return true;
+    });
+}
+
+
+/** Write image and mask in strips with the value mapping of
+ *  checkpoint(); see exportBandsInStrips().  Write the mask file,
+ *  too.  Answer whether the output has been written. */
+template <typename ImageType, typename AlphaType>
+bool
+exportMappedImageInStrips(const ImageType* image, const AlphaType* mask,
+                          const vigra::ImageExportInfo& outputImageInfo,
+                          double inputMin, double inputMax)
+{
+    if (!isParallelTiffOutput(outputImageInfo))
+    {
+        return false;
     }
 
-    OutputIsValid = true;
+    bool is_written = false;
+
+    try
+    {
+        is_written =
+            exportBandsInStrips<typename ImageType::PixelType, typename AlphaType::PixelType>
+            (image->size(), outputImageInfo, inputMin, inputMax, 0U,
+             [&](int, auto a_write) {a_write(0, srcImageRange(*image), srcImage(*mask));});
+    }
+    catch (std::exception& e)
+    {
+        std::cerr <<
+            command << ": warning: parallel TIFF writer failed; falling back to serial writer\n" <<
+            command << ": note: " << e.what() << std::endl;
+    }
+
+    if (is_written)
+    {
+        exportOutputMask(mask);
+        OutputIsValid = true;
+    }
+
+    return is_written;
+}
+
+
+/** Convert image with outputValueMapping() into an image of the
+ *  output pixel type and export that with vigra.  As the converted
+ *  image already has the output type, vigra neither narrows nor
+ *  rescales it again. */
+template <typename ImageType, typename AlphaType>
+void
+exportMappedImage(const ImageType* image, const AlphaType* mask,
+                  const vigra::ImageExportInfo& outputImageInfo,
+                  double inputMin, double inputMax)
+{
+    typedef typename ImageType::PixelType ImagePixelType;
+    typedef typename AlphaType::Accessor AlphaAccessor;
+    typedef typename AlphaType::PixelType AlphaPixelType;
+
+    const std::string pixel_type(outputImageInfo.getPixelType());
+    const range_t outputRange(enblend::rangeOfPixelType(pixel_type));
+
+    const bool is_known_type =
+        withComponentTypeOf(pixel_type, [&](auto a_component) -> bool {
+            typedef decltype(a_component) OutputComponentType;
+            typedef typename TiffPixelTraits<ImagePixelType>::template rebind<OutputComponentType> OutputPixelType;
+            typedef vigra::Threshold<AlphaPixelType, OutputComponentType> Threshold;
+
+            IMAGETYPE<OutputPixelType> outputImage(image->width(), image->height());
+            vigra::omp::transformImage(srcImageRange(*image),
+                                       destImage(outputImage),
+                                       outputValueMapping<ImagePixelType, OutputPixelType>(inputMin, inputMax,
+                                                                                           outputRange));
+
+            vigra_ext::ReadFunctorAccessor<Threshold, AlphaAccessor>
+                threshing_alpha_accessor(Threshold(AlphaTraits<AlphaPixelType>::zero(),
+                                                   AlphaTraits<AlphaPixelType>::zero(),
+                                                   AlphaTraits<OutputComponentType>::max(),
+                                                   AlphaTraits<OutputComponentType>::zero()),
+                                         mask->accessor());
+            exportImagePreferablyWithAlpha(&outputImage, mask, threshing_alpha_accessor, outputImageInfo);
+
+            return true;
+        });
+
+    vigra_precondition(is_known_type, "exportMappedImage: unknown output pixel type \"" + pixel_type + "\"");
 }
 
 
@@ -184,14 +409,9 @@ checkpoint(const std::pair<ImageType*, AlphaType*>& p,
                       << ": info: narrowing channel width for output as \""
                       << pixel_type << "\"" << std::endl;
 
-            ImageType lowDepthImage(image->width(), image->height());
-            vigra::omp::transformImage(srcImageRange(*image),
-                                       destImage(lowDepthImage),
-                                       vigra::linearRangeMapping(ImagePixelType(inputMin),
-                                                                 ImagePixelType(inputMax),
-                                                                 ImagePixelType(outputRange.first),
-                                                                 ImagePixelType(outputRange.second)));
-            exportImagePreferablyWithAlpha(&lowDepthImage, mask, threshing_alpha_accessor, outputImageInfo);
+            if (!exportMappedImageInStrips(image, mask, outputImageInfo, inputMin, inputMax)) {
+                exportMappedImage(image, mask, outputImageInfo, inputMin, inputMax);
+            }
         }
     } else {
         const std::string pixel_type(enblend::to_lower_copy(std::string(outputImageInfo.getPixelType())));
@@ -199,28 +419,143 @@ checkpoint(const std::pair<ImageType*, AlphaType*>& p,
                   << ": info: rescaling floating-point data for output as \""
                   << pixel_type << "\"" << std::endl;
 
-        typedef typename IntegralSelect<ImagePixelType>::Result IntegralPixelType;
-        typedef typename EnblendNumericTraits<IntegralPixelType>::ImagePixelComponentType
-            IntegralPixelComponentType;
+        if (!exportMappedImageInStrips(image, mask, outputImageInfo, inputMin, inputMax)) {
+            exportMappedImage(image, mask, outputImageInfo, inputMin, inputMax);
+        }
+    }
+}
 
-        IMAGETYPE<IntegralPixelType> integralImage(image->width(), image->height());
 
-        vigra_ext::ReadFunctorAccessor<vigra::Threshold<AlphaPixelType, IntegralPixelComponentType>, AlphaAccessor>
-            threshing_alpha_accessor(vigra::Threshold<AlphaPixelType, IntegralPixelComponentType>
-                (AlphaTraits<AlphaPixelType>::zero(),
-                 AlphaTraits<AlphaPixelType>::zero(),
-                 AlphaTraits<IntegralPixelComponentType>::max(),
-                 AlphaTraits<IntegralPixelComponentType>::zero()),
-                mask->accessor());
-
-        vigra::omp::transformImage(srcImageRange(*image),
-                                   destImage(integralImage),
-                                   vigra::linearRangeMapping(ImagePixelType(inputMin),
-                                                             ImagePixelType(inputMax),
-                                                             IntegralPixelType(outputRange.first),
-                                                             IntegralPixelType(outputRange.second)));
-        exportImagePreferablyWithAlpha(&integralImage, mask, threshing_alpha_accessor, outputImageInfo);
+/** Write pyramid level 0 aPyramid and its mask directly to the
+ *  output while the pyramid collapses into it.
+ *
+ *  a_collapse finishes the collapse of aPyramid.  It gets called
+ *  exactly once with a callable that takes the number of rows of
+ *  aPyramid that are final, see collapsePyramid().  Whenever enough
+ *  rows for a band of a few strips are final, we convert them into a
+ *  band image and pass it to the strip writer, which maps and
+ *  narrows the values while it encodes them.  So neither the output
+ *  image nor a range-mapped copy of it exists, and the conversion and
+ *  encoding overlap the last expansion instead of following the
+ *  complete collapse.
+ *
+ *  aPyramid is fully collapsed on return in any case.  Answer false
+ *  if the output has not been written; the caller then goes the way
+ *  of copyFromPyramidImageIf() and checkpoint(). */
+template <typename ImageType, typename PyramidImageType, typename AlphaType,
+          int PyramidIntegerBits, int PyramidFractionBits, typename Collapse>
+bool
+checkpointFromPyramid(const PyramidImageType* aPyramid,
+                      const AlphaType* mask,
+                      const vigra::ImageExportInfo& outputImageInfo,
+                      Collapse a_collapse)
+{
+    typedef typename ImageType::PixelType ImagePixelType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType
+        ImagePixelComponentType;
+
+    const std::string pixelType(outputImageInfo.getPixelType());
+    bool is_collapsed = false;
+    bool is_written = false;
+
+    if (isParallelTiffOutput(outputImageInfo) &&
+        withComponentTypeOf(pixelType, [&](auto a_component) -> bool {
+                return canExportInStrips<decltype(a_component)>(outputImageInfo);
+            }))
+    {
+        const std::pair<double, double> outputRange = enblend::rangeOfPixelType(pixelType);
+        const double inputMin =
+            vigra::NumericTraits<ImagePixelComponentType>::isIntegral::asBool ?
+            vigra::NumericTraits<ImagePixelComponentType>::min() :
+            0.0;
+        const double inputMax =
+            vigra::NumericTraits<ImagePixelComponentType>::isIntegral::asBool ?
+            vigra::NumericTraits<ImagePixelComponentType>::max() :
+            1.0;
+
+        if (inputMin != outputRange.first || inputMax != outputRange.second) {
+            std::cerr << command
+                      << (inputMin <= outputRange.first && inputMax >= outputRange.second ?
+                          ": info: narrowing channel width for output as \"" :
+                          ": info: rescaling floating-point data for output as \"")
+                      << enblend::to_lower_copy(pixelType) << "\"" << std::endl;
+        }
+
+        const int width = aPyramid->width();
+        const int height = aPyramid->height();
+        const unsigned bandStrips = static_cast<unsigned>(std::max(1, 2 * omp_get_max_threads()));
+
+        try
+        {
+            is_written =
+                exportBandsInStrips<ImagePixelType, typename AlphaType::PixelType>
+                (aPyramid->size(), outputImageInfo, inputMin, inputMax, bandStrips,
+                 [&](int bandRows, auto a_write) {
+                    ImageType band(width, std::min(bandRows, height));
+                    std::exception_ptr write_error;
+                    int firstRow = 0;
+
+                    // A failing write must not cut the collapse
+                    // short, for our caller falls back to the
+                    // complete level 0.  So we keep the error until
+                    // the collapse has finished.
+                    is_collapsed = true;
+                    a_collapse([&](int finalRows) {
+                            while (!write_error && firstRow < height &&
+                                   (finalRows - firstRow >= bandRows || finalRows == height)) {
+                                const int rows = std::min(bandRows, height - firstRow);
+                                const vigra::Diff2D origin(0, firstRow);
+
+                                band.init(vigra::NumericTraits<ImagePixelType>::zero());
+                                copyFromPyramidImageIf<PyramidImageType, AlphaType, ImageType,
+                                                       PyramidIntegerBits, PyramidFractionBits>
+                                    (aPyramid->upperLeft() + origin,
+                                     aPyramid->upperLeft() + vigra::Diff2D(width, firstRow + rows),
+                                     aPyramid->accessor(),
+                                     mask->upperLeft() + origin, mask->accessor(),
+                                     band.upperLeft(), band.accessor());
+
+                                try
+                                {
+                                    a_write(firstRow,
+                                            vigra::make_triple(band.upperLeft(),
+                                                               band.upperLeft() + vigra::Diff2D(width, rows),
+                                                               band.accessor()),
+                                            std::make_pair(mask->upperLeft() + origin, mask->accessor()));
+                                }
+                                catch (...)
+                                {
+                                    write_error = std::current_exception();
+                                }
+                                firstRow += rows;
+                            }
+                        });
+
+                    if (write_error) {
+                        std::rethrow_exception(write_error);
+                    }
+                });
+        }
+        catch (std::exception& e)
+        {
+            is_written = false;
+            std::cerr <<
+                command << ": warning: parallel TIFF writer failed; falling back to serial writer\n" <<
+                command << ": note: " << e.what() << std::endl;
+        }
+    }
+
+    if (!is_collapsed) {
+        a_collapse([](int) {});
     }
+
+    if (is_written)
+    {
+        exportOutputMask(mask);
+        OutputIsValid = true;
+    }
+
+    return is_written;
 }
 
 
@@ -291,6 +626,31 @@ import(const vigra::ImageImportInfo& info,
 }
 
 
+/** Import the image of INFO into freshly allocated images.  With
+ *  option --preview they hold the scaled-down proxy of the image.
+ *  Answer the rectangle the images cover in the canvas of the
+ *  (preview) output.
+ */
+template <typename ImageType, typename AlphaType>
+vigra::Rect2D
+importScaled(const vigra::ImageImportInfo& info,
+             std::unique_ptr<ImageType>& image, std::unique_ptr<AlphaType>& alpha)
+{
+    const vigra::Rect2D rect(vigra::Point2D(info.getPosition()), info.size());
+
+    image.reset(new ImageType(info.size()));
+    alpha.reset(new AlphaType(info.size()));
+    import(info, destImage(*image), destImage(*alpha));
+
+    if (PreviewLevels == 0U) {
+        return rect;
+    }
+
+    reduceToPreview(PreviewLevels, WrapAround != OpenBoundaries, rect.upperLeft(), image, alpha);
+    return previewRect(rect, PreviewLevels);
+}
+
+
 /** Find images that do not overlap and assemble them into one image.
  *  Uses a greedy heuristic.
  *  Removes used images from given list of ImageImportInfos.
@@ -301,9 +661,6 @@ template <typename ImageType, typename AlphaType>
 std::pair<ImageType*, AlphaType*>
 assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& inputUnion, vigra::Rect2D& bb)
 {
-    typedef typename AlphaType::traverser AlphaIteratorType;
-    typedef typename AlphaType::Accessor AlphaAccessor;
-
     // No more images to assemble?
     if (imageInfoList.empty()) {
         return std::pair<ImageType*, AlphaType*>(static_cast<ImageType*>(nullptr),
@@ -330,12 +687,26 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
         }
     }
 
-    const vigra::Diff2D imagePos = imageInfoList.front()->getPosition();
-    import(*imageInfoList.front(),
-           vigra::destIter(image->upperLeft() + imagePos - inputUnion.upperLeft()),
-           vigra::destIter(imageA->upperLeft() + imagePos - inputUnion.upperLeft()));
+    if (PreviewLevels == 0U) {
+        const vigra::Diff2D imagePos = imageInfoList.front()->getPosition();
+        import(*imageInfoList.front(),
+               vigra::destIter(image->upperLeft() + imagePos - inputUnion.upperLeft()),
+               vigra::destIter(imageA->upperLeft() + imagePos - inputUnion.upperLeft()));
+    } else {
+        std::unique_ptr<ImageType> preview;
+        std::unique_ptr<AlphaType> previewA;
+        const vigra::Rect2D rect(importScaled(*imageInfoList.front(), preview, previewA));
+        vigra::omp::copyImage(srcImageRange(*preview),
+                              vigra::destIter(image->upperLeft() + rect.upperLeft() - inputUnion.upperLeft()));
+        vigra::omp::copyImage(srcImageRange(*previewA),
+                              vigra::destIter(imageA->upperLeft() + rect.upperLeft() - inputUnion.upperLeft()));
+    }
     imageInfoList.erase(imageInfoList.begin());
 
+    // Overlap tests and the bounding box work on a packed copy of
+    // the assembled alpha channel.
+    PackedAlpha packedA(srcImageRange(*imageA));
+
     if (!OneAtATime) {
         // Attempt to assemble additional non-overlapping images.
 
@@ -347,34 +718,15 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
             vigra::ImageImportInfo* info = *i;
 
             // Load the next image.
-            std::unique_ptr<ImageType> src {new ImageType(info->size())};
-            std::unique_ptr<AlphaType> srcA {new AlphaType(info->size())};
-
-            import(*info, destImage(*src), destImage(*srcA));
+            std::unique_ptr<ImageType> src;
+            std::unique_ptr<AlphaType> srcA;
+            const vigra::Diff2D srcPos = importScaled(*info, src, srcA).upperLeft();
 
             // Check for overlap.
-            bool overlapFound = false;
-            AlphaIteratorType dy = imageA->upperLeft() - inputUnion.upperLeft() + info->getPosition();
-            AlphaAccessor da = imageA->accessor();
-            AlphaIteratorType sy = srcA->upperLeft();
-            AlphaIteratorType send = srcA->lowerRight();
-            AlphaAccessor sa = srcA->accessor();
-
-            for(; sy.y < send.y; ++sy.y, ++dy.y) {
-                AlphaIteratorType sx = sy;
-                AlphaIteratorType dx = dy;
-                for(; sx.x < send.x; ++sx.x, ++dx.x) {
-                    if (sa(sx) && da(dx)) {
-                        overlapFound = true;
-                        break;
-                    }
-                }
-                if (overlapFound) {
-                    break;
-                }
-            }
+            const PackedAlpha packedSrcA(srcImageRange(*srcA));
+            const vigra::Diff2D offset(srcPos - inputUnion.upperLeft());
 
-            if (!overlapFound) {
+            if (!packedA.intersects(packedSrcA, offset)) {
                 // Copy src and srcA into image and imageA.
 
                 if (Verbose >= VERBOSE_ASSEMBLE_MESSAGES) {
@@ -382,7 +734,6 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
                     std::cerr.flush();
                 }
 
-                const vigra::Diff2D srcPos = info->getPosition();
 #ifdef OPENMP
                 omp::scoped_nested(true);
                 omp::scoped_dynamic(true);
@@ -402,6 +753,8 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
                 } // omp parallel
 #endif
 
+                packedA.merge(packedSrcA, offset);
+
                 // Remove info from list later.
                 toBeRemoved.push_back(i);
             }
@@ -420,15 +773,12 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
     }
 
     // Calculate bounding box of image.
-    vigra::FindBoundingRectangle unionRect;
-    vigra::inspectImageIf(srcIterRange(vigra::Diff2D(), vigra::Diff2D() + image->size()),
-                          srcImage(*imageA), unionRect);
-    bb = unionRect();
+    bb = packedA.bounding_box();
 
     if (Verbose >= VERBOSE_ABB_MESSAGES) {
         std::cerr << command
                   << ": info: assembled images bounding box: "
-                  << unionRect()
+                  << bb
                   << std::endl;
     }
 
@@ -0,0 +1,587 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <csignal>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "error_message.h"
+#include "openmp_def.h"
+#include "batch.h"
+
+
+namespace enblend
+{
+    namespace batch
+    {
+        std::vector<std::string>
+        split_arguments(const std::string& a_line)
+        {
+            std::vector<std::string> arguments;
+            std::string argument;
+            bool in_argument = false;
+            char quote = '\0';
+
+            for (std::string::const_iterator c = a_line.begin(); c != a_line.end(); ++c)
+            {
+                if (quote != '\0')
+                {
+                    if (*c == quote)
+                    {
+                        quote = '\0';
+                    }
+                    else if (*c == '\\' && quote == '"' && c + 1 != a_line.end())
+                    {
+                        argument.push_back(*++c);
+                    }
+                    else
+                    {
+                        argument.push_back(*c);
+                    }
+                }
+                else if (*c == '\'' || *c == '"')
+                {
+                    quote = *c;
+                    in_argument = true;
+                }
+                else if (*c == '\\' && c + 1 != a_line.end())
+                {
+                    argument.push_back(*++c);
+                    in_argument = true;
+                }
+                else if (std::isspace(static_cast<unsigned char>(*c)))
+                {
+                    if (in_argument)
+                    {
+                        arguments.push_back(argument);
+                        argument.clear();
+                        in_argument = false;
+                    }
+                }
+                else
+                {
+                    argument.push_back(*c);
+                    in_argument = true;
+                }
+            }
+
+            if (quote != '\0')
+            {
+                throw std::invalid_argument(std::string("unbalanced ") + quote);
+            }
+            if (in_argument)
+            {
+                arguments.push_back(argument);
+            }
+
+            return arguments;
+        }
+
+
+        bool
+        find_manifest(int argc, char** argv, Arguments* some_arguments)
+        {
+            static const std::string batch_option("--batch");
+            static const std::string jobs_option("--batch-jobs=");
+            bool is_batch = false;
+
+            for (int i = 1; i < argc; ++i)
+            {
+                const std::string argument(argv[i]);
+
+                if (argument.compare(0U, jobs_option.size(), jobs_option) == 0)
+                {
+                    some_arguments->concurrency =
+                        static_cast<unsigned>(std::max(1, std::atoi(argument.c_str() + jobs_option.size())));
+                }
+                else if (argument.compare(0U, batch_option.size() + 1U, batch_option + "=") == 0)
+                {
+                    some_arguments->manifest = argument.substr(batch_option.size() + 1U);
+                    is_batch = true;
+                }
+                else if (argument == batch_option && i + 1 < argc)
+                {
+                    some_arguments->manifest = argv[++i];
+                    is_batch = true;
+                }
+                else
+                {
+                    some_arguments->common.push_back(argument);
+                }
+            }
+
+            return is_batch;
+        }
+
+
+        int
+        call(const job_function& a_job, const std::string& a_command,
+             const std::vector<std::string>& some_arguments)
+        {
+            std::vector<std::string> arguments(1U, a_command);
+            arguments.insert(arguments.end(), some_arguments.begin(), some_arguments.end());
+
+            std::vector<char*> argv;
+            for (auto& a : arguments)
+            {
+                argv.push_back(&a[0]);
+            }
+            argv.push_back(nullptr);
+
+            return a_job(static_cast<int>(arguments.size()), &argv[0]);
+        }
+
+
+#ifdef _WIN32
+        int
+        run(const std::string& a_command, const Arguments&, const job_function&)
+        {
+            std::cerr << a_command << ": batch mode is not available on this platform" << std::endl;
+            return 1;
+        }
+#else
+        namespace
+        {
+            struct Worker
+            {
+                pid_t pid;
+                int job_fd;         // parent writes the arguments of the next job
+                int status_fd;      // parent reads the exit status of the job
+                unsigned line;      // line of manifest of the running job; zero if idle
+            };
+
+
+            bool
+            write_all(int a_fd, const void* a_buffer, size_t a_size)
+            {
+                const char* buffer = static_cast<const char*>(a_buffer);
+                while (a_size != 0U)
+                {
+                    const ssize_t n = write(a_fd, buffer, a_size);
+                    if (n == -1)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        return false;
+                    }
+                    buffer += n;
+                    a_size -= static_cast<size_t>(n);
+                }
+                return true;
+            }
+
+
+            // Answer false at end of file or on error.
+            bool
+            read_all(int a_fd, void* a_buffer, size_t a_size)
+            {
+                char* buffer = static_cast<char*>(a_buffer);
+                while (a_size != 0U)
+                {
+                    const ssize_t n = read(a_fd, buffer, a_size);
+                    if (n == -1)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        return false;
+                    }
+                    if (n == 0)
+                    {
+                        return false;
+                    }
+                    buffer += n;
+                    a_size -= static_cast<size_t>(n);
+                }
+                return true;
+            }
+
+
+            // A job travels as the number of its arguments followed by
+            // each argument prefixed with its length.
+            bool
+            send_job(int a_fd, const std::vector<std::string>& some_arguments)
+            {
+                const uint32_t count = static_cast<uint32_t>(some_arguments.size());
+                if (!write_all(a_fd, &count, sizeof(count)))
+                {
+                    return false;
+                }
+                for (auto const& a : some_arguments)
+                {
+                    const uint32_t size = static_cast<uint32_t>(a.size());
+                    if (!write_all(a_fd, &size, sizeof(size)) || !write_all(a_fd, a.data(), a.size()))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+
+            bool
+            receive_job(int a_fd, std::vector<std::string>* some_arguments)
+            {
+                uint32_t count;
+                if (!read_all(a_fd, &count, sizeof(count)))
+                {
+                    return false;
+                }
+                some_arguments->clear();
+                for (uint32_t i = 0U; i != count; ++i)
+                {
+                    uint32_t size;
+                    if (!read_all(a_fd, &size, sizeof(size)))
+                    {
+                        return false;
+                    }
+                    std::string argument(size, '\0');
+                    if (size != 0U && !read_all(a_fd, &argument[0], size))
+                    {
+                        return false;
+                    }
+                    some_arguments->push_back(argument);
+                }
+                return true;
+            }
+
+
+            [[noreturn]] void
+            run_worker(const std::string& a_command, const Arguments& some_arguments,
+                       int a_job_fd, int a_status_fd, const job_function& a_job)
+            {
+                // The worker shares the file offset of standard input
+                // with the parent, which may be reading the manifest
+                // from it.  The stdio clean-up in exit() -- ours below
+                // or any of the job's error exits -- may seek a
+                // seekable standard input back to what its buffer has
+                // consumed, and the parent would read the same lines
+                // again.  Detach the worker from it.
+                const int null_fd = open("/dev/null", O_RDONLY);
+                if (null_fd != -1)
+                {
+                    dup2(null_fd, STDIN_FILENO);
+                    close(null_fd);
+                }
+                else
+                {
+                    close(STDIN_FILENO);
+                }
+
+                signal(SIGPIPE, SIG_DFL);
+
+#ifdef OPENMP
+                // Concurrent jobs share the cores.
+                if (some_arguments.concurrency > 1U)
+                {
+                    omp_set_num_threads(std::max(1, omp_get_max_threads() /
+                                                 static_cast<int>(some_arguments.concurrency)));
+                }
+#endif
+
+                std::vector<std::string> job_arguments;
+                while (receive_job(a_job_fd, &job_arguments))
+                {
+                    std::vector<std::string> arguments(some_arguments.common);
+                    arguments.insert(arguments.end(), job_arguments.begin(), job_arguments.end());
+
+                    const int status = call(a_job, a_command, arguments);
+                    std::cout.flush();
+                    std::cerr.flush();
+                    if (!write_all(a_status_fd, &status, sizeof(status)))
+                    {
+                        break;
+                    }
+                }
+
+                std::exit(0);
+            }
+        } // namespace
+
+
+        int
+        run(const std::string& a_command, const Arguments& some_arguments, const job_function& a_job)
+        {
+            std::ifstream manifest_file;
+            std::istream* manifest = &std::cin;
+            if (some_arguments.manifest != "-")
+            {
+                manifest_file.open(some_arguments.manifest.c_str());
+                if (!manifest_file)
+                {
+                    std::cerr << a_command << ": cannot open batch manifest \"" <<
+                        some_arguments.manifest << "\"" << std::endl;
+                    return 1;
+                }
+                manifest = &manifest_file;
+            }
+
+            // A worker that dies between two jobs must not take the
+            // parent with it when the parent sends the next job.
+            signal(SIGPIPE, SIG_IGN);
+
+            typedef std::vector<Worker> worker_list;
+            worker_list workers;
+            unsigned jobs = 0U;
+            unsigned failures = 0U;
+
+            auto start_worker = [&]() -> bool
+            {
+                int job_pipe[2];
+                int status_pipe[2];
+                if (pipe(job_pipe) == -1)
+                {
+                    return false;
+                }
+                if (pipe(status_pipe) == -1)
+                {
+                    const int error = errno;
+                    close(job_pipe[0]);
+                    close(job_pipe[1]);
+                    errno = error;
+                    return false;
+                }
+
+                // Do not let the worker inherit unflushed output.
+                std::cout.flush();
+                std::cerr.flush();
+
+                const pid_t pid = fork();
+                if (pid == 0)
+                {
+                    for (auto const& w : workers)
+                    {
+                        close(w.job_fd);
+                        close(w.status_fd);
+                    }
+                    close(job_pipe[1]);
+                    close(status_pipe[0]);
+                    run_worker(a_command, some_arguments, job_pipe[0], status_pipe[1], a_job);
+                }
+
+                const int error = errno;
+                close(job_pipe[0]);
+                close(status_pipe[1]);
+                if (pid == -1)
+                {
+                    close(job_pipe[1]);
+                    close(status_pipe[0]);
+                    errno = error;
+                    return false;
+                }
+
+                workers.push_back(Worker {pid, job_pipe[1], status_pipe[0], 0U});
+                return true;
+            };
+
+            auto retire_worker = [&](worker_list::iterator a_worker) -> int
+            {
+                close(a_worker->job_fd);
+                close(a_worker->status_fd);
+
+                int status;
+                pid_t pid;
+                do
+                {
+                    pid = waitpid(a_worker->pid, &status, 0);
+                }
+                while (pid == -1 && errno == EINTR);
+
+                workers.erase(a_worker);
+                return pid == -1 ? 0 : status;
+            };
+
+            auto report_failure = [&](unsigned a_line)
+            {
+                ++failures;
+                std::cerr << a_command << ": job in line " << a_line << " of batch manifest ";
+            };
+
+            auto wait_for_job = [&]()
+            {
+                std::vector<pollfd> descriptors;
+                for (auto const& w : workers)
+                {
+                    if (w.line != 0U)
+                    {
+                        descriptors.push_back(pollfd {w.status_fd, POLLIN, 0});
+                    }
+                }
+
+                while (poll(&descriptors[0], descriptors.size(), -1) == -1 && errno == EINTR)
+                {
+                    // retry
+                }
+
+                for (auto const& d : descriptors)
+                {
+                    if (d.revents == 0)
+                    {
+                        continue;
+                    }
+
+                    worker_list::iterator worker =
+                        std::find_if(workers.begin(), workers.end(),
+                                     [&](const Worker& w) {return w.status_fd == d.fd;});
+                    const unsigned line = worker->line;
+
+                    int status;
+                    if (read_all(worker->status_fd, &status, sizeof(status)))
+                    {
+                        worker->line = 0U;
+                        if (status != 0)
+                        {
+                            report_failure(line);
+                            std::cerr << "failed with exit status " << status << std::endl;
+                        }
+                    }
+                    else
+                    {
+                        // The job has ended the worker, usually with
+                        // exit() on an error.
+                        status = retire_worker(worker);
+                        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                        {
+                            report_failure(line);
+                            if (WIFSIGNALED(status))
+                            {
+                                std::cerr << "was killed by signal " << WTERMSIG(status) << std::endl;
+                            }
+                            else
+                            {
+                                std::cerr << "failed with exit status " << WEXITSTATUS(status) << std::endl;
+                            }
+                        }
+                    }
+                }
+            };
+
+            auto is_idle = [](const Worker& w) {return w.line == 0U;};
+            auto is_busy = [](const Worker& w) {return w.line != 0U;};
+
+            std::string line;
+            unsigned line_number = 0U;
+            while (std::getline(*manifest, line))
+            {
+                ++line_number;
+
+                std::vector<std::string> job_arguments;
+                try
+                {
+                    job_arguments = split_arguments(line);
+                }
+                catch (std::invalid_argument& e)
+                {
+                    ++jobs;
+                    ++failures;
+                    std::cerr << a_command << ": cannot parse line " << line_number <<
+                        " of batch manifest: " << e.what() << std::endl;
+                    continue;
+                }
+                if (job_arguments.empty() || job_arguments.front()[0] == '#')
+                {
+                    continue;
+                }
+
+                ++jobs;
+
+                worker_list::iterator worker = std::find_if(workers.begin(), workers.end(), is_idle);
+                while (worker == workers.end())
+                {
+                    if (workers.size() < some_arguments.concurrency && start_worker())
+                    {
+                        worker = workers.end() - 1;
+                    }
+                    else if (std::any_of(workers.begin(), workers.end(), is_busy))
+                    {
+                        wait_for_job();
+                        worker = std::find_if(workers.begin(), workers.end(), is_idle);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+
+                if (worker == workers.end())
+                {
+                    ++failures;
+                    std::cerr << a_command << ": cannot start job in line " << line_number <<
+                        " of batch manifest: " << errorMessage(errno) << std::endl;
+                    continue;
+                }
+
+                if (!send_job(worker->job_fd, job_arguments))
+                {
+                    ++failures;
+                    std::cerr << a_command << ": cannot start job in line " << line_number <<
+                        " of batch manifest: " << errorMessage(errno) << std::endl;
+                    retire_worker(worker);
+                    continue;
+                }
+                worker->line = line_number;
+            }
+
+            while (std::any_of(workers.begin(), workers.end(), is_busy))
+            {
+                wait_for_job();
+            }
+
+            // Closing its job pipe lets each worker exit.
+            while (!workers.empty())
+            {
+                retire_worker(workers.begin());
+            }
+
+            if (failures != 0U)
+            {
+                std::cerr << a_command << ": " << failures << " of " << jobs << " batch jobs failed" << std::endl;
+            }
+
+            return failures == 0U ? 0 : 1;
+        }
+#endif // _WIN32
+    } // namespace batch
+} // namespace enblend
+
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef BATCH_H_INCLUDED_
+#define BATCH_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <functional>
+#include <string>
+#include <vector>
+
+
+namespace enblend
+{
+    // Batch mode
+    //
+    // A manifest lists one job per line with the same arguments as
+    // the command line; empty lines and lines starting with '#' are
+    // skipped.  The manifest "-" is standard input, which turns the
+    // process into a server that fuses stacks as their lines arrive.
+    //
+    // The one-time set-up of the process -- loading the shared
+    // libraries, installing the handlers, and the self-tests -- is
+    // paid once.  A pool of worker processes forked from the prepared
+    // parent then runs the jobs in-process, one after the other, so
+    // that whatever a worker has built -- the GPU context, lookup
+    // tables, thread pools, and color transforms -- serves all its
+    // later jobs.  A job that ends with exit() takes its worker with
+    // it, but not the batch: the parent replaces the worker.
+    namespace batch
+    {
+        typedef std::function<int(int argc, char** argv)> job_function;
+
+        struct Arguments
+        {
+            Arguments() : concurrency(1U) {}
+
+            std::string manifest;
+            unsigned concurrency;                  // number of jobs to run at the same time
+            std::vector<std::string> common;       // prepended to the arguments of every job
+        };
+
+        // Split A_LINE into arguments at whitespace.  Single and double
+        // quotes group words and a backslash escapes the next
+        // character.
+        std::vector<std::string> split_arguments(const std::string& a_line);
+
+        // Answer whether the command line ARGC/ARGV asks for batch
+        // mode with "--batch=MANIFEST" and collect all other arguments
+        // but "--batch-jobs=JOBS" in SOME_ARGUMENTS.
+        bool find_manifest(int argc, char** argv, Arguments* some_arguments);
+
+        // Call A_JOB with A_COMMAND as argv[0] followed by
+        // SOME_ARGUMENTS and answer its exit status.
+        int call(const job_function& a_job, const std::string& a_command,
+                 const std::vector<std::string>& some_arguments);
+
+        // Run every job of the manifest in SOME_ARGUMENTS by calling
+        // A_JOB in one of the worker processes with A_COMMAND as
+        // argv[0].  A_JOB must restore whatever global state a
+        // previous job may have left behind.  Answer the exit status
+        // of the whole batch: zero if all jobs succeeded.
+        int run(const std::string& a_command, const Arguments& some_arguments, const job_function& a_job);
+    } // namespace batch
+} // namespace enblend
+
+
+#endif // BATCH_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -25,12 +25,18 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 
+#include <vigra/basicimage.hxx>
 #include <vigra/combineimages.hxx>
+#include <vigra/copyimage.hxx>
 #include <vigra/numerictraits.hxx>
 
 #include "fixmath.h"
+#include "pyramid.h"
+#include "rect2d.hxx"
 
 
 namespace enblend {
@@ -120,6 +126,220 @@ blend(std::vector<MaskPyramidType*>* maskGP,
     }
 }
 
+
+// Seam-band blending
+//
+// Away from the seam the mask pyramid is exactly zero or exactly white
+// on every level.  Where this holds for a pixel and for the support of
+// Expand on all coarser levels, the collapsed blend is just the black
+// or the white image.  We classify the pixels of each level as black,
+// white, or mixed, starting at the coarsest level, and compute the
+// Laplacians, the blend, and the collapse only in the tiles that hold
+// mixed pixels.  Within these tiles the arithmetic is that of the
+// dense code.
+
+enum {SeamBandBlack = 1, SeamBandWhite = 2, SeamBandMixed = SeamBandBlack | SeamBandWhite};
+
+// Expand reads the coarser level at most one pixel beyond the
+// footprint of the destination.  The halo keeps the border effects of
+// Expand on a sub-image out of the tile.
+#define SEAM_BAND_HALO 8
+
+
+/** Classify the pixels of a level of the mask pyramid.  A pixel gets
+ *  all the classes of the pixels of the next coarser level that Expand
+ *  reads for it. */
+template <typename MaskPyramidType>
+void
+seamBandClassify(const MaskPyramidType& mask, typename MaskPyramidType::value_type maskPyramidWhiteValue,
+                 const vigra::BImage* coarser, vigra::BImage& label)
+{
+    typedef typename MaskPyramidType::value_type MaskPixelType;
+
+    const MaskPixelType black(vigra::NumericTraits<MaskPixelType>::zero());
+    const int width = mask.width();
+    const int height = mask.height();
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const MaskPixelType m = mask(x, y);
+            unsigned char c =
+                m <= black ? SeamBandBlack : (m >= maskPyramidWhiteValue ? SeamBandWhite : SeamBandMixed);
+
+            if (coarser != nullptr) {
+                const int top = std::max((y - 1) >> 1, 0);
+                const int bottom = std::min((y + 2) >> 1, coarser->height() - 1);
+                const int left = std::max((x - 1) >> 1, 0);
+                const int right = std::min((x + 2) >> 1, coarser->width() - 1);
+                for (int v = top; v <= bottom; ++v) {
+                    for (int u = left; u <= right; ++u) {
+                        c |= (*coarser)(u, v);
+                    }
+                }
+            }
+
+            label(x, y) = c;
+        }
+    }
+}
+
+
+/** Sort the tiles of a level into the seam band, i.e., tiles with any
+ *  mixed pixel, and the tiles that are white throughout.  The
+ *  remaining tiles are black and need no work. */
+inline void
+seamBandTiles(const vigra::BImage& label, int tileSize,
+              std::vector<vigra::Rect2D>& band, std::vector<vigra::Rect2D>& white)
+{
+    const int width = label.width();
+    const int height = label.height();
+
+    for (int y = 0; y < height; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            const vigra::Rect2D tile(x, y, std::min(x + tileSize, width), std::min(y + tileSize, height));
+            unsigned char c = 0;
+
+            for (int v = tile.top(); v < tile.bottom() && c != SeamBandMixed; ++v) {
+                for (int u = tile.left(); u < tile.right(); ++u) {
+                    c |= label(u, v);
+                }
+            }
+
+            if (c == SeamBandMixed) {
+                band.push_back(tile);
+            } else if (c == SeamBandWhite) {
+                white.push_back(tile);
+            }
+        }
+    }
+}
+
+
+/** Combine the expansion of coarser with the tiles of level, i.e.,
+ *  subtract it when building a Laplacian and add it when collapsing.
+ *  Each tile is expanded with a halo in a scratch image. */
+template <typename SKIPSMImagePixelType, typename PyramidImageType>
+void
+expandTiles(bool add, const PyramidImageType& coarser, PyramidImageType& level,
+            const std::vector<vigra::Rect2D>& tiles)
+{
+    const vigra::Rect2D bounds(vigra::Point2D(0, 0), level.size());
+    const int n = tiles.size();
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < n; ++i) {
+        const vigra::Rect2D& tile = tiles[i];
+        vigra::Rect2D region(tile);
+        region.addBorder(SEAM_BAND_HALO);
+        region &= bounds;
+
+        // Tiles start at even coordinates and so does the region,
+        // thus the region's source is half its size rounded up,
+        // just like the next level of the pyramid.
+        const vigra::Rect2D source(region.left() / 2, region.top() / 2,
+                                   (region.right() + 1) / 2, (region.bottom() + 1) / 2);
+        const vigra::Diff2D offset(tile.upperLeft() - region.upperLeft());
+
+        PyramidImageType scratch(region.width(), region.height());
+        vigra::copyImage(vigra_ext::apply(tile, srcImageRange(level)),
+                         destIter(scratch.upperLeft() + offset, scratch.accessor()));
+        expand<SKIPSMImagePixelType>(add, false,
+                                     vigra_ext::apply(source, srcImageRange(coarser)),
+                                     destImageRange(scratch));
+        vigra::copyImage(srcIterRange(scratch.upperLeft() + offset,
+                                      scratch.upperLeft() + offset + tile.size(),
+                                      scratch.accessor()),
+                         vigra_ext::apply(tile, destImage(level)));
+    }
+}
+
+
+/** Blend the Gaussian pyramids whiteGP and blackGP using the mask
+ *  pyramid maskGP like blend() followed by collapsePyramid() on the
+ *  respective Laplacian pyramids, but only work on the seam band.
+ *  The collapsed result is left in level 0 of blackGP.  Both image
+ *  pyramids are clobbered. */
+template <typename SKIPSMImagePixelType, typename MaskPyramidType, typename ImagePyramidType>
+void
+blendSeamBand(std::vector<MaskPyramidType*>* maskGP,
+              std::vector<ImagePyramidType*>* whiteGP,
+              std::vector<ImagePyramidType*>* blackGP,
+              typename MaskPyramidType::value_type maskPyramidWhiteValue,
+              int tileSize)
+{
+    typedef typename MaskPyramidType::value_type MaskPixelType;
+
+    const int levels = maskGP->size();
+    std::vector<std::vector<vigra::Rect2D> > band(levels);
+    std::vector<std::vector<vigra::Rect2D> > white(levels);
+
+    {
+        std::unique_ptr<vigra::BImage> coarser;
+        for (int l = levels - 1; l >= 0; --l) {
+            std::unique_ptr<vigra::BImage> label(new vigra::BImage((*maskGP)[l]->size()));
+            seamBandClassify(*((*maskGP)[l]), maskPyramidWhiteValue, coarser.get(), *label);
+            seamBandTiles(*label, tileSize, band[l], white[l]);
+            coarser.swap(label);
+        }
+    }
+
+    if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+        std::cerr << command << ": info: blending seam band:";
+        for (int l = 0; l < levels; ++l) {
+            const vigra::Size2D size((*maskGP)[l]->size());
+            const int tiles = ((size.x + tileSize - 1) / tileSize) * ((size.y + tileSize - 1) / tileSize);
+            std::cerr << " l" << l << " " << (100U * band[l].size() + tiles / 2) / tiles << "%";
+        }
+        std::cerr << std::endl;
+    }
+
+    // Laplacians inside the band, finest level first, for each one
+    // needs the Gaussian of the next coarser level.
+    for (int l = 0; l < levels - 1; ++l) {
+        expandTiles<SKIPSMImagePixelType>(false, *((*whiteGP)[l + 1]), *((*whiteGP)[l]), band[l]);
+        expandTiles<SKIPSMImagePixelType>(false, *((*blackGP)[l + 1]), *((*blackGP)[l]), band[l]);
+    }
+
+    // Blend inside the band and take the white Gaussian where the
+    // collapse would yield it; elsewhere the black Gaussian already is
+    // in place.
+    for (int l = 0; l < levels; ++l) {
+        const MaskPyramidType& mask = *((*maskGP)[l]);
+        ImagePyramidType& whiteLevel = *((*whiteGP)[l]);
+        ImagePyramidType& blackLevel = *((*blackGP)[l]);
+        const int n = band[l].size();
+        const int m = white[l].size();
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int i = 0; i < n + m; ++i) {
+            if (i < n) {
+                const vigra::Rect2D& tile = band[l][i];
+                vigra::combineThreeImages(vigra_ext::apply(tile, srcImageRange(mask)),
+                                          vigra_ext::apply(tile, srcImage(whiteLevel)),
+                                          vigra_ext::apply(tile, srcImage(blackLevel)),
+                                          vigra_ext::apply(tile, destImage(blackLevel)),
+                                          CartesianBlendFunctor<MaskPixelType>(maskPyramidWhiteValue));
+            } else {
+                const vigra::Rect2D& tile = white[l][i - n];
+                vigra::copyImage(vigra_ext::apply(tile, srcImageRange(whiteLevel)),
+                                 vigra_ext::apply(tile, destImage(blackLevel)));
+            }
+        }
+    }
+
+    // Collapse inside the band, coarsest level first.
+    for (int l = levels - 2; l >= 0; --l) {
+        expandTiles<SKIPSMImagePixelType>(true, *((*blackGP)[l + 1]), *((*blackGP)[l]), band[l]);
+    }
+}
+
 } // namespace enblend
 
 #endif /* __BLEND_H__ */
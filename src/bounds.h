@@ -26,6 +26,7 @@
 #endif
 
 #include "common.h"
+#include "numerictraits.h"
 #include "parameter.h"
 #include "pyramid.h"
 
@@ -87,20 +88,17 @@ inspectOverlap(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> sr
                           src2.first, src2.second);
 }
 
-/** Determine the region-of-interest and number of blending levels to use,
- *  given the current mask-bounding-box and intersection-bounding-box.
- *  We also need to know if the image is a 360-degree pano so we can check
- *  for the case that the ROI wraps around the left and right edges.
+/** Answer the region-of-interest of a pyramid with the given number
+ *  of levels: the mask-bounding-box padded by the half width of the
+ *  filter of that many levels, but not larger than uBB.
  */
-template <typename ImagePixelComponentType>
-unsigned int
-roiBounds(const vigra::Rect2D& inputUnion,
-          const vigra::Rect2D& iBB, const vigra::Rect2D& mBB, const vigra::Rect2D& uBB,
-          vigra::Rect2D& roiBB,        // roiBB is an _output_ parameter!
-          bool wraparoundForMask)
+inline vigra::Rect2D
+roiForLevels(unsigned int levels,
+             const vigra::Rect2D& mBB, const vigra::Rect2D& uBB,
+             bool wraparoundForMask)
 {
-    roiBB = mBB;
-    roiBB.addBorder(filterHalfWidth(MAX_PYRAMID_LEVELS));
+    vigra::Rect2D roiBB(mBB);
+    roiBB.addBorder(filterHalfWidth(levels));
 
     if (wraparoundForMask &&
         (roiBB.left() < 0 || roiBB.right() > uBB.right())) {
@@ -113,14 +111,16 @@ roiBounds(const vigra::Rect2D& inputUnion,
 
     // ROI must not be bigger than uBB.
     roiBB &= uBB;
-    if (Verbose >= VERBOSE_ROIBB_SIZE_MESSAGES) {
-        std::cerr << command << ": info: region-of-interest bounding box: " << roiBB << std::endl;
-    }
 
-    // Verify the number of levels based on the size of the ROI.
+    return roiBB;
+}
+
+
+/** Answer the number of levels the size of roiBB admits. */
+inline unsigned int
+levelsForRoi(const vigra::Rect2D& roiBB, unsigned int minimumPyramidLevels)
+{
     unsigned int roiShortDimension = std::min(roiBB.width(), roiBB.height());
-    const unsigned int minimumPyramidLevels =
-        parameter::as_unsigned("minimum-pyramid-levels", 1U); //< minimum-pyramid-levels 1
     unsigned int allowableLevels = minimumPyramidLevels;
     while (allowableLevels <= MAX_PYRAMID_LEVELS) {
         if (roiShortDimension <= 8U) {
@@ -131,22 +131,84 @@ roiBounds(const vigra::Rect2D& inputUnion,
         ++allowableLevels;
     }
 
+    return allowableLevels;
+}
+
+
+/** Answer the total number of pixels in all levels of a pyramid. */
+inline long long
+pyramidArea(const vigra::Size2D& size, unsigned int levels)
+{
+    long long area = 0LL;
+    long long width = size.x;
+    long long height = size.y;
+    for (unsigned int l = 0U; l != levels; ++l) {
+        area += width * height;
+        width = (width + 1LL) >> 1;
+        height = (height + 1LL) >> 1;
+    }
+
+    return area;
+}
+
+
+/** Determine the region-of-interest and number of blending levels to use,
+ *  given the current mask-bounding-box and intersection-bounding-box.
+ *  We also need to know if the image is a 360-degree pano so we can check
+ *  for the case that the ROI wraps around the left and right edges.
+ *
+ *  The ROI is padded for the number of levels that finally gets used,
+ *  not for the maximum number of levels.  As fewer levels need less
+ *  padding, which in turn may admit fewer levels, we pick the largest
+ *  number of levels that the ROI padded for it admits.  exactLevels
+ *  is the number of levels that the user asked for; 0 means as many as
+ *  possible, negative values that many less.
+ */
+template <typename ImagePixelType>
+unsigned int
+roiBounds(const vigra::Rect2D& inputUnion,
+          const vigra::Rect2D& iBB, const vigra::Rect2D& mBB, const vigra::Rect2D& uBB,
+          vigra::Rect2D& roiBB,        // roiBB is an _output_ parameter!
+          bool wraparoundForMask,
+          int exactLevels)
+{
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePyramidPixelType ImagePyramidPixelType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::MaskPyramidPixelType MaskPyramidPixelType;
+
+    const unsigned int minimumPyramidLevels =
+        parameter::as_unsigned("minimum-pyramid-levels", 1U); //< minimum-pyramid-levels 1
+    const bool isLevelAdaptive =
+        parameter::as_boolean("level-adaptive-roi", true); //< level-adaptive-roi 1
+
+    const vigra::Rect2D maximumRoiBB(roiForLevels(MAX_PYRAMID_LEVELS, mBB, uBB, wraparoundForMask));
+    roiBB = maximumRoiBB;
+
+    // Verify the number of levels based on the size of the ROI.
+    unsigned int allowableLevels = levelsForRoi(roiBB, minimumPyramidLevels);
+    if (isLevelAdaptive) {
+        while (allowableLevels > minimumPyramidLevels &&
+               levelsForRoi(roiForLevels(allowableLevels, mBB, uBB, wraparoundForMask),
+                            minimumPyramidLevels) < allowableLevels) {
+            --allowableLevels;
+        }
+    }
+
     if (allowableLevels <= minimumPyramidLevels) {
         std::cerr << command << ": info: overlap region is too small to make more than "
                   << minimumPyramidLevels << " pyramid level(s)" << std::endl;
     } else {
-        if (ExactLevels >= 1) {
-            if (ExactLevels > static_cast<int>(allowableLevels)) {
-                std::cerr << command << ": warning: cannot blend with " << ExactLevels << " pyramid level(s) as\n"
+        if (exactLevels >= 1) {
+            if (exactLevels > static_cast<int>(allowableLevels)) {
+                std::cerr << command << ": warning: cannot blend with " << exactLevels << " pyramid level(s) as\n"
                           << command << ": warning: image geometry precludes using more than "
                           << allowableLevels << " pyramid level(s)" << std::endl;
             }
-            allowableLevels = std::min(allowableLevels, static_cast<unsigned int>(ExactLevels));
-        } else if (ExactLevels < 0) {
-            if (static_cast<int>(allowableLevels) + ExactLevels >= static_cast<int>(minimumPyramidLevels)) {
-                allowableLevels -= static_cast<unsigned int>(-ExactLevels);
+            allowableLevels = std::min(allowableLevels, static_cast<unsigned int>(exactLevels));
+        } else if (exactLevels < 0) {
+            if (static_cast<int>(allowableLevels) + exactLevels >= static_cast<int>(minimumPyramidLevels)) {
+                allowableLevels -= static_cast<unsigned int>(-exactLevels);
             } else {
-                std::cerr << ": warning: cannot sensibly blend with " << allowableLevels << ExactLevels
+                std::cerr << ": warning: cannot sensibly blend with " << allowableLevels << exactLevels
                           << " levels\n"
                           << command << ": warning: will not use less than " << minimumPyramidLevels
                           << " pyramid level(s)" << std::endl;
@@ -155,6 +217,26 @@ roiBounds(const vigra::Rect2D& inputUnion,
         }
     }
 
+    if (isLevelAdaptive) {
+        roiBB = roiForLevels(std::max(allowableLevels, 1U), mBB, uBB, wraparoundForMask);
+    }
+
+    if (Verbose >= VERBOSE_ROIBB_SIZE_MESSAGES) {
+        const long long area = pyramidArea(roiBB.size(), allowableLevels);
+        const long long bytes =
+            area * static_cast<long long>(2U * sizeof(ImagePyramidPixelType) + sizeof(MaskPyramidPixelType));
+
+        std::cerr << command << ": info: region-of-interest bounding box: " << roiBB << "\n"
+                  << command << ": info: pyramids cover " << area << " pixels, about "
+                  << (bytes + 999999LL) / 1000000LL << " MB";
+        if (roiBB != maximumRoiBB) {
+            std::cerr << ", "
+                      << (100LL * roiBB.area() + maximumRoiBB.area() / 2) / std::max(maximumRoiBB.area(), 1)
+                      << "% of the area padded for the maximum number of levels";
+        }
+        std::cerr << std::endl;
+    }
+
     if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
         std::cerr << command << ": info: using ";
         if (allowableLevels == 1) {
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "checkpoint_journal.h"
+
+
+// The journal is a private file of one machine, so all numbers are
+// stored in native byte order.
+#define JOURNAL_MAGIC "ENBLJRNL"
+#define JOURNAL_VERSION 1U
+#define TILE_TAG 0x454c4954U   // "TILE"
+#define COMMIT_TAG 0x54494d43U // "CMIT"
+#define TRAILER_TAG 0x454e4f44U // "DONE"
+
+
+namespace enblend
+{
+    namespace
+    {
+        template <typename T>
+        bool
+        read_value(std::FILE* a_file, T* a_value)
+        {
+            return std::fread(a_value, sizeof(T), 1U, a_file) == 1U;
+        }
+
+
+        // Answer the number of bytes between the position of A_FILE and
+        // its end, where A_FILE_SIZE is the length of the file.
+        uint64_t
+        bytes_left(std::FILE* a_file, uint64_t a_file_size)
+        {
+            const long position = std::ftell(a_file);
+            return position < 0 || static_cast<uint64_t>(position) > a_file_size ?
+                0U :
+                a_file_size - static_cast<uint64_t>(position);
+        }
+
+
+        // A torn tail may hold any garbage, so every size read from
+        // the journal gets checked against the bytes that are left
+        // before we allocate for it.
+        bool
+        read_header(std::FILE* a_file, uint64_t a_file_size, CheckpointJournal::Header* a_header)
+        {
+            char magic[sizeof(JOURNAL_MAGIC) - 1U];
+            uint32_t version;
+            uint32_t signature_size;
+
+            if (std::fread(magic, sizeof(magic), 1U, a_file) != 1U ||
+                std::memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0 ||
+                !read_value(a_file, &version) || version != JOURNAL_VERSION ||
+                !read_value(a_file, &a_header->width) ||
+                !read_value(a_file, &a_header->height) ||
+                !read_value(a_file, &a_header->tile_size) ||
+                !read_value(a_file, &a_header->pixel_size) ||
+                !read_value(a_file, &a_header->alpha_size) ||
+                !read_value(a_file, &signature_size) ||
+                signature_size > bytes_left(a_file, a_file_size))
+            {
+                return false;
+            }
+
+            a_header->signature.resize(signature_size);
+            return signature_size == 0U ||
+                std::fread(&a_header->signature[0], signature_size, 1U, a_file) == 1U;
+        }
+
+
+        bool
+        operator==(const CheckpointJournal::Header& a, const CheckpointJournal::Header& b)
+        {
+            return
+                a.width == b.width && a.height == b.height && a.tile_size == b.tile_size &&
+                a.pixel_size == b.pixel_size && a.alpha_size == b.alpha_size &&
+                a.signature == b.signature;
+        }
+
+
+        // Read the remainder of a commit record.
+        bool
+        read_commit(std::FILE* a_file, uint64_t a_file_size, CheckpointJournal::State* a_state)
+        {
+            int32_t box[4];
+            uint32_t n;
+            uint32_t trailer;
+
+            if (!read_value(a_file, &a_state->iteration) ||
+                std::fread(box, sizeof(box), 1U, a_file) != 1U ||
+                !read_value(a_file, &n) ||
+                uint64_t(n) * sizeof(uint32_t) > bytes_left(a_file, a_file_size))
+            {
+                return false;
+            }
+
+            a_state->bounding_box = vigra::Rect2D(box[0], box[1], box[2], box[3]);
+            a_state->remaining.resize(n);
+
+            return
+                (n == 0U || std::fread(&a_state->remaining[0], sizeof(uint32_t), n, a_file) == n) &&
+                read_value(a_file, &trailer) && trailer == TRAILER_TAG;
+        }
+
+
+        // Walk the records of A_FILE, which is positioned right after
+        // the header and A_FILE_SIZE bytes long.  Feed tiles to
+        // A_HANDLER if it is non-null, but only up to A_LIMIT commits.
+        // Answer the number of complete commits seen and leave the
+        // last one in A_STATE.
+        unsigned
+        walk_records(std::FILE* a_file, uint64_t a_file_size, const CheckpointJournal::tile_handler* a_handler,
+                     unsigned a_limit, CheckpointJournal::State* a_state)
+        {
+            std::vector<char> data;
+            unsigned commits = 0U;
+            uint32_t tag;
+
+            while (commits < a_limit && read_value(a_file, &tag))
+            {
+                if (tag == TILE_TAG)
+                {
+                    uint32_t tile;
+                    uint64_t size;
+
+                    if (!read_value(a_file, &tile) || !read_value(a_file, &size) ||
+                        size > bytes_left(a_file, a_file_size))
+                    {
+                        break;
+                    }
+                    data.resize(size);
+                    if (size != 0U && std::fread(&data[0], size, 1U, a_file) != 1U)
+                    {
+                        break;
+                    }
+                    if (a_handler != nullptr)
+                    {
+                        (*a_handler)(tile, data.data(), data.size());
+                    }
+                }
+                else if (tag == COMMIT_TAG)
+                {
+                    CheckpointJournal::State state;
+
+                    if (!read_commit(a_file, a_file_size, &state))
+                    {
+                        break;
+                    }
+                    *a_state = std::move(state);
+                    ++commits;
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            return commits;
+        }
+    } // namespace
+
+
+    CheckpointJournal::CheckpointJournal(const std::string& a_filename) :
+        filename_(a_filename), file_(nullptr), is_fresh_(false), size_(0U)
+    {
+    }
+
+
+    CheckpointJournal::~CheckpointJournal()
+    {
+        if (file_ != nullptr)
+        {
+            std::fclose(file_);
+        }
+    }
+
+
+    std::string
+    CheckpointJournal::filename_of(const std::string& an_output_filename)
+    {
+        return an_output_filename + ".checkpoint";
+    }
+
+
+    void
+    CheckpointJournal::write(const void* a_data, size_t a_size)
+    {
+        if (a_size != 0U && std::fwrite(a_data, a_size, 1U, file_) != 1U)
+        {
+            throw std::runtime_error("CheckpointJournal: cannot write to \"" + filename_ + "\"");
+        }
+        size_ += a_size;
+    }
+
+
+    void
+    CheckpointJournal::close()
+    {
+        if (file_ != nullptr)
+        {
+            const bool failed = std::fclose(file_) != 0;
+            file_ = nullptr;
+            if (failed)
+            {
+                throw std::runtime_error("CheckpointJournal: cannot close \"" + filename_ + "\"");
+            }
+        }
+    }
+
+
+    void
+    CheckpointJournal::create(const Header& a_header)
+    {
+        const Header header(a_header); // A_HEADER may be our own header_
+        const uint32_t version = JOURNAL_VERSION;
+        const uint32_t signature_size = static_cast<uint32_t>(header.signature.size());
+
+        close();
+        file_ = std::fopen((filename_ + ".tmp").c_str(), "wb");
+        if (file_ == nullptr)
+        {
+            throw std::runtime_error("CheckpointJournal: cannot create \"" + filename_ + ".tmp\"");
+        }
+        header_ = header;
+        is_fresh_ = true;
+        size_ = 0U;
+
+        write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1U);
+        write(&version, sizeof(version));
+        write(&header_.width, sizeof(header_.width));
+        write(&header_.height, sizeof(header_.height));
+        write(&header_.tile_size, sizeof(header_.tile_size));
+        write(&header_.pixel_size, sizeof(header_.pixel_size));
+        write(&header_.alpha_size, sizeof(header_.alpha_size));
+        write(&signature_size, sizeof(signature_size));
+        write(header_.signature.data(), signature_size);
+    }
+
+
+    void
+    CheckpointJournal::append_tile(uint32_t a_tile, const void* a_data, size_t a_size)
+    {
+        const uint32_t tag = TILE_TAG;
+        const uint64_t size = a_size;
+
+        write(&tag, sizeof(tag));
+        write(&a_tile, sizeof(a_tile));
+        write(&size, sizeof(size));
+        write(a_data, a_size);
+    }
+
+
+    void
+    CheckpointJournal::commit(const State& a_state)
+    {
+        const uint32_t tag = COMMIT_TAG;
+        const int32_t box[4] = {a_state.bounding_box.left(), a_state.bounding_box.top(),
+                                a_state.bounding_box.right(), a_state.bounding_box.bottom()};
+        const uint32_t n = static_cast<uint32_t>(a_state.remaining.size());
+        const uint32_t trailer = TRAILER_TAG;
+
+        write(&tag, sizeof(tag));
+        write(&a_state.iteration, sizeof(a_state.iteration));
+        write(box, sizeof(box));
+        write(&n, sizeof(n));
+        write(a_state.remaining.data(), n * sizeof(uint32_t));
+        write(&trailer, sizeof(trailer));
+
+        if (std::fflush(file_) != 0)
+        {
+            throw std::runtime_error("CheckpointJournal: cannot flush \"" + filename_ + "\"");
+        }
+#ifdef _WIN32
+        _commit(_fileno(file_));
+#else
+        fsync(fileno(file_));
+#endif
+
+        if (is_fresh_)
+        {
+            // The new journal is complete; let it replace the old one.
+            close();
+#ifdef _WIN32
+            std::remove(filename_.c_str()); // rename() does not overwrite on Windows
+#endif
+            if (std::rename((filename_ + ".tmp").c_str(), filename_.c_str()) != 0)
+            {
+                throw std::runtime_error("CheckpointJournal: cannot rename journal to \"" +
+                                         filename_ + "\"");
+            }
+            file_ = std::fopen(filename_.c_str(), "ab");
+            if (file_ == nullptr)
+            {
+                throw std::runtime_error("CheckpointJournal: cannot reopen \"" + filename_ + "\"");
+            }
+            is_fresh_ = false;
+        }
+    }
+
+
+    bool
+    CheckpointJournal::replay(const Header& an_expected_header, const tile_handler& a_handler, State* a_state)
+    {
+        std::FILE* file = std::fopen(filename_.c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        // First find the last complete commit, then apply the tiles
+        // up to it; tiles of a torn tail never reach the image.
+        uint64_t file_size = 0U;
+        if (std::fseek(file, 0L, SEEK_END) == 0)
+        {
+            const long end = std::ftell(file);
+            file_size = end < 0 ? 0U : static_cast<uint64_t>(end);
+        }
+        std::rewind(file);
+
+        Header header;
+        State state;
+        unsigned commits = 0U;
+        if (read_header(file, file_size, &header) && header == an_expected_header)
+        {
+            const long records = std::ftell(file);
+
+            commits = walk_records(file, file_size, nullptr, ~0U, &state);
+            if (commits != 0U)
+            {
+                try
+                {
+                    std::fseek(file, records, SEEK_SET);
+                    walk_records(file, file_size, &a_handler, commits, &state);
+                }
+                catch (...)
+                {
+                    std::fclose(file);
+                    throw;
+                }
+            }
+        }
+
+        std::fclose(file);
+
+        if (commits == 0U)
+        {
+            return false;
+        }
+
+        *a_state = std::move(state);
+        return true;
+    }
+
+
+    void
+    CheckpointJournal::remove()
+    {
+        close();
+        std::remove((filename_ + ".tmp").c_str());
+        std::remove(filename_.c_str());
+        is_fresh_ = false;
+        size_ = 0U;
+    }
+} // namespace enblend
+
+
+// Local Variables:
+// mode: c++
+// End:
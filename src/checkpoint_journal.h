@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef CHECKPOINT_JOURNAL_H_INCLUDED_
+#define CHECKPOINT_JOURNAL_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>             // std::pair
+#include <vector>
+
+#include "rect2d.hxx"
+
+
+namespace enblend
+{
+    // Journal of Enblend's checkpoints
+    //
+    // With option --checkpoint Enblend used to export the whole
+    // union-sized black image after every blending step, although a
+    // step only changes the bounding box of the latest image and its
+    // seam region.  The journal is a sidecar file that instead
+    // receives the raw pixels of the tiles that intersect the changed
+    // region, each batch followed by a commit record holding the
+    // state of the blending loop.  Only committed tiles count; a torn
+    // tail left by a crash is ignored when the journal is replayed.
+    class CheckpointJournal
+    {
+    public:
+        struct Header
+        {
+            Header() : width(0U), height(0U), tile_size(0U), pixel_size(0U), alpha_size(0U) {}
+
+            uint32_t width;
+            uint32_t height;
+            uint32_t tile_size;
+            uint32_t pixel_size;
+            uint32_t alpha_size;
+            std::string signature; // identifies the inputs the journal belongs to
+        };
+
+        struct State
+        {
+            State() : iteration(0U) {}
+
+            uint32_t iteration;              // counter of the blending loop
+            vigra::Rect2D bounding_box;      // bounding box of the black image
+            std::vector<uint32_t> remaining; // indices of the input images still to blend
+        };
+
+        typedef std::function<void(uint32_t a_tile, const char* a_data, size_t a_size)> tile_handler;
+
+        explicit CheckpointJournal(const std::string& a_filename);
+        CheckpointJournal(const CheckpointJournal&) = delete;
+        CheckpointJournal& operator=(const CheckpointJournal&) = delete;
+        ~CheckpointJournal();
+
+        // Answer the name of the journal that belongs to the output
+        // file AN_OUTPUT_FILENAME.
+        static std::string filename_of(const std::string& an_output_filename);
+
+        const std::string& filename() const {return filename_;}
+        const Header& header() const {return header_;}
+
+        // Size of the journal in bytes
+        uint64_t size() const {return size_;}
+
+        // Start a fresh journal.  The previous one stays valid until
+        // the first commit() of the new journal replaces it.
+        void create(const Header& a_header);
+
+        // Append the raw data of tile A_TILE.
+        void append_tile(uint32_t a_tile, const void* a_data, size_t a_size);
+
+        // Make all tiles appended so far durable together with A_STATE.
+        void commit(const State& a_state);
+
+        // Feed all committed tiles of an existing journal, which must
+        // match AN_EXPECTED_HEADER, to A_HANDLER in the order they were
+        // written and answer the state of the last commit.  Answer
+        // false if there is no such journal or it holds no commit.
+        bool replay(const Header& an_expected_header, const tile_handler& a_handler, State* a_state);
+
+        // Close and delete the journal.
+        void remove();
+
+    private:
+        void write(const void* a_data, size_t a_size);
+        void close();
+
+        std::string filename_;
+        Header header_;
+        std::FILE* file_;
+        bool is_fresh_;        // written to the temporary file; not yet committed
+        uint64_t size_;
+    };
+
+
+    // Rectangle of tile A_TILE in an image of A_WIDTH x A_HEIGHT pixels
+    // divided into A_TILE_SIZE x A_TILE_SIZE tiles
+    inline vigra::Rect2D
+    journalTileRect(uint32_t a_tile, unsigned a_width, unsigned a_height, unsigned a_tile_size)
+    {
+        const unsigned tiles_across = (a_width + a_tile_size - 1U) / a_tile_size;
+        const unsigned x = (a_tile % tiles_across) * a_tile_size;
+        const unsigned y = (a_tile / tiles_across) * a_tile_size;
+
+        return vigra::Rect2D(x, y,
+                             std::min(x + a_tile_size, a_width),
+                             std::min(y + a_tile_size, a_height));
+    }
+
+
+    // Append all tiles of AN_IMAGE and AN_ALPHA that intersect A_REGION
+    // to A_JOURNAL.  A tile holds the raw image pixels of its rectangle
+    // row by row followed by the raw alpha pixels.
+    template <class ImageType, class AlphaType>
+    void
+    journalTiles(CheckpointJournal& a_journal,
+                 const ImageType& an_image, const AlphaType& an_alpha,
+                 const vigra::Rect2D& a_region)
+    {
+        typedef typename ImageType::value_type ImagePixelType;
+        typedef typename AlphaType::value_type AlphaPixelType;
+
+        static_assert(std::is_trivially_copyable<ImagePixelType>::value &&
+                      std::is_trivially_copyable<AlphaPixelType>::value,
+                      "journal stores raw pixels");
+
+        const vigra::Rect2D region(a_region & vigra::Rect2D(an_image.size()));
+        if (region.isEmpty())
+        {
+            return;
+        }
+
+        const unsigned width = an_image.width();
+        const unsigned tile_size = a_journal.header().tile_size;
+        const unsigned tiles_across = (width + tile_size - 1U) / tile_size;
+        std::vector<char> tile;
+
+        for (unsigned ty = region.top() / tile_size; ty * tile_size < unsigned(region.bottom()); ++ty)
+        {
+            for (unsigned tx = region.left() / tile_size; tx * tile_size < unsigned(region.right()); ++tx)
+            {
+                const uint32_t index = ty * tiles_across + tx;
+                const vigra::Rect2D rect(journalTileRect(index, width, an_image.height(), tile_size));
+                const size_t image_row = rect.width() * sizeof(ImagePixelType);
+                const size_t alpha_row = rect.width() * sizeof(AlphaPixelType);
+
+                tile.resize(rect.height() * (image_row + alpha_row));
+                char* p = &tile[0];
+                for (int y = rect.top(); y < rect.bottom(); ++y, p += image_row)
+                {
+                    std::memcpy(p, &an_image(rect.left(), y), image_row);
+                }
+                for (int y = rect.top(); y < rect.bottom(); ++y, p += alpha_row)
+                {
+                    std::memcpy(p, &an_alpha(rect.left(), y), alpha_row);
+                }
+
+                a_journal.append_tile(index, &tile[0], tile.size());
+            }
+        }
+    }
+
+
+    // Journal the tiles of A_PAIR that intersect A_DIRTY_REGION and
+    // commit A_STATE.  Replace a journal that has grown beyond
+    // "checkpoint-journal-compaction" times the raw size of the image
+    // with a single snapshot.
+    template <class ImageType, class AlphaType>
+    void
+    journalCheckpoint(CheckpointJournal& a_journal,
+                      const std::pair<ImageType*, AlphaType*>& a_pair,
+                      const vigra::Rect2D& a_dirty_region,
+                      const CheckpointJournal::State& a_state,
+                      double a_compaction_factor)
+    {
+        const vigra::Rect2D everything(a_pair.first->size());
+        const double snapshot_size =
+            static_cast<double>(everything.area()) *
+            (sizeof(typename ImageType::value_type) + sizeof(typename AlphaType::value_type));
+
+        if (a_journal.size() > a_compaction_factor * snapshot_size)
+        {
+            a_journal.create(a_journal.header());
+            journalTiles(a_journal, *a_pair.first, *a_pair.second, everything);
+        }
+        else
+        {
+            journalTiles(a_journal, *a_pair.first, *a_pair.second, a_dirty_region);
+        }
+
+        a_journal.commit(a_state);
+    }
+
+
+    // Rebuild the black image of size A_SIZE from the journal that
+    // matches A_HEADER.  Answer false and leave A_PAIR alone if there is
+    // nothing to resume from.
+    template <class ImageType, class AlphaType>
+    bool
+    resumeFromJournal(CheckpointJournal& a_journal, const CheckpointJournal::Header& a_header,
+                      const vigra::Size2D& a_size,
+                      std::pair<ImageType*, AlphaType*>* a_pair, CheckpointJournal::State* a_state)
+    {
+        typedef typename ImageType::value_type ImagePixelType;
+        typedef typename AlphaType::value_type AlphaPixelType;
+
+        std::unique_ptr<ImageType> image(new ImageType(a_size));
+        std::unique_ptr<AlphaType> alpha(new AlphaType(a_size));
+
+        auto restore_tile = [&](uint32_t a_tile, const char* a_data, size_t a_data_size)
+        {
+            const vigra::Rect2D rect(journalTileRect(a_tile, a_size.x, a_size.y, a_header.tile_size));
+            const size_t image_row = rect.width() * sizeof(ImagePixelType);
+            const size_t alpha_row = rect.width() * sizeof(AlphaPixelType);
+
+            if (rect.isEmpty() || a_data_size != rect.height() * (image_row + alpha_row))
+            {
+                throw std::runtime_error("CheckpointJournal: tile does not fit image");
+            }
+
+            for (int y = rect.top(); y < rect.bottom(); ++y, a_data += image_row)
+            {
+                std::memcpy(&(*image)(rect.left(), y), a_data, image_row);
+            }
+            for (int y = rect.top(); y < rect.bottom(); ++y, a_data += alpha_row)
+            {
+                std::memcpy(&(*alpha)(rect.left(), y), a_data, alpha_row);
+            }
+        };
+
+        if (!a_journal.replay(a_header, restore_tile, a_state))
+        {
+            return false;
+        }
+
+        a_pair->first = image.release();
+        a_pair->second = alpha.release();
+
+        return true;
+    }
+} // namespace enblend
+
+
+#endif // CHECKPOINT_JOURNAL_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -189,6 +189,19 @@ public:
 
 namespace enblend {
 
+// Enfuse cannot go on with the images or options at hand.  what()
+// holds the diagnostic without the leading command name.  The
+// command-line tool prints it and exits; libenfuse answers it to the
+// caller.
+class fatal_error : public std::runtime_error
+{
+public:
+    fatal_error() = delete;
+    explicit fatal_error(const std::string& a_message) : std::runtime_error(a_message) {}
+    virtual ~fatal_error() noexcept {}
+};
+
+
 /** The different image overlap classifications. */
 enum Overlap {NoOverlap, PartialOverlap, CompleteOverlap};
 
@@ -907,6 +920,22 @@ profileChannels(cmsHPROFILE profile)
 }
 
 
+// Answer the serialized form of PROFILE, which identifies it
+// regardless of where it came from.
+inline std::vector<unsigned char>
+profileBytes(cmsHPROFILE profile)
+{
+    cmsUInt32Number size = 0U;
+    cmsSaveProfileToMem(profile, nullptr, &size);
+    std::vector<unsigned char> bytes(size);
+    if (size != 0U) {
+        cmsSaveProfileToMem(profile, &bytes[0], &size);
+    }
+
+    return bytes;
+}
+
+
 inline bool
 has_known_image_extension(const std::string an_image_filename)
 {
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef COMPACT_PYRAMID_H_INCLUDED_
+#define COMPACT_PYRAMID_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <utility>             // std::make_pair
+#include <vector>
+
+#include <vigra/accessor.hxx>
+#include <vigra/diff2d.hxx>
+#include <vigra/error.hxx>
+#include <vigra/numerictraits.hxx>
+#include <vigra/rgbvalue.hxx>
+#include <vigra/utilities.hxx>
+
+#include "pyramid_pool.h"
+
+
+namespace enblend
+{
+    // Conversion between the wide fixed-point numbers that Reduce,
+    // Expand, and the blending arithmetic operate on and the narrow
+    // integers that a compact pyramid stores.  A narrow number holds
+    // the wide one divided by step(e), rounded to nearest, and
+    // saturated to the range of the narrow type.  The exponent e
+    // picks the step: the steps run through the powers of two below
+    // STEP / 2 and end with STEP itself, which must cover the whole
+    // range of wide numbers.
+    template <typename WIDE, typename NARROW, int STEP>
+    struct CompactPyramidScalar
+    {
+        static_assert(STEP > 1, "STEP must be larger than one");
+
+        static constexpr unsigned coarsest_exponent()
+        {
+            unsigned e = 0U;
+            while ((2 << e) < STEP) {
+                ++e;
+            }
+            return e;
+        }
+
+        static constexpr WIDE step(unsigned e)
+        {
+            return e < coarsest_exponent() ? WIDE(1 << e) : WIDE(STEP);
+        }
+
+        static constexpr WIDE widen(NARROW n, unsigned e)
+        {
+            return static_cast<WIDE>(n) * step(e);
+        }
+
+        static constexpr WIDE quotient(WIDE w, unsigned e)
+        {
+            return w >= WIDE() ? (w + step(e) / WIDE(2)) / step(e) : -((step(e) / WIDE(2) - w) / step(e));
+        }
+
+        static constexpr NARROW narrow(WIDE w, unsigned e)
+        {
+            const WIDE n = quotient(w, e);
+
+            if (n > static_cast<WIDE>(std::numeric_limits<NARROW>::max())) {
+                return std::numeric_limits<NARROW>::max();
+            } else if (n < static_cast<WIDE>(std::numeric_limits<NARROW>::min())) {
+                return std::numeric_limits<NARROW>::min();
+            } else {
+                return static_cast<NARROW>(n);
+            }
+        }
+
+        // Answer the smallest exponent that holds w without saturation.
+        static constexpr unsigned exponent(WIDE w)
+        {
+            unsigned e = 0U;
+            while (e < coarsest_exponent() &&
+                   (quotient(w, e) > static_cast<WIDE>(std::numeric_limits<NARROW>::max()) ||
+                    quotient(w, e) < static_cast<WIDE>(std::numeric_limits<NARROW>::min()))) {
+                ++e;
+            }
+            return e;
+        }
+    };
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    struct CompactPyramidConverter : public CompactPyramidScalar<WIDE, NARROW, STEP>
+    {
+    };
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    struct CompactPyramidConverter<vigra::RGBValue<WIDE, 0, 1, 2>, vigra::RGBValue<NARROW, 0, 1, 2>, STEP>
+    {
+        typedef CompactPyramidScalar<WIDE, NARROW, STEP> Scalar;
+
+        static vigra::RGBValue<WIDE, 0, 1, 2> widen(const vigra::RGBValue<NARROW, 0, 1, 2>& n, unsigned e)
+        {
+            return vigra::RGBValue<WIDE, 0, 1, 2>(Scalar::widen(n.red(), e),
+                                                  Scalar::widen(n.green(), e),
+                                                  Scalar::widen(n.blue(), e));
+        }
+
+        static vigra::RGBValue<NARROW, 0, 1, 2> narrow(const vigra::RGBValue<WIDE, 0, 1, 2>& w, unsigned e)
+        {
+            return vigra::RGBValue<NARROW, 0, 1, 2>(Scalar::narrow(w.red(), e),
+                                                    Scalar::narrow(w.green(), e),
+                                                    Scalar::narrow(w.blue(), e));
+        }
+
+        static unsigned exponent(const vigra::RGBValue<WIDE, 0, 1, 2>& w)
+        {
+            return std::max(Scalar::exponent(w.red()),
+                            std::max(Scalar::exponent(w.green()), Scalar::exponent(w.blue())));
+        }
+    };
+
+
+    /** Accessor that presents narrow stored pixels as wide ones
+     *
+     *  The pixels of a compact pyramid image come in blocks of
+     *  block_width consecutive pixels of a row that share one
+     *  exponent.  A value too large for the exponent of its block
+     *  coarsens the block: the accessor requantizes the other pixels
+     *  of the block to the larger step before it stores the value. */
+    template <typename WIDE, typename NARROW, int STEP>
+    class CompactPyramidAccessor
+    {
+    public:
+        typedef WIDE value_type;
+        typedef CompactPyramidConverter<WIDE, NARROW, STEP> Converter;
+        enum {block_width = 64};
+
+        CompactPyramidAccessor(NARROW* a_base, unsigned char* some_exponents) :
+            base_(a_base), exponents_(some_exponents)
+        {}
+
+        template <class ITERATOR>
+        value_type operator()(const ITERATOR& i) const
+        {
+            return get(&*i);
+        }
+
+        template <class ITERATOR, class DIFFERENCE>
+        value_type operator()(const ITERATOR& i, DIFFERENCE d) const
+        {
+            return get(&i[d]);
+        }
+
+        template <class VALUE, class ITERATOR>
+        void set(const VALUE& v, const ITERATOR& i) const
+        {
+            put(vigra::detail::RequiresExplicitCast<value_type>::cast(v), &*i);
+        }
+
+        template <class VALUE, class ITERATOR, class DIFFERENCE>
+        void set(const VALUE& v, const ITERATOR& i, DIFFERENCE d) const
+        {
+            put(vigra::detail::RequiresExplicitCast<value_type>::cast(v), &i[d]);
+        }
+
+    private:
+        size_t block_of(const NARROW* p) const
+        {
+            return static_cast<size_t>(p - base_) / block_width;
+        }
+
+        value_type get(const NARROW* p) const
+        {
+            return Converter::widen(*p, exponents_[block_of(p)]);
+        }
+
+        void put(const value_type& w, NARROW* p) const
+        {
+            const size_t block = block_of(p);
+            const unsigned e = exponents_[block];
+            const unsigned needed = Converter::exponent(w);
+
+            if (needed > e) {
+                NARROW* const first = base_ + block * block_width;
+                for (NARROW* q = first; q != first + block_width; ++q) {
+                    *q = Converter::narrow(Converter::widen(*q, e), needed);
+                }
+                exponents_[block] = static_cast<unsigned char>(needed);
+            }
+
+            *p = Converter::narrow(w, std::max(e, needed));
+        }
+
+        NARROW* base_;
+        unsigned char* exponents_;
+    };
+
+
+    /** Pyramid level that stores its pixels in a narrower type.
+     *
+     *  To all pyramid code it looks like an image of WIDE pixels:
+     *  value_type is WIDE and its accessors convert on the fly.  It
+     *  implements the subset of the vigra::BasicImage interface the
+     *  pyramid functions use, plus the argument object factories.
+     *
+     *  Each block of block_width pixels of a row has an exponent of
+     *  its own that grows with the largest magnitude stored in it.
+     *  So the narrowing follows the range of the values, which
+     *  differs from level to level and within a level: the small
+     *  Laplacians of flat areas keep the full resolution of the wide
+     *  numbers and only blocks with large values fall back to the
+     *  coarsest step.  The storage rows are padded to whole blocks. */
+    template <typename WIDE, typename NARROW, int STEP>
+    class CompactPyramidImage
+    {
+        typedef PyramidImage<NARROW> StorageType;
+
+    public:
+        typedef WIDE value_type;
+        typedef WIDE PixelType;
+        typedef typename StorageType::traverser traverser;
+        typedef typename StorageType::const_traverser const_traverser;
+        typedef CompactPyramidAccessor<WIDE, NARROW, STEP> Accessor;
+        typedef CompactPyramidAccessor<WIDE, NARROW, STEP> ConstAccessor;
+        typedef typename StorageType::difference_type difference_type;
+        typedef typename StorageType::size_type size_type;
+        enum {block_width = Accessor::block_width};
+
+        CompactPyramidImage(int a_width, int a_height) :
+            width_(a_width), height_(a_height),
+            storage_(padded_width(a_width), a_height),
+            exponents_(static_cast<size_t>(padded_width(a_width) / block_width) * static_cast<size_t>(a_height))
+        {}
+
+        explicit CompactPyramidImage(const difference_type& a_size) :
+            CompactPyramidImage(a_size.x, a_size.y)
+        {}
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+        size_type size() const {return size_type(width_, height_);}
+
+        traverser upperLeft() {return storage_.upperLeft();}
+        traverser lowerRight() {return upperLeft() + size();}
+        const_traverser upperLeft() const {return storage_.upperLeft();}
+        const_traverser lowerRight() const {return upperLeft() + size();}
+
+        // The stored narrow numbers, rows padded to whole blocks.
+        // Only the accessors know the exponents to widen them.
+        NARROW* data() {return storage_.data();}
+        const NARROW* data() const {return storage_.data();}
+
+        Accessor accessor()
+        {
+            return Accessor(storage_.data(), exponents_.data());
+        }
+
+        ConstAccessor accessor() const
+        {
+            return ConstAccessor(const_cast<NARROW*>(storage_.data()),
+                                 const_cast<unsigned char*>(exponents_.data()));
+        }
+
+    private:
+        static int padded_width(int a_width)
+        {
+            return (a_width + block_width - 1) / block_width * block_width;
+        }
+
+        int width_;
+        int height_;
+        StorageType storage_;
+        std::vector<unsigned char> exponents_;
+    };
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    struct PyramidBlockWidth<CompactPyramidImage<WIDE, NARROW, STEP> >
+    {
+        enum {value = CompactPyramidImage<WIDE, NARROW, STEP>::block_width};
+    };
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::triple<typename CompactPyramidImage<WIDE, NARROW, STEP>::const_traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::const_traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::ConstAccessor>
+    srcImageRange(const CompactPyramidImage<WIDE, NARROW, STEP>& an_image)
+    {
+        return vigra::make_triple(an_image.upperLeft(), an_image.lowerRight(), an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::triple<typename CompactPyramidImage<WIDE, NARROW, STEP>::const_traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::const_traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::ConstAccessor>
+    srcImageRange(const CompactPyramidImage<WIDE, NARROW, STEP>& an_image, const vigra::Rect2D& a_roi)
+    {
+        vigra_precondition(a_roi.left() >= 0 && a_roi.top() >= 0 &&
+                           a_roi.right() <= an_image.width() && a_roi.bottom() <= an_image.height(),
+                           "srcImageRange(): ROI rectangle outside image.");
+        return vigra::make_triple(an_image.upperLeft() + a_roi.upperLeft(),
+                                  an_image.upperLeft() + a_roi.lowerRight(),
+                                  an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::pair<typename CompactPyramidImage<WIDE, NARROW, STEP>::const_traverser,
+                       typename CompactPyramidImage<WIDE, NARROW, STEP>::ConstAccessor>
+    srcImage(const CompactPyramidImage<WIDE, NARROW, STEP>& an_image)
+    {
+        return std::make_pair(an_image.upperLeft(), an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::pair<typename CompactPyramidImage<WIDE, NARROW, STEP>::const_traverser,
+                       typename CompactPyramidImage<WIDE, NARROW, STEP>::ConstAccessor>
+    srcImage(const CompactPyramidImage<WIDE, NARROW, STEP>& an_image, const vigra::Point2D& an_upperleft)
+    {
+        vigra_precondition(an_upperleft.x >= 0 && an_upperleft.y >= 0 &&
+                           an_upperleft.x < an_image.width() && an_upperleft.y < an_image.height(),
+                           "srcImage(): ROI rectangle outside image.");
+        return std::make_pair(an_image.upperLeft() + an_upperleft, an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::triple<typename CompactPyramidImage<WIDE, NARROW, STEP>::traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::Accessor>
+    destImageRange(CompactPyramidImage<WIDE, NARROW, STEP>& an_image)
+    {
+        return vigra::make_triple(an_image.upperLeft(), an_image.lowerRight(), an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::triple<typename CompactPyramidImage<WIDE, NARROW, STEP>::traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::traverser,
+                         typename CompactPyramidImage<WIDE, NARROW, STEP>::Accessor>
+    destImageRange(CompactPyramidImage<WIDE, NARROW, STEP>& an_image, const vigra::Rect2D& a_roi)
+    {
+        vigra_precondition(a_roi.left() >= 0 && a_roi.top() >= 0 &&
+                           a_roi.right() <= an_image.width() && a_roi.bottom() <= an_image.height(),
+                           "destImageRange(): ROI rectangle outside image.");
+        return vigra::make_triple(an_image.upperLeft() + a_roi.upperLeft(),
+                                  an_image.upperLeft() + a_roi.lowerRight(),
+                                  an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::pair<typename CompactPyramidImage<WIDE, NARROW, STEP>::traverser,
+                       typename CompactPyramidImage<WIDE, NARROW, STEP>::Accessor>
+    destImage(CompactPyramidImage<WIDE, NARROW, STEP>& an_image)
+    {
+        return std::make_pair(an_image.upperLeft(), an_image.accessor());
+    }
+
+
+    template <typename WIDE, typename NARROW, int STEP>
+    inline vigra::pair<typename CompactPyramidImage<WIDE, NARROW, STEP>::traverser,
+                       typename CompactPyramidImage<WIDE, NARROW, STEP>::Accessor>
+    destImage(CompactPyramidImage<WIDE, NARROW, STEP>& an_image, const vigra::Point2D& an_upperleft)
+    {
+        vigra_precondition(an_upperleft.x >= 0 && an_upperleft.y >= 0 &&
+                           an_upperleft.x < an_image.width() && an_upperleft.y < an_image.height(),
+                           "destImage(): ROI rectangle outside image.");
+        return std::make_pair(an_image.upperLeft() + an_upperleft, an_image.accessor());
+    }
+
+
+    template <typename T> struct NarrowPyramidPixel;
+    template <> struct NarrowPyramidPixel<vigra::Int32> {typedef vigra::Int16 type;};
+    template <> struct NarrowPyramidPixel<vigra::RGBValue<vigra::Int32, 0, 1, 2> >
+    {
+        typedef vigra::RGBValue<vigra::Int16, 0, 1, 2> type;
+    };
+
+
+    /** Compact storage of 17.7 fixed-point pyramids: the stored
+     *  16-bit numbers count steps of 1, 2, 4, ..., 128, or 257
+     *  fixed-point units.  The finest step keeps all bits of values
+     *  up to 256 units of the input; the coarsest step, 257/128 or
+     *  about two units of the input, covers everything.  Because 257
+     *  divides 65535, black and white of UInt16 images survive
+     *  exactly, and the narrow range covers the Laplacian differences
+     *  of +/-65535 units without saturation. */
+    enum {CompactInt32PyramidStep = 257};
+
+    template <typename T>
+    using CompactInt32PyramidImage =
+        CompactPyramidImage<T, typename NarrowPyramidPixel<T>::type, CompactInt32PyramidStep>;
+
+    namespace detail
+    {
+        typedef CompactPyramidScalar<vigra::Int32, vigra::Int16, CompactInt32PyramidStep> CompactInt32Scalar;
+
+        constexpr bool compactRoundTrip(vigra::Int32 a_value)
+        {
+            return CompactInt32Scalar::widen(CompactInt32Scalar::narrow(a_value,
+                                                                        CompactInt32Scalar::exponent(a_value)),
+                                             CompactInt32Scalar::exponent(a_value)) == a_value;
+        }
+
+        static_assert(compactRoundTrip(0), "compact pyramids do not preserve black");
+        static_assert(compactRoundTrip(65535 * 128), "compact pyramids do not preserve UInt16 white");
+        static_assert(compactRoundTrip(-65535 * 128), "compact pyramids saturate Laplacian differences");
+        static_assert(compactRoundTrip(32767) && compactRoundTrip(-32768),
+                      "compact pyramids lose the resolution of small values");
+        static_assert(CompactInt32Scalar::exponent(65535 * 128) == CompactInt32Scalar::coarsest_exponent(),
+                      "compact pyramids do not need the coarsest step for white");
+    }
+} // namespace enblend
+
+
+#endif // COMPACT_PYRAMID_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -81,8 +81,10 @@ extern "C" int optind;
 
 #include "alternativepercentage.h"
 #include "global.h"
+#include "input_header_cache.h"
 #include "layer_selection.h"
 #include "parameter.h"
+#include "pyramid_pool.h"
 #include "selector.h"
 #include "self_test.h"
 #include "signature.h"
@@ -115,6 +117,7 @@ const int fineMaskVectorizeDistance = 20; //< fine-mask-vectorize-distance 20
 // Global values from command line parameters.
 std::string OutputFileName(DEFAULT_OUTPUT_FILENAME);
 std::optional<std::string> OutputMaskFileName;
+unsigned PreviewLevels = 0U;    // 0 means: full resolution
 int Verbose = 0;                //< default-verbosity-level 0
 int ExactLevels = 0;            // 0 means: automatically calculate maximum
 bool OneAtATime = true;
@@ -183,6 +186,7 @@ cmsHPROFILE FallbackProfile = nullptr;
 
 Signature sig;
 LayerSelectionHost LayerSelection;
+enblend::InputHeaderCache InputHeaders;
 
 #include <vigra/imageinfo.hxx>
 #include <vigra/impex.hxx>
@@ -238,6 +242,7 @@ void dump_global_variables(std::ostream& out = std::cout)
         "+ Verbose = " << Verbose << ", option \"--verbose\"\n" <<
         "+ OutputFileName = <" << OutputFileName << ">\n" <<
         "+ OutputMaskFileName = <" << OutputMaskFileName.value_or("<not defined>") << ">\n" <<
+        "+ PreviewLevels = " << PreviewLevels << ", option \"--preview\"\n" <<
         "+ ExactLevels = " << ExactLevels << "\n" <<
         "+ UseGPU = " << UseGPU << "\n" <<
         "+ OneAtATime = " << enblend::stringOfBool(OneAtATime) << ", option \"-a\"\n" <<
@@ -335,6 +340,9 @@ printUsage(const bool error = true)
         "                         and Cinepaint\n" <<
         "  --output-mask[=FILE]   write output mask to FILE if the output format does not\n" <<
         "                         support alpha-channels; default: \"" << DEFAULT_OUTPUT_MASK_FILENAME << "\"\n" <<
+        "  --preview[=LEVELS]     blend proxies of the input images scaled down by\n" <<
+        "                         2^LEVELS for a quick look at the effect of other\n" <<
+        "                         options; default: " << DEFAULT_PREVIEW_LEVELS << "\n" <<
         "  -w, --wrap[=MODE]      wrap around image boundary, where MODE is \"none\",\n" <<
         "                         \"horizontal\", \"vertical\", or \"both\"; default: " <<
         enblend::stringOfWraparound(WrapAround) << ";\n" <<
@@ -445,6 +453,11 @@ printUsage(const bool error = true)
 #if defined(OPENCL) && defined(PREFER_SEPARATE_OPENCL_SOURCE)
         "  ENBLEND_OPENCL_PATH    The ENBLEND_OPENCL_PATH environment variable sets the search\n" <<
         "                         path for OpenCL source files.\n" <<
+#endif
+#ifdef OPENCL
+        "  ENBLEND_OPENCL_CACHE   The ENBLEND_OPENCL_CACHE environment variable sets the\n" <<
+        "                         directory of the cache of compiled OpenCL programs.  An\n" <<
+        "                         empty value disables the cache.\n" <<
 #endif
         "\n" <<
         "Report bugs at <" PACKAGE_BUGREPORT ">." <<
@@ -489,7 +502,7 @@ void sigint_handler(int sig)
 
 enum AllPossibleOptions {
     VersionOption, PreAssembleOption /* -a */, NoPreAssembleOption, HelpOption, LevelsOption,
-    OutputOption, OutputMaskOption, VerboseOption, WrapAroundOption /* -w */,
+    OutputOption, OutputMaskOption, PreviewOption, VerboseOption, WrapAroundOption /* -w */,
     CheckpointOption /* -x */, CompressionOption, LZWCompressionOption,
     BlendColorspaceOption, FallbackProfileOption,
     DepthOption, AssociatedAlphaOption /* -g */,
@@ -782,6 +795,7 @@ process_options(int argc, char** argv)
         DepthId,
         OutputId,
         OutputMaskId,
+        PreviewId,
         WrapAroundId,
         OptimizerWeightsId,
         LevelsId,
@@ -827,6 +841,7 @@ process_options(int argc, char** argv)
         {"depth", required_argument, 0, DepthId},
         {"output", required_argument, 0, OutputId},
         {"output-mask", optional_argument, 0, OutputMaskId},
+        {"preview", optional_argument, 0, PreviewId},
         {"wrap", optional_argument, 0, WrapAroundId},
         {"optimizer-weights", required_argument, 0, OptimizerWeightsId},
         {"levels", required_argument, 0, LevelsId},
@@ -1080,6 +1095,25 @@ process_options(int argc, char** argv)
             optionSet.insert(OutputMaskOption);
             break;
 
+        case PreviewId:
+            if (optarg != nullptr && *optarg != 0) {
+                std::ostringstream oss;
+                oss << "cannot preview at less than 1/2^" << MAX_PREVIEW_LEVELS << " size; will use " <<
+                    MAX_PREVIEW_LEVELS << " levels";
+                PreviewLevels =
+                    enblend::numberOfString(optarg,
+                                            [](unsigned x) {return x >= 1U;},
+                                            "preview needs at least one level; will use one level",
+                                            1U,
+                                            [](unsigned x) {return x <= MAX_PREVIEW_LEVELS;},
+                                            oss.str(),
+                                            MAX_PREVIEW_LEVELS);
+            } else {
+                PreviewLevels = DEFAULT_PREVIEW_LEVELS;
+            }
+            optionSet.insert(PreviewOption);
+            break;
+
         case ImageDifferenceId: {
             std::string::size_type tail;
             const std::regex delimiterRegex(NUMERIC_OPTION_DELIMITERS_REGEX);
@@ -1655,6 +1689,14 @@ process_options(int argc, char** argv)
         failed = true;
     }
 
+    if (contains(optionSet, PreviewOption) &&
+        (contains(optionSet, LoadMasksOption) || contains(optionSet, SaveMasksOption)))
+    {
+        std::cerr << command
+                  << ": option \"--preview\" excludes \"--load-masks\" and \"--save-masks\"" << std::endl;
+        failed = true;
+    }
+
     if (failed) {
         exit(1);
     }
@@ -1808,6 +1850,14 @@ int main(int argc, char** argv)
 
     sig.check();
 
+    {
+        std::vector<std::string> filenames;
+        for (auto const& f : inputTraceableFileNameList) {
+            filenames.push_back(f->filename());
+        }
+        InputHeaders.scan(filenames);
+    }
+
     for (enblend::TraceableFileNameList::iterator i = inputTraceableFileNameList.begin();
          i != inputTraceableFileNameList.end();
          ++i) {
@@ -1816,7 +1866,7 @@ int main(int argc, char** argv)
             exit(1);
         }
 
-        if (!vigra::isImage((*i)->filename().c_str())) {
+        if (!InputHeaders.is_image((*i)->filename())) {
             std::cerr <<
                 command << ": cannot process \"" << (*i)->filename() << "\"; not recognized as an image\n" <<
                 command << ": info: possible causes:\n" <<
@@ -1832,7 +1882,10 @@ int main(int argc, char** argv)
     }
 
     LayerSelection.retrieve_image_information(inputTraceableFileNameList.begin(),
-                                              inputTraceableFileNameList.end());
+                                              inputTraceableFileNameList.end(),
+                                              [](const std::string& a_filename)
+                                              -> const enblend::InputHeaderCache::layer_list&
+                                              {return InputHeaders.layers(a_filename);});
 
     // List of info structures for each input image.
     std::list<vigra::ImageImportInfo*> imageInfoList;
@@ -1854,7 +1907,7 @@ int main(int argc, char** argv)
         const std::string filename((*inputFileNameIterator)->filename());
         vigra::ImageImportInfo* inputInfo = nullptr;
         try {
-            vigra::ImageImportInfo info(filename.c_str());
+            const enblend::LayerHeader& info(InputHeaders.layer(filename, 0U));
             if (layers == 0) { // OPTIMIZATION: call only once per file
                 layers = info.numImages();
                 LayerSelection.set_selector((*inputFileNameIterator)->selector());
@@ -1868,7 +1921,11 @@ int main(int argc, char** argv)
                 std::cout << "]\n";
 #endif
             }
-            inputInfo = new vigra::ImageImportInfo(info);
+
+            // Vigra opens the file once more, for the only layer we
+            // import.
+            assert(layer != viable_layers.end());
+            inputInfo = new vigra::ImageImportInfo(filename.c_str(), *layer - 1);
         } catch (vigra::ContractViolation& exception) {
             std::cerr <<
                 command << ": cannot load image \"" << filename << "\"\n" <<
@@ -1881,9 +1938,6 @@ int main(int argc, char** argv)
             exit(1);
         }
 
-        assert(layer != viable_layers.end());
-        inputInfo->setImageIndex(*layer - 1);
-
         if (Verbose >= VERBOSE_LAYER_SELECTION) {
             std::cerr << command << ": info: layer selector \"" << LayerSelection.name() << "\" accepts\n"
                       << command << ": info: layer " << *layer << " of " << layers << " in image \""
@@ -2138,6 +2192,30 @@ int main(int argc, char** argv)
                                         OutputOffsetYCmdLine + OutputHeightCmdLine);
         }
 
+        // Shrink the canvas, the resolution, explicit pyramid
+        // heights, and the seam parameters measured in pixels for
+        // option --preview.  Distances given as percentages scale by
+        // themselves.
+        if (PreviewLevels != 0U) {
+            const float scale = static_cast<float>(1U << PreviewLevels);
+
+            inputUnion = enblend::previewRect(inputUnion, PreviewLevels);
+            ImageResolution.x /= scale;
+            ImageResolution.y /= scale;
+            if (ExactLevels > 0) {
+                ExactLevels = std::max(1, ExactLevels - static_cast<int>(PreviewLevels));
+            }
+            DijkstraRadius = std::max(1U, DijkstraRadius >> PreviewLevels);
+            if (!MaskVectorizeDistance.is_percentage()) {
+                MaskVectorizeDistance.set_value(std::max(static_cast<double>(minimumVectorizeDistance),
+                                                         MaskVectorizeDistance.value() / scale));
+            }
+
+            if (Verbose >= VERBOSE_INPUT_UNION_SIZE_MESSAGES) {
+                std::cerr << command << ": info: preview at 1/" << scale << " size" << std::endl;
+            }
+        }
+
         if (!OutputCompression.empty()) {
             outputImageInfo.setCompression(OutputCompression.c_str());
         }
@@ -2247,6 +2325,9 @@ int main(int argc, char** argv)
                 exit(1);
             }
 
+            // Gamut mappings cached for earlier transforms are void.
+            enblend::clear_gamut_map_caches();
+
             cmsCIExyY white_point;
             if (cmsIsTag(InputProfile, cmsSigMediaWhitePointTag)) {
                 cmsXYZ2xyY(&white_point,
@@ -2384,6 +2465,10 @@ int main(int argc, char** argv)
         for (auto x : inputTraceableFileNameList) {
             delete x;
         }
+
+        if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+            enblend::PyramidPool::instance().report(std::cerr, command);
+        }
     } catch (std::bad_alloc& e) {
         std::cerr << std::endl
                   << command << ": out of memory\n"
@@ -25,8 +25,15 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <sstream>
+#include <typeinfo>
+#include <vector>
 
 #include <vigra/impex.hxx>
 #include <vigra/initimage.hxx>
@@ -45,7 +52,9 @@
 #include "assemble.h"
 #include "blend.h"
 #include "bounds.h"
+#include "checkpoint_journal.h"
 #include "mask.h"
+#include "packed_alpha.h"
 #include "pyramid.h"
 
 
@@ -59,7 +68,6 @@ void enblendMain(const FileNameList& anInputFileNameList,
                  vigra::ImageExportInfo& anOutputImageInfo,
                  vigra::Rect2D& anInputUnion)
 {
-    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType ImagePixelComponentType;
     typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
     typedef typename EnblendNumericTraits<ImagePixelType>::AlphaPixelType AlphaPixelType;
     typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
@@ -79,14 +87,150 @@ void enblendMain(const FileNameList& anInputFileNameList,
     typedef typename EnblendNumericTraits<ImagePixelType>::SKIPSMMaskPixelType SKIPSMMaskPixelType;
 
     std::list<vigra::ImageImportInfo*> imageInfoList(anImageInfoList);
+    const std::vector<vigra::ImageImportInfo*> allImageInfos(anImageInfoList.begin(), anImageInfoList.end());
 
-    // Create the initial black image.
     vigra::Rect2D blackBB;
-    std::pair<ImageType*, AlphaType*> blackPair =
-        assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, blackBB);
+    std::pair<ImageType*, AlphaType*> blackPair(static_cast<ImageType*>(nullptr),
+                                                static_cast<AlphaType*>(nullptr));
+
+    // With a journal, checkpoints only record the tiles that changed
+    // and the output image is written once at the end.
+    std::unique_ptr<CheckpointJournal> journal;
+    CheckpointJournal::Header journalHeader;
+    const double journalCompaction =
+        parameter::as_double("checkpoint-journal-compaction", 4.0); //< checkpoint-journal-compaction 4
+    if (Checkpoint && parameter::as_boolean("checkpoint-journal", true)) { //< checkpoint-journal 1
+        // A resumed run must blend exactly like the interrupted one,
+        // so the signature covers the inputs, the pixel type, and all
+        // options that shape masks or pyramids.
+        std::ostringstream signature;
+        signature << std::setprecision(17);
+        for (auto const& filename : anInputFileNameList) {
+            signature << filename << '\n';
+        }
+        signature <<
+            anInputUnion << '\n' <<
+            typeid(ImagePixelType).name() << '\n' <<
+            "levels " << ExactLevels << " wrap " << WrapAround << " preview " << PreviewLevels <<
+            " colorspace " << BlendColorspace << " one-at-a-time " << OneAtATime <<
+            " gimp-alpha " << GimpAssociatedAlphaHack << '\n' <<
+            "seam " << MainAlgorithm << " optimize " << OptimizeMask <<
+            " coarse " << CoarseMask << " " << CoarsenessFactor <<
+            " difference " << PixelDifferenceFunctor <<
+            " " << LuminanceDifferenceWeight << " " << ChrominanceDifferenceWeight <<
+            " optimizer " << OptimizerWeights.first << " " << OptimizerWeights.second <<
+            " anneal " << AnnealPara.kmax << " " << AnnealPara.tau <<
+            " " << AnnealPara.deltaEMax << " " << AnnealPara.deltaEMin <<
+            " dijkstra " << DijkstraRadius << " vectorize " << MaskVectorizeDistance.str() << '\n';
+        if (LoadMasks) {
+            signature << "load-masks " << LoadMaskTemplate << '\n';
+        }
 
-    if (Checkpoint) {
+        journal.reset(new CheckpointJournal(CheckpointJournal::filename_of(OutputFileName)));
+        journalHeader.width = anInputUnion.width();
+        journalHeader.height = anInputUnion.height();
+        journalHeader.tile_size =
+            std::max(16, parameter::as_integer("checkpoint-tile-size", 256)); //< checkpoint-tile-size 256
+        journalHeader.pixel_size = sizeof(ImagePixelType);
+        journalHeader.alpha_size = sizeof(AlphaPixelType);
+        journalHeader.signature = signature.str();
+    }
+
+    // Answer the state of the blending loop for the journal.
+    auto journalState = [&](unsigned anIteration, const vigra::Rect2D& aBlackBB) {
+        CheckpointJournal::State state;
+        state.iteration = anIteration;
+        state.bounding_box = aBlackBB;
+        for (auto const info : imageInfoList) {
+            state.remaining.push_back(static_cast<uint32_t>(std::find(allImageInfos.begin(),
+                                                                      allImageInfos.end(),
+                                                                      info) -
+                                                            allImageInfos.begin()));
+        }
+        return state;
+    };
+
+    // Record a checkpoint of the black image whose pixels inside
+    // aDirtyBB have changed.  Fall back to writing the whole image if
+    // the journal fails.
+    auto checkpointStep = [&](const vigra::Rect2D& aDirtyBB, unsigned anIteration, const vigra::Rect2D& aBlackBB) {
+        if (journal) {
+            try {
+                journalCheckpoint(*journal, blackPair, aDirtyBB,
+                                  journalState(anIteration, aBlackBB), journalCompaction);
+                return;
+            }
+            catch (std::exception& e) {
+                std::cerr <<
+                    command << ": warning: cannot write checkpoint journal \"" << journal->filename() << "\"\n" <<
+                    command << ": note: " << e.what() << "\n" <<
+                    command << ": note: checkpointing to output image instead" << std::endl;
+                journal.reset();
+            }
+        }
         checkpoint(blackPair, anOutputImageInfo);
+    };
+
+    // Create the initial black image or restore it from the journal.
+    CheckpointJournal::State resumedState;
+    bool isResumed = false;
+    if (journal && parameter::as_boolean("checkpoint-resume", false)) { //< checkpoint-resume 0
+        try {
+            isResumed = resumeFromJournal(*journal, journalHeader, anInputUnion.size(),
+                                          &blackPair, &resumedState);
+        }
+        catch (std::exception& e) {
+            std::cerr <<
+                command << ": warning: cannot resume from checkpoint journal \"" << journal->filename() << "\"\n" <<
+                command << ": note: " << e.what() << std::endl;
+        }
+
+        if (isResumed) {
+            imageInfoList.clear();
+            for (auto const index : resumedState.remaining) {
+                imageInfoList.push_back(allImageInfos.at(index));
+            }
+            blackBB = resumedState.bounding_box;
+            if (Verbose >= VERBOSE_CHECKPOINTING_MESSAGES) {
+                std::cerr << command << ": info: resuming from checkpoint journal \"" <<
+                    journal->filename() << "\" with " << imageInfoList.size() << " of " <<
+                    allImageInfos.size() << " images left to blend" << std::endl;
+            }
+        } else {
+            std::cerr << command << ": warning: no matching checkpoint journal \"" <<
+                journal->filename() << "\"; starting from the beginning" << std::endl;
+        }
+    }
+    if (!isResumed) {
+        blackPair = assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, blackBB);
+    }
+
+    if (journal) {
+        try {
+            journal->create(journalHeader);
+        }
+        catch (std::exception& e) {
+            std::cerr <<
+                command << ": warning: cannot create checkpoint journal \"" << journal->filename() << "\"\n" <<
+                command << ": note: " << e.what() << std::endl;
+            journal.reset();
+        }
+    }
+    if (Checkpoint) {
+        checkpointStep(vigra::Rect2D(anInputUnion.size()), resumedState.iteration, blackBB);
+    }
+
+    // Packed copy of the black alpha channel for the overlap tests.
+    // Each step that adds the white alpha to the black one merges the
+    // packed white alpha into it, too.
+    PackedAlpha packedBlackAlpha(srcImageRange(*(blackPair.second)));
+
+    // The difference planes of the black image are kept across blend
+    // steps; each step invalidates the part of the black image it
+    // changes.
+    std::unique_ptr<DifferencePlaneCache<ImagePixelType> > blackPlanes;
+    if (!LoadMasks && parameter::as_boolean("cache-difference-planes", true)) { //< cache-difference-planes 1
+        blackPlanes.reset(new DifferencePlaneCache<ImagePixelType>);
     }
 
     // mem usage before = 0
@@ -96,8 +240,9 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
     const unsigned numberOfImages = imageInfoList.size();
 
-    unsigned m = 0;
+    unsigned m = resumedState.iteration;
     FileNameList::const_iterator inputFileNameIterator(anInputFileNameList.begin());
+    std::advance(inputFileNameIterator, std::min<size_t>(m, anInputFileNameList.size()));
 
 #ifdef HAVE_EXIV2
     typedef allocate::array<Exiv2::Image::UniquePtr> metadata_array;
@@ -108,7 +253,7 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
         while (filename != anInputFileNameList.end()) {
             try {
-                new (metadata) metadata_array::value_type(metadata::read(*filename));
+                new (metadata) metadata_array::value_type(InputHeaders.take_metadata(*filename));
                 input_metadata.mark_as_initialized(metadata - input_metadata.begin());
             }
             catch (Exiv2::Error& e) {
@@ -158,10 +303,10 @@ void enblendMain(const FileNameList& anInputFileNameList,
             std::cerr << std::endl;
         }
 
-        // Determine what kind of overlap we have.
-        const Overlap overlap =
-            inspectOverlap(vigra_ext::apply(uBB, srcImageRange(*(blackPair.second))),
-                           vigra_ext::apply(uBB, srcImage(*(whitePair.second))));
+        // Determine what kind of overlap we have.  The white alpha is
+        // transparent outside of whiteBB.
+        const PackedAlpha packedWhiteAlpha(vigra_ext::apply(whiteBB, srcImageRange(*(whitePair.second))));
+        const Overlap overlap = inspectOverlap(packedBlackAlpha, packedWhiteAlpha, whiteBB.upperLeft());
 
         // If white image is redundant, skip it and go to next images.
         if (overlap == CompleteOverlap) {
@@ -201,10 +346,15 @@ void enblendMain(const FileNameList& anInputFileNameList,
                 } // omp single
             } // omp parallel
 #endif
+            packedBlackAlpha.merge(packedWhiteAlpha, whiteBB.upperLeft());
 
             delete whitePair.first;
             delete whitePair.second;
 
+            if (blackPlanes) {
+                blackPlanes->invalidate(whiteBB);
+            }
+
             // Checkpoint results.
             if (Checkpoint) {
                 if (Verbose >= VERBOSE_CHECKPOINTING_MESSAGES) {
@@ -215,7 +365,11 @@ void enblendMain(const FileNameList& anInputFileNameList,
                         std::cerr << "checkpointing" << std::endl;
                     }
                 }
-                checkpoint(blackPair, anOutputImageInfo);
+                if (!journal) {
+                    checkpoint(blackPair, anOutputImageInfo);
+                } else if (!imageInfoList.empty()) {
+                    checkpointStep(whiteBB, m, uBB);
+                }
             }
 
             blackBB = uBB;
@@ -280,7 +434,8 @@ void enblendMain(const FileNameList& anInputFileNameList,
                                                        whitePair.second, blackPair.second,
                                                        uBB, iBB, wraparoundForMask,
                                                        numberOfImages,
-                                                       inputFileNameIterator, m);
+                                                       inputFileNameIterator, m,
+                                                       blackPlanes.get());
 
         // Calculate bounding box of seam line.
         vigra::Rect2D mBB;
@@ -329,9 +484,9 @@ void enblendMain(const FileNameList& anInputFileNameList,
         // ROI bounds must be at least mBB but not to extend uBB.
         vigra::Rect2D roiBB;
         const unsigned int numLevels =
-            roiBounds<ImagePixelComponentType>(anInputUnion,
-                                               iBB, mBB, uBB, roiBB,
-                                               wraparoundForMask);
+            roiBounds<ImagePixelType>(anInputUnion,
+                                      iBB, mBB, uBB, roiBB,
+                                      wraparoundForMask, ExactLevels);
         const bool wraparoundForBlend =
             WrapAround != OpenBoundaries &&
             roiBB.width() == anInputUnion.width();
@@ -343,10 +498,15 @@ void enblendMain(const FileNameList& anInputFileNameList,
             vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
                                vigra_ext::apply(whiteBB, maskImage(*(whitePair.second))),
                                vigra::NumericTraits<AlphaPixelType>::max());
+            packedBlackAlpha.merge(packedWhiteAlpha, whiteBB.upperLeft());
 
             delete whitePair.first;
             delete whitePair.second;
 
+            if (blackPlanes) {
+                blackPlanes->invalidate(uBB);
+            }
+
             blackBB = uBB;
             ++m;
             ++inputFileNameIterator;
@@ -415,8 +575,22 @@ void enblendMain(const FileNameList& anInputFileNameList,
         //                   2*anInputUnion*AlphaValueType +
         //                   (4/3)*roiBB*MaskPyramidType
 
+        // Seam-band blending builds the Laplacians itself, but only
+        // near the seam, so it starts from the Gaussian pyramids.
+        const bool isSeamBand =
+            parameter::as_boolean("seam-band-blending", false) && //< seam-band-blending 0
+            !wraparoundForBlend &&
+            !parameter::as_boolean("compensated-collapse", false);
+
         // Build Laplacian pyramid from white image.
         std::vector<ImagePyramidType*>* whiteLP =
+            isSeamBand ?
+            gaussianPyramid<ImageType, AlphaType, ImagePyramidType,
+                            ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                            SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+            (numLevels, wraparoundForBlend,
+             vigra_ext::apply(roiBB, srcImageRange(*(whitePair.first))),
+             vigra_ext::apply(roiBB, maskImage(*(whitePair.second)))) :
             laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
                              ImagePyramidIntegerBits, ImagePyramidFractionBits,
                              SKIPSMImagePixelType, SKIPSMAlphaPixelType>
@@ -437,6 +611,13 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
         // Build Laplacian pyramid from black image.
         std::vector<ImagePyramidType*>* blackLP =
+            isSeamBand ?
+            gaussianPyramid<ImageType, AlphaType, ImagePyramidType,
+                            ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                            SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+            (numLevels, wraparoundForBlend,
+             vigra_ext::apply(roiBB, srcImageRange(*(blackPair.first))),
+             vigra_ext::apply(roiBB, maskImage(*(blackPair.second)))) :
             laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
                              ImagePyramidIntegerBits, ImagePyramidFractionBits,
                              SKIPSMImagePixelType, SKIPSMAlphaPixelType>
@@ -461,6 +642,7 @@ void enblendMain(const FileNameList& anInputFileNameList,
         vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
                            vigra_ext::apply(whiteBB, maskImage(*(whitePair.second))),
                            vigra::NumericTraits<AlphaPixelType>::max());
+        packedBlackAlpha.merge(packedWhiteAlpha, whiteBB.upperLeft());
 
         // We no longer need the white alpha data.
         delete whitePair.second;
@@ -471,7 +653,20 @@ void enblendMain(const FileNameList& anInputFileNameList,
         // Blend pyramids
         ConvertScalarToPyramidFunctor<MaskPixelType, MaskPyramidPixelType,
                                       MaskPyramidIntegerBits, MaskPyramidFractionBits> whiteMask;
-        blend(maskGP, whiteLP, blackLP, whiteMask(vigra::NumericTraits<MaskPixelType>::max()));
+        if (isSeamBand) {
+            // Tiles get blended in parallel, so they must not split
+            // the blocks of a pyramid level.
+            const int blockWidth = PyramidBlockWidth<ImagePyramidType>::value;
+            const int evenTileSize =
+                std::max(2 * SEAM_BAND_HALO,
+                         (parameter::as_integer("seam-band-tile-size", 64) + 1) & ~1); //< seam-band-tile-size 64
+            const int tileSize = (evenTileSize + blockWidth - 1) / blockWidth * blockWidth;
+            blendSeamBand<SKIPSMImagePixelType>(maskGP, whiteLP, blackLP,
+                                                whiteMask(vigra::NumericTraits<MaskPixelType>::max()),
+                                                tileSize);
+        } else {
+            blend(maskGP, whiteLP, blackLP, whiteMask(vigra::NumericTraits<MaskPixelType>::max()));
+        }
 
         // delete mask pyramid
 #ifdef DEBUG_EXPORT_PYRAMID
@@ -500,7 +695,9 @@ void enblendMain(const FileNameList& anInputFileNameList,
 #endif
 
         // collapse black pyramid
-        collapsePyramid<SKIPSMImagePixelType>(wraparoundForBlend, blackLP);
+        if (!isSeamBand) {
+            collapsePyramid<SKIPSMImagePixelType>(wraparoundForBlend, blackLP);
+        }
 
         // copy collapsed black pyramid into black image ROI, using black alpha mask.
         copyFromPyramidImageIf<ImagePyramidType, MaskType, ImageType,
@@ -517,6 +714,12 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
         // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
 
+        // The black image has changed wherever the journal would
+        // record it.
+        if (blackPlanes) {
+            blackPlanes->invalidate(whiteBB | roiBB);
+        }
+
         // Checkpoint results.
         if (Checkpoint) {
             if (Verbose >= VERBOSE_CHECKPOINTING_MESSAGES) {
@@ -527,7 +730,11 @@ void enblendMain(const FileNameList& anInputFileNameList,
                     std::cerr << "checkpointing" << std::endl;
                 }
             }
-            checkpoint(blackPair, anOutputImageInfo);
+            if (!journal) {
+                checkpoint(blackPair, anOutputImageInfo);
+            } else if (!imageInfoList.empty()) {
+                checkpointStep(whiteBB | roiBB, m + 1U, uBB);
+            }
         }
 
         // Now set blackBB to uBB.
@@ -537,12 +744,15 @@ void enblendMain(const FileNameList& anInputFileNameList,
         ++inputFileNameIterator;
     } // end main blending loop
 
-    if (!StopAfterMaskGeneration && !Checkpoint) {
-        if (Verbose >= VERBOSE_CHECKPOINTING_MESSAGES) {
+    if (!StopAfterMaskGeneration && (!Checkpoint || journal)) {
+        if (Verbose >= VERBOSE_CHECKPOINTING_MESSAGES && !Checkpoint) {
             std::cerr << command << ": info: writing final output" << std::endl;
         }
         checkpoint(blackPair, anOutputImageInfo);
     }
+    if (journal) {
+        journal->remove();
+    }
 
     delete blackPair.first;
     delete blackPair.second;
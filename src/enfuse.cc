@@ -47,8 +47,10 @@
 #include <iostream>
 #include <list>
 #include <memory>               // std::unique_ptr
+#include <mutex>
 #include <optional>
 #include <set>
+#include <tuple>
 #include <vector>
 
 #include <getopt.h>
@@ -82,11 +84,14 @@ extern "C" int optind;
 #endif
 
 #include "alternativepercentage.h"
+#include "batch.h"
 #include "dynamic_loader.h"
 #include "exposure_weight.h"
 #include "global.h"
+#include "input_header_cache.h"
 #include "layer_selection.h"
 #include "parameter.h"
+#include "pyramid_pool.h"
 #include "selector.h"
 #include "self_test.h"
 #include "signature.h"
@@ -101,6 +106,7 @@ const std::string command("enfuse");
 // Global values from command line parameters.
 std::string OutputFileName(DEFAULT_OUTPUT_FILENAME);
 std::optional<std::string> OutputMaskFileName;
+unsigned PreviewLevels = 0U;    // 0 means: full resolution
 int Verbose = 0;                //< default-verbosity-level 0
 int ExactLevels = 0;            // 0 means: automatically calculate maximum
 bool OneAtATime = true;
@@ -171,10 +177,13 @@ cmsHTRANSFORM LabToInputTransform = nullptr;
 cmsViewingConditions ViewingConditions;
 cmsHANDLE CIECAMTransform = nullptr;
 cmsHPROFILE FallbackProfile = nullptr;
+std::vector<unsigned char> ColorTransformProfile; // input profile the transforms were built for
 
 Signature sig;
 LayerSelectionHost LayerSelection;
+enblend::InputHeaderCache InputHeaders;
 
+#include <vigra/basicimageview.hxx>
 #include <vigra/imageinfo.hxx>
 #include <vigra/impex.hxx>
 #include <vigra/sized_int.hxx>
@@ -185,6 +194,9 @@ LayerSelectionHost LayerSelection;
 #include "filespec.h"
 #include "introspection.h"
 #include "enfuse.h"
+#ifdef ENFUSE_LIBRARY
+#include "libenfuse.h"
+#endif
 
 #ifdef DMALLOC
 #include "dmalloc.h"            // must be last #include
@@ -211,6 +223,7 @@ void dump_global_variables(std::ostream& out = std::cout)
         "+ Verbose = " << Verbose << ", option \"--verbose\"\n" <<
         "+ OutputFileName = <" << OutputFileName << ">\n" <<
         "+ OutputMaskFileName = <" << OutputMaskFileName.value_or("<not defined>") << ">\n" <<
+        "+ PreviewLevels = " << PreviewLevels << ", option \"--preview\"\n" <<
         "+ ExactLevels = " << ExactLevels << "\n" <<
         "+ UseGPU = " << UseGPU << "\n" <<
         "+ OneAtATime = " << enblend::stringOfBool(OneAtATime) << ", option \"-a\"\n" <<
@@ -331,6 +344,9 @@ printUsage(const bool error = true)
         "                         and Cinepaint\n" <<
         "  --output-mask[=FILE]   write output mask to FILE if the output format does not\n" <<
         "                         support alpha-channels; default: \"" << DEFAULT_OUTPUT_MASK_FILENAME << "\"\n" <<
+        "  --preview[=LEVELS]     fuse proxies of the input images scaled down by\n" <<
+        "                         2^LEVELS for a quick look at the effect of other\n" <<
+        "                         options; default: " << DEFAULT_PREVIEW_LEVELS << "\n" <<
         "  -w, --wrap[=MODE]      wrap around image boundary, where MODE is \"none\",\n" <<
         "                         \"horizontal\", \"vertical\", or \"both\"; default: " <<
         enblend::stringOfWraparound(WrapAround) << ";\n" <<
@@ -448,6 +464,13 @@ printUsage(const bool error = true)
         "                         default: " <<
         EntropyLowerCutoff.str() << ":" << EntropyUpperCutoff.str() << "\n" <<
         "\n" <<
+        "Batch options:\n" <<
+        "  --batch=MANIFEST       fuse each stack listed in MANIFEST, one line of\n" <<
+        "                         arguments per stack, in a process of its own;\n" <<
+        "                         \"-\" reads the lines from standard input; all\n" <<
+        "                         other arguments apply to every stack\n" <<
+        "  --batch-jobs=JOBS      fuse up to JOBS stacks at the same time; default: 1\n" <<
+        "\n" <<
         "Information options:\n" <<
         "  -h, --help             print this help message and exit\n" <<
         "  -V, --version          output version information and exit\n" <<
@@ -481,7 +504,12 @@ printUsage(const bool error = true)
 #if defined(OPENCL) && defined(PREFER_SEPARATE_OPENCL_SOURCE)
         "  ENBLEND_OPENCL_PATH    The ENBLEND_OPENCL_PATH environment variable sets the search\n" <<
         "                         path for OpenCL source files.  Note that the variable name is\n" <<
-        "                         ENBLEND_OPENCL_PATH for Enfuse, too." <<
+        "                         ENBLEND_OPENCL_PATH for Enfuse, too.\n" <<
+#endif
+#ifdef OPENCL
+        "  ENBLEND_OPENCL_CACHE   The ENBLEND_OPENCL_CACHE environment variable sets the\n" <<
+        "                         directory of the cache of compiled OpenCL programs.  An\n" <<
+        "                         empty value disables the cache.\n" <<
 #endif
         "\n" <<
         "Report bugs at <" PACKAGE_BUGREPORT ">." <<
@@ -505,6 +533,23 @@ void cleanup_output(void)
 }
 
 
+void free_color_transforms()
+{
+    if (LabProfile) {cmsCloseProfile(LabProfile);}
+    if (InputToLabTransform) {cmsDeleteTransform(InputToLabTransform);}
+    if (LabToInputTransform) {cmsDeleteTransform(LabToInputTransform);}
+    if (CIECAMTransform) {cmsCIECAM02Done(CIECAMTransform);}
+    if (InputToXYZTransform) {cmsDeleteTransform(InputToXYZTransform);}
+    if (XYZToInputTransform) {cmsDeleteTransform(XYZToInputTransform);}
+    if (XYZProfile) {cmsCloseProfile(XYZProfile);}
+
+    LabProfile = XYZProfile = nullptr;
+    InputToLabTransform = LabToInputTransform = InputToXYZTransform = XYZToInputTransform = nullptr;
+    CIECAMTransform = nullptr;
+    ColorTransformProfile.clear();
+}
+
+
 void sigint_handler(int sig)
 {
     std::cerr << std::endl << command << ": interrupted" << std::endl;
@@ -525,7 +570,7 @@ void sigint_handler(int sig)
 
 
 enum AllPossibleOptions {
-    VersionOption, HelpOption, LevelsOption, OutputOption, OutputMaskOption, VerboseOption,
+    VersionOption, HelpOption, LevelsOption, OutputOption, OutputMaskOption, PreviewOption, VerboseOption,
     WrapAroundOption /* -w */, CompressionOption, LZWCompressionOption,
     BlendColorspaceOption, FallbackProfileOption,
     DepthOption, AssociatedAlphaOption /* -g */,
@@ -911,6 +956,7 @@ process_options(int argc, char** argv)
         DepthId,
         OutputId,
         OutputMaskId,
+        PreviewId,
         SaveMasksId,
         WrapAroundId,
         LevelsId,
@@ -955,6 +1001,7 @@ process_options(int argc, char** argv)
         {"depth", required_argument, 0, DepthId},
         {"output", required_argument, 0, OutputId},
         {"output-mask", optional_argument, 0, OutputMaskId},
+        {"preview", optional_argument, 0, PreviewId},
         {"save-mask", optional_argument, 0, SaveMasksId}, // singular form: not documented, not deprecated
         {"save-masks", optional_argument, 0, SaveMasksId},
         {"wrap", optional_argument, 0, WrapAroundId},
@@ -1424,6 +1471,25 @@ process_options(int argc, char** argv)
             optionSet.insert(OutputMaskOption);
             break;
 
+        case PreviewId:
+            if (optarg != nullptr && *optarg != 0) {
+                std::ostringstream oss;
+                oss << "cannot preview at less than 1/2^" << MAX_PREVIEW_LEVELS << " size; will use " <<
+                    MAX_PREVIEW_LEVELS << " levels";
+                PreviewLevels =
+                    enblend::numberOfString(optarg,
+                                            [](unsigned x) {return x >= 1U;},
+                                            "preview needs at least one level; will use one level",
+                                            1U,
+                                            [](unsigned x) {return x <= MAX_PREVIEW_LEVELS;},
+                                            oss.str(),
+                                            MAX_PREVIEW_LEVELS);
+            } else {
+                PreviewLevels = DEFAULT_PREVIEW_LEVELS;
+            }
+            optionSet.insert(PreviewOption);
+            break;
+
         case LoadMasksId:
             fill_mask_templates(optarg, SoftMaskTemplate, HardMaskTemplate, "--load-masks");
             LoadMasks = true;
@@ -1848,6 +1914,14 @@ process_options(int argc, char** argv)
         failed = true;
     }
 
+    if (contains(optionSet, PreviewOption) &&
+        (contains(optionSet, LoadMasksOption) || contains(optionSet, SaveMasksOption)))
+    {
+        std::cerr << command
+                  << ": option \"--preview\" excludes \"--load-masks\" and \"--save-masks\"" << std::endl;
+        failed = true;
+    }
+
     if (failed) {
         exit(1);
     }
@@ -1954,7 +2028,233 @@ process_options(int argc, char** argv)
 }
 
 
-int main(int argc, char** argv)
+#ifdef ENFUSE_LIBRARY
+namespace libenfuse
+{
+    namespace
+    {
+        template <typename PixelType>
+        vigra::BasicImageView<PixelType>
+        view_of(const image_view& a_view)
+        {
+            return vigra::BasicImageView<PixelType>(static_cast<PixelType*>(a_view.pixels),
+                                                    a_view.width, a_view.height,
+                                                    a_view.row_stride / static_cast<std::ptrdiff_t>(sizeof(PixelType)));
+        }
+
+
+        vigra::BasicImageView<vigra::UInt8>
+        view_of(const alpha_view& a_view, const image_view& an_image)
+        {
+            return vigra::BasicImageView<vigra::UInt8>(a_view.pixels, an_image.width, an_image.height,
+                                                       a_view.row_stride);
+        }
+
+
+        template <typename ImagePixelType>
+        void
+        fuse_images(const enblend::FusionOptions& some_options,
+                    const std::vector<input_image>& some_inputs, const output_image& an_output,
+                    vigra::Rect2D& an_input_union)
+        {
+            typedef enblend::EnfuseMemoryIO<ImagePixelType> MemoryIO;
+            typedef typename MemoryIO::ImageType ImageType;
+            typedef typename MemoryIO::AlphaType AlphaType;
+            typedef typename MemoryIO::ImagePyramidType ImagePyramidType;
+            typedef vigra::BasicImageView<ImagePixelType> ViewType;
+
+            enum {ImagePyramidIntegerBits = enblend::EnblendNumericTraits<ImagePixelType>::ImagePyramidIntegerBits};
+            enum {ImagePyramidFractionBits = enblend::EnblendNumericTraits<ImagePixelType>::ImagePyramidFractionBits};
+
+            MemoryIO io;
+            unsigned next = 0U;
+
+            io.numberOfImages = some_inputs.size();
+            io.nextImage = [&](vigra::Rect2D& a_bounding_box) {
+                const input_image& input(some_inputs[next++]);
+                const vigra::Diff2D offset(vigra::Diff2D(input.x, input.y) - an_input_union.upperLeft());
+                const ViewType image_view(view_of<ImagePixelType>(input.image));
+
+                std::unique_ptr<ImageType> image(new ImageType(an_input_union.size()));
+                std::unique_ptr<AlphaType> alpha(new AlphaType(an_input_union.size()));
+
+                vigra::omp::copyImage(srcImageRange(image_view), vigra::destIter(image->upperLeft() + offset));
+                if (input.alpha.pixels == nullptr) {
+                    vigra::initImage(alpha->upperLeft() + offset, alpha->upperLeft() + offset + image_view.size(),
+                                     alpha->accessor(), vigra::NumericTraits<vigra::UInt8>::max());
+                } else {
+                    const vigra::BasicImageView<vigra::UInt8> alpha_view(view_of(input.alpha, input.image));
+                    vigra::omp::transformImage(srcImageRange(alpha_view), vigra::destIter(alpha->upperLeft() + offset),
+                                               vigra::Threshold<vigra::UInt8, vigra::UInt8>(1, 255, 0, 255));
+                }
+
+                a_bounding_box = vigra::Rect2D(vigra::Point2D(offset), image_view.size());
+
+                return std::make_pair(image.release(), alpha.release());
+            };
+            io.writeOutput = [&](const ImagePyramidType& a_pyramid, const AlphaType& an_alpha) {
+                ViewType output_view(view_of<ImagePixelType>(an_output.image));
+
+                enblend::copyFromPyramidImageIf<ImagePyramidType, AlphaType, ViewType,
+                                                ImagePyramidIntegerBits, ImagePyramidFractionBits>
+                    (srcImageRange(a_pyramid), maskImage(an_alpha), destImage(output_view));
+
+                if (an_output.alpha.pixels != nullptr) {
+                    vigra::BasicImageView<vigra::UInt8> alpha_view(view_of(an_output.alpha, an_output.image));
+                    vigra::omp::copyImage(srcImageRange(an_alpha), destImage(alpha_view));
+                }
+            };
+
+            const enblend::FileNameList no_files;
+            const std::list<vigra::ImageImportInfo*> no_infos;
+            vigra::ImageExportInfo no_output("");
+
+            enblend::enfuseMain<ImagePixelType>(no_files, no_infos, no_output, an_input_union, some_options, &io);
+        }
+
+
+        std::string
+        check_view(const image_view& a_view, size_t a_sample_size, const char* a_name)
+        {
+            const size_t pixel_size = a_view.channels * a_sample_size;
+
+            if (a_view.pixels == nullptr || a_view.width == 0U || a_view.height == 0U) {
+                return std::string(a_name) + " is empty";
+            } else if (a_view.channels != 1U && a_view.channels != 3U) {
+                return std::string(a_name) + " has neither 1 nor 3 channels";
+            } else if (a_view.row_stride % static_cast<std::ptrdiff_t>(pixel_size) != 0 ||
+                       a_view.row_stride < static_cast<std::ptrdiff_t>(a_view.width * pixel_size)) {
+                return std::string(a_name) + " has a row stride that does not fit its pixels";
+            } else {
+                return std::string();
+            }
+        }
+
+
+        size_t
+        size_of(sample_type a_sample)
+        {
+            switch (a_sample) {
+            case sample_type::uint8: return sizeof(vigra::UInt8);
+            case sample_type::uint16: return sizeof(vigra::UInt16);
+            case sample_type::float32: return sizeof(float);
+            }
+            return 0U;
+        }
+    } // namespace
+
+
+    std::string
+    fuse(const options& some_options, const std::vector<input_image>& some_inputs, const output_image& an_output)
+    {
+        if (some_inputs.empty()) {
+            return "no input images given";
+        }
+
+        const image_view& first(some_inputs.front().image);
+        vigra::Rect2D input_union;
+        for (auto const& input : some_inputs) {
+            const std::string problem(check_view(input.image, size_of(first.sample), "input image"));
+            if (!problem.empty()) {
+                return problem;
+            }
+            if (input.image.sample != first.sample || input.image.channels != first.channels) {
+                return "input images differ in sample type or number of channels";
+            }
+            if (input.alpha.pixels != nullptr && input.alpha.row_stride < static_cast<std::ptrdiff_t>(input.image.width)) {
+                return "input alpha channel has a row stride that does not fit its pixels";
+            }
+            input_union |= vigra::Rect2D(vigra::Point2D(input.x, input.y),
+                                         vigra::Size2D(input.image.width, input.image.height));
+        }
+
+        const std::string problem(check_view(an_output.image, size_of(first.sample), "output image"));
+        if (!problem.empty()) {
+            return problem;
+        }
+        if (an_output.image.sample != first.sample || an_output.image.channels != first.channels) {
+            return "output image differs from the input images in sample type or number of channels";
+        }
+        if (static_cast<int>(an_output.image.width) != input_union.width() ||
+            static_cast<int>(an_output.image.height) != input_union.height()) {
+            return "output image does not match the union of the input images";
+        }
+
+#ifdef _MSC_VER
+        _controlfp(_RC_NEAR, _MCW_RC);
+#else
+        fesetround(FE_TONEAREST);
+#endif
+        static std::once_flag gsl_initialized;
+        std::call_once(gsl_initialized, []() {gsl_set_error_handler_off();});
+
+        try {
+            const std::unique_ptr<ExposureWeight> weight_function
+                (exposure_weight::make_weight_function(some_options.exposure_weight_function,
+                                                       some_options.exposure_weight_function_arguments.begin(),
+                                                       some_options.exposure_weight_function_arguments.end(),
+                                                       some_options.exposure_optimum, some_options.exposure_width));
+
+            // Configure the fusion exactly as the command-line tool
+            // would, but for this call only.
+            enblend::FusionOptions fusion;
+            fusion.exposureWeight = some_options.exposure_weight;
+            fusion.saturationWeight = first.channels == 3U ? some_options.saturation_weight : 0.0;
+            fusion.contrastWeight = some_options.contrast_weight;
+            fusion.entropyWeight = some_options.entropy_weight;
+            fusion.exposureWeightFunction = weight_function.get();
+            fusion.grayscaleProjector = some_options.grayscale_projector;
+            fusion.contrastWindowSize = some_options.contrast_window_size;
+            fusion.entropyWindowSize = some_options.entropy_window_size;
+            fusion.exactLevels = some_options.levels;
+            fusion.useHardMask = some_options.hard_mask;
+            fusion.wrapAround = some_options.wrap_around ? HorizontalStrip : OpenBoundaries;
+
+            const bool is_color = first.channels == 3U;
+            switch (first.sample) {
+            case sample_type::uint8:
+                if (is_color) {
+                    fuse_images<vigra::RGBValue<vigra::UInt8> >(fusion, some_inputs, an_output, input_union);
+                } else {
+                    fuse_images<vigra::UInt8>(fusion, some_inputs, an_output, input_union);
+                }
+                break;
+#ifndef DEBUG_8BIT_ONLY
+            case sample_type::uint16:
+                if (is_color) {
+                    fuse_images<vigra::RGBValue<vigra::UInt16> >(fusion, some_inputs, an_output, input_union);
+                } else {
+                    fuse_images<vigra::UInt16>(fusion, some_inputs, an_output, input_union);
+                }
+                break;
+            case sample_type::float32:
+                if (is_color) {
+                    fuse_images<vigra::RGBValue<float> >(fusion, some_inputs, an_output, input_union);
+                } else {
+                    fuse_images<float>(fusion, some_inputs, an_output, input_union);
+                }
+                break;
+#endif
+            default:
+                return "sample type not supported";
+            }
+        } catch (std::bad_alloc& e) {
+            return std::string("out of memory: ") + e.what();
+        } catch (std::exception& e) {
+            return e.what();
+        }
+
+        return std::string();
+    }
+} // namespace libenfuse
+
+
+#else // ENFUSE_LIBRARY
+
+// Set up everything that does not depend on the command line.  In
+// batch mode this happens once for all jobs.
+void
+initialize_process()
 {
 #ifdef _MSC_VER
     // Make sure the FPU is set to rounding mode so that the lrint
@@ -1999,7 +2299,50 @@ int main(int argc, char** argv)
         std::cerr << command << ": cannot reliably parse command line; giving up\n";
         exit(1);
     }
+}
+
 
+// Collect the options of the fusion from the parsed command line.
+enblend::FusionOptions
+commandLineFusionOptions()
+{
+    enblend::FusionOptions options;
+
+    options.exposureWeight = WExposure;
+    options.saturationWeight = WSaturation;
+    options.contrastWeight = WContrast;
+    options.entropyWeight = WEntropy;
+    options.exposureWeightFunction = ExposureWeightFunction;
+    options.exposureLowerCutoff = ExposureLowerCutoff;
+    options.exposureUpperCutoff = ExposureUpperCutoff;
+    options.exposureLowerCutoffProjector = ExposureLowerCutoffGrayscaleProjector;
+    options.exposureUpperCutoffProjector = ExposureUpperCutoffGrayscaleProjector;
+    options.grayscaleProjector = GrayscaleProjector;
+    options.contrastWindowSize = ContrastWindowSize;
+    options.edgeFilter = FilterConfig;
+    options.minCurvature = MinCurvature;
+    options.entropyWindowSize = EntropyWindowSize;
+    options.entropyLowerCutoff = EntropyLowerCutoff;
+    options.entropyUpperCutoff = EntropyUpperCutoff;
+    options.useHardMask = UseHardMask;
+    options.loadMasks = LoadMasks;
+    options.saveMasks = SaveMasks;
+    options.stopAfterMaskGeneration = StopAfterMaskGeneration;
+    options.softMaskTemplate = SoftMaskTemplate;
+    options.hardMaskTemplate = HardMaskTemplate;
+    options.outputFileName = OutputFileName;
+    options.resolution = ImageResolution;
+    options.wrapAround = WrapAround;
+    options.exactLevels = ExactLevels;
+
+    return options;
+}
+
+
+// Fuse the images given on command line ARGC/ARGV.
+int
+process_job(int argc, char** argv)
+{
     int optind;
     try {
         optind = process_options(argc, argv);
@@ -2032,6 +2375,14 @@ int main(int argc, char** argv)
 
     sig.check();
 
+    {
+        std::vector<std::string> filenames;
+        for (auto const& f : inputTraceableFileNameList) {
+            filenames.push_back(f->filename());
+        }
+        InputHeaders.scan(filenames);
+    }
+
     for (enblend::TraceableFileNameList::iterator i = inputTraceableFileNameList.begin();
          i != inputTraceableFileNameList.end();
          ++i) {
@@ -2040,7 +2391,7 @@ int main(int argc, char** argv)
             exit(1);
         }
 
-        if (!vigra::isImage((*i)->filename().c_str())) {
+        if (!InputHeaders.is_image((*i)->filename())) {
             std::cerr <<
                 command << ": cannot process \"" << (*i)->filename() << "\"; not recognized as an image\n" <<
                 command << ": info: possible causes:\n" <<
@@ -2056,7 +2407,10 @@ int main(int argc, char** argv)
     }
 
     LayerSelection.retrieve_image_information(inputTraceableFileNameList.begin(),
-                                              inputTraceableFileNameList.end());
+                                              inputTraceableFileNameList.end(),
+                                              [](const std::string& a_filename)
+                                              -> const enblend::InputHeaderCache::layer_list&
+                                              {return InputHeaders.layers(a_filename);});
 
     // List of info structures for each input image.
     std::list<vigra::ImageImportInfo*> imageInfoList;
@@ -2077,7 +2431,7 @@ int main(int argc, char** argv)
         const std::string filename((*inputFileNameIterator)->filename());
         vigra::ImageImportInfo* inputInfo = nullptr;
         try {
-            vigra::ImageImportInfo info(filename.c_str());
+            const enblend::LayerHeader& info(InputHeaders.layer(filename, 0U));
             if (layers == 0) { // OPTIMIZATION: call only once per file
                 layers = info.numImages();
                 LayerSelection.set_selector((*inputFileNameIterator)->selector());
@@ -2091,7 +2445,11 @@ int main(int argc, char** argv)
                 std::cout << "]\n";
 #endif
             }
-            inputInfo = new vigra::ImageImportInfo(info);
+
+            // Vigra opens the file once more, for the only layer we
+            // import.
+            assert(layer != viable_layers.end());
+            inputInfo = new vigra::ImageImportInfo(filename.c_str(), *layer - 1);
         } catch (vigra::ContractViolation& exception) {
             std::cerr <<
                 command << ": cannot load image \"" << filename << "\"\n" <<
@@ -2104,9 +2462,6 @@ int main(int argc, char** argv)
             exit(1);
         }
 
-        assert(layer != viable_layers.end());
-        inputInfo->setImageIndex(*layer - 1);
-
         if (Verbose >= VERBOSE_LAYER_SELECTION) {
             std::cerr << command << ": info: layer selector \"" << LayerSelection.name() << "\" accepts\n"
                       << command << ": info: layer " << *layer << " of " << layers << " in image \""
@@ -2338,6 +2693,34 @@ int main(int argc, char** argv)
                                         OutputOffsetYCmdLine + OutputHeightCmdLine);
         }
 
+        // Shrink the canvas, the resolution, explicit pyramid
+        // heights, the windows of the local contrast and entropy
+        // weights, and the Gaussian scales of the edge detection for
+        // option --preview.  The windows stay odd and span at least 3
+        // pixels; the scales do not drop below half a pixel.
+        if (PreviewLevels != 0U) {
+            const float scale = static_cast<float>(1U << PreviewLevels);
+
+            inputUnion = enblend::previewRect(inputUnion, PreviewLevels);
+            ImageResolution.x /= scale;
+            ImageResolution.y /= scale;
+            if (ExactLevels > 0) {
+                ExactLevels = std::max(1, ExactLevels - static_cast<int>(PreviewLevels));
+            }
+            ContrastWindowSize = std::max(3, ContrastWindowSize >> PreviewLevels) | 1;
+            EntropyWindowSize = std::max(3, EntropyWindowSize >> PreviewLevels) | 1;
+            if (FilterConfig.edgeScale > 0.0) {
+                FilterConfig.edgeScale = std::max(0.5, FilterConfig.edgeScale / scale);
+            }
+            if (FilterConfig.lceScale > 0.0) {
+                FilterConfig.lceScale = std::max(0.5, FilterConfig.lceScale / scale);
+            }
+
+            if (Verbose >= VERBOSE_INPUT_UNION_SIZE_MESSAGES) {
+                std::cerr << command << ": info: preview at 1/" << scale << " size" << std::endl;
+            }
+        }
+
         if (!OutputCompression.empty()) {
             outputImageInfo.setCompression(OutputCompression.c_str());
         }
@@ -2397,102 +2780,116 @@ int main(int argc, char** argv)
                     FallbackProfile = nullptr; // avoid double freeing
                 }
             }
-            XYZProfile = cmsCreateXYZProfile();
-
-            const unsigned input_profile_type =
-                enblend::profileChannels(InputProfile) > 1 ? TYPE_RGB_DBL : TYPE_GRAY_DBL;
-
-            InputToXYZTransform = cmsCreateTransform(InputProfile, input_profile_type,
-                                                     XYZProfile, TYPE_XYZ_DBL,
-                                                     RENDERING_INTENT_FOR_BLENDING,
-                                                     TRANSFORMATION_FLAGS_FOR_BLENDING);
-            if (InputToXYZTransform == nullptr) {
-                std::cerr << command << ": error building color transform from \""
-                          << enblend::profileName(InputProfile)
-                          << " "
-                          << enblend::profileDescription(InputProfile)
-                          << "\" to XYZ space" << std::endl;
-                exit(1);
-            }
+            // Jobs of a batch with the same input profile share the
+            // transforms and with them the cached gamut mappings.
+            const std::vector<unsigned char> inputProfileBytes(enblend::profileBytes(InputProfile));
+            if (inputProfileBytes != ColorTransformProfile) {
+                free_color_transforms();
+
+                XYZProfile = cmsCreateXYZProfile();
+
+                const unsigned input_profile_type =
+                    enblend::profileChannels(InputProfile) > 1 ? TYPE_RGB_DBL : TYPE_GRAY_DBL;
+
+                InputToXYZTransform = cmsCreateTransform(InputProfile, input_profile_type,
+                                                         XYZProfile, TYPE_XYZ_DBL,
+                                                         RENDERING_INTENT_FOR_BLENDING,
+                                                         TRANSFORMATION_FLAGS_FOR_BLENDING);
+                if (InputToXYZTransform == nullptr) {
+                    std::cerr << command << ": error building color transform from \""
+                              << enblend::profileName(InputProfile)
+                              << " "
+                              << enblend::profileDescription(InputProfile)
+                              << "\" to XYZ space" << std::endl;
+                    exit(1);
+                }
 
-            XYZToInputTransform = cmsCreateTransform(XYZProfile, TYPE_XYZ_DBL,
-                                                     InputProfile, input_profile_type,
-                                                     RENDERING_INTENT_FOR_BLENDING,
-                                                     TRANSFORMATION_FLAGS_FOR_BLENDING);
-            if (XYZToInputTransform == nullptr) {
-                std::cerr << command
-                          << ": error building color transform from XYZ space to \""
-                          << enblend::profileName(InputProfile)
-                          << " "
-                          << enblend::profileDescription(InputProfile)
-                          << "\"" << std::endl;
-                exit(1);
-            }
+                XYZToInputTransform = cmsCreateTransform(XYZProfile, TYPE_XYZ_DBL,
+                                                         InputProfile, input_profile_type,
+                                                         RENDERING_INTENT_FOR_BLENDING,
+                                                         TRANSFORMATION_FLAGS_FOR_BLENDING);
+                if (XYZToInputTransform == nullptr) {
+                    std::cerr << command
+                              << ": error building color transform from XYZ space to \""
+                              << enblend::profileName(InputProfile)
+                              << " "
+                              << enblend::profileDescription(InputProfile)
+                              << "\"" << std::endl;
+                    exit(1);
+                }
 
-            // P2 Viewing Conditions: D50, 500 lumens
-            ViewingConditions.whitePoint.X = XYZ_SCALE * cmsD50_XYZ()->X;
-            ViewingConditions.whitePoint.Y = XYZ_SCALE * cmsD50_XYZ()->Y;
-            ViewingConditions.whitePoint.Z = XYZ_SCALE * cmsD50_XYZ()->Z;
-            ViewingConditions.Yb = 20.0;
-            ViewingConditions.La = 31.83;
-            ViewingConditions.surround = AVG_SURROUND;
-            ViewingConditions.D_value = 1.0;
+                // P2 Viewing Conditions: D50, 500 lumens
+                ViewingConditions.whitePoint.X = XYZ_SCALE * cmsD50_XYZ()->X;
+                ViewingConditions.whitePoint.Y = XYZ_SCALE * cmsD50_XYZ()->Y;
+                ViewingConditions.whitePoint.Z = XYZ_SCALE * cmsD50_XYZ()->Z;
+                ViewingConditions.Yb = 20.0;
+                ViewingConditions.La = 31.83;
+                ViewingConditions.surround = AVG_SURROUND;
+                ViewingConditions.D_value = 1.0;
+
+                CIECAMTransform = cmsCIECAM02Init(nullptr, &ViewingConditions);
+                if (!CIECAMTransform) {
+                    std::cerr << std::endl
+                              << command
+                              << ": error initializing CIECAM02 transform"
+                              << std::endl;
+                    exit(1);
+                }
 
-            CIECAMTransform = cmsCIECAM02Init(nullptr, &ViewingConditions);
-            if (!CIECAMTransform) {
-                std::cerr << std::endl
-                          << command
-                          << ": error initializing CIECAM02 transform"
-                          << std::endl;
-                exit(1);
-            }
+                // Gamut mappings cached for earlier transforms are void.
+                enblend::clear_gamut_map_caches();
 
-            cmsCIExyY white_point;
-            if (cmsIsTag(InputProfile, cmsSigMediaWhitePointTag)) {
-                cmsXYZ2xyY(&white_point,
-                           (const cmsCIEXYZ*) cmsReadTag(InputProfile, cmsSigMediaWhitePointTag));
-                if (Verbose >= VERBOSE_COLOR_CONVERSION_MESSAGES) {
-                    double temperature;
-                    cmsTempFromWhitePoint(&temperature, &white_point);
-                    std::cerr << command
-                              << ": info: using white point of input profile at " << temperature << "K"
-                              << std::endl;
+                cmsCIExyY white_point;
+                if (cmsIsTag(InputProfile, cmsSigMediaWhitePointTag)) {
+                    cmsXYZ2xyY(&white_point,
+                               (const cmsCIEXYZ*) cmsReadTag(InputProfile, cmsSigMediaWhitePointTag));
+                    if (Verbose >= VERBOSE_COLOR_CONVERSION_MESSAGES) {
+                        double temperature;
+                        cmsTempFromWhitePoint(&temperature, &white_point);
+                        std::cerr << command
+                                  << ": info: using white point of input profile at " << temperature << "K"
+                                  << std::endl;
+                    }
+                } else {
+                    memcpy(&white_point, cmsD50_xyY(), sizeof(cmsCIExyY));
+                    if (Verbose >= VERBOSE_COLOR_CONVERSION_MESSAGES) {
+                        double temperature;
+                        cmsTempFromWhitePoint(&temperature, &white_point);
+                        std::cerr << command
+                                  << ": info: falling back to predefined (D50) white point at " << temperature << "K"
+                                  << std::endl;
+                    }
                 }
-            } else {
-                memcpy(&white_point, cmsD50_xyY(), sizeof(cmsCIExyY));
-                if (Verbose >= VERBOSE_COLOR_CONVERSION_MESSAGES) {
-                    double temperature;
-                    cmsTempFromWhitePoint(&temperature, &white_point);
+                LabProfile = cmsCreateLab2Profile(&white_point);
+                InputToLabTransform = cmsCreateTransform(InputProfile, input_profile_type,
+                                                         LabProfile, TYPE_Lab_DBL,
+                                                         RENDERING_INTENT_FOR_BLENDING,
+                                                         TRANSFORMATION_FLAGS_FOR_BLENDING);
+                if (!InputToLabTransform) {
+                    std::cerr << command << ": error building color transform from \""
+                              << enblend::profileName(InputProfile)
+                              << " "
+                              << enblend::profileDescription(InputProfile)
+                              << "\" to Lab space" << std::endl;
+                    exit(1);
+                }
+                LabToInputTransform = cmsCreateTransform(LabProfile, TYPE_Lab_DBL,
+                                                         InputProfile, input_profile_type,
+                                                         RENDERING_INTENT_FOR_BLENDING,
+                                                         TRANSFORMATION_FLAGS_FOR_BLENDING);
+                if (!LabToInputTransform) {
                     std::cerr << command
-                              << ": info: falling back to predefined (D50) white point at " << temperature << "K"
-                              << std::endl;
+                              << ": error building color transform from Lab space to \""
+                              << enblend::profileName(InputProfile)
+                              << " "
+                              << enblend::profileDescription(InputProfile)
+                              << "\"" << std::endl;
+                    exit(1);
                 }
-            }
-            LabProfile = cmsCreateLab2Profile(&white_point);
-            InputToLabTransform = cmsCreateTransform(InputProfile, input_profile_type,
-                                                     LabProfile, TYPE_Lab_DBL,
-                                                     RENDERING_INTENT_FOR_BLENDING,
-                                                     TRANSFORMATION_FLAGS_FOR_BLENDING);
-            if (!InputToLabTransform) {
-                std::cerr << command << ": error building color transform from \""
-                          << enblend::profileName(InputProfile)
-                          << " "
-                          << enblend::profileDescription(InputProfile)
-                          << "\" to Lab space" << std::endl;
-                exit(1);
-            }
-            LabToInputTransform = cmsCreateTransform(LabProfile, TYPE_Lab_DBL,
-                                                     InputProfile, input_profile_type,
-                                                     RENDERING_INTENT_FOR_BLENDING,
-                                                     TRANSFORMATION_FLAGS_FOR_BLENDING);
-            if (!LabToInputTransform) {
-                std::cerr << command
-                          << ": error building color transform from Lab space to \""
-                          << enblend::profileName(InputProfile)
-                          << " "
-                          << enblend::profileDescription(InputProfile)
-                          << "\"" << std::endl;
-                exit(1);
+
+                ColorTransformProfile = inputProfileBytes;
+            } else if (Verbose >= VERBOSE_COLOR_CONVERSION_MESSAGES) {
+                std::cerr << command << ": info: reusing color transforms of previous job" << std::endl;
             }
         } else {
             if (FallbackProfile != nullptr) {
@@ -2539,17 +2936,19 @@ int main(int argc, char** argv)
         }
     }
 
+    enblend::FusionOptions fusionOptions(commandLineFusionOptions());
+
     // Invoke templatized blender.
     try {
         if (isColor) {
-            if      (pixelType == "UINT8")  enblend::enfuseMain<vigra::RGBValue<vigra::UInt8 > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
+            if      (pixelType == "UINT8")  enblend::enfuseMain<vigra::RGBValue<vigra::UInt8 > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
 #ifndef DEBUG_8BIT_ONLY
-            else if (pixelType == "UINT16") enblend::enfuseMain<vigra::RGBValue<vigra::UInt16> >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "INT16")  enblend::enfuseMain<vigra::RGBValue<vigra::Int16 > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "UINT32") enblend::enfuseMain<vigra::RGBValue<vigra::UInt32> >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "INT32")  enblend::enfuseMain<vigra::RGBValue<vigra::Int32 > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "FLOAT")  enblend::enfuseMain<vigra::RGBValue<float > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "DOUBLE") enblend::enfuseMain<vigra::RGBValue<double> >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
+            else if (pixelType == "UINT16") enblend::enfuseMain<vigra::RGBValue<vigra::UInt16> >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "INT16")  enblend::enfuseMain<vigra::RGBValue<vigra::Int16 > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "UINT32") enblend::enfuseMain<vigra::RGBValue<vigra::UInt32> >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "INT32")  enblend::enfuseMain<vigra::RGBValue<vigra::Int32 > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "FLOAT")  enblend::enfuseMain<vigra::RGBValue<float > >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "DOUBLE") enblend::enfuseMain<vigra::RGBValue<double> >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
 #endif
             else {
                 std::cerr << command << ": RGB images with pixel type \""
@@ -2565,16 +2964,16 @@ int main(int argc, char** argv)
                           << command
                           << ": warning: this parameter will have no effect"
                           << std::endl;
-                WSaturation = 0.0;
+                fusionOptions.saturationWeight = 0.0;
             }
-            if      (pixelType == "UINT8")  enblend::enfuseMain<vigra::UInt8 >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
+            if      (pixelType == "UINT8")  enblend::enfuseMain<vigra::UInt8 >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
 #ifndef DEBUG_8BIT_ONLY
-            else if (pixelType == "UINT16") enblend::enfuseMain<vigra::UInt16>(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "INT16")  enblend::enfuseMain<vigra::Int16 >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "UINT32") enblend::enfuseMain<vigra::UInt32>(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "INT32")  enblend::enfuseMain<vigra::Int32 >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "FLOAT")  enblend::enfuseMain<float >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
-            else if (pixelType == "DOUBLE") enblend::enfuseMain<double>(inputFileNameList, imageInfoList, outputImageInfo, inputUnion);
+            else if (pixelType == "UINT16") enblend::enfuseMain<vigra::UInt16>(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "INT16")  enblend::enfuseMain<vigra::Int16 >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "UINT32") enblend::enfuseMain<vigra::UInt32>(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "INT32")  enblend::enfuseMain<vigra::Int32 >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "FLOAT")  enblend::enfuseMain<float >(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
+            else if (pixelType == "DOUBLE") enblend::enfuseMain<double>(inputFileNameList, imageInfoList, outputImageInfo, inputUnion, fusionOptions);
 #endif
             else {
                 std::cerr << command
@@ -2592,6 +2991,13 @@ int main(int argc, char** argv)
         for (auto x : inputTraceableFileNameList) {
             delete x;
         }
+
+        if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+            enblend::PyramidPool::instance().report(std::cerr, command);
+        }
+    } catch (enblend::fatal_error& e) {
+        std::cerr << command << ": " << e.what() << std::endl;
+        exit(1);
     } catch (std::bad_alloc& e) {
         std::cerr << std::endl
                   << command << ": out of memory\n"
@@ -2606,22 +3012,84 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-#ifdef OPENCL
-    delete GPUContext;
-#endif // OPENCL
-
+    // The GPU context and the color transforms stay for the next
+    // job of a batch.
     if (FallbackProfile) {cmsCloseProfile(FallbackProfile);}
-    if (LabProfile) {cmsCloseProfile(LabProfile);}
-    if (InputToLabTransform) {cmsCIECAM02Done(InputToLabTransform);}
-    if (LabToInputTransform) {cmsCIECAM02Done(LabToInputTransform);}
-    if (CIECAMTransform) {cmsCIECAM02Done(CIECAMTransform);}
-    if (InputToXYZTransform) {cmsDeleteTransform(InputToXYZTransform);}
-    if (XYZToInputTransform) {cmsDeleteTransform(XYZToInputTransform);}
-    if (XYZProfile) {cmsCloseProfile(XYZProfile);}
     if (InputProfile) {cmsCloseProfile(InputProfile);}
+    FallbackProfile = InputProfile = nullptr;
 
     delete ExposureWeightFunction;
+    ExposureWeightFunction = nullptr;
 
     // Success.
     return 0;
 }
+
+
+// All global variables that a job may change, so that batch mode can
+// restore their values at start-up before each job.
+auto
+job_globals()
+{
+    return std::tie(OutputFileName, OutputMaskFileName, PreviewLevels, Verbose, ExactLevels,
+                    OneAtATime, WrapAround, GimpAssociatedAlphaHack, BlendColorspace,
+                    OutputSizeGiven, OutputWidthCmdLine, OutputHeightCmdLine,
+                    OutputOffsetXCmdLine, OutputOffsetYCmdLine, OutputCompression, OutputPixelType,
+                    WExposure, ExposureOptimum, ExposureWidth,
+                    ExposureWeightFunctionName, ExposureWeightFunctionArguments,
+                    ExposureLowerCutoff, ExposureUpperCutoff,
+                    ExposureLowerCutoffGrayscaleProjector, ExposureUpperCutoffGrayscaleProjector,
+                    WContrast, WSaturation, WEntropy, WSaturationIsDefault,
+                    ContrastWindowSize, GrayscaleProjector, FilterConfig, MinCurvature,
+                    EntropyWindowSize, EntropyLowerCutoff, EntropyUpperCutoff,
+                    UseHardMask, SaveMasks, StopAfterMaskGeneration, LoadMasks,
+                    SoftMaskTemplate, HardMaskTemplate,
+                    ImageResolution, OutputIsValid, UseGPU);
+}
+
+
+template <typename... T>
+std::tuple<T...>
+values_of(const std::tuple<T&...>& some_references)
+{
+    return std::tuple<T...>(some_references);
+}
+
+
+// Run the job ARGC/ARGV in a process that may have run other jobs
+// before, starting from the global state SOME_DEFAULTS.
+template <typename Tuple>
+int
+process_batch_job(const Tuple& some_defaults, int argc, char** argv)
+{
+    job_globals() = some_defaults;
+
+    delete ExposureWeightFunction;
+    ExposureWeightFunction = new exposure_weight::Gaussian(ExposureOptimum, ExposureWidth);
+
+    LayerSelection.set_selector(selector::find_by_id(selector::id_t::AllLayersId)->get());
+    InputHeaders.clear();
+    parameter::erase_all();
+
+    optind = 1;                 // reset parsing index
+
+    return process_job(argc, argv);
+}
+
+
+int main(int argc, char** argv)
+{
+    initialize_process();
+
+    enblend::batch::Arguments batch_arguments;
+    if (enblend::batch::find_manifest(argc, argv, &batch_arguments)) {
+        const auto defaults(values_of(job_globals()));
+        return enblend::batch::run(command, batch_arguments,
+                                   [&defaults](int job_argc, char** job_argv) {
+                                       return process_batch_job(defaults, job_argc, job_argv);
+                                   });
+    }
+
+    return enblend::batch::call(process_job, argv[0], batch_arguments.common);
+}
+#endif // ENFUSE_LIBRARY
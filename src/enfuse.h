@@ -25,10 +25,14 @@
 #include <config.h>
 #endif
 
+#include <functional>
 #include <iostream>
 #include <iomanip>
 #include <list>
 #include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 
 #include <vigra/flatmorphology.hxx>
 #include <vigra/functorexpression.hxx>
@@ -51,6 +55,7 @@
 #include "assemble.h"
 #include "blend.h"
 #include "bounds.h"
+#include "hardmask.h"
 #include "pyramid.h"
 #include "mga.h"
 
@@ -61,17 +66,70 @@ using vigra::functor::Param;
 
 
 namespace enblend {
-// Keep sum and sum-of-squares together for improved CPU-cache locality.
+
+// Running column statistics of the local-variance window.  Sums,
+// sums of squares, and pixel counts live in separate arrays, so that
+// the row updates sweep contiguous memory and the compiler can
+// vectorize them.
 template <typename T>
-struct ScratchPad {
-    ScratchPad() : sum(T()), sumSqr(T()), n(size_t()) {}
+struct ColumnSums {
+    explicit ColumnSums(size_t size) : sum(size), sumSqr(size), n(size) {}
 
-    T sum;
-    T sumSqr;
-    size_t n;
+    void clear() {
+        std::fill(sum.begin(), sum.end(), T());
+        std::fill(sumSqr.begin(), sumSqr.end(), T());
+        std::fill(n.begin(), n.end(), T());
+    }
+
+    std::vector<T> sum;
+    std::vector<T> sumSqr;
+    std::vector<T> n;           // pixel counts as T to keep the update loops homogeneous
 };
 
 
+// Collect the masked contributions of one image row.
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          typename T>
+inline static void
+localStdDevRowContribution(SrcIterator src, SrcAccessor src_acc,
+                           MaskIterator mask, MaskAccessor mask_acc,
+                           ColumnSums<T>& row)
+{
+    const size_t width = row.sum.size();
+    for (size_t x = 0; x != width; ++x, ++src.x, ++mask.x)
+    {
+        if (mask_acc(mask))
+        {
+            const T value = src_acc(src);
+            row.sum[x] = value;
+            row.sumSqr[x] = square(value);
+            row.n[x] = T(1);
+        }
+        else
+        {
+            row.sum[x] = T();
+            row.sumSqr[x] = T();
+            row.n[x] = T();
+        }
+    }
+}
+
+
+// Compute the standard deviation of all pixels inside a window of
+// SIZE centered at each pixel that passes MASK.  Pixels outside the
+// mask neither contribute nor receive a result.
+//
+// PERFORMANCE: The statistics of the window are a summed-area table
+// in disguise.  The vertical difference of the table, i.e. the
+// column sums over the window's height, is carried from row to row
+// by adding the entering and subtracting the leaving image row; the
+// horizontal difference is a running sum along the row.  Thus each
+// pixel costs O(1) regardless of the window size.  In contrast to a
+// full-size table, the sums never grow beyond the window's contents,
+// which keeps them exact for all integral pixel types and avoids the
+// cancellation in "sumSqr - sum^2 / n" for huge images.  Each thread
+// works on its own band of rows and seeds its column sums once.
 template <class SrcIterator, class SrcAccessor,
           class MaskIterator, class MaskAccessor,
           class DestIterator, class DestAccessor>
@@ -82,9 +140,7 @@ void localStdDevIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
 {
     typedef typename vigra::NumericTraits<typename SrcAccessor::value_type>::RealPromote SrcSumType;
     typedef vigra::NumericTraits<typename DestAccessor::value_type> DestTraits;
-    typedef ScratchPad<SrcSumType> ScratchPadType;
-    typedef std::vector<ScratchPadType> ScratchPadArray;
-    typedef typename ScratchPadArray::iterator ScratchPadArrayIterator;
+    typedef ColumnSums<SrcSumType> ColumnSumsType;
 
     vigra_precondition(size.x > 1 && size.y > 1,
                        "localStdDevIf(): window for local variance must be at least 2x2");
@@ -93,127 +149,107 @@ void localStdDevIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
                        "localStdDevIf(): window larger than image");
 
     const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
-    ScratchPadArray scratchPad(imageSize.x + 1);
-
     const vigra::Diff2D border(size.x / 2, size.y / 2);
-    const vigra::Diff2D nextUpperRight(size.x / 2 + 1, -size.y / 2);
+    const int windowWidth = 2 * border.x + 1;
+    const int windowHeight = 2 * border.y + 1;
+    const int rows = imageSize.y - 2 * border.y;
+    const int columns = imageSize.x - 2 * border.x;
+    if (rows <= 0 || columns <= 0)
+    {
+        return;                 // an even window may not fit
+    }
 
-    SrcIterator const srcEnd(src_lr - border);
-    SrcIterator const srcEndXm1(srcEnd - vigra::Diff2D(1, 0));
+    const int bands = std::max(1, std::min(rows, omp_get_max_threads()));
 
-    // For each row in the source image...
 #ifdef OPENMP
-#pragma omp parallel for firstprivate (scratchPad)
+#pragma omp parallel for schedule(static)
 #endif
-    for (int row = 0; row < imageSize.y - 2 * border.y; ++row)
+    for (int band = 0; band < bands; ++band)
     {
-        SrcIterator srcRow(src_ul + border + vigra::Diff2D(0, row));
-        MaskIterator maskRow(mask_ul + border + vigra::Diff2D(0, row));
-        DestIterator destRow(dest_ul + border + vigra::Diff2D(0, row));
-
-        // Row's running values
-        SrcSumType sum = vigra::NumericTraits<SrcSumType>::zero();
-        SrcSumType sumSqr = vigra::NumericTraits<SrcSumType>::zero();
-        size_t n = 0;
-
-        SrcIterator const windowSrcUpperLeft(srcRow - border);
-        SrcIterator const windowSrcLowerRight(srcRow + border);
-        SrcIterator windowSrc;
-        MaskIterator const windowMaskUpperLeft(maskRow - border);
-        MaskIterator windowMask;
-        ScratchPadArrayIterator spCol;
-
-        // Initialize running-sums of this row
-        for (windowSrc = windowSrcUpperLeft, windowMask = windowMaskUpperLeft,
-                 spCol = scratchPad.begin();
-             windowSrc.x <= windowSrcLowerRight.x;
-             ++windowSrc.x, ++windowMask.x, ++spCol)
+        const int rowBegin = band * rows / bands;
+        const int rowEnd = (band + 1) * rows / bands;
+
+        if (rowBegin == rowEnd)
         {
-            SrcSumType sumInit = vigra::NumericTraits<SrcSumType>::zero();
-            SrcSumType sumSqrInit = vigra::NumericTraits<SrcSumType>::zero();
-            size_t nInit = 0;
+            continue;           // seeding would read past the last row
+        }
+
+        ColumnSumsType window(imageSize.x);
+        ColumnSumsType entering(imageSize.x);
+        ColumnSumsType leaving(imageSize.x);
 
-            for (windowSrc.y = windowSrcUpperLeft.y, windowMask.y = windowMaskUpperLeft.y;
-                 windowSrc.y <= windowSrcLowerRight.y;
-                 ++windowSrc.y, ++windowMask.y)
+        // Seed the column sums with the window of the band's first row.
+        window.clear();
+        for (int y = rowBegin; y != rowBegin + windowHeight; ++y)
+        {
+            localStdDevRowContribution(src_ul + vigra::Diff2D(0, y), src_acc,
+                                       mask_ul + vigra::Diff2D(0, y), mask_acc,
+                                       entering);
+            for (int x = 0; x < imageSize.x; ++x)
             {
-                if (mask_acc(windowMask))
-                {
-                    const SrcSumType value = src_acc(windowSrc);
-                    sumInit += value;
-                    sumSqrInit += square(value);
-                    ++nInit;
-                }
+                window.sum[x] += entering.sum[x];
+                window.sumSqr[x] += entering.sumSqr[x];
+                window.n[x] += entering.n[x];
             }
-
-            // Set scratch pad's column-wise values
-            spCol->sum = sumInit;
-            spCol->sumSqr = sumSqrInit;
-            spCol->n = nInit;
-
-            // Update totals
-            sum += sumInit;
-            sumSqr += sumSqrInit;
-            n += nInit;
         }
 
-        // Write one row of results
-        SrcIterator srcCol(srcRow);
-        MaskIterator maskCol(maskRow);
-        DestIterator destCol(destRow);
-        ScratchPadArrayIterator old(scratchPad.begin());
-        ScratchPadArrayIterator next(scratchPad.begin() + size.x);
-
-        while (true)
+        for (int row = rowBegin; row != rowEnd; ++row)
         {
-            // Compute standard deviation
-            if (mask_acc(maskCol))
+            // Write one row of results
+            SrcSumType sum = vigra::NumericTraits<SrcSumType>::zero();
+            SrcSumType sumSqr = vigra::NumericTraits<SrcSumType>::zero();
+            SrcSumType n = vigra::NumericTraits<SrcSumType>::zero();
+            for (int x = 0; x != windowWidth; ++x)
             {
-                const SrcSumType result =
-                    n <= 1 ?
-                    vigra::NumericTraits<SrcSumType>::zero() :
-                    sqrt((sumSqr - square(sum) / n) / (n - 1));
-                dest_acc.set(DestTraits::fromRealPromote(result), destCol);
+                sum += window.sum[x];
+                sumSqr += window.sumSqr[x];
+                n += window.n[x];
             }
-            if (srcCol.x == srcEndXm1.x)
+
+            MaskIterator maskCol(mask_ul + border + vigra::Diff2D(0, row));
+            DestIterator destCol(dest_ul + border + vigra::Diff2D(0, row));
+            for (int column = 0; column != columns; ++column, ++maskCol.x, ++destCol.x)
             {
-                break;
-            }
+                if (mask_acc(maskCol))
+                {
+                    const SrcSumType variance =
+                        n <= SrcSumType(1) ?
+                        vigra::NumericTraits<SrcSumType>::zero() :
+                        (sumSqr - square(sum) / n) / (n - SrcSumType(1));
+                    // Rounding can push the variance of a flat window
+                    // slightly below zero.
+                    const SrcSumType result =
+                        variance > vigra::NumericTraits<SrcSumType>::zero() ?
+                        sqrt(variance) :
+                        vigra::NumericTraits<SrcSumType>::zero();
+                    dest_acc.set(DestTraits::fromRealPromote(result), destCol);
+                }
 
-            // Compute auxiliary values of next column
-            SrcSumType sumInit = vigra::NumericTraits<SrcSumType>::zero();
-            SrcSumType sumSqrInit = vigra::NumericTraits<SrcSumType>::zero();
-            size_t nInit = 0;
+                if (column + 1 != columns)
+                {
+                    const int next = column + windowWidth;
+                    sum += window.sum[next] - window.sum[column];
+                    sumSqr += window.sumSqr[next] - window.sumSqr[column];
+                    n += window.n[next] - window.n[column];
+                }
+            }
 
-            for (windowSrc = srcCol + nextUpperRight, windowMask = maskCol + nextUpperRight;
-                 windowSrc.y <= windowSrcLowerRight.y;
-                 ++windowSrc.y, ++windowMask.y)
+            // Slide the column sums down by one row.
+            if (row + 1 != rowEnd)
             {
-                if (mask_acc(windowMask))
+                localStdDevRowContribution(src_ul + vigra::Diff2D(0, row + windowHeight), src_acc,
+                                           mask_ul + vigra::Diff2D(0, row + windowHeight), mask_acc,
+                                           entering);
+                localStdDevRowContribution(src_ul + vigra::Diff2D(0, row), src_acc,
+                                           mask_ul + vigra::Diff2D(0, row), mask_acc,
+                                           leaving);
+                for (int x = 0; x < imageSize.x; ++x)
                 {
-                    const SrcSumType value = src_acc(windowSrc);
-                    sumInit += value;
-                    sumSqrInit += square(value);
-                    ++nInit;
+                    window.sum[x] += entering.sum[x] - leaving.sum[x];
+                    window.sumSqr[x] += entering.sumSqr[x] - leaving.sumSqr[x];
+                    window.n[x] += entering.n[x] - leaving.n[x];
                 }
             }
-
-            // Set sums of next column
-            next->sum = sumInit;
-            next->sumSqr = sumSqrInit;
-            next->n = nInit;
-
-            // Update totals
-            sum += sumInit - old->sum;
-            sumSqr += sumSqrInit - old->sumSqr;
-            n += nInit - old->n;
-
-            // Advance to next column
-            ++srcCol.x;
-            ++maskCol.x;
-            ++destCol.x;
-            ++old;
-            ++next;
         }
     }
 }
@@ -620,6 +656,47 @@ protected:
 };
 
 
+// Weight the pyramid level anImageLevel with aMaskLevel like
+// ImageMaskMultiplyFunctor and add the product to aResultLevel, all
+// in a single sweep.  If aResultLevel is anImageLevel itself, just
+// weight it in place.
+template <typename ImagePyramidType, typename MaskPyramidType>
+void
+accumulateWeightedLevel(const ImagePyramidType& anImageLevel,
+                        const MaskPyramidType& aMaskLevel,
+                        typename MaskPyramidType::value_type aMaxMaskValue,
+                        ImagePyramidType& aResultLevel)
+{
+    typedef typename MaskPyramidType::value_type MaskPyramidPixelType;
+
+    const ImageMaskMultiplyFunctor<MaskPyramidPixelType> multiply(aMaxMaskValue);
+    const bool inPlace = &anImageLevel == &aResultLevel;
+    const int width = anImageLevel.width();
+    const typename ImagePyramidType::ConstAccessor ia(anImageLevel.accessor());
+    const typename MaskPyramidType::ConstAccessor ma(aMaskLevel.accessor());
+    typename ImagePyramidType::Accessor ra(aResultLevel.accessor());
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < anImageLevel.height(); ++y) {
+        typename ImagePyramidType::const_traverser i(anImageLevel.upperLeft() + vigra::Diff2D(0, y));
+        typename MaskPyramidType::const_traverser m(aMaskLevel.upperLeft() + vigra::Diff2D(0, y));
+        typename ImagePyramidType::traverser r(aResultLevel.upperLeft() + vigra::Diff2D(0, y));
+
+        if (inPlace) {
+            for (int x = 0; x < width; ++x, ++i.x, ++m.x, ++r.x) {
+                ra.set(multiply(ia(i), ma(m)), r);
+            }
+        } else {
+            for (int x = 0; x < width; ++x, ++i.x, ++m.x, ++r.x) {
+                ra.set(multiply(ia(i), ma(m)) + ra(r), r);
+            }
+        }
+    }
+}
+
+
 template <typename InputType, typename InputAccessor, typename ResultType>
 class ExposureFunctor : public std::unary_function<InputType, ResultType> {
 public:
@@ -667,21 +744,20 @@ public:
         const value_type max = vigra::NumericTraits<value_type>::max();
 
         if (lower_cutoff_ < value_type()) {
-            std::cerr << command << ": negative lower exposure cutoff" << std::endl;
-            exit(1);
+            throw fatal_error("negative lower exposure cutoff");
         }
         if (upper_cutoff_ < value_type()) {
-            std::cerr << command << ": negative upper exposure cutoff" << std::endl;
-            exit(1);
+            throw fatal_error("negative upper exposure cutoff");
         }
         if (lower_cutoff_ > upper_cutoff_) {
-            std::cerr << command <<
-                ": lower exposure cutoff (" << lower_cutoff_ << "/" << max <<
+            std::ostringstream message;
+            message <<
+                "lower exposure cutoff (" << lower_cutoff_ << "/" << max <<
                 " = " << 100.0 * lower_cutoff_ / max <<
                 "%) exceeds upper cutoff (" << upper_cutoff_ << "/" << max <<
                 " = " << 100.0 * upper_cutoff_ / max <<
-                "%)" << std::endl;
-            exit(1);
+                "%)";
+            throw fatal_error(message.str());
         }
     }
 
@@ -959,10 +1035,65 @@ private:
 };
 
 
+/** Configuration of one fusion.  enfuseMain() and the functions it
+ *  calls take their settings from here instead of the process-wide
+ *  variables of the command-line tool, so that fusions with different
+ *  options can run side by side in one process.  The defaults are
+ *  those of the command-line tool.
+ */
+struct FusionOptions
+{
+    double exposureWeight = 1.0;
+    double saturationWeight = 0.0;
+    double contrastWeight = 0.0;
+    double entropyWeight = 0.0;
+    ExposureWeight* exposureWeightFunction = nullptr; // not owned; required if exposureWeight > 0
+    AlternativePercentage exposureLowerCutoff {0.0, true};
+    CompactifiedAlternativePercentage exposureUpperCutoff {100.0, true};
+    std::string exposureLowerCutoffProjector {"anti-value"};
+    std::string exposureUpperCutoffProjector {"value"};
+    std::string grayscaleProjector;
+    int contrastWindowSize = 5;
+    EdgeFilterConfiguration edgeFilter {0.0, 0.0, 0.0};
+    AlternativePercentage minCurvature {0.0, false};
+    int entropyWindowSize = 3;
+    AlternativePercentage entropyLowerCutoff {0.0, true};
+    CompactifiedAlternativePercentage entropyUpperCutoff {100.0, true};
+    bool useHardMask = false;
+    bool loadMasks = false;
+    bool saveMasks = false;
+    bool stopAfterMaskGeneration = false;
+    std::string softMaskTemplate {"softmask-%n.tif"};
+    std::string hardMaskTemplate {"hardmask-%n.tif"};
+    std::string outputFileName;     // only for mask filenames and the meta-data of file output
+    TiffResolution resolution;      // of saved masks
+    boundary_t wrapAround = OpenBoundaries;
+    int exactLevels = 0;            // 0 means: automatically calculate maximum
+};
+
+
+/** Delete a pyramid together with all of its levels. */
+template <typename ImageType>
+struct PyramidDeleter
+{
+    void operator()(std::vector<ImageType*>* aPyramid) const
+    {
+        for (auto level : *aPyramid) {
+            delete level;
+        }
+        delete aPyramid;
+    }
+};
+
+template <typename ImageType>
+using PyramidPtr = std::unique_ptr<std::vector<ImageType*>, PyramidDeleter<ImageType> >;
+
+
 template <typename ImageType, typename AlphaType, typename MaskType>
 void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename ImageType::const_traverser, typename ImageType::ConstAccessor> src,
                 vigra::pair<typename AlphaType::const_traverser, typename AlphaType::ConstAccessor> mask,
-                vigra::pair<typename MaskType::traverser, typename MaskType::Accessor> result) {
+                vigra::pair<typename MaskType::traverser, typename MaskType::Accessor> result,
+                const FusionOptions& someOptions) {
     typedef typename ImageType::value_type ImageValueType;
     typedef typename ImageType::PixelType PixelType;
     typedef typename vigra::NumericTraits<PixelType>::ValueType ScalarType;
@@ -971,80 +1102,91 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
     const typename ImageType::difference_type imageSize = src.second - src.first;
 
     // Exposure
-    if (WExposure > 0.0) {
+    if (someOptions.exposureWeight > 0.0) {
         typedef MultiGrayscaleAccessor<ImageValueType, ScalarType> MultiGrayAcc;
-        MultiGrayAcc ga(GrayscaleProjector);
-
-        if (ExposureLowerCutoff.is_effective<ScalarType>() ||
-            ExposureUpperCutoff.is_effective<ScalarType>()) {
-            MultiGrayAcc lca(ExposureLowerCutoffGrayscaleProjector.empty() ?
-                             GrayscaleProjector :
-                             ExposureLowerCutoffGrayscaleProjector);
-            MultiGrayAcc uca(ExposureUpperCutoffGrayscaleProjector.empty() ?
-                             ExposureLowerCutoffGrayscaleProjector :
-                             ExposureUpperCutoffGrayscaleProjector);
+        MultiGrayAcc ga(someOptions.grayscaleProjector);
+
+        if (someOptions.exposureLowerCutoff.is_effective<ScalarType>() ||
+            someOptions.exposureUpperCutoff.is_effective<ScalarType>()) {
+            MultiGrayAcc lca(someOptions.exposureLowerCutoffProjector.empty() ?
+                             someOptions.grayscaleProjector :
+                             someOptions.exposureLowerCutoffProjector);
+            MultiGrayAcc uca(someOptions.exposureUpperCutoffProjector.empty() ?
+                             someOptions.exposureLowerCutoffProjector :
+                             someOptions.exposureUpperCutoffProjector);
             CutoffExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
-                cef(WExposure, ExposureWeightFunction, ga,
-                    ExposureLowerCutoff, ExposureUpperCutoff, lca, uca);
+                cef(someOptions.exposureWeight, someOptions.exposureWeightFunction, ga,
+                    someOptions.exposureLowerCutoff, someOptions.exposureUpperCutoff, lca, uca);
 #ifdef DEBUG_EXPOSURE
             std::cout << "+ enfuseMask: cutoff - GrayscaleProjector = <" <<
-                GrayscaleProjector << ">\n" <<
+                someOptions.grayscaleProjector << ">\n" <<
                 "+ enfuseMask: ExposureLowerCutoffGrayscaleProjector = <" <<
-                ExposureLowerCutoffGrayscaleProjector << ">, cutoff spec = " << ExposureLowerCutoff.str() <<
-                ", actual cutoff = " << static_cast<double>(ExposureLowerCutoff.instantiate<ScalarType>()) <<
+                someOptions.exposureLowerCutoffProjector << ">, cutoff spec = " << someOptions.exposureLowerCutoff.str() <<
+                ", actual cutoff = " << static_cast<double>(someOptions.exposureLowerCutoff.instantiate<ScalarType>()) <<
                 "\n+ enfuseMask: ExposureUpperCutoffGrayscaleProjector = <" <<
-                ExposureUpperCutoffGrayscaleProjector << ">, cutoff spec = " << ExposureUpperCutoff.str() <<
-                ", actual cutoff = " << static_cast<double>(ExposureUpperCutoff.instantiate<ScalarType>()) <<
+                someOptions.exposureUpperCutoffProjector << ">, cutoff spec = " << someOptions.exposureUpperCutoff.str() <<
+                ", actual cutoff = " << static_cast<double>(someOptions.exposureUpperCutoff.instantiate<ScalarType>()) <<
                 "\n";
 #endif
             vigra::omp::transformImageIf(src, mask, result, cef);
         } else {
-            ExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
-                ef(WExposure, ExposureWeightFunction, ga);
 #ifdef DEBUG_EXPOSURE
             std::cout << "+ enfuseMask: plain - GrayscaleProjector = <" <<
-                GrayscaleProjector << ">\n";
+                someOptions.grayscaleProjector << ">\n";
 #endif
-            vigra::omp::transformImageIf(src, mask, result, ef);
+            ga.dispatch([&](const auto& projector) {
+                    typedef typename std::decay<decltype(projector)>::type ProjectingAcc;
+                    ExposureFunctor<ImageValueType, ProjectingAcc, MaskValueType>
+                        ef(someOptions.exposureWeight, someOptions.exposureWeightFunction, projector);
+                    vigra::omp::transformImageIf(src, mask, result, ef);
+                });
         }
     }
 
     // Contrast
-    if (WContrast > 0.0) {
+    if (someOptions.contrastWeight > 0.0) {
         typedef typename vigra::NumericTraits<ScalarType>::Promote LongScalarType;
         typedef IMAGETYPE<LongScalarType> GradImage;
 
         GradImage grad(imageSize);
-        MultiGrayscaleAccessor<PixelType, LongScalarType> ga(GrayscaleProjector);
 
-        if (FilterConfig.edgeScale > 0.0)
+        // Project onto grayscale once.  All filters below read the
+        // projected image several times per pixel.
+        GradImage gray(imageSize);
+        MultiGrayscaleAccessor<PixelType, LongScalarType>(someOptions.grayscaleProjector).dispatch
+            ([&](const auto& projector) {
+                vigra::omp::copyImage(src.first, src.second, projector,
+                                      gray.upperLeft(), gray.accessor());
+            });
+
+        if (someOptions.edgeFilter.edgeScale > 0.0)
         {
 #ifdef DEBUG_LOG
             std::cout << "+ Laplacian Edge Detection, scale = "
-                      << FilterConfig.edgeScale << " pixels" << std::endl;
+                      << someOptions.edgeFilter.edgeScale << " pixels" << std::endl;
 #endif
             GradImage laplacian(imageSize);
 
-            if (FilterConfig.lceScale > 0.0)
+            if (someOptions.edgeFilter.lceScale > 0.0)
             {
 #ifdef DEBUG_LOG
                 std::cout << "+ Local Contrast Enhancement, (scale, amount) = "
-                          << FilterConfig.lceScale << " pixels, "
-                          << (100.0 * FilterConfig.lceFactor) << "%" << std::endl;
+                          << someOptions.edgeFilter.lceScale << " pixels, "
+                          << (100.0 * someOptions.edgeFilter.lceFactor) << "%" << std::endl;
 #endif
                 GradImage lce(imageSize);
-                vigra::gaussianSharpening(src.first, src.second, ga,
+                vigra::gaussianSharpening(gray.upperLeft(), gray.lowerRight(), gray.accessor(),
                                           lce.upperLeft(), lce.accessor(),
-                                          FilterConfig.lceFactor, FilterConfig.lceScale);
+                                          someOptions.edgeFilter.lceFactor, someOptions.edgeFilter.lceScale);
                 vigra::laplacianOfGaussian(lce.upperLeft(), lce.lowerRight(), lce.accessor(),
                                            laplacian.upperLeft(), MagnitudeAccessor<LongScalarType>(),
-                                           FilterConfig.edgeScale);
+                                           someOptions.edgeFilter.edgeScale);
             }
             else
             {
-                vigra::laplacianOfGaussian(src.first, src.second, ga,
+                vigra::laplacianOfGaussian(gray.upperLeft(), gray.lowerRight(), gray.accessor(),
                                            laplacian.upperLeft(), MagnitudeAccessor<LongScalarType>(),
-                                           FilterConfig.edgeScale);
+                                           someOptions.edgeFilter.edgeScale);
             }
 
 #ifdef DEBUG_LOG
@@ -1056,7 +1198,7 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
             }
 #endif
 
-            const double minCurve = static_cast<double>(MinCurvature.instantiate<ScalarType>());
+            const double minCurve = static_cast<double>(someOptions.minCurvature.instantiate<ScalarType>());
             if (minCurve <= 0.0)
             {
 #ifdef DEBUG_LOG
@@ -1075,11 +1217,10 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
                 std::cout << "+ merge local contrast and edges - switch at " << minCurve << std::endl;
 #endif
                 GradImage localContrast(imageSize);
-                // TODO: use localStdDev
-                localStdDevIf(src.first, src.second, ga,
+                localStdDevIf(gray.upperLeft(), gray.lowerRight(), gray.accessor(),
                               mask.first, mask.second,
                               localContrast.upperLeft(), localContrast.accessor(),
-                              vigra::Size2D(ContrastWindowSize, ContrastWindowSize));
+                              vigra::Size2D(someOptions.contrastWindowSize, someOptions.contrastWindowSize));
 
                 vigra::omp::combineTwoImagesIf(laplacian.upperLeft(), laplacian.lowerRight(), laplacian.accessor(),
                                                localContrast.upperLeft(), localContrast.accessor(),
@@ -1096,10 +1237,10 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
 #ifdef DEBUG_LOG
             std::cout << "+ Variance of Local Contrast" << std::endl;
 #endif
-            localStdDevIf(src.first, src.second, ga,
+            localStdDevIf(gray.upperLeft(), gray.lowerRight(), gray.accessor(),
                           mask.first, mask.second,
                           grad.upperLeft(), grad.accessor(),
-                          vigra::Size2D(ContrastWindowSize, ContrastWindowSize));
+                          vigra::Size2D(someOptions.contrastWindowSize, someOptions.contrastWindowSize));
         }
 
 #ifdef DEBUG_LOG
@@ -1109,7 +1250,7 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
             std::cout << "+ final grad: min = " << minmax.min << ", max = " << minmax.max << std::endl;
         }
 #endif
-        ContrastFunctor<LongScalarType, ScalarType, MaskValueType> cf(WContrast);
+        ContrastFunctor<LongScalarType, ScalarType, MaskValueType> cf(someOptions.contrastWeight);
 #if defined(__clang__)
         vigra::omp::combineTwoImagesIf(srcImageRange(grad), result, mask, result,
                                        std::bind(std::plus<MaskValueType>(),
@@ -1122,8 +1263,8 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
     }
 
     // Saturation
-    if (WSaturation > 0.0) {
-        SaturationFunctor<ImageValueType, MaskValueType> sf(WSaturation);
+    if (someOptions.saturationWeight > 0.0) {
+        SaturationFunctor<ImageValueType, MaskValueType> sf(someOptions.saturationWeight);
 #if defined(__clang__)
         vigra::omp::combineTwoImagesIf(src, result, mask, result,
                                        std::bind(std::plus<MaskValueType>(),
@@ -1136,44 +1277,44 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
     }
 
     // Entropy
-    if (WEntropy > 0.0) {
+    if (someOptions.entropyWeight > 0.0) {
         typedef typename ImageType::PixelType PixelType;
         typedef typename vigra::NumericTraits<PixelType>::ValueType ScalarType;
         typedef IMAGETYPE<PixelType> Image;
         Image entropy(imageSize);
 
-        if (EntropyLowerCutoff.is_effective<ScalarType>() || EntropyUpperCutoff.is_effective<ScalarType>())
+        if (someOptions.entropyLowerCutoff.is_effective<ScalarType>() ||
+            someOptions.entropyUpperCutoff.is_effective<ScalarType>())
         {
-            const ScalarType lowerCutoff = EntropyLowerCutoff.instantiate<ScalarType>();
-            const ScalarType upperCutoff = EntropyUpperCutoff.instantiate<ScalarType>();
+            const ScalarType lowerCutoff = someOptions.entropyLowerCutoff.instantiate<ScalarType>();
+            const ScalarType upperCutoff = someOptions.entropyUpperCutoff.instantiate<ScalarType>();
 #ifdef DEBUG_ENTROPY
             std::cout <<
-                "+ EntropyLowerCutoff.value = " << EntropyLowerCutoff.value() << ", " <<
+                "+ EntropyLowerCutoff.value = " << someOptions.entropyLowerCutoff.value() << ", " <<
                 "lowerCutoff = " << static_cast<double>(lowerCutoff) << "\n" <<
-                "+ EntropyUpperCutoff.value = " << EntropyUpperCutoff.value() << ", " <<
+                "+ EntropyUpperCutoff.value = " << someOptions.entropyUpperCutoff.value() << ", " <<
                 "upperCutoff = " << static_cast<double>(upperCutoff) << std::endl;
 #endif
 
             if (lowerCutoff < ScalarType())
             {
-                std::cerr << command << ": negative lower entropy cutoff" << std::endl;
-                exit(1);
+                throw fatal_error("negative lower entropy cutoff");
             }
             if (upperCutoff < ScalarType())
             {
-                std::cerr << command << ": negative upper entropy cutoff" << std::endl;
-                exit(1);
+                throw fatal_error("negative upper entropy cutoff");
             }
             if (lowerCutoff > upperCutoff)
             {
                 const double max = static_cast<double>(vigra::NumericTraits<ScalarType>::max());
-                std::cerr << command <<
-                    ": lower entropy cutoff (" << static_cast<double>(lowerCutoff) << "/" << max <<
+                std::ostringstream message;
+                message <<
+                    "lower entropy cutoff (" << static_cast<double>(lowerCutoff) << "/" << max <<
                     " = " << 100.0 * lowerCutoff / max <<
                     "%) exceeds upper cutoff (" << static_cast<double>(upperCutoff) << "/" << max <<
                     " = " << 100.0 * upperCutoff / max <<
-                    "%)" << std::endl;
-                exit(1);
+                    "%)";
+                throw fatal_error(message.str());
             }
 
             Image trunc(imageSize);
@@ -1188,17 +1329,17 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
             localEntropyIf(trunc.upperLeft(), trunc.lowerRight(), trunc.accessor(),
                            mask.first, mask.second,
                            entropy.upperLeft(), entropy.accessor(),
-                           vigra::Size2D(EntropyWindowSize, EntropyWindowSize));
+                           vigra::Size2D(someOptions.entropyWindowSize, someOptions.entropyWindowSize));
         }
         else
         {
             localEntropyIf(src.first, src.second, src.third,
                            mask.first, mask.second,
                            entropy.upperLeft(), entropy.accessor(),
-                           vigra::Size2D(EntropyWindowSize, EntropyWindowSize));
+                           vigra::Size2D(someOptions.entropyWindowSize, someOptions.entropyWindowSize));
         }
 
-        EntropyFunctor<PixelType, MaskValueType> ef(WEntropy);
+        EntropyFunctor<PixelType, MaskValueType> ef(someOptions.entropyWeight);
 #if defined(__clang__)
         vigra::omp::combineTwoImagesIf(srcImageRange(entropy), result, mask, result,
                                        std::bind(std::plus<MaskValueType>(),
@@ -1212,15 +1353,103 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
 }
 
 
+/** Compute the weights of an image for all numLevels levels of its
+ *  pyramids without a full-resolution mask per image.  The weights of
+ *  the finest pointwiseLevels levels are evaluated on the Gaussian
+ *  pyramid of the image itself; each coarser level is the Gaussian
+ *  reduction of the level above it.  Level 0 always gets the complete
+ *  weight function, i.e., including contrast and entropy.
+ */
+template <typename ImageType, typename AlphaType, typename MaskType,
+          typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType>
+PyramidPtr<MaskType>
+enfuseWeightPyramid(unsigned numLevels, unsigned pointwiseLevels, bool wraparound,
+                    const ImageType& image, const AlphaType& alpha,
+                    const FusionOptions& someOptions)
+{
+    PyramidPtr<MaskType> weights(new std::vector<MaskType*>);
+    weights->reserve(std::max(numLevels, 1U));
+
+    std::unique_ptr<MaskType> weight(new MaskType(image.size()));
+    enfuseMask<ImageType, AlphaType, MaskType>(srcImageRange(image), srcImage(alpha), destImage(*weight),
+                                               someOptions);
+    weights->push_back(weight.release());
+
+    std::unique_ptr<ImageType> levelImage;
+    std::unique_ptr<AlphaType> levelAlpha;
+    const ImageType* lastImage = &image;
+    const AlphaType* lastAlpha = &alpha;
+
+    for (unsigned l = 1U; l < numLevels; ++l) {
+        const int width = (lastAlpha->width() + 1) >> 1;
+        const int height = (lastAlpha->height() + 1) >> 1;
+        std::unique_ptr<AlphaType> nextAlpha(new AlphaType(width, height));
+        weight.reset(new MaskType(width, height));
+
+        if (l < pointwiseLevels) {
+            std::unique_ptr<ImageType> nextImage(new ImageType(width, height));
+            reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                               srcImageRange(*lastImage), maskImage(*lastAlpha),
+                                                               destImageRange(*nextImage), destImageRange(*nextAlpha));
+            enfuseMask<ImageType, AlphaType, MaskType>(srcImageRange(*nextImage),
+                                                       srcImage(*nextAlpha),
+                                                       destImage(*weight),
+                                                       someOptions);
+            levelImage.swap(nextImage);
+            lastImage = levelImage.get();
+        } else {
+            levelImage.reset();
+            reduce<double, SKIPSMAlphaPixelType>(wraparound,
+                                                 srcImageRange(*weights->back()), maskImage(*lastAlpha),
+                                                 destImageRange(*weight), destImageRange(*nextAlpha));
+        }
+
+        weights->push_back(weight.release());
+        levelAlpha.swap(nextAlpha);
+        lastAlpha = levelAlpha.get();
+    }
+
+    return weights;
+}
+
+
+/** In-memory replacement of the input files and the output file of
+ *  enfuseMain().  The library interface hands in the input images one
+ *  by one and takes the collapsed result pyramid, so no image passes
+ *  through an encoder or a decoder. */
+template <typename ImagePixelType>
+struct EnfuseMemoryIO
+{
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePyramidType ImagePyramidType;
+
+    unsigned numberOfImages;
+
+    // Answer the next input image and its alpha channel, both of the
+    // size of the input union, and set the bounding box of the image.
+    std::function<std::pair<ImageType*, AlphaType*>(vigra::Rect2D&)> nextImage;
+
+    // Take level zero of the collapsed result pyramid and the union
+    // of the input alpha channels.
+    std::function<void(const ImagePyramidType&, const AlphaType&)> writeOutput;
+};
+
+
 /** Enfuse's main blending loop. Templatized to handle different image types.
+ *  With aMemoryIO the input images and the output come from and go to
+ *  memory instead of the files in anImageInfoList and anOutputImageInfo.
+ *  If someOptions ask to stop after the masks have been generated, the
+ *  function returns without blending.
  */
 template <typename ImagePixelType>
 void enfuseMain(const FileNameList& anInputFileNameList,
                 const std::list<vigra::ImageImportInfo*>& anImageInfoList,
                 vigra::ImageExportInfo& anOutputImageInfo,
-                vigra::Rect2D& anInputUnion)
+                vigra::Rect2D& anInputUnion,
+                const FusionOptions& someOptions,
+                const EnfuseMemoryIO<ImagePixelType>* aMemoryIO = nullptr)
 {
-    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType ImagePixelComponentType;
     typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
     typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
     typedef IMAGETYPE<float> MaskType;
@@ -1238,18 +1467,76 @@ void enfuseMain(const FileNameList& anInputFileNameList,
     typedef typename EnblendNumericTraits<ImagePixelType>::SKIPSMMaskPixelType SKIPSMMaskPixelType;
 
     // List of input image / input alpha / mask triples
-    typedef std::list< vigra::triple<ImageType*, AlphaType*, MaskType*> > imageListType;
+    struct InputTriple
+    {
+        std::unique_ptr<ImageType> image;
+        std::unique_ptr<AlphaType> alpha;
+        std::unique_ptr<MaskType> mask;
+    };
+    typedef std::list<InputTriple> imageListType;
     typedef typename imageListType::iterator imageListIteratorType;
     imageListType imageList;
 
-    // Sum of all masks
-    MaskType *normImage = new MaskType(anInputUnion.size());
+    // Coarse-to-fine weights replace the full-resolution mask of each
+    // image by a pyramid of weights that gets computed twice: once for
+    // the norm and once for the blend.  Masks that are loaded, saved,
+    // or hardened need the full-resolution masks.
+    const int coarseToFineLevels = parameter::as_integer("coarse-to-fine-weights", 0); //< coarse-to-fine-weights 0
+    const bool isCoarseToFine =
+        coarseToFineLevels > 0 &&
+        !someOptions.useHardMask && !someOptions.loadMasks && !someOptions.saveMasks &&
+        !someOptions.stopAfterMaskGeneration;
+    if (coarseToFineLevels > 0 && !isCoarseToFine) {
+        std::cerr << command
+                  << ": warning: coarse-to-fine weights do not work with hard masks or\n"
+                  << command
+                  << ": warning:     loading or saving masks; computing weights at full resolution"
+                  << std::endl;
+    }
+
+    vigra::Rect2D junkBB;
+    const unsigned int numLevels =
+        roiBounds<ImagePixelType>(anInputUnion, anInputUnion, anInputUnion, anInputUnion,
+                                  junkBB,
+                                  someOptions.wrapAround != OpenBoundaries,
+                                  someOptions.exactLevels);
+
+    // Contrast and entropy measure a neighborhood of fixed size in
+    // pixels, which would mean something different on each level.
+    const unsigned pointwiseLevels =
+        someOptions.contrastWeight > 0.0 || someOptions.entropyWeight > 0.0 ?
+        1U :
+        std::min(static_cast<unsigned>(std::max(coarseToFineLevels, 1)), numLevels);
+    if (isCoarseToFine && Verbose >= VERBOSE_MASK_MESSAGES) {
+        std::cerr << command
+                  << ": info: computing weights on the finest " << pointwiseLevels
+                  << " of " << numLevels << " levels" << std::endl;
+    }
+
+    // Sum of all masks, respectively sum of all weight pyramids; hard
+    // masks do not get normalized.
+    std::unique_ptr<MaskType> normImage(isCoarseToFine || someOptions.useHardMask ?
+                                        nullptr :
+                                        new MaskType(anInputUnion.size()));
+    PyramidPtr<MaskType> normPyramid;
 
     // Result image. Alpha will be union of all input alphas.
-    std::pair<ImageType*, AlphaType*> outputPair(static_cast<ImageType*>(nullptr),
-                                                 new AlphaType(anInputUnion.size()));
+    std::unique_ptr<ImageType> outputImage;
+    std::unique_ptr<AlphaType> outputAlpha(new AlphaType(anInputUnion.size()));
     std::list<vigra::ImageImportInfo*> imageInfoList(anImageInfoList);
-    const unsigned numberOfImages = imageInfoList.size();
+    const unsigned numberOfImages = aMemoryIO ? aMemoryIO->numberOfImages : imageInfoList.size();
+
+    // Hard masks keep the largest weight so far and the label of its
+    // image instead of the masks of all images.
+    std::unique_ptr<hardmask::HardMask> hardMask;
+    if (someOptions.useHardMask) {
+        if (numberOfImages > hardmask::MaximumNumberOfImages) {
+            std::ostringstream message;
+            message << "hard masks support at most " << hardmask::MaximumNumberOfImages << " input images";
+            throw fatal_error(message.str());
+        }
+        hardMask.reset(new hardmask::HardMask(anInputUnion.size()));
+    }
 
     unsigned m = 0;
     FileNameList::const_iterator inputFileNameIterator(anInputFileNameList.begin());
@@ -1263,7 +1550,7 @@ void enfuseMain(const FileNameList& anInputFileNameList,
 
         while (filename != anInputFileNameList.end()) {
             try {
-                new (metadata) metadata_array::value_type(metadata::read(*filename));
+                new (metadata) metadata_array::value_type(InputHeaders.take_metadata(*filename));
                 input_metadata.mark_as_initialized(metadata - input_metadata.begin());
             }
             catch (Exiv2::Error& e) {
@@ -1278,40 +1565,58 @@ void enfuseMain(const FileNameList& anInputFileNameList,
     }
 #endif
 
-    while (!imageInfoList.empty()) {
+    while (aMemoryIO ? m != numberOfImages : !imageInfoList.empty()) {
         vigra::Rect2D imageBB;
-        std::pair<ImageType*, AlphaType*> imagePair =
+        const std::pair<ImageType*, AlphaType*> imagePair =
+            aMemoryIO ?
+            aMemoryIO->nextImage(imageBB) :
             assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, imageBB);
-
-        MaskType* mask = new MaskType(anInputUnion.size());
-
-        if (LoadMasks) {
+        InputTriple input {std::unique_ptr<ImageType>(imagePair.first),
+                           std::unique_ptr<AlphaType>(imagePair.second),
+                           std::unique_ptr<MaskType>(isCoarseToFine ? nullptr : new MaskType(anInputUnion.size()))};
+        MaskType* mask = input.mask.get();
+
+        if (isCoarseToFine) {
+            PyramidPtr<MaskType> weights =
+                enfuseWeightPyramid<ImageType, AlphaType, MaskType, SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                (numLevels, pointwiseLevels, someOptions.wrapAround != OpenBoundaries,
+                 *input.image, *input.alpha, someOptions);
+
+            if (!normPyramid) {
+                normPyramid = std::move(weights);
+            } else {
+                for (unsigned int i = 0; i < weights->size(); ++i) {
+                    vigra::omp::combineTwoImages(srcImageRange(*((*weights)[i])),
+                                                 srcImage(*((*normPyramid)[i])),
+                                                 destImage(*((*normPyramid)[i])),
+                                                 Arg1() + Arg2());
+                }
+            }
+        } else if (someOptions.loadMasks) {
             // IMPLEMENTATION NOTE: For simplicity of the code, here
             // we also load in hard masks.  Computing the set of hard
             // masks from a set of soft masks is done by maximum
             // selection, which is an idempotent function.
             const std::string maskFilename =
-                enblend::expandFilenameTemplate(UseHardMask ? HardMaskTemplate : SoftMaskTemplate,
+                enblend::expandFilenameTemplate(someOptions.useHardMask ?
+                                                someOptions.hardMaskTemplate :
+                                                someOptions.softMaskTemplate,
                                                 numberOfImages,
                                                 *inputFileNameIterator,
-                                                OutputFileName,
+                                                someOptions.outputFileName,
                                                 m);
             if (can_open_file(maskFilename)) {
                 vigra::ImageImportInfo maskInfo(maskFilename.c_str());
                 if (Verbose >= VERBOSE_MASK_MESSAGES) {
                     std::cerr << command
-                              << ": info: loading " << (UseHardMask ? "hard" : "soft")
+                              << ": info: loading " << (someOptions.useHardMask ? "hard" : "soft")
                               << "mask \"" << maskFilename << "\"" << std::endl;
                 }
                 if (!maskInfo.isGrayscale()) {
-                    std::cerr << command
-                              << ": mask image \"" << maskFilename << "\" is not grayscale" << std::endl;
-                    exit(1);
+                    throw fatal_error("mask image \"" + maskFilename + "\" is not grayscale");
                 }
                 if (maskInfo.numExtraBands() != 0) {
-                    std::cerr << command
-                              << ": mask image \"" << maskFilename << "\" must not have an alpha channel" << std::endl;
-                    exit(1);
+                    throw fatal_error("mask image \"" + maskFilename + "\" must not have an alpha channel");
                 }
                 if (maskInfo.width() != anInputUnion.width() || maskInfo.height() != anInputUnion.height()) {
                     std::cerr << command
@@ -1325,48 +1630,39 @@ void enfuseMain(const FileNameList& anInputFileNameList,
                 }
                 importImage(maskInfo, destImage(*mask));
             } else {
-                // Cannot read mask file.  We already issued an error
-                // message through can_open_file().
-                exit(1);
+                // can_open_file() has already told why.
+                throw fatal_error("cannot load mask \"" + maskFilename + "\"");
             }
         } else {
-            enfuseMask<ImageType, AlphaType, MaskType>(srcImageRange(*(imagePair.first)),
-                                                       srcImage(*(imagePair.second)),
-                                                       destImage(*mask));
+            enfuseMask<ImageType, AlphaType, MaskType>(srcImageRange(*input.image),
+                                                       srcImage(*input.alpha),
+                                                       destImage(*mask),
+                                                       someOptions);
         }
 
-        if (SaveMasks) {
+        if (someOptions.saveMasks) {
             const std::string mask_pixel_type =
                 to_upper_copy(parameter::as_string("mask-save-pixel-type", "float"));
             const std::string maskFilename =
-                enblend::expandFilenameTemplate(SoftMaskTemplate,
+                enblend::expandFilenameTemplate(someOptions.softMaskTemplate,
                                                 numberOfImages,
                                                 *inputFileNameIterator,
-                                                OutputFileName,
+                                                someOptions.outputFileName,
                                                 m);
 
             if (maskFilename == *inputFileNameIterator) {
-                std::cerr << command
-                          << ": will not overwrite input image \""
-                          << *inputFileNameIterator
-                          << "\" with soft mask file"
-                          << std::endl;
-                exit(1);
-            } else if (maskFilename == OutputFileName) {
-                std::cerr << command
-                          << ": will not overwrite output image \""
-                          << OutputFileName
-                          << "\" with soft mask file"
-                          << std::endl;
-                exit(1);
+                throw fatal_error("will not overwrite input image \"" + *inputFileNameIterator + "\" with soft mask file");
+            } else if (maskFilename == someOptions.outputFileName) {
+                throw fatal_error("will not overwrite output image \"" + someOptions.outputFileName +
+                                  "\" with soft mask file");
             } else {
                 if (Verbose >= VERBOSE_MASK_MESSAGES) {
                     std::cerr << command
                               << ": info: saving soft mask \"" << maskFilename << "\"" << std::endl;
                 }
                 vigra::ImageExportInfo maskInfo(maskFilename.c_str());
-                maskInfo.setXResolution(ImageResolution.x);
-                maskInfo.setYResolution(ImageResolution.y);
+                maskInfo.setXResolution(someOptions.resolution.x);
+                maskInfo.setYResolution(someOptions.resolution.y);
                 maskInfo.setCompression(MASK_COMPRESSION);
                 maskInfo.setPixelType(mask_pixel_type.c_str());
                 exportImage(srcImageRange(*mask), maskInfo);
@@ -1374,178 +1670,171 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         }
 
         // Make output alpha the union of all input alphas.
-        vigra::omp::copyImageIf(srcImageRange(*(imagePair.second)),
-                                maskImage(*(imagePair.second)),
-                                destImage(*(outputPair.second)));
-
-        // Add the mask to the norm image.
-        vigra::omp::combineTwoImages(srcImageRange(*mask),
-                                     srcImage(*normImage),
-                                     destImage(*normImage),
-                                     Arg1() + Arg2());
+        vigra::omp::copyImageIf(srcImageRange(*input.alpha),
+                                maskImage(*input.alpha),
+                                destImage(*outputAlpha));
+
+        if (someOptions.useHardMask) {
+            // Let the mask compete for the pixels; the hard mask of
+            // the image gets derived from the labels later.
+            hardMask->update(*mask, m);
+            input.mask.reset();
+        } else if (!isCoarseToFine) {
+            // Add the mask to the norm image.
+            vigra::omp::combineTwoImages(srcImageRange(*mask),
+                                         srcImage(*normImage),
+                                         destImage(*normImage),
+                                         Arg1() + Arg2());
+        }
 
-        imageList.push_back(vigra::make_triple(imagePair.first, imagePair.second, mask));
+        imageList.push_back(std::move(input));
 
         ++m;
-        ++inputFileNameIterator;
+        if (!aMemoryIO) {
+            ++inputFileNameIterator;
+        }
     }
 
-    if (StopAfterMaskGeneration && !UseHardMask) {
-        exit(0);
+    if (someOptions.stopAfterMaskGeneration && !someOptions.useHardMask) {
+        return;
     }
 
     const int totalImages = imageList.size();
 
     typename EnblendNumericTraits<ImagePixelType>::MaskPixelType maxMaskPixelType =
         vigra::NumericTraits<typename EnblendNumericTraits<ImagePixelType>::MaskPixelType>::max();
+    const MaskPixelType hardMaskWinner = static_cast<MaskPixelType>(maxMaskPixelType);
+    const MaskPixelType hardMaskShare = static_cast<MaskPixelType>(maxMaskPixelType) / totalImages;
 
-    if (UseHardMask) {
+    if (someOptions.useHardMask) {
         if (Verbose >= VERBOSE_MASK_MESSAGES) {
             std::cerr << command
                       << ": info: creating hard blend mask" << std::endl;
         }
-        const vigra::Size2D sz = normImage->size();
-        imageListIteratorType imageIter;
-#ifdef OPENMP
-#pragma omp parallel for private (imageIter)
-#endif
-        for (int y = 0; y < sz.y; ++y) {
-            for (int x = 0; x < sz.x; ++x) {
-                float max = 0.0f;
-                int maxi = 0;
-                int i = 0;
-                for (imageIter = imageList.begin();
-                     imageIter != imageList.end();
-                     ++imageIter) {
-                    const float w = static_cast<float>((*imageIter->third)(x, y));
-                    if (w > max) {
-                        max = w;
-                        maxi = i;
-                    }
-                    i++;
-                }
-                i = 0;
-                for (imageIter = imageList.begin();
-                     imageIter != imageList.end();
-                     ++imageIter) {
-                    if (max == 0.0f) {
-                        (*imageIter->third)(x, y) =
-                            static_cast<MaskPixelType>(maxMaskPixelType) / totalImages;
-                    } else if (i == maxi) {
-                        (*imageIter->third)(x, y) = maxMaskPixelType;
-                    } else {
-                        (*imageIter->third)(x, y) = 0.0f;
-                    }
-                    i++;
-                }
-            }
-        }
         unsigned i = 0;
-        if (SaveMasks) {
+        if (someOptions.saveMasks) {
             const std::string mask_pixel_type =
                 to_upper_copy(parameter::as_string("mask-save-pixel-type", "float"));
+            MaskType hardMaskImage(anInputUnion.size());
+            imageListIteratorType imageIter;
 
             for (imageIter = imageList.begin(), inputFileNameIterator = anInputFileNameList.begin();
                  imageIter != imageList.end();
                  ++imageIter, ++inputFileNameIterator) {
                 const std::string maskFilename =
-                    enblend::expandFilenameTemplate(HardMaskTemplate,
+                    enblend::expandFilenameTemplate(someOptions.hardMaskTemplate,
                                                     imageList.size(),
                                                     *inputFileNameIterator,
-                                                    OutputFileName,
+                                                    someOptions.outputFileName,
                                                     i);
                 if (maskFilename == *inputFileNameIterator) {
-                    std::cerr << command
-                              << ": will not overwrite input image \""
-                              << *inputFileNameIterator
-                              << "\" with hard mask"
-                              << std::endl;
-                    exit(1);
-                } else if (maskFilename == OutputFileName) {
-                    std::cerr << command
-                              << ": will not overwrite output image \""
-                              << OutputFileName
-                              << "\" with hard mask"
-                              << std::endl;
-                    exit(1);
+                    throw fatal_error("will not overwrite input image \"" + *inputFileNameIterator + "\" with hard mask");
+                } else if (maskFilename == someOptions.outputFileName) {
+                    throw fatal_error("will not overwrite output image \"" + someOptions.outputFileName +
+                                      "\" with hard mask");
                 } else {
                     if (Verbose >= VERBOSE_MASK_MESSAGES) {
                         std::cerr << command
                                   << ": info: saving hard mask \"" << maskFilename << "\"" << std::endl;
                     }
                     vigra::ImageExportInfo maskInfo(maskFilename.c_str());
-                    maskInfo.setXResolution(ImageResolution.x);
-                    maskInfo.setYResolution(ImageResolution.y);
+                    maskInfo.setXResolution(someOptions.resolution.x);
+                    maskInfo.setYResolution(someOptions.resolution.y);
                     maskInfo.setCompression(MASK_COMPRESSION);
                     maskInfo.setPixelType(mask_pixel_type.c_str());
-                    exportImage(srcImageRange(*(imageIter->third)), maskInfo);
+                    hardMask->extract(i, hardMaskWinner, hardMaskShare, hardMaskImage);
+                    exportImage(srcImageRange(hardMaskImage), maskInfo);
                 }
                 i++;
             }
         }
     }
 
-    if (StopAfterMaskGeneration) {
-        exit(0);
+    if (someOptions.stopAfterMaskGeneration) {
+        return;
     }
 
-    vigra::Rect2D junkBB;
-    const unsigned int numLevels =
-        roiBounds<ImagePixelComponentType>(anInputUnion, anInputUnion, anInputUnion, anInputUnion,
-                                           junkBB,
-                                           WrapAround != OpenBoundaries);
-
-    std::vector<ImagePyramidType*> *resultLP = nullptr;
+    PyramidPtr<ImagePyramidType> resultLP;
 
     m = 0;
     while (!imageList.empty()) {
-        vigra::triple<ImageType*, AlphaType*, MaskType*> imageTriple = imageList.front();
-        imageList.erase(imageList.begin());
-
-        std::ostringstream oss0;
-        oss0 << "imageGP" << m << "_";
-
-        // imageLP is constructed using the image's own alpha channel
-        // as the boundary for extrapolation.
-        std::vector<ImagePyramidType*> *imageLP =
-            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
-                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
-                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>(
-                                                                         oss0.str().c_str(),
-                                                                         numLevels, WrapAround != OpenBoundaries,
-                                                                         srcImageRange(*(imageTriple.first)),
-                                                                         maskImage(*(imageTriple.second)));
-
-        delete imageTriple.first;
-        delete imageTriple.second;
-
-        //std::ostringstream oss1;
-        //oss1 << "imageLP" << m << "_";
-        //exportPyramid<ImagePyramidType>(imageLP, oss1.str().c_str());
-
-        if (!UseHardMask) {
-            // Normalize the mask coefficients.
-            // Scale to the range expected by the MaskPyramidPixelType.
-            vigra::omp::combineTwoImages(srcImageRange(*(imageTriple.third)),
-                                         srcImage(*normImage),
-                                         destImage(*(imageTriple.third)),
-                                         ifThenElse(Arg2() > Param(0.0),
-                                                    Param(maxMaskPixelType) * Arg1() / Arg2(),
-                                                    Param(maxMaskPixelType / totalImages)));
+        InputTriple imageTriple(std::move(imageList.front()));
+        imageList.pop_front();
+
+        // In coarse-to-fine mode the weights of the image replace its
+        // mask; recompute them while we still have the image.
+        PyramidPtr<MaskType> weights;
+        if (isCoarseToFine) {
+            weights =
+                enfuseWeightPyramid<ImageType, AlphaType, MaskType, SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                (numLevels, pointwiseLevels, someOptions.wrapAround != OpenBoundaries,
+                 *imageTriple.image, *imageTriple.alpha, someOptions);
         }
 
-        // maskGP is constructed using the union of the input alpha channels
-        // as the boundary for extrapolation.
-        std::vector<MaskPyramidType*> *maskGP =
-            gaussianPyramid<MaskType, AlphaType, MaskPyramidType,
-            MaskPyramidIntegerBits, MaskPyramidFractionBits,
-            SKIPSMMaskPixelType, SKIPSMAlphaPixelType>
-            (numLevels,
-             WrapAround != OpenBoundaries,
-             srcImageRange(*(imageTriple.third)),
-             maskImage(*(outputPair.second)));
+        // imageGP is constructed using the image's own alpha channel
+        // as the boundary for extrapolation.  It turns into the
+        // Laplacian pyramid of the image level by level below.
+        PyramidPtr<ImagePyramidType> imageGP
+            (gaussianPyramid<ImageType, AlphaType, ImagePyramidType,
+                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>(numLevels, someOptions.wrapAround != OpenBoundaries,
+                                                                         srcImageRange(*imageTriple.image),
+                                                                         maskImage(*imageTriple.alpha)));
+
+        imageTriple.image.reset();
+        imageTriple.alpha.reset();
+
+        PyramidPtr<MaskPyramidType> maskGP;
+        if (isCoarseToFine) {
+            // Normalize the weights level by level, which makes them
+            // a partition of unity on every level.
+            maskGP.reset(new std::vector<MaskPyramidType*>);
+            maskGP->reserve(weights->size());
+            for (unsigned int i = 0; i < weights->size(); ++i) {
+                MaskType* weight = (*weights)[i];
+                vigra::omp::combineTwoImages(srcImageRange(*weight),
+                                             srcImage(*((*normPyramid)[i])),
+                                             destImage(*weight),
+                                             ifThenElse(Arg2() > Param(0.0),
+                                                        Param(maxMaskPixelType) * Arg1() / Arg2(),
+                                                        Param(maxMaskPixelType / totalImages)));
+
+                std::unique_ptr<MaskPyramidType> level(new MaskPyramidType(weight->width(), weight->height()));
+                copyToPyramidImage<MaskType, MaskPyramidType, MaskPyramidIntegerBits, MaskPyramidFractionBits>
+                    (srcImageRange(*weight), destImage(*level));
+                maskGP->push_back(level.release());
+                delete weight;
+                (*weights)[i] = nullptr;
+            }
+            weights.reset();
+        } else {
+            if (someOptions.useHardMask) {
+                imageTriple.mask.reset(new MaskType(anInputUnion.size()));
+                hardMask->extract(m, hardMaskWinner, hardMaskShare, *imageTriple.mask);
+            } else {
+                // Normalize the mask coefficients.
+                // Scale to the range expected by the MaskPyramidPixelType.
+                vigra::omp::combineTwoImages(srcImageRange(*imageTriple.mask),
+                                             srcImage(*normImage),
+                                             destImage(*imageTriple.mask),
+                                             ifThenElse(Arg2() > Param(0.0),
+                                                        Param(maxMaskPixelType) * Arg1() / Arg2(),
+                                                        Param(maxMaskPixelType / totalImages)));
+            }
 
-        delete imageTriple.third;
+            // maskGP is constructed using the union of the input alpha channels
+            // as the boundary for extrapolation.
+            maskGP.reset
+                (gaussianPyramid<MaskType, AlphaType, MaskPyramidType,
+                 MaskPyramidIntegerBits, MaskPyramidFractionBits,
+                 SKIPSMMaskPixelType, SKIPSMAlphaPixelType>
+                 (numLevels,
+                  someOptions.wrapAround != OpenBoundaries,
+                  srcImageRange(*imageTriple.mask),
+                  maskImage(*outputAlpha)));
+
+            imageTriple.mask.reset();
+        }
 
         //std::ostringstream oss2;
         //oss2 << "maskGP" << m << "_";
@@ -1557,35 +1846,34 @@ void enfuseMain(const FileNameList& anInputFileNameList,
             MaskPyramidFractionBits> maskConvertFunctor;
         MaskPyramidPixelType maxMaskPyramidPixelValue = maskConvertFunctor(maxMaskPixelType);
 
-        for (unsigned int i = 0; i < maskGP->size(); ++i) {
-            // Multiply image lp with the mask gp.
-            vigra::omp::combineTwoImages(srcImageRange(*((*imageLP)[i])),
-                                         srcImage(*((*maskGP)[i])),
-                                         destImage(*((*imageLP)[i])),
-                                         ImageMaskMultiplyFunctor<MaskPyramidPixelType>(maxMaskPyramidPixelValue));
-
-            // Done with maskGP.
-            delete (*maskGP)[i];
-        }
-        delete maskGP;
-
-        //std::ostringstream oss3;
-        //oss3 << "multLP" << m << "_";
-        //exportPyramid<ImagePyramidType>(imageLP, oss3.str().c_str());
-
-        if (resultLP != nullptr) {
-            // Add imageLP to resultLP.
-            for (unsigned int i = 0; i < imageLP->size(); ++i) {
-                vigra::omp::combineTwoImages(srcImageRange(*((*imageLP)[i])),
-                                             srcImage(*((*resultLP)[i])),
-                                             destImage(*((*resultLP)[i])),
-                                             Arg1() + Arg2());
-                delete (*imageLP)[i];
-            }
-            delete imageLP;
-        } else {
-            resultLP = imageLP;
+        // Weight each Laplacian level with the mask as soon as it is
+        // final and add it to resultLP in the same sweep.  The first
+        // image's levels are weighted in place and become resultLP.
+        const bool isFirstImage = !resultLP;
+        if (isFirstImage) {
+            resultLP.reset(new std::vector<ImagePyramidType*>);
+            resultLP->reserve(imageGP->size());
         }
+        consumeLaplacianLevels<SKIPSMImagePixelType>
+            (someOptions.wrapAround != OpenBoundaries, imageGP.get(),
+             [&](unsigned int l, ImagePyramidType* anImageLevel) {
+                std::unique_ptr<ImagePyramidType> imageLevel(anImageLevel);
+
+                if (isFirstImage) {
+                    accumulateWeightedLevel(*imageLevel, *((*maskGP)[l]), maxMaskPyramidPixelValue,
+                                            *imageLevel);
+                    resultLP->push_back(imageLevel.release());
+                } else {
+                    accumulateWeightedLevel(*imageLevel, *((*maskGP)[l]), maxMaskPyramidPixelValue,
+                                            *((*resultLP)[l]));
+                }
+
+                // Done with maskGP.
+                delete (*maskGP)[l];
+                (*maskGP)[l] = nullptr;
+             });
+        imageGP.reset();
+        maskGP.reset();
 
         //std::ostringstream oss4;
         //oss4 << "resultLP" << m << "_";
@@ -1594,33 +1882,51 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         ++m;
     }
 
-    delete normImage;
+    normImage.reset();
+    normPyramid.reset();
 
     //exportPyramid<ImagePyramidType>(resultLP, "resultLP");
 
-    collapsePyramid<SKIPSMImagePixelType>(WrapAround != OpenBoundaries, resultLP);
+    // Write the output straight from the pyramid while it collapses
+    // if we can; else convert the pyramid to the output image as a
+    // whole.
+    bool isWrittenFromPyramid = true;
+    if (aMemoryIO) {
+        collapsePyramid<SKIPSMImagePixelType>(someOptions.wrapAround != OpenBoundaries, resultLP.get());
+        aMemoryIO->writeOutput(*((*resultLP)[0]), *outputAlpha);
+    } else {
+        isWrittenFromPyramid =
+            checkpointFromPyramid<ImageType, ImagePyramidType, AlphaType,
+                                  ImagePyramidIntegerBits, ImagePyramidFractionBits>
+            ((*resultLP)[0], outputAlpha.get(), anOutputImageInfo,
+             [&](auto a_rows_done) {
+                collapsePyramid<SKIPSMImagePixelType>(someOptions.wrapAround != OpenBoundaries, resultLP.get(),
+                                                      a_rows_done);
+            });
+    }
 
-    outputPair.first = new ImageType(anInputUnion.size());
+    if (!isWrittenFromPyramid) {
+        outputImage.reset(new ImageType(anInputUnion.size()));
 
-    copyFromPyramidImageIf<ImagePyramidType, AlphaType, ImageType,
-                           ImagePyramidIntegerBits, ImagePyramidFractionBits>
-        (srcImageRange(*((*resultLP)[0])),
-         maskImage(*(outputPair.second)),
-         destImage(*(outputPair.first)));
+        copyFromPyramidImageIf<ImagePyramidType, AlphaType, ImageType,
+                               ImagePyramidIntegerBits, ImagePyramidFractionBits>
+            (srcImageRange(*((*resultLP)[0])),
+             maskImage(*outputAlpha),
+             destImage(*outputImage));
+    }
 
     // Delete result pyramid.
-    for (unsigned int i = 0; i < resultLP->size(); ++i) {
-        delete (*resultLP)[i];
-    }
-    delete resultLP;
+    resultLP.reset();
 
-    checkpoint(outputPair, anOutputImageInfo);
+    if (!isWrittenFromPyramid) {
+        checkpoint(std::make_pair(outputImage.get(), outputAlpha.get()), anOutputImageInfo);
+    }
 
-    delete outputPair.first;
-    delete outputPair.second;
+    outputImage.reset();
+    outputAlpha.reset();
 
 #ifdef HAVE_EXIV2
-    if (OutputIsValid && parameter::as_boolean("metadata-pass-through", true)) {
+    if (!aMemoryIO && OutputIsValid && parameter::as_boolean("metadata-pass-through", true)) {
         const size_t metadata_source_image_index =
             std::min(static_cast<size_t>(parameter::as_unsigned("metadata-source-image-index", 0)),
                      input_metadata.size() - 1);
@@ -1642,19 +1948,19 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         } else {
             try {
                 metadata::named_meta_array::const_iterator
-                    input_meta(metadata::write(OutputFileName,
+                    input_meta(metadata::write(someOptions.outputFileName,
                                                valid_named_metadata.begin(),
                                                valid_named_metadata.end()));
                 if (Verbose >= VERBOSE_METADATA) {
                     std::cerr <<
                         command << ": info: attach metadata of input image \"" <<
-                        input_meta->filename() << "\" to output image \"" << OutputFileName << "\"\n";
+                        input_meta->filename() << "\" to output image \"" << someOptions.outputFileName << "\"\n";
                 }
             }
             catch (Exiv2::Error& e) {
                 std::cerr <<
                     command << ": warning: could not write metadata to output image \"" <<
-                    OutputFileName << "\"\n" <<
+                    someOptions.outputFileName << "\"\n" <<
                     command << ": note: " << e.what() << "\n";
             }
             catch (metadata::Warning& w) {
@@ -31,6 +31,8 @@
 
 #include <vigra/diff2d.hxx>
 
+#include "openmp_def.h"
+
 #ifndef HAVE_LRINT
 __inline long int lrint (double x){
     return static_cast<long int>(x + (x < 0.0 ? -0.5 : 0.5));
@@ -465,6 +467,157 @@ namespace vigra_ext
             }
         }
     }
+
+
+    // Band-parallel variant of fill_polygon_active().  Each thread owns
+    // a contiguous band of scanlines and builds its table of active
+    // segments from the shared, sorted list of segments.  A scanline
+    // meets exactly the segments that fill_polygon_active() finds
+    // active there and computes the same intersections, so both
+    // functions fill the same pixels.
+    template <class ImageIterator, class ImageAccessor, class ValueType, class PolygonVertexIterator>
+    void
+    fill_polygon_banded(const ImageIterator& upper_left, const ImageIterator& lower_right, const ImageAccessor& accessor,
+                        const PolygonVertexIterator& vertex_begin, const PolygonVertexIterator& vertex_end,
+                        const ValueType& fill_value)
+    {
+        typedef std::pair<int, detail::intersection_t> intersection_data;
+        typedef std::vector<intersection_data> intersection_list;
+        typedef typename ImageIterator::row_iterator row_iterator;
+
+        if (vertex_begin == vertex_end)
+        {
+            return;
+        }
+
+        const vigra::Size2D image_size(lower_right - upper_left);
+        const vigra::Rect2D extent(detail::get_polygon_extent(vertex_begin, vertex_end));
+
+        typedef std::pair<vigra::Point2D, vigra::Point2D> segment;
+        typedef std::vector<segment> segments;
+        typedef typename segments::const_iterator segments_const_iterator;
+
+        // Create the line segments that make up the polygon with
+        // ascending y-coordinates.  Segments that end in an
+        // END_OF_SEGMENT_MARKER never intersect a scanline.
+        segments polygon_segments;
+        PolygonVertexIterator u(vertex_begin);
+        PolygonVertexIterator v(vertex_begin);
+
+        ++v;
+        while (v != vertex_end)
+        {
+            if (*u != END_OF_SEGMENT_MARKER && *v != END_OF_SEGMENT_MARKER)
+            {
+                polygon_segments.push_back(u->py() < v->py() ? std::make_pair(*u, *v) : std::make_pair(*v, *u));
+            }
+            ++u;
+            ++v;
+        }
+
+        std::sort(polygon_segments.begin(), polygon_segments.end(), detail::LessThanSegment<segment>());
+
+        const int y_begin = std::max(0, extent.top());
+        const int y_end = std::min(image_size.height(), extent.bottom());
+        if (y_begin >= y_end)
+        {
+            return;
+        }
+
+        // A few bands per thread balance the load of unevenly complex
+        // parts of the polygon.
+        const int bands_wanted = 4 * omp_get_max_threads();
+        const int band_height = std::max(16, (y_end - y_begin + bands_wanted - 1) / bands_wanted);
+        const int number_of_bands = (y_end - y_begin + band_height - 1) / band_height;
+        bool is_malformed = false;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(||: is_malformed)
+#endif
+        for (int band = 0; band < number_of_bands; ++band)
+        {
+            const int band_top = y_begin + band * band_height;
+            const int band_bottom = std::min(band_top + band_height, y_end);
+
+            // Active segments of the first scanline of the band
+            segments active_segments;
+            segments_const_iterator s(polygon_segments.begin());
+            while (s != polygon_segments.end() && s->first.py() <= band_top)
+            {
+                if (s->second.py() >= band_top)
+                {
+                    active_segments.push_back(*s);
+                }
+                ++s;
+            }
+
+            intersection_list intersections;
+            std::vector<int> paired_intersections;
+
+            for (int y = band_top; y < band_bottom; ++y)
+            {
+                while (s != polygon_segments.end() && s->first.py() <= y)
+                {
+                    active_segments.push_back(*s);
+                    ++s;
+                }
+
+                intersections.clear();
+                for (typename segments::const_iterator a = active_segments.begin(); a != active_segments.end(); ++a)
+                {
+                    const int delta_y = a->second.py() - a->first.py();
+                    if (delta_y != 0)
+                    {
+                        const double m = static_cast<double>(y - a->first.py()) / static_cast<double>(delta_y);
+                        const int x = lrint(static_cast<double>(a->first.px()) +
+                                            m * static_cast<double>(a->second.px() - a->first.px()));
+                        const detail::intersection_t kind =
+                            detail::intersection_of_bool(detail::is_touching_point(a->first, a->second, y));
+                        intersections.push_back(std::make_pair(x, kind));
+                    }
+                    else // horizontal segment, which is active in its scanline only
+                    {
+                        intersections.push_back(std::make_pair(std::min(a->first.px(), a->second.px()),
+                                                               detail::HORIZONTAL_LEFT));
+                        intersections.push_back(std::make_pair(std::max(a->first.px(), a->second.px()),
+                                                               detail::HORIZONTAL_RIGHT));
+                    }
+                }
+
+                // Retire the segments that end in this scanline.
+                active_segments.erase(std::remove_if(active_segments.begin(), active_segments.end(),
+                                                     [y](const segment& a) {return a.second.py() <= y;}),
+                                      active_segments.end());
+
+                if (!intersections.empty()) // OPTIMIZATION: skip empty scanlines
+                {
+                    std::sort(intersections.begin(), intersections.end());
+
+                    paired_intersections.clear();
+                    detail::group_to_pairs(intersections.begin(), intersections.end(),
+                                           std::back_inserter(paired_intersections));
+
+                    const row_iterator row((upper_left + vigra::Diff2D(0, y)).rowIterator());
+                    try
+                    {
+                        detail::fill_row_segments(paired_intersections,
+                                                  row, image_size.width(), accessor,
+                                                  fill_value);
+                    }
+                    catch (detail::malformed_polygon&)
+                    {
+                        // Exceptions must not leave the parallel region.
+                        is_malformed = true;
+                    }
+                }
+            }
+        }
+
+        if (is_malformed)
+        {
+            throw detail::malformed_polygon("vigra_ext::fill_row_segments: open polygon");
+        }
+    }
 } // end namespace vigra_ext
 
 
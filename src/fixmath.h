@@ -36,6 +36,7 @@
 #include <vigra/numerictraits.hxx>
 #include <vigra/utilities.hxx>
 
+#include "gamut_map_cache.h"
 #include "mersenne.h"
 #include "minimizer.h"
 #include "muopt.h"
@@ -91,6 +92,45 @@ calculate_delta_e(const cmsCIELab* lab1, const cmsCIELab* lab2)
 }
 
 
+// Answer the edge length of the cubical cells of the gamut-map
+// caches such that any point of a cell is at most
+// "gamut-map-cache-delta-e" (Euclidean) away from the cell's center.
+// A zero edge length disables caching.
+static inline double
+gamut_map_cache_step()
+{
+    const double delta_e = limit(parameter::as_double("gamut-map-cache-delta-e", 0.25), 0.0, 10.0); //< gamut-map-cache-delta-e 0.25
+    return 2.0 * delta_e / std::sqrt(3.0);
+}
+
+
+// The caches of gamut-mapped pixels are only valid for the ICC
+// transforms and the blend color space they were filled with.
+// Whoever sets up the transforms calls clear_gamut_map_caches().
+static inline GamutMapCache*
+lab_gamut_map_cache()
+{
+    static GamutMapCache cache(parameter::as_unsigned("gamut-map-cache-entries", 262144U)); //< gamut-map-cache-entries 262144
+    return &cache;
+}
+
+
+static inline GamutMapCache*
+jch_gamut_map_cache()
+{
+    static GamutMapCache cache(parameter::as_unsigned("gamut-map-cache-entries", 262144U));
+    return &cache;
+}
+
+
+static inline void
+clear_gamut_map_caches()
+{
+    lab_gamut_map_cache()->clear();
+    jch_gamut_map_cache()->clear();
+}
+
+
 static inline void
 jch_to_rgb(const cmsJCh* jch, double* rgb)
 {
@@ -842,7 +882,8 @@ public:
         optimizer_error(parameter::as_double("lum-optimizer-error", 0.5 / 256.0)),
         optimizer_goal(parameter::as_double("lum-optimizer-deltae-goal", 0.5)),
         maximum_iterations(parameter::as_unsigned("lum-maximum-iterations", 50U)),
-        max_chroma_factor(parameter::as_double("lum-max-chroma-factor", 20.0))
+        max_chroma_factor(parameter::as_double("lum-max-chroma-factor", 20.0)),
+        cache_step(gamut_map_cache_step())
 #ifdef LOG_COLORSPACE_OPTIMIZATION
         , polish_tally(0U), polish_false_positive_tally(0U),
         total_delta_e(0.0), total_iterations(0U)
@@ -934,6 +975,35 @@ public:
 #endif // LOG_COLORSPACE_OPTIMIZATION
         }
 
+        if (cache_step > 0.0)
+        {
+            const std::int64_t l = quantize_coordinate(lab->L, cache_step);
+            const std::int64_t a = quantize_coordinate(lab->a, cache_step);
+            const std::int64_t b = quantize_coordinate(lab->b, cache_step);
+            const GamutMapCache::key_type key = GamutMapCache::make_key(l, a, b);
+
+            if (EXPECT_RESULT(key != GamutMapCache::invalid_key, true))
+            {
+                GamutMapCache* const cache = lab_gamut_map_cache();
+
+                if (!cache->find(key, rgb))
+                {
+                    const cmsCIELab center {l * cache_step, a * cache_step, b * cache_step};
+                    search_rgb(&center, rgb);
+                    cache->insert(key, rgb);
+                }
+                return;
+            }
+        }
+
+        search_rgb(lab, rgb);
+    }
+
+private:
+    // Search for the RGB value of the pixel with the same luminance
+    // and hue as LAB that is closest to LAB.
+    void search_rgb(const cmsCIELab* lab, double* rgb) const
+    {
         const double initial_chroma {chroma_of_cartesian_lab(*lab)};
 
         lab_detail::extra_minimizer_parameter extra(*lab);
@@ -1035,6 +1105,7 @@ private:
     const double optimizer_goal;
     const unsigned maximum_iterations;
     const double max_chroma_factor;
+    const double cache_step;
 
 #ifdef LOG_COLORSPACE_OPTIMIZATION
     mutable unsigned polish_tally;
@@ -1619,7 +1690,9 @@ public:
         optimizer_error(limit(parameter::as_double("ciecam-optimizer-error", 0.5 / 65536.0),
                               0.5 / 16777216.0, 1.0)),
         // Delta-E goals: LoFi: 1.0, HiFi: 0.5, Super-HiFi: 0.0
-        optimizer_goal(limit(parameter::as_double("ciecam-optimizer-deltae-goal", 0.5), 0.0, 10.0))
+        optimizer_goal(limit(parameter::as_double("ciecam-optimizer-deltae-goal", 0.5), 0.0, 10.0)),
+
+        cache_step(gamut_map_cache_step())
     {}
 
     double highlight_lightness_guess_1d(const cmsJCh& jch) const
@@ -1906,29 +1979,12 @@ public:
         //     JCh model wants to compensate the low luminance, and the RGB components go
         //     haywire.  We solve the problem by expunging the saturation before launching the
         //     shadow optimizer.
-        if (rgb[0] > 1.0 || rgb[1] > 1.0 || rgb[2] > 1.0)
+        //
+        // (4) All of the above is expensive, so we memoize the results in a cache that is
+        //     keyed on the quantized JCh-value.  See cached_map_into_cube().
+        if (is_outside_cube(rgb))
         {
-            if (jch.J <= shadow_disguised_as_highlight_j)
-            {
-                const cmsJCh ich {jch.J, 0.0, jch.h};
-                multistart_optimize_2d(&ich, rgb);
-            }
-            else
-            {
-                flexible_optimize_1d_2d(&jch, rgb);
-            }
-        }
-        else if (rgb[0] <= 0.0 || rgb[1] <= 0.0 || rgb[2] <= 0.0)
-        {
-            if (jch.J <= shadow_disguised_as_highlight_j)
-            {
-                const cmsJCh ich {jch.J, 0.0, jch.h};
-                multistart_optimize_2d(&ich, rgb);
-            }
-            else
-            {
-                multistart_optimize_2d(&jch, rgb);
-            }
+            cached_map_into_cube(jch, rgb);
         }
 
 #ifdef LOG_COLORSPACE_OPTIMIZATION
@@ -1977,6 +2033,82 @@ public:
     }
 
 protected:
+    static bool is_outside_cube(const double* rgb)
+    {
+        return
+            rgb[0] > 1.0 || rgb[1] > 1.0 || rgb[2] > 1.0 ||
+            rgb[0] <= 0.0 || rgb[1] <= 0.0 || rgb[2] <= 0.0;
+    }
+
+    // Apply the strategies (1)-(3) of operator() to the RGB-value
+    // of JCH.
+    void map_into_cube(const cmsJCh& jch, double* rgb) const
+    {
+        if (rgb[0] > 1.0 || rgb[1] > 1.0 || rgb[2] > 1.0)
+        {
+            if (jch.J <= shadow_disguised_as_highlight_j)
+            {
+                const cmsJCh ich {jch.J, 0.0, jch.h};
+                multistart_optimize_2d(&ich, rgb);
+            }
+            else
+            {
+                flexible_optimize_1d_2d(&jch, rgb);
+            }
+        }
+        else if (rgb[0] <= 0.0 || rgb[1] <= 0.0 || rgb[2] <= 0.0)
+        {
+            if (jch.J <= shadow_disguised_as_highlight_j)
+            {
+                const cmsJCh ich {jch.J, 0.0, jch.h};
+                multistart_optimize_2d(&ich, rgb);
+            }
+            else
+            {
+                multistart_optimize_2d(&jch, rgb);
+            }
+        }
+    }
+
+    // Same as map_into_cube(), but for the center of the cache cell
+    // that contains JCH.  Lightness and chroma are quantized
+    // directly; the hue cells narrow with increasing chroma, such
+    // that their arc lengths match the other edges.
+    void cached_map_into_cube(const cmsJCh& jch, double* rgb) const
+    {
+        if (cache_step > 0.0)
+        {
+            const std::int64_t j = quantize_coordinate(jch.J, cache_step);
+            const std::int64_t c = quantize_coordinate(jch.C, cache_step);
+            const double chroma = std::max(static_cast<double>(c) * cache_step, cache_step);
+            const std::int64_t hue_cells =
+                static_cast<std::int64_t>(std::ceil(2.0 * M_PI * chroma / cache_step));
+            const double hue_step = 360.0 / static_cast<double>(hue_cells);
+            const std::int64_t h = quantize_coordinate(wrap_cyclically(jch.h, 360.0), hue_step) % hue_cells;
+            const GamutMapCache::key_type key = GamutMapCache::make_key(j, c, h);
+
+            if (EXPECT_RESULT(key != GamutMapCache::invalid_key, true))
+            {
+                GamutMapCache* const cache = jch_gamut_map_cache();
+
+                if (!cache->find(key, rgb))
+                {
+                    const cmsJCh center {
+                        static_cast<double>(j) * cache_step,
+                        static_cast<double>(c) * cache_step,
+                        static_cast<double>(h) * hue_step
+                    };
+                    jch_to_rgb(&center, rgb);
+                    map_into_cube(center, rgb);
+                    cache->insert(key, rgb);
+                }
+                return;
+            }
+        }
+
+        map_into_cube(jch, rgb);
+    }
+
     ConvertFunctorType converter;
     const double rgb_dest_scale;
 
@@ -2005,6 +2137,8 @@ protected:
 
     const double optimizer_error;
     const double optimizer_goal;
+
+    const double cache_step;
 };
 
 
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef GAMUT_MAP_CACHE_H_INCLUDED_
+#define GAMUT_MAP_CACHE_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>               // std::unique_ptr
+
+
+namespace enblend
+{
+    // Memoize the results of the gamut mapping that kicks in when a
+    // pixel converted back from a perceptual color space lands
+    // outside of the RGB cube.
+    //
+    // The callers quantize the perceptual coordinates into cubical
+    // cells and always run the expensive search on the cell's center.
+    // Therefore the result associated with a key does not depend on
+    // which pixel of the cell arrived first, and the output of a run
+    // is the same with or without the cache and for any number of
+    // threads.
+    //
+    // The table uses open addressing with a short linear probe.
+    // Readers never block: a slot is published by a release-store of
+    // its key after its value has been written, and a reader only
+    // trusts a value after an acquire-load of the matching key.
+    // Writers claim empty slots with a compare-and-swap.  If the table
+    // is full or a probe sequence is contended, we simply do not
+    // cache.
+    class GamutMapCache
+    {
+    public:
+        typedef std::uint64_t key_type;
+
+        static constexpr key_type invalid_key = 0U;
+
+        explicit GamutMapCache(size_t a_minimum_capacity) : mask_(capacity_of(a_minimum_capacity) - 1U)
+        {
+            table_.reset(new Entry[mask_ + 1U]);
+        }
+
+        GamutMapCache(const GamutMapCache&) = delete;
+        GamutMapCache& operator=(const GamutMapCache&) = delete;
+
+        // Pack three quantized coordinates into a key.  Answer
+        // invalid_key if any coordinate falls outside of the
+        // representable range.
+        static key_type make_key(std::int64_t x, std::int64_t y, std::int64_t z)
+        {
+            if (!is_representable(x) || !is_representable(y) || !is_representable(z))
+            {
+                return invalid_key;
+            }
+
+            return
+                key_type(1U) << 63 |
+                biased(x) << (2U * coordinate_bits) |
+                biased(y) << coordinate_bits |
+                biased(z);
+        }
+
+        bool find(key_type a_key, double* rgb) const
+        {
+            for (size_t i = 0U, slot = hash(a_key); i != maximum_probes; ++i, slot = (slot + 1U) & mask_)
+            {
+                const Entry& entry = table_[slot];
+                const key_type key = entry.key.load(std::memory_order_acquire);
+
+                if (key == a_key)
+                {
+                    rgb[0] = entry.rgb[0];
+                    rgb[1] = entry.rgb[1];
+                    rgb[2] = entry.rgb[2];
+                    return true;
+                }
+                if (key == empty_key)
+                {
+                    return false;
+                }
+            }
+
+            return false;
+        }
+
+        void insert(key_type a_key, const double* rgb)
+        {
+            for (size_t i = 0U, slot = hash(a_key); i != maximum_probes; ++i, slot = (slot + 1U) & mask_)
+            {
+                Entry& entry = table_[slot];
+                key_type key = entry.key.load(std::memory_order_relaxed);
+
+                if (key == a_key)
+                {
+                    return;
+                }
+                if (key == empty_key &&
+                    entry.key.compare_exchange_strong(key, reserved_key, std::memory_order_relaxed))
+                {
+                    entry.rgb[0] = rgb[0];
+                    entry.rgb[1] = rgb[1];
+                    entry.rgb[2] = rgb[2];
+                    entry.key.store(a_key, std::memory_order_release);
+                    return;
+                }
+            }
+        }
+
+        // Forget all entries.  No other thread may use the cache
+        // meanwhile.
+        void clear()
+        {
+            for (size_t slot = 0U; slot <= mask_; ++slot)
+            {
+                table_[slot].key.store(empty_key, std::memory_order_relaxed);
+            }
+        }
+
+        size_t capacity() const {return mask_ + 1U;}
+
+    private:
+        static constexpr key_type empty_key = 0U;
+        static constexpr key_type reserved_key = ~key_type(0U) >> 1; // top bit clear: never a valid key
+        static constexpr unsigned coordinate_bits = 21U;
+        static constexpr std::int64_t coordinate_bias = std::int64_t(1) << (coordinate_bits - 1U);
+        static constexpr size_t maximum_probes = 8U;
+
+        struct Entry
+        {
+            Entry() : key(empty_key) {}
+
+            std::atomic<key_type> key;
+            double rgb[3];
+        };
+
+        static bool is_representable(std::int64_t x)
+        {
+            return x >= -coordinate_bias && x < coordinate_bias;
+        }
+
+        static key_type biased(std::int64_t x)
+        {
+            return static_cast<key_type>(x + coordinate_bias);
+        }
+
+        static size_t capacity_of(size_t a_minimum_capacity)
+        {
+            size_t capacity = 1024U;
+            while (capacity < a_minimum_capacity)
+            {
+                capacity <<= 1;
+            }
+            return capacity;
+        }
+
+        size_t hash(key_type a_key) const
+        {
+            // Fibonacci hashing
+            return static_cast<size_t>((a_key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask_;
+        }
+
+        const size_t mask_;
+        std::unique_ptr<Entry[]> table_;
+    };
+
+
+    /** Answer the index of the cell of width step that contains x. */
+    inline static std::int64_t
+    quantize_coordinate(double x, double step)
+    {
+        return static_cast<std::int64_t>(std::floor(x / step + 0.5));
+    }
+} // namespace enblend
+
+
+#endif // GAMUT_MAP_CACHE_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -84,6 +84,12 @@
 //< default-output-mask-filename a.mask.tif
 #define DEFAULT_OUTPUT_MASK_FILENAME "a.mask.tif"
 
+//< default-preview-levels 3
+#define DEFAULT_PREVIEW_LEVELS 3U
+
+//< maximum-preview-levels 8
+#define MAX_PREVIEW_LEVELS 8U
+
 //< default-fallback-output-mask-file-type pbm
 #define DEFAULT_FALLBACK_OUTPUT_MASK_FILE_TYPE "pbm"
 
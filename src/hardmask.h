@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef HARDMASK_H_INCLUDED_
+#define HARDMASK_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cstddef>
+
+#include <vigra/basicimage.hxx>
+#include <vigra/sized_int.hxx>
+
+#include "openmp_def.h"
+#include "parameter.h"
+#include "skipsm_simd.h"
+
+
+// Hard masks of Enfuse
+//
+// A hard mask gives each pixel to the image with the largest weight
+// there.  Instead of keeping the weights of all images until the last
+// one is known, HardMask keeps the largest weight so far and the label
+// of its image.  Each image updates the two with row kernels that
+// select in SIMD registers, and the hard mask of a single image is
+// derived from the labels whenever needed.
+
+namespace enblend
+{
+namespace hardmask
+{
+    typedef vigra::UInt16 label_t;
+
+    // Label of the pixels where no image has a positive weight
+    enum {NoLabel = 0, MaximumNumberOfImages = 65534};
+
+
+    namespace detail
+    {
+        // Let the weights W compete with the maxima MAX so far; where
+        // a weight is strictly larger it becomes the maximum and
+        // INDEX the label.  Ties go to the earlier image.
+        inline void
+        update_row_generic(size_t n, const float* w, float* max, label_t* label, label_t index)
+        {
+            for (size_t i = 0U; i != n; ++i)
+            {
+                const bool greater = w[i] > max[i];
+                max[i] = greater ? w[i] : max[i];
+                label[i] = greater ? index : label[i];
+            }
+        }
+
+
+#ifdef SKIPSM_SIMD_X86
+        __attribute__((target("sse4.2"))) inline void
+        update_row_sse42(size_t n, const float* w, float* max, label_t* label, label_t index)
+        {
+            const __m128i vindex = _mm_set1_epi16(static_cast<short>(index));
+            size_t i = 0U;
+
+            for (; i + 8U <= n; i += 8U)
+            {
+                const __m128 w0 = _mm_loadu_ps(w + i);
+                const __m128 w1 = _mm_loadu_ps(w + i + 4U);
+                const __m128 m0 = _mm_loadu_ps(max + i);
+                const __m128 m1 = _mm_loadu_ps(max + i + 4U);
+                const __m128 g0 = _mm_cmpgt_ps(w0, m0);
+                const __m128 g1 = _mm_cmpgt_ps(w1, m1);
+
+                _mm_storeu_ps(max + i, _mm_blendv_ps(m0, w0, g0));
+                _mm_storeu_ps(max + i + 4U, _mm_blendv_ps(m1, w1, g1));
+
+                const __m128i g = _mm_packs_epi32(_mm_castps_si128(g0), _mm_castps_si128(g1));
+                const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(label + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(label + i), _mm_blendv_epi8(l, vindex, g));
+            }
+
+            update_row_generic(n - i, w + i, max + i, label + i, index);
+        }
+
+
+        __attribute__((target("avx2"))) inline void
+        update_row_avx2(size_t n, const float* w, float* max, label_t* label, label_t index)
+        {
+            const __m128i vindex = _mm_set1_epi16(static_cast<short>(index));
+            size_t i = 0U;
+
+            for (; i + 8U <= n; i += 8U)
+            {
+                const __m256 vw = _mm256_loadu_ps(w + i);
+                const __m256 vmax = _mm256_loadu_ps(max + i);
+                const __m256 greater = _mm256_cmp_ps(vw, vmax, _CMP_GT_OQ);
+
+                _mm256_storeu_ps(max + i, _mm256_blendv_ps(vmax, vw, greater));
+
+                const __m256i g32 = _mm256_castps_si256(greater);
+                const __m128i g = _mm_packs_epi32(_mm256_castsi256_si128(g32), _mm256_extracti128_si256(g32, 1));
+                const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(label + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(label + i), _mm_blendv_epi8(l, vindex, g));
+            }
+
+            update_row_generic(n - i, w + i, max + i, label + i, index);
+        }
+#endif // SKIPSM_SIMD_X86
+
+
+#ifdef SKIPSM_SIMD_NEON
+        inline void
+        update_row_neon(size_t n, const float* w, float* max, label_t* label, label_t index)
+        {
+            const uint16x8_t vindex = vdupq_n_u16(index);
+            size_t i = 0U;
+
+            for (; i + 8U <= n; i += 8U)
+            {
+                const float32x4_t w0 = vld1q_f32(w + i);
+                const float32x4_t w1 = vld1q_f32(w + i + 4U);
+                const float32x4_t m0 = vld1q_f32(max + i);
+                const float32x4_t m1 = vld1q_f32(max + i + 4U);
+                const uint32x4_t g0 = vcgtq_f32(w0, m0);
+                const uint32x4_t g1 = vcgtq_f32(w1, m1);
+
+                vst1q_f32(max + i, vbslq_f32(g0, w0, m0));
+                vst1q_f32(max + i + 4U, vbslq_f32(g1, w1, m1));
+
+                const uint16x8_t g = vcombine_u16(vmovn_u32(g0), vmovn_u32(g1));
+                vst1q_u16(label + i, vbslq_u16(g, vindex, vld1q_u16(label + i)));
+            }
+
+            update_row_generic(n - i, w + i, max + i, label + i, index);
+        }
+#endif // SKIPSM_SIMD_NEON
+
+
+        typedef void (*UpdateRowFunction)(size_t, const float*, float*, label_t*, label_t);
+
+
+        inline UpdateRowFunction
+        select_update_row()
+        {
+            if (!parameter::as_boolean("hard-mask-simd", true)) //< hard-mask-simd 1
+            {
+                return update_row_generic;
+            }
+
+            switch (skipsm::detail::detect_instruction_set())
+            {
+#ifdef SKIPSM_SIMD_X86
+            case skipsm::SSE42Instructions:
+                return update_row_sse42;
+            case skipsm::AVX2Instructions: // fall through
+            case skipsm::AVX512Instructions:
+                return update_row_avx2;
+#endif
+#ifdef SKIPSM_SIMD_NEON
+            case skipsm::NEONInstructions:
+                return update_row_neon;
+#endif
+            default:
+                return update_row_generic;
+            }
+        }
+    } // namespace detail
+
+
+    class HardMask
+    {
+    public:
+        typedef vigra::BasicImage<float> WeightImageType;
+        typedef vigra::BasicImage<label_t> LabelImageType;
+
+        explicit HardMask(const vigra::Size2D& a_size) :
+            max_weight_(a_size, 0.0f), label_(a_size, label_t(NoLabel)),
+            update_row_(detail::select_update_row())
+        {}
+
+        const LabelImageType& labels() const {return label_;}
+
+        // Let the image with index AN_INDEX, counted from zero,
+        // compete with its weights A_MASK for the pixels.  Images must
+        // come in ascending order of their indices.
+        template <typename MaskType>
+        void update(const MaskType& a_mask, unsigned an_index)
+        {
+            const size_t width = static_cast<size_t>(label_.width());
+            const label_t label = static_cast<label_t>(an_index + 1U);
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (int y = 0; y < label_.height(); ++y)
+            {
+                update_row_(width, a_mask[y], max_weight_[y], label_[y], label);
+            }
+        }
+
+        // Write the hard mask of the image with index AN_INDEX to
+        // A_MASK: A_WINNER where the image has the largest weight,
+        // A_SHARE where no image has a positive weight, and zero
+        // elsewhere.
+        template <typename MaskType>
+        void extract(unsigned an_index,
+                     typename MaskType::value_type a_winner, typename MaskType::value_type a_share,
+                     MaskType& a_mask) const
+        {
+            typedef typename MaskType::value_type mask_value_type;
+
+            const int width = label_.width();
+            const label_t label = static_cast<label_t>(an_index + 1U);
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (int y = 0; y < label_.height(); ++y)
+            {
+                const label_t* l = label_[y];
+                mask_value_type* m = a_mask[y];
+
+                for (int x = 0; x < width; ++x)
+                {
+                    m[x] =
+                        l[x] == label ? a_winner :
+                        (l[x] == label_t(NoLabel) ? a_share : mask_value_type());
+                }
+            }
+        }
+
+    private:
+        WeightImageType max_weight_;
+        LabelImageType label_;
+        detail::UpdateRowFunction update_row_;
+    };
+} // namespace hardmask
+} // namespace enblend
+
+
+#endif // HARDMASK_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
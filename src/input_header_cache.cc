@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>                // floor()
+#include <cstdint>
+#include <cstring>              // memcmp()
+
+#include <fcntl.h>              // open()
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>             // read(), lseek(), close()
+#endif
+
+#include <tiffio.h>
+
+#include "openmp_def.h"
+#include "parameter.h"
+#include "input_header_cache.h"
+
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+namespace enblend
+{
+    LayerHeader::LayerHeader(const vigra::ImageImportInfo& an_info) :
+        width_(an_info.width()), height_(an_info.height()),
+        number_of_layers_(an_info.numImages()), index_(an_info.getImageIndex()),
+        bands_(an_info.numBands()), extra_bands_(an_info.numExtraBands()),
+        pixel_type_(an_info.getPixelType()), pixel_type_enum_(an_info.pixelType()),
+        position_(an_info.getPosition()),
+        x_resolution_(an_info.getXResolution()), y_resolution_(an_info.getYResolution())
+    {}
+
+
+    namespace
+    {
+        bool
+        has_tiff_magic(const unsigned char* a_magic)
+        {
+            return
+                std::memcmp(a_magic, "II*\0", 4U) == 0 || // classic, little endian
+                std::memcmp(a_magic, "MM\0*", 4U) == 0 || // classic, big endian
+                std::memcmp(a_magic, "II+\0", 4U) == 0 || // BigTIFF, little endian
+                std::memcmp(a_magic, "MM\0+", 4U) == 0;   // BigTIFF, big endian
+        }
+
+
+        // Answer the Vigra name of the pixel type of the current
+        // directory of A_TIFF or nullptr if Vigra would name it
+        // differently than our table does (e.g. "BILEVEL").
+        const char*
+        tiff_pixel_type(TIFF* a_tiff, vigra::ImageImportInfo::PixelType* a_pixel_type)
+        {
+            uint16_t bits_per_sample;
+            uint16_t sample_format;
+            TIFFGetFieldDefaulted(a_tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+            TIFFGetFieldDefaulted(a_tiff, TIFFTAG_SAMPLEFORMAT, &sample_format);
+
+            switch (sample_format)
+            {
+            case SAMPLEFORMAT_UINT:
+                switch (bits_per_sample)
+                {
+                case 8U: *a_pixel_type = vigra::ImageImportInfo::UINT8; return "UINT8";
+                case 16U: *a_pixel_type = vigra::ImageImportInfo::UINT16; return "UINT16";
+                case 32U: *a_pixel_type = vigra::ImageImportInfo::UINT32; return "UINT32";
+                default: return nullptr;
+                }
+            case SAMPLEFORMAT_INT:
+                switch (bits_per_sample)
+                {
+                case 16U: *a_pixel_type = vigra::ImageImportInfo::INT16; return "INT16";
+                case 32U: *a_pixel_type = vigra::ImageImportInfo::INT32; return "INT32";
+                default: return nullptr;
+                }
+            case SAMPLEFORMAT_IEEEFP:
+                switch (bits_per_sample)
+                {
+                case 32U: *a_pixel_type = vigra::ImageImportInfo::FLOAT; return "FLOAT";
+                case 64U: *a_pixel_type = vigra::ImageImportInfo::DOUBLE; return "DOUBLE";
+                default: return nullptr;
+                }
+            default:
+                return nullptr;
+            }
+        }
+    } // namespace
+
+
+    // Read the header of the current directory of A_TIFF into
+    // A_HEADER the way Vigra's TIFF decoder interprets it.  Answer
+    // false for anything we do not interpret ourselves.
+    bool
+    InputHeaderCache::read_tiff_directory(TIFF* a_tiff, LayerHeader* a_header)
+    {
+        uint32_t width;
+        uint32_t height;
+        if (!TIFFGetField(a_tiff, TIFFTAG_IMAGEWIDTH, &width) ||
+            !TIFFGetField(a_tiff, TIFFTAG_IMAGELENGTH, &height))
+        {
+            return false;
+        }
+
+        uint16_t photometric;
+        if (!TIFFGetField(a_tiff, TIFFTAG_PHOTOMETRIC, &photometric) ||
+            photometric == PHOTOMETRIC_PALETTE)
+        {
+            return false;       // Vigra expands palettes itself
+        }
+
+        const char* pixel_type = tiff_pixel_type(a_tiff, &a_header->pixel_type_enum_);
+        if (pixel_type == nullptr)
+        {
+            return false;
+        }
+
+        uint16_t resolution_unit;
+        TIFFGetFieldDefaulted(a_tiff, TIFFTAG_RESOLUTIONUNIT, &resolution_unit);
+        if (resolution_unit != RESUNIT_INCH)
+        {
+            return false;       // Vigra converts the resolution
+        }
+
+        uint16_t samples_per_pixel;
+        uint16_t extra_sample_count;
+        uint16_t* extra_sample_types;
+        TIFFGetFieldDefaulted(a_tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+        TIFFGetFieldDefaulted(a_tiff, TIFFTAG_EXTRASAMPLES, &extra_sample_count, &extra_sample_types);
+
+        float x_resolution = 0.0f;
+        float y_resolution = 0.0f;
+        TIFFGetField(a_tiff, TIFFTAG_XRESOLUTION, &x_resolution);
+        TIFFGetField(a_tiff, TIFFTAG_YRESOLUTION, &y_resolution);
+
+        float x_position = 0.0f;
+        float y_position = 0.0f;
+        TIFFGetField(a_tiff, TIFFTAG_XPOSITION, &x_position);
+        TIFFGetField(a_tiff, TIFFTAG_YPOSITION, &y_position);
+
+        a_header->width_ = static_cast<int>(width);
+        a_header->height_ = static_cast<int>(height);
+        a_header->bands_ = static_cast<int>(samples_per_pixel);
+        a_header->extra_bands_ = static_cast<int>(extra_sample_count);
+        a_header->pixel_type_ = pixel_type;
+        a_header->position_ =
+            vigra::Diff2D(static_cast<int>(std::floor(x_position * x_resolution + 0.5f)),
+                          static_cast<int>(std::floor(y_position * y_resolution + 0.5f)));
+        a_header->x_resolution_ = x_resolution;
+        a_header->y_resolution_ = y_resolution;
+
+        return true;
+    }
+
+
+    // Read the headers of all layers of the TIFF file A_FILENAME in
+    // a single pass over one open file.  Answer false if the file is
+    // not a TIFF or if any of its layers needs Vigra's own
+    // interpretation; the caller then falls back to Vigra.
+    bool
+    InputHeaderCache::read_tiff_entry(const std::string& a_filename, Entry* an_entry)
+    {
+        const int fd = ::open(a_filename.c_str(), O_RDONLY | O_BINARY);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        unsigned char magic[4];
+        if (::read(fd, magic, sizeof(magic)) != static_cast<int>(sizeof(magic)) ||
+            !has_tiff_magic(magic) ||
+            ::lseek(fd, 0, SEEK_SET) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+#ifdef _WIN32
+        // libtiff wants a native file handle on Windows.
+        ::close(fd);
+        TIFF* tiff = TIFFOpen(a_filename.c_str(), "r");
+#else
+        TIFF* tiff = TIFFFdOpen(fd, a_filename.c_str(), "r");
+        if (tiff == nullptr)
+        {
+            ::close(fd);
+        }
+#endif
+        if (tiff == nullptr)
+        {
+            return false;
+        }
+
+        const int number_of_layers = static_cast<int>(TIFFNumberOfDirectories(tiff));
+        layer_list layers(number_of_layers);
+        bool ok = number_of_layers >= 1;
+
+        for (int i = 0; ok && i < number_of_layers; ++i)
+        {
+            layers[i].number_of_layers_ = number_of_layers;
+            layers[i].index_ = i;
+            ok = TIFFSetDirectory(tiff, static_cast<uint16_t>(i)) && read_tiff_directory(tiff, &layers[i]);
+        }
+
+        TIFFClose(tiff);    // also closes FD
+
+        if (ok)
+        {
+            an_entry->is_image = true;
+            an_entry->layers = std::move(layers);
+        }
+
+        return ok;
+    }
+
+
+    void
+    InputHeaderCache::read_vigra_entry(const std::string& a_filename, Entry* an_entry)
+    {
+        // Vigra's codec registry is process-wide and not documented
+        // to be thread-safe, so at most one thread may be inside
+        // vigra impex at a time.
+#ifdef OPENMP
+#pragma omp critical (input_header_cache_vigra_impex)
+#endif
+        {
+            try
+            {
+                an_entry->is_image = vigra::isImage(a_filename.c_str());
+                if (an_entry->is_image)
+                {
+                    const vigra::ImageImportInfo info(a_filename.c_str());
+
+                    an_entry->layers.push_back(LayerHeader(info));
+                    for (int i = 1; i < info.numImages(); ++i)
+                    {
+                        // Only TIFF has more than one layer and ended
+                        // up here for a layer we do not interpret
+                        // ourselves.
+                        vigra::ImageImportInfo layer_info(info);
+                        layer_info.setImageIndex(i);
+                        an_entry->layers.push_back(LayerHeader(layer_info));
+                    }
+                }
+            }
+            catch (...)
+            {
+                an_entry->error = std::current_exception();
+            }
+        }
+    }
+
+
+    void
+    InputHeaderCache::read_entry(const std::string& a_filename, Entry* an_entry)
+    {
+        if (!read_tiff_entry(a_filename, an_entry))
+        {
+            read_vigra_entry(a_filename, an_entry);
+        }
+
+#ifdef HAVE_EXIV2
+        // Exiv2 (0.27 and later) guarantees that distinct Image
+        // objects may be used concurrently; the only shared state
+        // that gets written, the XMP toolkit, is set up by scan()
+        // before the threads start.  Thus meta-data reads overlap
+        // without a lock.
+        if (an_entry->is_image && !an_entry->error)
+        {
+            try
+            {
+                an_entry->metadata = metadata::read(a_filename);
+            }
+            catch (...)
+            {
+                an_entry->metadata_error = std::current_exception();
+            }
+        }
+#endif
+    }
+
+
+    void
+    InputHeaderCache::scan(const std::vector<std::string>& a_filenames)
+    {
+        std::vector<std::string> filenames;
+        for (auto const& filename : a_filenames)
+        {
+            if (entries_.find(filename) == entries_.end() &&
+                std::find(filenames.begin(), filenames.end(), filename) == filenames.end())
+            {
+                filenames.push_back(filename);
+            }
+        }
+
+        std::vector<Entry> entries(filenames.size());
+        const int n = static_cast<int>(filenames.size());
+
+#ifdef HAVE_EXIV2
+        Exiv2::XmpParser::initialize(); // not thread-safe; must precede the parallel reads
+#endif
+
+#ifdef OPENMP
+        // Reading headers waits for the file system rather than the
+        // CPU, so we may well run more threads than there are cores.
+        const int threads = std::max(1, parameter::as_integer("header-scan-threads", //< header-scan-threads 8
+                                                              std::max(8, omp_get_max_threads())));
+#pragma omp parallel for num_threads(threads) schedule(dynamic)
+#endif
+        for (int i = 0; i < n; ++i)
+        {
+            read_entry(filenames[i], &entries[i]);
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            entries_.insert(entry_map::value_type(filenames[i], std::move(entries[i])));
+        }
+    }
+
+
+    InputHeaderCache::Entry&
+    InputHeaderCache::entry(const std::string& a_filename)
+    {
+        entry_map::iterator e = entries_.find(a_filename);
+
+        if (e == entries_.end())
+        {
+            scan(std::vector<std::string>(1U, a_filename));
+            e = entries_.find(a_filename);
+            assert(e != entries_.end());
+        }
+
+        return e->second;
+    }
+
+
+    bool
+    InputHeaderCache::is_image(const std::string& a_filename)
+    {
+        return entry(a_filename).is_image;
+    }
+
+
+    const InputHeaderCache::layer_list&
+    InputHeaderCache::layers(const std::string& a_filename)
+    {
+        const Entry& e = entry(a_filename);
+
+        if (e.error)
+        {
+            std::rethrow_exception(e.error);
+        }
+
+        return e.layers;
+    }
+
+
+    const LayerHeader&
+    InputHeaderCache::layer(const std::string& a_filename, unsigned an_index)
+    {
+        const layer_list& all_layers = layers(a_filename);
+
+        vigra_precondition(an_index < all_layers.size(),
+                           "InputHeaderCache::layer: layer index out of range");
+
+        return all_layers[an_index];
+    }
+
+
+#ifdef HAVE_EXIV2
+    Exiv2::Image::UniquePtr
+    InputHeaderCache::take_metadata(const std::string& a_filename)
+    {
+        Entry& e = entry(a_filename);
+
+        if (e.metadata_error)
+        {
+            std::exception_ptr error = e.metadata_error;
+            e.metadata_error = nullptr;
+            std::rethrow_exception(error);
+        }
+        else if (e.metadata)
+        {
+            return std::move(e.metadata);
+        }
+        else
+        {
+            return metadata::read(a_filename);
+        }
+    }
+#endif
+} // namespace enblend
+
+
+// Local Variables:
+// mode: c++
+// End:
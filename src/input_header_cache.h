@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef INPUT_HEADER_CACHE_H_INCLUDED_
+#define INPUT_HEADER_CACHE_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <vigra/imageinfo.hxx>
+
+#include "metadata.h"
+
+
+typedef struct tiff TIFF;       // as in <tiffio.h>
+
+namespace enblend
+{
+    // Header of one layer of an input image
+    //
+    // It answers the questions that the layer selection and the
+    // checks before the image loop ask, with the names of
+    // vigra::ImageImportInfo.  Unlike the latter it does not need
+    // the file to be open.
+    class LayerHeader
+    {
+    public:
+        LayerHeader() = default;
+        explicit LayerHeader(const vigra::ImageImportInfo& an_info);
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+        int numImages() const {return number_of_layers_;}
+        int getImageIndex() const {return index_;}
+        int numBands() const {return bands_;}
+        int numExtraBands() const {return extra_bands_;}
+        bool isColor() const {return bands_ - extra_bands_ == 3;}
+        bool isGrayscale() const {return bands_ - extra_bands_ == 1;}
+        const char* getPixelType() const {return pixel_type_.c_str();}
+        vigra::ImageImportInfo::PixelType pixelType() const {return pixel_type_enum_;}
+        vigra::Diff2D getPosition() const {return position_;}
+        float getXResolution() const {return x_resolution_;}
+        float getYResolution() const {return y_resolution_;}
+
+    private:
+        friend class InputHeaderCache;
+
+        int width_ = 0;
+        int height_ = 0;
+        int number_of_layers_ = 0;
+        int index_ = 0;
+        int bands_ = 0;
+        int extra_bands_ = 0;
+        std::string pixel_type_;
+        vigra::ImageImportInfo::PixelType pixel_type_enum_ = vigra::ImageImportInfo::UINT8;
+        vigra::Diff2D position_;
+        float x_resolution_ = 0.0f;
+        float y_resolution_ = 0.0f;
+    };
+
+
+    // Headers of all input images
+    //
+    // Before any pixel is touched, the input files get checked for
+    // being images, their layers get enumerated for the layer
+    // selection, and -- with Exiv2 -- their meta-data are read.
+    //
+    // scan() reads all of that up front and concurrently.  A TIFF
+    // file gets opened once, and libtiff, whose handles are
+    // independent of each other, reads the headers of all its layers
+    // in that one pass; the layer selection and the checks draw from
+    // these headers.  Other formats, and the few TIFF layouts that
+    // Vigra interprets in its own way (palettes, bilevel images, ...),
+    // go through Vigra's codec registry, which is process-wide and
+    // not documented to be thread-safe, so only these reads are
+    // serialized.  Exiv2 reads the meta-data on its own.  Failures
+    // are recorded and rethrown to the consumer that asks for the
+    // data, so the diagnostics appear in the same order and with the
+    // same text as without the cache.
+    class InputHeaderCache
+    {
+    public:
+        typedef std::vector<LayerHeader> layer_list;
+
+        InputHeaderCache() = default;
+        InputHeaderCache(const InputHeaderCache&) = delete;
+        InputHeaderCache& operator=(const InputHeaderCache&) = delete;
+
+        // Read the headers of all A_FILENAMES not yet in the cache.
+        void scan(const std::vector<std::string>& a_filenames);
+
+        // Answer whether A_FILENAME is an image we can read.
+        bool is_image(const std::string& a_filename);
+
+        // Answer the headers of all layers of A_FILENAME.  Throw what
+        // reading the header threw.
+        const layer_list& layers(const std::string& a_filename);
+
+        // Answer the header of layer AN_INDEX (zero-based) of
+        // A_FILENAME.
+        const LayerHeader& layer(const std::string& a_filename, unsigned an_index);
+
+#ifdef HAVE_EXIV2
+        // Hand over the meta-data of A_FILENAME.  The first call per
+        // file yields the cached data; further calls read the file
+        // again.  Throw what reading the meta-data threw.
+        Exiv2::Image::UniquePtr take_metadata(const std::string& a_filename);
+#endif
+
+        void clear() {entries_.clear();}
+
+    private:
+        struct Entry
+        {
+            Entry() : is_image(false) {}
+
+            bool is_image;
+            layer_list layers;
+            std::exception_ptr error;
+#ifdef HAVE_EXIV2
+            Exiv2::Image::UniquePtr metadata;
+            std::exception_ptr metadata_error;
+#endif
+        };
+
+        typedef std::map<std::string, Entry> entry_map;
+
+        static bool read_tiff_directory(TIFF* a_tiff, LayerHeader* a_header);
+        static bool read_tiff_entry(const std::string& a_filename, Entry* an_entry);
+        static void read_vigra_entry(const std::string& a_filename, Entry* an_entry);
+        static void read_entry(const std::string& a_filename, Entry* an_entry);
+        Entry& entry(const std::string& a_filename);
+
+        entry_map entries_;
+    };
+} // namespace enblend
+
+
+#endif // INPUT_HEADER_CACHE_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
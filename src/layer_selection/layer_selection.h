@@ -57,6 +57,31 @@ public:
 
     template <class const_iterator>
     void retrieve_image_information(const_iterator begin, const_iterator end)
+    {
+        std::vector<vigra::ImageImportInfo> layers;
+
+        retrieve_image_information(begin, end,
+                                   [&layers](const std::string& a_filename)
+                                   -> const std::vector<vigra::ImageImportInfo>&
+                                   {
+                                       vigra::ImageImportInfo file_info(a_filename.c_str());
+
+                                       layers.assign(1U, file_info);
+                                       for (int layer = 1; layer < file_info.numImages(); ++layer)
+                                       {
+                                           layers.push_back(file_info);
+                                           layers.back().setImageIndex(layer);
+                                       }
+                                       return layers;
+                                   });
+    }
+
+    // Retrieve the information of all layers through LAYERS_OF, which
+    // maps a filename to the headers of each of its layers, e.g. the
+    // enblend::LayerHeaders of an enblend::InputHeaderCache or a
+    // vector of vigra::ImageImportInfo.
+    template <class const_iterator, class layer_source>
+    void retrieve_image_information(const_iterator begin, const_iterator end, layer_source layers_of)
     {
         delete info_;
         info_ = new ImageListInformation;
@@ -67,22 +92,19 @@ public:
         for (const_iterator image = begin; image != end; ++image)
         {
             ImageInfo image_info((*image)->filename());
-            vigra::ImageImportInfo file_info((*image)->filename().c_str());
+            const auto& layers(layers_of((*image)->filename()));
 
-            for (int layer = 0; layer < file_info.numImages(); ++layer)
+            for (auto const& layer_info : layers)
             {
-                std::unique_ptr<vigra::ImageImportInfo> layer_info(new vigra::ImageImportInfo(file_info));
-                layer_info->setImageIndex(layer);
-
-                image_info.append(LayerInfo(layer_info->width(), layer_info->height(),
-                                            layer_info->isColor(), layer_info->pixelType(),
-                                            layer_info->getPosition(),
-                                            layer_info->getXResolution(), layer_info->getYResolution()));
+                image_info.append(LayerInfo(layer_info.width(), layer_info.height(),
+                                            layer_info.isColor(), layer_info.pixelType(),
+                                            layer_info.getPosition(),
+                                            layer_info.getXResolution(), layer_info.getYResolution()));
             }
 
             info_->append(image_info);
             tally_->insert(file_tally_t::value_type((*image)->filename(),
-                                                    layer_tally_t(file_info.numImages())));
+                                                    layer_tally_t(layers.size())));
         }
     }
 
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef LIBENFUSE_H_INCLUDED_
+#define LIBENFUSE_H_INCLUDED_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// Enfuse as an in-process library
+//
+// The caller owns all pixel buffers.  Inputs are read through strided
+// views and the result is written into the caller's output view, so
+// no image gets encoded to or decoded from a file.  The library
+// blends in identity space, which is what Enfuse does for inputs
+// without ICC profile.
+//
+// fuse() is reentrant: each call gets its configuration from its
+// options alone and touches no process-wide state, so several threads
+// may fuse at the same time.  Each call may use all cores through
+// OpenMP.  The library runs at the default verbosity of the
+// command-line tool, whose few warnings go to std::cerr; errors that
+// make the command-line tool exit come back as the answer of fuse()
+// instead.
+//
+// There is no Enblend counterpart.
+namespace libenfuse
+{
+    enum class sample_type {uint8, uint16, float32};
+
+
+    // View of a caller-owned image with interleaved channels
+    struct image_view
+    {
+        void* pixels;               // first sample of the top row
+        unsigned width;
+        unsigned height;
+        std::ptrdiff_t row_stride;  // distance of two rows in bytes
+        unsigned channels;          // 1 for grayscale or 3 for RGB
+        sample_type sample;
+    };
+
+
+    // View of a caller-owned 8-bit alpha channel; zero means
+    // transparent, anything else opaque
+    struct alpha_view
+    {
+        unsigned char* pixels;      // nullptr means fully opaque
+        std::ptrdiff_t row_stride;  // distance of two rows in bytes
+    };
+
+
+    struct input_image
+    {
+        image_view image;
+        alpha_view alpha;
+        int x;                      // position of the image in the output canvas
+        int y;
+    };
+
+
+    // The output covers the union of all input images and has their
+    // sample type and number of channels.  Pixels outside of the union
+    // of the input alpha channels are left alone.
+    struct output_image
+    {
+        image_view image;
+        alpha_view alpha;           // optional; receives the union of the input alphas
+    };
+
+
+    // Counterparts of Enfuse's fusion options; the defaults are those
+    // of the command-line tool.
+    struct options
+    {
+        options() :
+            exposure_weight(1.0), saturation_weight(0.0), contrast_weight(0.0), entropy_weight(0.0),
+            exposure_optimum(0.5), exposure_width(0.2), exposure_weight_function("gaussian"),
+            contrast_window_size(5), entropy_window_size(3),
+            levels(0), hard_mask(false), wrap_around(false)
+        {}
+
+        double exposure_weight;     // --exposure-weight
+        double saturation_weight;   // --saturation-weight; ignored for grayscale images
+        double contrast_weight;     // --contrast-weight
+        double entropy_weight;      // --entropy-weight
+        double exposure_optimum;    // --exposure-optimum
+        double exposure_width;      // --exposure-width
+        std::string exposure_weight_function; // --exposure-weight-function, name part
+        std::vector<std::string> exposure_weight_function_arguments; // ... and the arguments
+        std::string grayscale_projector; // --gray-projector; empty selects the default
+        int contrast_window_size;   // --contrast-window-size
+        int entropy_window_size;    // --entropy-window-size
+        int levels;                 // --levels; 0 selects the maximum
+        bool hard_mask;             // --hard-mask
+        bool wrap_around;           // --wrap=horizontal
+    };
+
+
+    // Fuse SOME_INPUTS into AN_OUTPUT.  Answer an empty string on
+    // success and the reason of the failure otherwise.
+    std::string fuse(const options& some_options,
+                     const std::vector<input_image>& some_inputs,
+                     const output_image& an_output);
+} // namespace libenfuse
+
+
+#endif // LIBENFUSE_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
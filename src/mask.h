@@ -25,9 +25,14 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <functional>
+#include <memory>
 #include <numeric>
+#include <vector>
 
 #include <vigra/contourcirculator.hxx>
 #include <vigra/error.hxx>
@@ -53,6 +58,8 @@
 #include "graphcut.h"
 #include "maskcommon.h"
 #include "masktypedefs.h"
+#include "mismatch_planes.h"
+#include "packed_alpha.h"
 
 
 using vigra::functor::Arg1;
@@ -493,11 +500,30 @@ fillContourScanLineActive(MaskType* mask, const Contour& contour, const vigra::D
 }
 
 
+template <typename MaskType>
+void
+fillContourScanLineBanded(MaskType* mask, const Contour& contour, const vigra::Diff2D& offset)
+{
+    typedef typename MaskType::PixelType MaskPixelType;
+    typedef typename MaskType::Accessor MaskAccessor;
+
+    const vigra::Size2D mask_size(mask->lowerRight() - mask->upperLeft());
+    std::vector<vigra::Point2D> polygon;
+
+    closedPolygonsOfContourSegments(mask_size, contour, std::back_inserter(polygon));
+
+    vigra_ext::fill_polygon_banded(mask->upperLeft() + offset, mask->lowerRight() + offset,
+                                   XorAccessor<MaskPixelType, MaskAccessor>(mask->accessor()),
+                                   polygon.begin(), polygon.end(),
+                                   ~MaskPixelType());
+}
+
+
 template <typename MaskType>
 void
 fillContour(MaskType* mask, const Contour& contour, const vigra::Diff2D& offset)
 {
-    const std::string routine_name(parameter::as_string("polygon-filler", "new-active"));
+    const std::string routine_name(parameter::as_string("polygon-filler", "new-banded")); //< polygon-filler new-banded
 
 #ifdef DEBUG_POLYGON_FILL
     std::cout << "+ fillContour: mask offset = " << offset << "\n";
@@ -508,12 +534,58 @@ fillContour(MaskType* mask, const Contour& contour, const vigra::Diff2D& offset)
         std::cout << "+ fillContour: use fillContourScanLine polygon filler\n";
 #endif
         fillContourScanLine(mask, contour, offset);
-    } else {
+    } else if (routine_name == "new-active") {
 #ifdef DEBUG_POLYGON_FILL
         std::cout << "+ fillContour: use fillContourScanLineActive polygon filler\n";
 #endif
         fillContourScanLineActive(mask, contour, offset);
+    } else {
+#ifdef DEBUG_POLYGON_FILL
+        std::cout << "+ fillContour: use fillContourScanLineBanded polygon filler\n";
+#endif
+        fillContourScanLineBanded(mask, contour, offset);
+    }
+}
+
+
+// Answer the first index in [0, n) where the sequences a and b
+// differ, or n if they agree.  Equal runs get skipped a machine word
+// at a time.
+template <typename T>
+inline static int
+firstMismatch(const T* a, const T* b, int n)
+{
+    const int chunk = std::max(1, static_cast<int>(sizeof(uint64_t) / sizeof(T)));
+    int i = 0;
+
+    while (i + chunk <= n && std::memcmp(a + i, b + i, chunk * sizeof(T)) == 0) {
+        i += chunk;
+    }
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+
+    return i;
+}
+
+
+// Answer the last index in [0, n) where the sequences a and b differ,
+// or -1 if they agree.
+template <typename T>
+inline static int
+lastMismatch(const T* a, const T* b, int n)
+{
+    const int chunk = std::max(1, static_cast<int>(sizeof(uint64_t) / sizeof(T)));
+    int i = n;
+
+    while (i - chunk >= 0 && std::memcmp(a + i - chunk, b + i - chunk, chunk * sizeof(T)) == 0) {
+        i -= chunk;
+    }
+    while (i > 0 && a[i - 1] == b[i - 1]) {
+        --i;
     }
+
+    return i - 1;
 }
 
 
@@ -522,42 +594,46 @@ void
 maskBounds(MaskType* mask, const vigra::Rect2D& uBB, vigra::Rect2D& mBB)
 {
     typedef typename MaskType::PixelType MaskPixelType;
-    typedef typename MaskType::traverser MaskIteratorType;
 
     // Find the bounding box of the mask transition line and put it in mBB.
     // mBB starts out as empty rectangle.
     mBB = vigra::Rect2D(vigra::Point2D(mask->size()), vigra::Point2D(0, 0));
 
-    MaskIteratorType myPrev = mask->upperLeft();
-    MaskIteratorType my = mask->upperLeft() + vigra::Diff2D(0, 1);
-    MaskIteratorType mend = mask->lowerRight();
-    MaskIteratorType mxLeft = myPrev;
-    MaskIteratorType mx = myPrev + vigra::Diff2D(1, 0);
+    // Each row contributes the extreme transitions to its left
+    // neighbor and to the row above; the rows are independent.
+    const int width = mask->width();
+    const int height = mask->height();
+    std::vector<vigra::Rect2D> rowBB(height);
 
-    for (int x = 1; mx.x < mend.x; ++x, ++mx.x, ++mxLeft.x) {
-        if (*mxLeft != *mx) {
-            mBB |= vigra::Rect2D(x - 1, 0, x + 1, 1);
-        }
-    }
-    for (int y = 1; my.y < mend.y; ++y, ++my.y, ++myPrev.y) {
-        mxLeft = my;
-        mx = my + vigra::Diff2D(1, 0);
-        MaskIteratorType mxUpLeft = myPrev;
-        MaskIteratorType mxUp = myPrev + vigra::Diff2D(1, 0);
-
-        if (*mxUpLeft != *mxLeft) {
-            // Transition line is between mxUpLeft and mxLeft.
-            mBB |= vigra::Rect2D(0, y - 1, 1, y + 1);
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int y = 0; y < height; ++y) {
+        const MaskPixelType* row = (*mask)[y];
+        vigra::Rect2D bb;
+
+        // Transitions between x and x + 1
+        const int first = firstMismatch(row, row + 1, width - 1);
+        if (first < width - 1) {
+            bb |= vigra::Rect2D(first, y, lastMismatch(row, row + 1, width - 1) + 2, y + 1);
         }
 
-        for (int x = 1; mx.x < mend.x; ++x, ++mx.x, ++mxLeft.x, ++mxUp.x) {
-            if (*mxLeft != *mx) {
-                mBB |= vigra::Rect2D(x - 1, y, x + 1, y + 1);
-            }
-            if (*mxUp != *mx) {
-                mBB |= vigra::Rect2D(x, y - 1, x + 1, y + 1);
+        // Transitions between (x, y - 1) and (x, y)
+        if (y > 0) {
+            const MaskPixelType* rowAbove = (*mask)[y - 1];
+            const int firstUp = firstMismatch(rowAbove, row, width);
+            if (firstUp < width) {
+                bb |= vigra::Rect2D(firstUp, y - 1, lastMismatch(rowAbove, row, width) + 1, y + 1);
             }
         }
+
+        rowBB[y] = bb;
+    }
+
+    for (int y = 0; y < height; ++y) {
+        if (!rowBB[y].isEmpty()) {
+            mBB |= rowBB[y];
+        }
     }
 
     // Check that mBB is well-defined.
@@ -934,37 +1010,7 @@ search_for_isolated_points(const AlphaType* const alpha)
     // work on along the edges.  If necessary the test can be extended
     // to the edges using `vigra::RestrictedNeighborhoodCirculator'.
 
-    typedef typename AlphaType::const_traverser alpha_traverser;
-    typedef vigra::NeighborhoodCirculator<alpha_traverser, vigra::EightNeighborCode> circulator;
-
-    const alpha_traverser t_end(alpha->lowerRight() - vigra::Diff2D(1, 1));
-    const vigra::Size2D size(alpha->size());
-
-    unsigned number_of_isolated_points(0U);
-
-#ifdef OPENMP
-#pragma omp parallel for reduction(+: number_of_isolated_points) schedule(guided)
-#endif
-    for (int row = 1; row < size.y - 1; ++row) {
-        alpha_traverser t(alpha->upperLeft() + vigra::Diff2D(1, row));
-        for (t.x = 1; t.x != t_end.x; ++t.x) {
-            if (*t == 0) {
-                circulator c(t);
-                const circulator c_end(c);
-
-                while (true) {
-                    if (*c == 0) {
-                        break;
-                    }
-                    ++c;
-                    if (c == c_end) {
-                        ++number_of_isolated_points;
-                        break;
-                    }
-                }
-            }
-        }
-    }
+    const unsigned number_of_isolated_points = PackedAlpha(srcImageRange(*alpha)).isolated_points();
 
     if (number_of_isolated_points >=
         std::max(1U, parameter::as_unsigned("black-alpha-mask-check-isolated-points-threshold", 2U))) {
@@ -981,6 +1027,137 @@ search_for_isolated_points(const AlphaType* const alpha)
 }
 
 
+/** Difference planes of the accumulated black image, which live from
+ *  one blend step to the next.  Only the member that belongs to the
+ *  active difference functor ever gets allocated.
+ */
+template <typename ImagePixelType>
+struct DifferencePlaneCache
+{
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType PixelComponentType;
+
+    std::unique_ptr<DifferencePlanes<HueLuminancePlaneFunctor<PixelComponentType> > > hueLuminance;
+    std::unique_ptr<DifferencePlanes<LabPlaneFunctor<PixelComponentType> > > lab;
+
+    void invalidate(const vigra::Rect2D& aRect) {
+        if (hueLuminance) {
+            hueLuminance->invalidate(aRect);
+        }
+        if (lab) {
+            lab->invalidate(aRect);
+        }
+    }
+};
+
+
+/** Compute the mismatch image of white and black at every
+ *  stride-th pixel of uvBB from the difference planes of the images.
+ *  If cachedBlackPlanes is non-null it keeps the planes of black for
+ *  the next call.
+ */
+template <typename Functor, typename ImageType, typename DestIterator, typename DestAccessor>
+void
+planeMismatchImage(const Functor& functor,
+                   const ImageType* const white,
+                   const ImageType* const black,
+                   const vigra::Rect2D& uvBB,
+                   int stride,
+                   vigra::pair<DestIterator, DestAccessor> dest,
+                   std::unique_ptr<DifferencePlanes<typename Functor::PlaneFunctor> >* cachedBlackPlanes)
+{
+    typedef typename Functor::PlaneFunctor PlaneFunctor;
+    typedef DifferencePlanes<PlaneFunctor> PlanesType;
+
+    const PlaneFunctor toPlane;
+    PlanesType whitePlanes(uvBB);
+    whitePlanes.update(*white, uvBB, stride, toPlane);
+
+    std::unique_ptr<PlanesType> localBlackPlanes;
+    PlanesType* blackPlanes;
+    if (cachedBlackPlanes) {
+        if (!*cachedBlackPlanes) {
+            cachedBlackPlanes->reset(new PlanesType(vigra::Rect2D(black->size())));
+        }
+        blackPlanes = cachedBlackPlanes->get();
+    } else {
+        localBlackPlanes.reset(new PlanesType(uvBB));
+        blackPlanes = localBlackPlanes.get();
+    }
+    blackPlanes->update(*black, uvBB, stride, toPlane);
+
+    planeDifferences(whitePlanes, *blackPlanes, uvBB, stride, dest, functor);
+}
+
+
+template <typename ImageType, typename DestIterator, typename DestAccessor>
+void
+calculateMismatchImage(const ImageType* const white,
+                       const ImageType* const black,
+                       const vigra::Rect2D& uvBB,
+                       int stride,
+                       vigra::pair<DestIterator, DestAccessor> dest,
+                       DifferencePlaneCache<typename ImageType::PixelType>*,
+                       vigra::VigraTrueType)
+{
+    typedef typename ImageType::PixelType ImagePixelType;
+    typedef typename DestAccessor::value_type MismatchImagePixelType;
+
+    // Gray-scale pixels are their own planes.
+    switch (PixelDifferenceFunctor)
+    {
+    case HueLuminanceMaxDifference:
+        vigra::omp::combineTwoImages(vigra_ext::stride(stride, stride, vigra_ext::apply(uvBB, srcImageRange(*white))),
+                                     vigra_ext::stride(stride, stride, vigra_ext::apply(uvBB, srcImage(*black))),
+                                     dest,
+                                     MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                                     (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+        break;
+    case DeltaEDifference:
+        vigra::omp::combineTwoImages(vigra_ext::stride(stride, stride, vigra_ext::apply(uvBB, srcImageRange(*white))),
+                                     vigra_ext::stride(stride, stride, vigra_ext::apply(uvBB, srcImage(*black))),
+                                     dest,
+                                     DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                                     (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+        break;
+    default:
+        NEVER_REACHED("switch control expression \"PixelDifferenceFunctor\" out of range");
+    }
+}
+
+
+template <typename ImageType, typename DestIterator, typename DestAccessor>
+void
+calculateMismatchImage(const ImageType* const white,
+                       const ImageType* const black,
+                       const vigra::Rect2D& uvBB,
+                       int stride,
+                       vigra::pair<DestIterator, DestAccessor> dest,
+                       DifferencePlaneCache<typename ImageType::PixelType>* blackPlanes,
+                       vigra::VigraFalseType)
+{
+    typedef typename ImageType::PixelType ImagePixelType;
+    typedef typename DestAccessor::value_type MismatchImagePixelType;
+
+    switch (PixelDifferenceFunctor)
+    {
+    case HueLuminanceMaxDifference:
+        planeMismatchImage(MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                           (LuminanceDifferenceWeight, ChrominanceDifferenceWeight),
+                           white, black, uvBB, stride, dest,
+                           blackPlanes ? &blackPlanes->hueLuminance : nullptr);
+        break;
+    case DeltaEDifference:
+        planeMismatchImage(DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                           (LuminanceDifferenceWeight, ChrominanceDifferenceWeight),
+                           white, black, uvBB, stride, dest,
+                           blackPlanes ? &blackPlanes->lab : nullptr);
+        break;
+    default:
+        NEVER_REACHED("switch control expression \"PixelDifferenceFunctor\" out of range");
+    }
+}
+
+
 /** Calculate a blending mask between whiteImage and blackImage.
  */
 template <typename ImageType, typename AlphaType, typename MaskType>
@@ -994,7 +1171,8 @@ createMask(const ImageType* const white,
            bool wraparound,
            unsigned numberOfImages,
            FileNameList::const_iterator inputFileNameIterator,
-           unsigned m)
+           unsigned m,
+           DifferencePlaneCache<typename ImageType::PixelType>* blackPlanes = nullptr)
 {
     typedef typename ImageType::PixelType ImagePixelType;
     typedef typename MaskType::PixelType MaskPixelType;
@@ -1295,25 +1473,10 @@ createMask(const ImageType* const white,
     //                  !Visualize && !CoarseMask: iBB * UInt8
 
     // Calculate mismatch image
-    switch (PixelDifferenceFunctor)
-    {
-    case HueLuminanceMaxDifference:
-        vigra::omp::combineTwoImages(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
-                                     vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
-                                     vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
-                                     MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
-                                     (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
-        break;
-    case DeltaEDifference:
-        vigra::omp::combineTwoImages(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
-                                     vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
-                                     vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
-                                     DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
-                                     (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
-        break;
-    default:
-        NEVER_REACHED("switch control expression \"PixelDifferenceFunctor\" out of range");
-    }
+    calculateMismatchImage(white, black, uvBB, mismatchImageStride,
+                           vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
+                           blackPlanes,
+                           typename vigra::NumericTraits<ImagePixelType>::isScalar());
 
     if (Verbose >= VERBOSE_DIFFERENCE_STATISTICS) {
         auto non_maximum(std::bind(std::not_equal_to<MismatchImagePixelType>(),
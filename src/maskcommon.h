@@ -24,7 +24,15 @@
 
 namespace enblend {
 
-    template <typename PixelType, typename ResultType>
+    // Base of the pixel-difference functors
+    //
+    // A Derived functor maps RGB pixels with plane() to the
+    // coordinates in which it compares them and answers the
+    // difference of two such coordinates with planeDifference().
+    // Two RGB pixels compared directly go through the Derived's
+    // rgbDifference().  The base class dispatches statically, so
+    // that the per-pixel calls inline.
+    template <typename PixelType, typename ResultType, typename Derived>
     class DifferenceFunctor
     {
     public:
@@ -38,17 +46,17 @@ namespace enblend {
                                              ResultType(vigra::NumericTraits<ResultPixelComponentType>::min()),
                                              ResultType(vigra::NumericTraits<ResultPixelComponentType>::max()))) {}
 
-        virtual ~DifferenceFunctor() {}
-
         ResultType operator()(const PixelType& a, const PixelType& b) const {
             typedef typename vigra::NumericTraits<PixelType>::isScalar src_is_scalar;
             return difference(a, b, src_is_scalar());
         }
 
     protected:
-        virtual ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
-                                      const vigra::RGBValue<PixelComponentType>& b,
-                                      vigra::VigraFalseType) const = 0;
+        ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
+                              const vigra::RGBValue<PixelComponentType>& b,
+                              vigra::VigraFalseType) const {
+            return static_cast<const Derived&>(*this).rgbDifference(a, b);
+        }
 
         ResultType difference(PixelType a, PixelType b, vigra::VigraTrueType) const {
             typedef typename vigra::NumericTraits<PixelType>::isSigned src_is_signed;
@@ -103,13 +111,48 @@ namespace enblend {
     }
 
 
+    // Luminance and hue of an RGB pixel, the coordinates in which
+    // MaxHueLuminanceDifferenceFunctor compares pixels
+    template <typename PixelComponentType>
+    struct HueLuminancePlaneFunctor
+    {
+        typedef vigra::TinyVector<PixelComponentType, 2> result_type;
+
+        result_type operator()(const vigra::RGBValue<PixelComponentType>& a) const {
+            return result_type(a.luminance(), hue(a));
+        }
+    };
+
+
+    // L*a*b* coordinates of an RGB pixel, the coordinates in which
+    // DeltaEPixelDifferenceFunctor compares pixels
+    template <typename PixelComponentType>
+    class LabPlaneFunctor
+    {
+    public:
+        typedef vigra::TinyVector<double, 3> result_type;
+
+        LabPlaneFunctor() : rgb_to_lab_(vigra::NumericTraits<PixelComponentType>::max()) {}
+
+        result_type operator()(const vigra::RGBValue<PixelComponentType>& a) const {
+            return result_type(rgb_to_lab_(a));
+        }
+
+    private:
+        vigra::RGB2LabFunctor<double> rgb_to_lab_;
+    };
+
+
     template <typename PixelType, typename ResultType>
-    class MaxHueLuminanceDifferenceFunctor : public DifferenceFunctor<PixelType, ResultType>
+    class MaxHueLuminanceDifferenceFunctor :
+        public DifferenceFunctor<PixelType, ResultType, MaxHueLuminanceDifferenceFunctor<PixelType, ResultType> >
     {
-        typedef DifferenceFunctor<PixelType, ResultType> super;
+        typedef DifferenceFunctor<PixelType, ResultType, MaxHueLuminanceDifferenceFunctor<PixelType, ResultType> > super;
 
     public:
         typedef typename super::PixelComponentType PixelComponentType;
+        typedef HueLuminancePlaneFunctor<PixelComponentType> PlaneFunctor;
+        typedef typename PlaneFunctor::result_type PlanePixelType;
 
         MaxHueLuminanceDifferenceFunctor() = delete;
 
@@ -120,16 +163,18 @@ namespace enblend {
             chroma_ = aChrominanceWeight / total;
         }
 
-    protected:
-        ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
-                              const vigra::RGBValue<PixelComponentType>& b,
-                              vigra::VigraFalseType) const {
-            const PixelComponentType aLum = a.luminance();
-            const PixelComponentType bLum = b.luminance();
-            const PixelComponentType aHue = hue(a);
-            const PixelComponentType bHue = hue(b);
-            const PixelComponentType lumDiff = aLum > bLum ? aLum - bLum : bLum - aLum;
-            PixelComponentType hueDiff = aHue > bHue ? aHue - bHue : bHue - aHue;
+        PlanePixelType plane(const vigra::RGBValue<PixelComponentType>& a) const {
+            return PlaneFunctor()(a);
+        }
+
+        ResultType rgbDifference(const vigra::RGBValue<PixelComponentType>& a,
+                                 const vigra::RGBValue<PixelComponentType>& b) const {
+            return planeDifference(plane(a), plane(b));
+        }
+
+        ResultType planeDifference(const PlanePixelType& a, const PlanePixelType& b) const {
+            const PixelComponentType lumDiff = a[0] > b[0] ? a[0] - b[0] : b[0] - a[0];
+            PixelComponentType hueDiff = a[1] > b[1] ? a[1] - b[1] : b[1] - a[1];
 
             if (hueDiff > (vigra::NumericTraits<PixelComponentType>::max() / 2)) {
                 hueDiff = vigra::NumericTraits<PixelComponentType>::max() - hueDiff;
@@ -145,31 +190,35 @@ namespace enblend {
 
 
     template <typename PixelType, typename ResultType>
-    class DeltaEPixelDifferenceFunctor : public DifferenceFunctor<PixelType, ResultType>
+    class DeltaEPixelDifferenceFunctor :
+        public DifferenceFunctor<PixelType, ResultType, DeltaEPixelDifferenceFunctor<PixelType, ResultType> >
     {
-        typedef DifferenceFunctor<PixelType, ResultType> super;
+        typedef DifferenceFunctor<PixelType, ResultType, DeltaEPixelDifferenceFunctor<PixelType, ResultType> > super;
 
     public:
         typedef typename super::PixelComponentType PixelComponentType;
+        typedef LabPlaneFunctor<PixelComponentType> PlaneFunctor;
+        typedef typename PlaneFunctor::result_type PlanePixelType;
 
         DeltaEPixelDifferenceFunctor() = delete;
 
-        DeltaEPixelDifferenceFunctor(double aLuminanceWeight, double aChrominanceWeight) :
-            rgb_to_lab_(vigra::RGB2LabFunctor<double>(vigra::NumericTraits<PixelComponentType>::max())) {
+        DeltaEPixelDifferenceFunctor(double aLuminanceWeight, double aChrominanceWeight) {
             const double total = aLuminanceWeight + 2.0 * aChrominanceWeight;
             assert(total != 0.0);
             luma_ = aLuminanceWeight / total;
             chroma_ = aChrominanceWeight / total;
         }
 
-    protected:
-        ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
-                              const vigra::RGBValue<PixelComponentType>& b,
-                              vigra::VigraFalseType) const {
-            typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
+        PlanePixelType plane(const vigra::RGBValue<PixelComponentType>& a) const {
+            return rgb_to_lab_(a);
+        }
+
+        ResultType rgbDifference(const vigra::RGBValue<PixelComponentType>& a,
+                                 const vigra::RGBValue<PixelComponentType>& b) const {
+            return planeDifference(plane(a), plane(b));
+        }
 
-            const LABResultType lab_a = rgb_to_lab_(a);
-            const LABResultType lab_b = rgb_to_lab_(b);
+        ResultType planeDifference(const PlanePixelType& lab_a, const PlanePixelType& lab_b) const {
             // See, e.g. http://en.wikipedia.org/wiki/Color_difference
             // or http://www.colorwiki.com/wiki/Delta_E:_The_Color_Difference
             const double delta_e = sqrt(luma_ * square(lab_a[0] - lab_b[0]) +
@@ -187,7 +236,7 @@ namespace enblend {
     private:
         double luma_;
         double chroma_;
-        vigra::RGB2LabFunctor<double> rgb_to_lab_;
+        PlaneFunctor rgb_to_lab_;
     };
 
 
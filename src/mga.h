@@ -24,8 +24,13 @@
 #include <config.h>
 #endif
 
+#include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <memory>               // std::shared_ptr
+#include <sstream>
+#include <type_traits>          // std::integral_constant
+#include <vector>
 
 #include <vigra/colorconversions.hxx>
 
@@ -34,6 +39,198 @@
 
 namespace enblend {
 
+// Grayscale projectors with the kind of projection fixed at compile
+// time.  MultiGrayscaleAccessor::dispatch() selects one of them once
+// per image, so that the inner loops of the weighting functions can
+// inline the projection instead of branching on every pixel.
+namespace grayscale
+{
+    template <typename InputType, typename ResultType>
+    struct Identity
+    {
+        ResultType operator()(const InputType& x) const {return x;}
+    };
+
+
+    template <typename InputType, typename ResultType>
+    struct Average
+    {
+        ResultType operator()(const InputType& x) const {
+            typedef typename InputType::value_type ValueType;
+            return vigra::NumericTraits<ResultType>::fromRealPromote
+                ((vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
+                  vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
+                  vigra::NumericTraits<ValueType>::toRealPromote(x.blue())) /
+                 3.0);
+        }
+    };
+
+
+    template <typename InputType, typename ResultType>
+    struct Lightness
+    {
+        ResultType operator()(const InputType& x) const {
+            return vigra::NumericTraits<ResultType>::fromRealPromote
+                ((std::min(x.red(), std::min(x.green(), x.blue())) +
+                  std::max(x.red(), std::max(x.green(), x.blue()))) /
+                 2.0);
+        }
+    };
+
+
+    template <typename InputType, typename ResultType>
+    struct Value
+    {
+        ResultType operator()(const InputType& x) const {
+            return std::max(x.red(), std::max(x.green(), x.blue()));
+        }
+    };
+
+
+    template <typename InputType, typename ResultType>
+    struct AntiValue
+    {
+        ResultType operator()(const InputType& x) const {
+            return std::min(x.red(), std::min(x.green(), x.blue()));
+        }
+    };
+
+
+    template <typename InputType, typename ResultType>
+    struct Luminance
+    {
+        ResultType operator()(const InputType& x) const {
+            return vigra::NumericTraits<ResultType>::fromRealPromote(x.luminance());
+        }
+    };
+
+
+    template <typename InputType, typename ResultType>
+    class ChannelMixer
+    {
+    public:
+        ChannelMixer(double red, double green, double blue) :
+            redWeight(red), greenWeight(green), blueWeight(blue) {}
+
+        ResultType operator()(const InputType& x) const {
+            typedef typename InputType::value_type ValueType;
+            return vigra::NumericTraits<ResultType>::fromRealPromote
+                (redWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
+                 greenWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
+                 blueWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.blue()));
+        }
+
+    private:
+        double redWeight, greenWeight, blueWeight;
+    };
+
+
+    /** Answer the CIE 1976 lightness L* in the range [0, 100] of the
+     *  relative luminance y in the range [0, 1]. */
+    inline static double
+    cieLightness(double y)
+    {
+        const double epsilon = 216.0 / 24389.0;
+        const double kappa = 24389.0 / 27.0;
+
+        return y < epsilon ? kappa * y : 116.0 * std::cbrt(y) - 16.0;
+    }
+
+
+    // Project onto L* of CIE L*a*b*.  XYZFunctor is either
+    // vigra::RGB2XYZFunctor for linear RGB or vigra::RGBPrime2XYZFunctor
+    // for gamma-corrected RGB.
+    //
+    // PERFORMANCE: L* only depends on the luminance Y, which in turn
+    // is a sum of independent contributions of the three channels.
+    // For integral channel types of at most 16 bits we tabulate these
+    // contributions, including the gamma expansion of RGB', and
+    // compute just one cube root per pixel.  The table is shared
+    // between all copies of a projector.
+    template <typename InputType, typename ResultType, class XYZFunctor>
+    class LStar
+    {
+    public:
+        typedef typename InputType::value_type ValueType;
+        typedef vigra::NumericTraits<ValueType> ValueTraits;
+
+        LStar() : to_xyz(ValueTraits::max()) {
+            initialize(UseLookupTable());
+        }
+
+        ResultType operator()(const InputType& x) const {
+            return vigra::NumericTraits<ResultType>::fromRealPromote
+                (ValueTraits::max() * cieLightness(luminance(x, UseLookupTable())) / 100.0);
+        }
+
+    private:
+        typedef std::integral_constant<bool,
+                                       ValueTraits::isIntegral::asBool && sizeof(ValueType) <= 2> UseLookupTable;
+        typedef std::vector<double> TableType;
+
+        static int index(ValueType x) {
+            return static_cast<int>(x) - static_cast<int>(ValueTraits::min());
+        }
+
+        void initialize(std::false_type) {}
+
+        void initialize(std::true_type) {
+            const int size = index(ValueTraits::max()) + 1;
+            TableType* table = new TableType(3 * size);
+
+            for (int i = 0; i != size; ++i) {
+                const ValueType x = static_cast<ValueType>(static_cast<int>(ValueTraits::min()) + i);
+                const ValueType zero = ValueType();
+                (*table)[i] = to_xyz(InputType(x, zero, zero))[1];
+                (*table)[size + i] = to_xyz(InputType(zero, x, zero))[1];
+                (*table)[2 * size + i] = to_xyz(InputType(zero, zero, x))[1];
+            }
+
+            channel_size = size;
+            luminance_table.reset(table);
+        }
+
+        double luminance(const InputType& x, std::false_type) const {
+            return to_xyz(x)[1];
+        }
+
+        double luminance(const InputType& x, std::true_type) const {
+            const double* const table = luminance_table->data();
+            return
+                table[index(x.red())] +
+                table[channel_size + index(x.green())] +
+                table[2 * channel_size + index(x.blue())];
+        }
+
+        XYZFunctor to_xyz;
+        int channel_size;
+        std::shared_ptr<const TableType> luminance_table;
+    };
+
+
+    // Minimal vigra accessor that applies a fixed projector.
+    template <typename InputType, typename ResultType, class Projector>
+    class ProjectingAccessor
+    {
+    public:
+        typedef ResultType value_type;
+
+        explicit ProjectingAccessor(const Projector& aProjector = Projector()) : project(aProjector) {}
+
+        ResultType operator()(const InputType& x) const {return project(x);}
+
+        template <class Iterator>
+        ResultType operator()(const Iterator& i) const {return project(*i);}
+
+        template <class Iterator, class Difference>
+        ResultType operator()(const Iterator& i, Difference d) const {return project(i[d]);}
+
+    private:
+        Projector project;
+    };
+} // namespace grayscale
+
+
 template <typename InputType, typename ResultType>
 class MultiGrayscaleAccessor
 {
@@ -42,8 +239,8 @@ public:
 
     MultiGrayscaleAccessor(const std::string& accessorName) {
         typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
-        initializeTypeSpecific(srcIsScalar());
         initialize(accessorName);
+        initializeTypeSpecific(srcIsScalar());
     }
 
     ResultType operator()(const InputType& x) const {
@@ -67,6 +264,16 @@ public:
         return "average";       //< default-grayscale-accessor average
     }
 
+    /** Call aFunction with an accessor whose projection is fixed at
+     *  compile time, but otherwise behaves like this accessor.
+     *  Prefer this function over using the accessor directly in
+     *  loops that run over whole images. */
+    template <class Function>
+    void dispatch(Function aFunction) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        dispatchFun(aFunction, srcIsScalar());
+    }
+
 private:
     typedef enum AccessorKind {
         AVERAGE, LSTAR, PRIMED_LSTAR, LIGHTNESS, VALUE, ANTI_VALUE, LUMINANCE, MIXER
@@ -118,10 +325,7 @@ private:
                 }
                 else
                 {
-                    std::cerr << command
-                         << ": unknown grayscale projector \"" << accessorName << "\""
-                         << std::endl;
-                    exit(1);
+                    throw fatal_error("unknown grayscale projector \"" + accessorName + "\"");
                 }
 
             }
@@ -130,12 +334,8 @@ private:
                 kind = k->second;
                 if (kind == MIXER)
                 {
-                    std::cerr << command
-                         << ": \"" CHANNEL_MIXER "\" is a grayscale projector requiring\n"
-                         << command
-                         << ": arguments like e.g. \"channel-mixer:0.30:0.59:0.11\""
-                         << std::endl;
-                    exit(1);
+                    throw fatal_error("\"" CHANNEL_MIXER "\" is a grayscale projector requiring "
+                                      "arguments like e.g. \"channel-mixer:0.30:0.59:0.11\"");
                 }
             }
         }
@@ -145,86 +345,113 @@ private:
         // TODO: check for isnormal(WEIGHT) before comparison
         if (red < 0.0)
         {
-            std::cerr << command
-                 << ": nonsensical weight of red channel (" << red << ")"
-                 << std::endl;
-            exit(1);
+            std::ostringstream message;
+            message << "nonsensical weight of red channel (" << red << ")";
+            throw fatal_error(message.str());
         }
         if (green < 0.0)
         {
-            std::cerr << command
-                 << ": nonsensical weight of green channel (" << green << ")"
-                 << std::endl;
-            exit(1);
+            std::ostringstream message;
+            message << "nonsensical weight of green channel (" << green << ")";
+            throw fatal_error(message.str());
         }
         if (blue < 0.0)
         {
-            std::cerr << command
-                 << ": nonsensical weight of blue channel (" << blue << ")"
-                 << std::endl;
-            exit(1);
+            std::ostringstream message;
+            message << "nonsensical weight of blue channel (" << blue << ")";
+            throw fatal_error(message.str());
         }
         if (red + green + blue == 0.0)
         {
-            std::cerr << command
-                 << ": sum of channel weights is zero"
-                 << std::endl;
-            exit(1);
+            throw fatal_error("sum of channel weights is zero");
         }
     }
 
+    typedef grayscale::LStar<InputType, ResultType, vigra::RGB2XYZFunctor<double> > LStarProjector;
+    typedef grayscale::LStar<InputType, ResultType, vigra::RGBPrime2XYZFunctor<double> > PrimedLStarProjector;
+
     void initializeTypeSpecific(vigra::VigraTrueType) {}
 
     void initializeTypeSpecific(vigra::VigraFalseType) {
-        typedef typename InputType::value_type ValueType;
-        rgb_to_lab_fun = vigra::RGB2LabFunctor<double>(vigra::NumericTraits<ValueType>::max());
-        rgb_prime_to_lab_fun = vigra::RGBPrime2LabFunctor<double>(vigra::NumericTraits<ValueType>::max());
+        // Only pay for the lookup tables of the projector we use.
+        if (kind == LSTAR)
+        {
+            lstar.reset(new LStarProjector);
+        }
+        else if (kind == PRIMED_LSTAR)
+        {
+            primed_lstar.reset(new PrimedLStarProjector);
+        }
     }
 
     ResultType project(const InputType& x) const {
-        typedef typename InputType::value_type ValueType;
         switch (kind)
         {
         case AVERAGE:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                ((vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
-                  vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
-                  vigra::NumericTraits<ValueType>::toRealPromote(x.blue())) /
-                 3.0);
+            return grayscale::Average<InputType, ResultType>()(x);
         case LSTAR:
-        {
-            typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
-            const LABResultType y = rgb_to_lab_fun.operator()(x) / 100.0;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
-        }
+            return (*lstar)(x);
         case PRIMED_LSTAR:
-        {
-            typedef typename vigra::RGBPrime2LabFunctor<double>::result_type LABResultType;
-            const LABResultType y = rgb_prime_to_lab_fun.operator()(x) / 100.0;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
-        }
+            return (*primed_lstar)(x);
         case LIGHTNESS:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                ((std::min(x.red(), std::min(x.green(), x.blue())) +
-                  std::max(x.red(), std::max(x.green(), x.blue()))) /
-                 2.0);
+            return grayscale::Lightness<InputType, ResultType>()(x);
         case VALUE:
-            return std::max(x.red(), std::max(x.green(), x.blue()));
+            return grayscale::Value<InputType, ResultType>()(x);
         case ANTI_VALUE:
-            return std::min(x.red(), std::min(x.green(), x.blue()));
+            return grayscale::AntiValue<InputType, ResultType>()(x);
         case LUMINANCE:
-            return vigra::NumericTraits<ResultType>::fromRealPromote(x.luminance());
+            return grayscale::Luminance<InputType, ResultType>()(x);
         case MIXER:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                (redWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
-                 greenWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
-                 blueWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.blue()));
+            return grayscale::ChannelMixer<InputType, ResultType>(redWeight, greenWeight, blueWeight)(x);
         }
 
         // never reached
         return ResultType();
     }
 
+    template <class Projector, class Function>
+    static void apply(Function aFunction, const Projector& aProjector) {
+        aFunction(grayscale::ProjectingAccessor<InputType, ResultType, Projector>(aProjector));
+    }
+
+    // grayscale
+    template <class Function>
+    void dispatchFun(Function aFunction, vigra::VigraTrueType) const {
+        apply(aFunction, grayscale::Identity<InputType, ResultType>());
+    }
+
+    // RGB
+    template <class Function>
+    void dispatchFun(Function aFunction, vigra::VigraFalseType) const {
+        switch (kind)
+        {
+        case AVERAGE:
+            apply(aFunction, grayscale::Average<InputType, ResultType>());
+            break;
+        case LSTAR:
+            apply(aFunction, *lstar);
+            break;
+        case PRIMED_LSTAR:
+            apply(aFunction, *primed_lstar);
+            break;
+        case LIGHTNESS:
+            apply(aFunction, grayscale::Lightness<InputType, ResultType>());
+            break;
+        case VALUE:
+            apply(aFunction, grayscale::Value<InputType, ResultType>());
+            break;
+        case ANTI_VALUE:
+            apply(aFunction, grayscale::AntiValue<InputType, ResultType>());
+            break;
+        case LUMINANCE:
+            apply(aFunction, grayscale::Luminance<InputType, ResultType>());
+            break;
+        case MIXER:
+            apply(aFunction, grayscale::ChannelMixer<InputType, ResultType>(redWeight, greenWeight, blueWeight));
+            break;
+        }
+    }
+
     // RGB
     ResultType f(const InputType& x, vigra::VigraFalseType) const {
         return project(x);
@@ -252,8 +479,8 @@ private:
     NameMapType nameMap;
     AccKindType kind;
     double redWeight, greenWeight, blueWeight;
-    vigra::RGB2LabFunctor<double> rgb_to_lab_fun;
-    vigra::RGBPrime2LabFunctor<double> rgb_prime_to_lab_fun;
+    std::shared_ptr<const LStarProjector> lstar;
+    std::shared_ptr<const PrimedLStarProjector> primed_lstar;
 };
 
 } // namespace enblend
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef MISMATCH_PLANES_H_INCLUDED_
+#define MISMATCH_PLANES_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <vigra/diff2d.hxx>
+#include <vigra/utilities.hxx>
+
+#include "openmp_def.h"
+
+
+namespace enblend
+{
+    // Difference planes
+    //
+    // The mismatch image compares the white and the black image in
+    // the coordinates of the difference functor: luminance and hue
+    // for MaxHueLuminanceDifferenceFunctor and L*a*b* for
+    // DeltaEPixelDifferenceFunctor.  DifferencePlanes holds these
+    // coordinates for a rectangle of an image, so that each pixel is
+    // converted once no matter how often it gets compared.
+    //
+    // The planes live in tiles of 64x64 pixels.  A coarse mask only
+    // compares every other pixel in either direction, therefore a
+    // tile keeps each of the four 2x2-subsampling grids in a block of
+    // its own, which gets allocated when first needed.  Whoever
+    // changes the image must invalidate() the changed rectangle,
+    // which frees the blocks of the tiles it touches; update() then
+    // recomputes only the missing grids of the tiles it needs.  The
+    // planes hold the coordinates in the precision of PlaneFunctor,
+    // so comparing them gives the same differences as comparing the
+    // pixels directly.
+
+    template <typename PlaneFunctor>
+    class DifferencePlanes
+    {
+    public:
+        typedef typename PlaneFunctor::result_type value_type;
+
+        explicit DifferencePlanes(const vigra::Rect2D& an_extent) :
+            extent_(an_extent),
+            tiles_x_((an_extent.width() + tile_size - 1) >> tile_shift),
+            tiles_y_((an_extent.height() + tile_size - 1) >> tile_shift),
+            blocks_(grid_count * static_cast<size_t>(tiles_x_) * static_cast<size_t>(tiles_y_))
+        {}
+
+        const vigra::Rect2D& extent() const {return extent_;}
+
+        // Forget and free the planes of all tiles that intersect
+        // A_RECT.
+        void invalidate(const vigra::Rect2D& a_rect)
+        {
+            for (auto i : tiles_of(a_rect)) {
+                for (size_t g = 0U; g != grid_count; ++g) {
+                    blocks_[grid_count * i + g].reset();
+                }
+            }
+        }
+
+        // Make the planes of AN_IMAGE current at every A_STRIDE-th
+        // pixel of A_RECT, where A_STRIDE is 1 or 2.
+        template <typename ImageType>
+        void update(const ImageType& an_image, const vigra::Rect2D& a_rect, int a_stride,
+                    const PlaneFunctor& a_functor)
+        {
+            const unsigned wanted = grids_of(a_rect, a_stride);
+            std::vector<size_t> pending;
+
+            for (auto i : tiles_of(a_rect)) {
+                if ((present_grids(i) & wanted) != wanted) {
+                    pending.push_back(i);
+                }
+            }
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+            for (int k = 0; k < static_cast<int>(pending.size()); ++k) {
+                const size_t i = pending[k];
+                const unsigned missing = wanted & ~present_grids(i);
+                const int x0 = extent_.left() + static_cast<int>(i % tiles_x_) * tile_size;
+                const int y0 = extent_.top() + static_cast<int>(i / tiles_x_) * tile_size;
+                const int x1 = std::min(x0 + static_cast<int>(tile_size), extent_.right());
+                const int y1 = std::min(y0 + static_cast<int>(tile_size), extent_.bottom());
+
+                for (size_t g = 0U; g != grid_count; ++g) {
+                    if (!(missing & (1U << g))) {
+                        continue;
+                    }
+
+                    std::unique_ptr<value_type[]>& block = blocks_[grid_count * i + g];
+                    block.reset(new value_type[block_size * block_size]);
+
+                    // The grid's first row and column in the tile
+                    const int first_y = y0 + ((y0 ^ static_cast<int>(g >> 1)) & 1);
+                    const int first_x = x0 + ((x0 ^ static_cast<int>(g & 1U)) & 1);
+
+                    for (int y = first_y; y < y1; y += 2) {
+                        const auto row = an_image[y];
+                        value_type* dest = block.get() + ((y - y0) >> 1) * block_size;
+
+                        for (int x = first_x; x < x1; x += 2) {
+                            dest[(x - x0) >> 1] = a_functor(row[x]);
+                        }
+                    }
+                }
+            }
+        }
+
+        const value_type& operator()(int x, int y) const
+        {
+            const int u = x - extent_.left();
+            const int v = y - extent_.top();
+            const size_t i = static_cast<size_t>(v >> tile_shift) * tiles_x_ + (u >> tile_shift);
+
+            return blocks_[grid_count * i + ((y & 1) << 1) + (x & 1)]
+                [((v & tile_mask) >> 1) * block_size + ((u & tile_mask) >> 1)];
+        }
+
+    private:
+        enum {tile_shift = 6, tile_size = 1 << tile_shift, tile_mask = tile_size - 1,
+              block_size = tile_size / 2};
+
+        // Grid 2 * (y % 2) + x % 2 holds all pixels (x + 2 * i, y + 2 * j).
+        // Bit g of a set of grids stands for grid g.
+        static constexpr size_t grid_count = 4U;
+
+        static unsigned grids_of(const vigra::Rect2D& a_rect, int a_stride)
+        {
+            return a_stride == 1 ? 15U : 1U << (2 * (a_rect.top() & 1) + (a_rect.left() & 1));
+        }
+
+        unsigned present_grids(size_t i) const
+        {
+            unsigned result = 0U;
+            for (size_t g = 0U; g != grid_count; ++g) {
+                if (blocks_[grid_count * i + g]) {
+                    result |= 1U << g;
+                }
+            }
+            return result;
+        }
+
+        std::vector<size_t> tiles_of(const vigra::Rect2D& a_rect) const
+        {
+            vigra::Rect2D r(a_rect & extent_);
+            std::vector<size_t> result;
+
+            if (r.isEmpty()) {
+                return result;
+            }
+
+            r.moveBy(-extent_.upperLeft());
+            for (int v = r.top() >> tile_shift; v <= (r.bottom() - 1) >> tile_shift; ++v) {
+                for (int u = r.left() >> tile_shift; u <= (r.right() - 1) >> tile_shift; ++u) {
+                    result.push_back(static_cast<size_t>(v) * tiles_x_ + u);
+                }
+            }
+
+            return result;
+        }
+
+        vigra::Rect2D extent_;
+        int tiles_x_;
+        int tiles_y_;
+        // Block g of tile i is at grid_count * i + g.
+        std::vector<std::unique_ptr<value_type[]> > blocks_;
+    };
+
+
+    // Write the differences of A_WHITE and A_BLACK at every A_STRIDE-th
+    // pixel of A_RECT to DEST.  Both planes must be current there.
+    template <typename PlaneFunctor, typename DestIterator, typename DestAccessor, typename Functor>
+    void
+    planeDifferences(const DifferencePlanes<PlaneFunctor>& a_white, const DifferencePlanes<PlaneFunctor>& a_black,
+                     const vigra::Rect2D& a_rect, int a_stride,
+                     vigra::pair<DestIterator, DestAccessor> dest, const Functor& a_functor)
+    {
+        const int width = (a_rect.width() + a_stride - 1) / a_stride;
+        const int height = (a_rect.height() + a_stride - 1) / a_stride;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int j = 0; j < height; ++j) {
+            const int y = a_rect.top() + j * a_stride;
+            DestIterator d(dest.first + vigra::Diff2D(0, j));
+
+            for (int i = 0, x = a_rect.left(); i < width; ++i, x += a_stride, ++d.x) {
+                dest.second.set(a_functor.planeDifference(a_white(x, y), a_black(x, y)), d);
+            }
+        }
+    }
+} // namespace enblend
+
+
+#endif // MISMATCH_PLANES_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
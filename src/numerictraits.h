@@ -31,6 +31,10 @@
 #include <vigra/utilities.hxx>
 
 #include "common.h"
+#include "pyramid_pool.h"
+#ifdef PREFER_COMPACT_PYRAMID_TYPE
+#include "compact_pyramid.h"
+#endif
 
 
 namespace enblend
@@ -76,10 +80,10 @@ namespace enblend
     };
 
 
-#define ENBLEND_NUMERICTRAITS(IMAGE, IMAGECOMPONENT, ALPHA, MASK, \
-                              PYRAMIDCOMPONENT, PYRAMIDINTEGER, PYRAMIDFRACTION, \
-                              SKIPSMIMAGE, SKIPSMALPHA, \
-                              MASKPYRAMID, MASKPYRAMIDINTEGER, MASKPYRAMIDFRACTION, SKIPSMMASK) \
+#define ENBLEND_NUMERICTRAITS_PYRAMID(IMAGE, PYRAMIDIMAGE, IMAGECOMPONENT, ALPHA, MASK, \
+                                      PYRAMIDCOMPONENT, PYRAMIDINTEGER, PYRAMIDFRACTION, \
+                                      SKIPSMIMAGE, SKIPSMALPHA, \
+                                      MASKPYRAMID, MASKPYRAMIDINTEGER, MASKPYRAMIDFRACTION, SKIPSMMASK) \
     template <>                                                         \
     struct EnblendNumericTraits<IMAGECOMPONENT>                         \
     {                                                                   \
@@ -93,7 +97,7 @@ namespace enblend
         typedef IMAGE<MASK> MaskType;                                   \
         typedef PYRAMIDCOMPONENT ImagePyramidPixelComponentType;        \
         typedef PYRAMIDCOMPONENT ImagePyramidPixelType;                 \
-        typedef IMAGE<PYRAMIDCOMPONENT> ImagePyramidType;               \
+        typedef PYRAMIDIMAGE<PYRAMIDCOMPONENT> ImagePyramidType;        \
         enum {ImagePyramidIntegerBits = PYRAMIDINTEGER};                \
         enum {ImagePyramidFractionBits = PYRAMIDFRACTION};              \
         typedef SKIPSMIMAGE SKIPSMImagePixelComponentType;              \
@@ -104,7 +108,7 @@ namespace enblend
                       "ImagePyramidIntegerBits + ImagePyramidFractionBits do not fit into SKIPSMImagePixelType"); \
         typedef SKIPSMALPHA SKIPSMAlphaPixelType;                       \
         typedef MASKPYRAMID MaskPyramidPixelType;                       \
-        typedef IMAGE<MASKPYRAMID> MaskPyramidType;                     \
+        typedef PyramidImage<MASKPYRAMID> MaskPyramidType;              \
         enum {MaskPyramidIntegerBits = MASKPYRAMIDINTEGER};             \
         enum {MaskPyramidFractionBits = MASKPYRAMIDFRACTION};           \
         typedef SKIPSMMASK SKIPSMMaskPixelType;                         \
@@ -127,20 +131,23 @@ namespace enblend
         typedef IMAGE<MASK> MaskType;                                   \
         typedef PYRAMIDCOMPONENT ImagePyramidPixelComponentType;        \
         typedef vigra::RGBValue<PYRAMIDCOMPONENT, 0, 1, 2> ImagePyramidPixelType; \
-        typedef IMAGE<vigra::RGBValue<PYRAMIDCOMPONENT, 0, 1, 2> > ImagePyramidType; \
+        typedef PYRAMIDIMAGE<vigra::RGBValue<PYRAMIDCOMPONENT, 0, 1, 2> > ImagePyramidType; \
         enum {ImagePyramidIntegerBits = PYRAMIDINTEGER};                \
         enum {ImagePyramidFractionBits = PYRAMIDFRACTION};              \
         typedef SKIPSMIMAGE SKIPSMImagePixelComponentType;              \
         typedef vigra::RGBValue<SKIPSMIMAGE, 0, 1, 2> SKIPSMImagePixelType; \
         typedef SKIPSMALPHA SKIPSMAlphaPixelType;                       \
         typedef MASKPYRAMID MaskPyramidPixelType;                       \
-        typedef IMAGE<MASKPYRAMID> MaskPyramidType;                     \
+        typedef PyramidImage<MASKPYRAMID> MaskPyramidType;              \
         enum {MaskPyramidIntegerBits = MASKPYRAMIDINTEGER};             \
         enum {MaskPyramidFractionBits = MASKPYRAMIDFRACTION};           \
         typedef SKIPSMMASK SKIPSMMaskPixelType;                         \
     }
 
 
+#define ENBLEND_NUMERICTRAITS(IMAGE, ...) ENBLEND_NUMERICTRAITS_PYRAMID(IMAGE, PyramidImage, __VA_ARGS__)
+
+
     // Traits for converting between image pixel types and pyramid
     // pixel types Pyramids require one more bit of precision than the
     // regular image type.
@@ -160,6 +167,18 @@ namespace enblend
     //     (MaskPyramidIntegerBits + 1) + MaskPyramidFractionBits + 6  <=  sizeof(SKIPSMMaskPixelType) - 1
     //          (8 + 1) +  7 + 6  =  22  <=  32 - 1
     //          (8 + 1) + 15 + 6  =  30  <=  32 - 1
+    //   * Defining PREFER_COMPACT_PYRAMID_TYPE stores the 17.7 pyramids
+    //     of 16-bit images as 16-bit integers.  Each block of 64
+    //     pixels picks the finest step its values allow, from 1/128
+    //     up to 257/128, about two units of the input.  Black and
+    //     white of UInt16 images survive exactly; see
+    //     compact_pyramid.h.
+    //     Reduce and Expand still compute in the SKIPSM type.
+    //   * Defining PREFER_FLOAT_TO_DOUBLE_AS_PYRAMID_TYPE keeps the
+    //     pyramids of single-precision images in single precision.
+    //     This halves their memory footprint.  collapsePyramid()
+    //     sums plainly unless expert parameter "compensated-collapse"
+    //     (default: off) asks it to carry the rounding errors along.
     //
     //
     //                                    IMAGE-            ALPHA          MASK         PYRAMID-      IMG-PYR.      SKIPSM-         SKIPSM-          MASK-       MASK-PYR.     SKIPSM-
@@ -168,8 +187,15 @@ namespace enblend
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::Int8,     vigra::UInt8,  vigra::UInt8,  vigra::Int16,    9,    7,  vigra::Int32,   vigra::Int16,   vigra::Int16,    9,    7,  vigra::Int32);
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::UInt8,    vigra::UInt8,  vigra::UInt8,  vigra::Int16,    9,    7,  vigra::Int32,   vigra::Int16,   vigra::Int16,    9,    7,  vigra::Int32);
 
+#ifdef PREFER_COMPACT_PYRAMID_TYPE
+    ENBLEND_NUMERICTRAITS_PYRAMID(IMAGETYPE, CompactInt32PyramidImage,
+                                       vigra::Int16,    vigra::UInt8,  vigra::UInt8,  vigra::Int32,   17,    7,  vigra::Int32,   vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
+    ENBLEND_NUMERICTRAITS_PYRAMID(IMAGETYPE, CompactInt32PyramidImage,
+                                       vigra::UInt16,   vigra::UInt8,  vigra::UInt8,  vigra::Int32,   17,    7,  vigra::Int32,   vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
+#else
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::Int16,    vigra::UInt8,  vigra::UInt8,  vigra::Int32,   17,    7,  vigra::Int32,   vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::UInt16,   vigra::UInt8,  vigra::UInt8,  vigra::Int32,   17,    7,  vigra::Int32,   vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
+#endif
 
 #ifdef PREFER_DOUBLE_TO_INT64_AS_SKIPSM_IMAGE_TYPE
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::Int32,    vigra::UInt8,  vigra::UInt8,  double,          8,    0,  double,         vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
@@ -182,7 +208,11 @@ namespace enblend
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::Int64,    vigra::UInt8,  vigra::UInt8,  double,          8,    0,  double,         vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   vigra::UInt64,   vigra::UInt8,  vigra::UInt8,  double,          8,    0,  double,         vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
 
+#ifdef PREFER_FLOAT_TO_DOUBLE_AS_PYRAMID_TYPE
+    ENBLEND_NUMERICTRAITS(IMAGETYPE,   float,           vigra::UInt8,  vigra::UInt8,  float,           8,    0,  float,          vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
+#else
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   float,           vigra::UInt8,  vigra::UInt8,  double,          8,    0,  double,         vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
+#endif
 #ifdef PREFER_LONG_DOUBLE_TO_DOUBLE_AS_SKIPSM_IMAGE_TYPE
     ENBLEND_NUMERICTRAITS(IMAGETYPE,   double,          vigra::UInt8,  vigra::UInt8,  long double,     8,    0,  long double,    vigra::Int16,   vigra::Int32,    9,   15,  vigra::Int32);
 #else
@@ -190,6 +220,7 @@ namespace enblend
 #endif
 
 #undef ENBLEND_NUMERICTRAITS
+#undef ENBLEND_NUMERICTRAITS_PYRAMID
 
 
     // Traits for correctly handling alpha/mask values in floating point files.
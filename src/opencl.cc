@@ -21,7 +21,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdarg>              // va_list
+#include <filesystem>
 #include <fstream>              // std::ifstream
 #include <iomanip>
 #include <iostream>
@@ -1179,6 +1181,199 @@ namespace ocl
     ////////////////////////////////////////////////////////////////////////////
 
 
+#define OPENCL_CACHE "ENBLEND_OPENCL_CACHE" //< opencl-cache ENBLEND_OPENCL_CACHE
+
+
+    namespace program_cache
+    {
+        // Each entry is a file named after the hash of its key.  The
+        // file repeats the full key, which we compare on loading, so
+        // that a hash collision cannot smuggle in a foreign binary.
+        //     enblend-opencl-program-cache 1\n
+        //     <key size>\n
+        //     <key><binary code>
+
+        static const std::string magic("enblend-opencl-program-cache 1");
+
+
+        // FNV-1a -- unlike std::hash its value is the same for all
+        // builds, which a cache on disk needs.
+        static std::uint64_t
+        stable_hash(const std::string& a_string)
+        {
+            std::uint64_t hash = UINT64_C(14695981039346656037);
+
+            for (auto c : a_string)
+            {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= UINT64_C(1099511628211);
+            }
+
+            return hash;
+        }
+
+
+        static std::string
+        hex_string(std::uint64_t a_number)
+        {
+            std::ostringstream result;
+            result << std::hex << std::setw(16) << std::setfill('0') << a_number;
+            return result.str();
+        }
+
+
+        static std::filesystem::path
+        directory()
+        {
+            if (const char* cache = getenv(OPENCL_CACHE))
+            {
+                return std::filesystem::path(cache); // empty path disables the cache
+            }
+#ifdef _WIN32
+            if (const char* local_app_data = getenv("LOCALAPPDATA"))
+            {
+                return std::filesystem::path(local_app_data) / "enblend" / "opencl-cache";
+            }
+#else
+            if (const char* xdg_cache_home = getenv("XDG_CACHE_HOME"))
+            {
+                if (*xdg_cache_home != 0)
+                {
+                    return std::filesystem::path(xdg_cache_home) / "enblend" / "opencl";
+                }
+            }
+            if (const char* home = getenv("HOME"))
+            {
+                return std::filesystem::path(home) / ".cache" / "enblend" / "opencl";
+            }
+#endif
+
+            return std::filesystem::path();
+        }
+
+
+        static std::filesystem::path
+        filename(const std::string& a_key)
+        {
+            const std::filesystem::path cache(directory());
+            return cache.empty() ? cache : cache / (hex_string(stable_hash(a_key)) + ".bin");
+        }
+
+
+        std::string
+        key(const cl::Device& a_device, const std::string& a_source_text, const std::string& a_build_option)
+        {
+            const cl::Platform platform(a_device.getInfo<CL_DEVICE_PLATFORM>());
+            std::ostringstream result;
+
+            result <<
+                "platform: " << platform.getInfo<CL_PLATFORM_NAME>() <<
+                " " << platform.getInfo<CL_PLATFORM_VERSION>() << "\n" <<
+                "device: " << a_device.getInfo<CL_DEVICE_VENDOR>() <<
+                " " << a_device.getInfo<CL_DEVICE_NAME>() <<
+                " " << a_device.getInfo<CL_DEVICE_VERSION>() << "\n" <<
+                "driver: " << a_device.getInfo<CL_DRIVER_VERSION>() << "\n" <<
+                "source: " << hex_string(stable_hash(a_source_text)) << " " << a_source_text.size() << "\n" <<
+                "options: " << a_build_option << "\n";
+
+            return result.str();
+        }
+
+
+        bool
+        load(const std::string& a_key, BinaryPolicy::code_t& a_binary_code)
+        {
+            typedef std::istreambuf_iterator<char> file_iterator;
+
+            const std::filesystem::path path(filename(a_key));
+            if (path.empty())
+            {
+                return false;
+            }
+
+            std::ifstream file(path, std::ios::binary);
+            std::string header;
+            size_t key_size = 0U;
+
+            if (!std::getline(file, header) || header != magic || !(file >> key_size) || file.get() != '\n')
+            {
+                return false;
+            }
+
+            std::string key(key_size, '\0');
+            if (!file.read(&key[0], static_cast<std::streamsize>(key_size)) || key != a_key)
+            {
+                return false;
+            }
+
+            a_binary_code.assign(file_iterator(file), file_iterator());
+
+            return !a_binary_code.empty();
+        }
+
+
+        void
+        store(const std::string& a_key, const BinaryPolicy::code_t& a_binary_code)
+        {
+            const std::filesystem::path path(filename(a_key));
+            if (path.empty() || a_binary_code.empty())
+            {
+                return;
+            }
+
+            std::error_code error;
+            std::filesystem::create_directories(path.parent_path(), error);
+            if (error)
+            {
+                return;
+            }
+
+            // Write to a private file and rename it, so that concurrent
+            // processes never see a partial entry.
+            std::ostringstream suffix;
+            suffix <<
+                ".tmp-" << std::hash<std::thread::id>()(std::this_thread::get_id()) <<
+                "-" << std::chrono::steady_clock::now().time_since_epoch().count();
+            std::filesystem::path temporary(path);
+            temporary += suffix.str();
+
+            {
+                std::ofstream file(temporary, std::ios::binary);
+                file << magic << "\n" << a_key.size() << "\n" << a_key;
+                file.write(reinterpret_cast<const char*>(data(a_binary_code)),
+                           static_cast<std::streamsize>(a_binary_code.size()));
+                if (!file)
+                {
+                    file.close();
+                    std::filesystem::remove(temporary, error);
+                    return;
+                }
+            }
+
+            std::filesystem::rename(temporary, path, error);
+            if (error)
+            {
+                std::filesystem::remove(temporary, error);
+            }
+        }
+
+
+        void
+        erase(const std::string& a_key)
+        {
+            const std::filesystem::path path(filename(a_key));
+            if (!path.empty())
+            {
+                std::error_code error;
+                std::filesystem::remove(path, error);
+            }
+        }
+    } // namespace program_cache
+
+
+    ////////////////////////////////////////////////////////////////////////////
+
+
     template <class actual_code_policy, int default_queue_flags>
     Function<actual_code_policy, default_queue_flags>::Function(const cl::Context& a_context,
                                                                 const std::string& a_string) :
@@ -1312,8 +1507,7 @@ namespace ocl
         auto r(results.begin());
         for (auto b = binaries.begin(); b != binaries.end(); ++b, ++s, ++r)
         {
-            r->reserve(*s);
-            memcpy(&(*r)[0], *b, *s);
+            r->assign(*b, *b + *s);
         }
 
         return results;
@@ -1328,6 +1522,25 @@ namespace ocl
     }
 
 
+    template <class actual_code_policy, int default_queue_flags>
+    BinaryPolicy::code_t
+    Function<actual_code_policy, default_queue_flags>::binary(const cl::Device& a_device) const
+    {
+        const std::vector<cl::Device> devices(program_.getInfo<CL_PROGRAM_DEVICES>());
+        const std::vector<BinaryPolicy::code_t> codes(binaries());
+
+        for (size_t i = 0U; i != devices.size(); ++i)
+        {
+            if (devices[i]() == a_device())
+            {
+                return codes[i];
+            }
+        }
+
+        return BinaryPolicy::code_t();
+    }
+
+
     template <class actual_code_policy, int default_queue_flags>
     const cl::Context&
     Function<actual_code_policy, default_queue_flags>::context() const
@@ -1408,6 +1621,18 @@ namespace ocl
     }
 
 
+    template <class actual_code_policy, int default_queue_flags>
+    void
+    Function<actual_code_policy, default_queue_flags>::update_program_from_binary(const cl::Device& a_device,
+                                                                                  const BinaryPolicy::code_t& a_binary_code)
+    {
+        program_ = cl::Program(context(),
+                               std::vector<cl::Device>(1U, a_device),
+                               cl::Program::Binaries(1U, std::make_pair(static_cast<const void*>(data(a_binary_code)),
+                                                                        a_binary_code.size())));
+    }
+
+
     template <class actual_code_policy, int default_queue_flags>
     void
     Function<actual_code_policy, default_queue_flags>::initialize()
@@ -1450,7 +1675,8 @@ namespace ocl
     LazyFunction<actual_code_policy>::LazyFunction(const cl::Context& a_context, const std::string& a_string) :
         super(a_context, a_string),
         build_completed_(false),
-        text_hash_(size_t()), build_option_hash_(size_t())
+        text_hash_(size_t()), build_option_hash_(size_t()),
+        from_cache_(false)
     {}
 
 
@@ -1522,6 +1748,12 @@ namespace ocl
             return;
         }
 
+        if (build_from_cache(super::build_options(an_extra_build_option)))
+        {
+            update_hashes(an_extra_build_option);
+            return;
+        }
+
         cl::Program::Sources source(1U, code_policy::source());
         super::update_program_from_source(source);
 
@@ -1554,10 +1786,88 @@ namespace ocl
         typedef LazyFunction self_t;
 
         self_t* self = static_cast<self_t*>(an_instance); // Recover pointer to instance.
+        self->store_in_cache();
         self->notify(a_program);
     }
 
 
+    // Build the program from the binary in the cache if there is one
+    // and answer whether we succeeded.  Building a binary just links
+    // it, so we do it synchronously: if the runtime rejects the binary
+    // we remove the entry and the caller can compile the source.
+    template <class actual_code_policy>
+    bool
+    LazyFunction<actual_code_policy>::build_from_cache(const std::string& a_build_option)
+    {
+        from_cache_ = false;
+
+        try
+        {
+            cache_key_ = program_cache::key(super::device(), code_policy::text(), a_build_option);
+        }
+        catch (cl::Error&)
+        {
+            cache_key_.clear();
+            return false;
+        }
+
+        BinaryPolicy::code_t binary_code;
+        if (!program_cache::load(cache_key_, binary_code))
+        {
+            return false;
+        }
+
+        try
+        {
+            super::update_program_from_binary(super::device(), binary_code);
+            super::program().build(std::vector<cl::Device>(1U, super::device()), a_build_option.c_str());
+        }
+        catch (cl::Error& an_error)
+        {
+#ifdef DEBUG
+            std::cerr <<
+                "+ ocl::LazyFunction::build_from_cache: cached binary of \"" << code_policy::filename() <<
+                "\" rejected because of " << string_of_error_code(an_error.err()) << "\n";
+#endif
+            program_cache::erase(cache_key_);
+            return false;
+        }
+
+        from_cache_ = true;
+        notify(super::program()());
+
+        return true;
+    }
+
+
+    // Store the binary of a successful build from source.  We get
+    // here through the build-notification callback, so we must not
+    // throw.
+    template <class actual_code_policy>
+    void
+    LazyFunction<actual_code_policy>::store_in_cache()
+    {
+        if (from_cache_ || cache_key_.empty())
+        {
+            return;
+        }
+
+        try
+        {
+            const cl::Program& program = super::program();
+
+            if (program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(super::device()) == CL_BUILD_SUCCESS)
+            {
+                program_cache::store(cache_key_, super::binary(super::device()));
+            }
+        }
+        catch (...)
+        {
+            // The cache is an optimization; we can do without it.
+        }
+    }
+
+
     template <class actual_code_policy>
     void
     LazyFunction<actual_code_policy>::update_hashes(const std::string& an_extra_build_option)
@@ -501,6 +501,31 @@ namespace ocl
     }; // class BinaryFilePolicy
 
 
+    // Persistent cache of program binaries
+    //
+    // Compiling the kernels from source at each start costs seconds
+    // with some OpenCL runtimes.  Therefore we keep the binaries of
+    // successful builds on disk, in directory $ENBLEND_OPENCL_CACHE or
+    // in the user's cache directory; an empty $ENBLEND_OPENCL_CACHE
+    // disables the cache.  Each binary is filed under a key that
+    // comprises the device, its driver, the hash of the source text,
+    // and the build options, so any change of them just misses.
+    namespace program_cache
+    {
+        std::string key(const cl::Device& a_device, const std::string& a_source_text,
+                        const std::string& a_build_option);
+
+        // Answer whether the cache holds a binary for a_key and
+        // retrieve it in a_binary_code.
+        bool load(const std::string& a_key, /* output */ BinaryPolicy::code_t& a_binary_code);
+
+        // Store or remove the binary for a_key.  Both fail silently,
+        // for the cache is a mere optimization.
+        void store(const std::string& a_key, const BinaryPolicy::code_t& a_binary_code);
+        void erase(const std::string& a_key);
+    } // namespace program_cache
+
+
     ////////////////////////////////////////////////////////////////////////////
 
 
@@ -558,6 +583,7 @@ namespace ocl
 
         std::vector<BinaryPolicy::code_t> binaries() const;
         BinaryPolicy::code_t binary() const;
+        BinaryPolicy::code_t binary(const cl::Device& a_device) const;
 
         const cl::Context& context() const;
 
@@ -580,6 +606,8 @@ namespace ocl
 
     protected:
         virtual void update_program_from_source(const cl::Program::Sources& a_source);
+        virtual void update_program_from_binary(const cl::Device& a_device,
+                                                const BinaryPolicy::code_t& a_binary_code);
 
     private:
         void initialize();
@@ -654,10 +682,14 @@ namespace ocl
 
         void update_hashes(const std::string& an_extra_build_option);
         bool needs_building(const std::string& an_extra_build_option);
+        bool build_from_cache(const std::string& a_build_option);
+        void store_in_cache();
 
         bool build_completed_;
         size_t text_hash_;
         size_t build_option_hash_;
+        std::string cache_key_;
+        bool from_cache_;
     }; // class LazyFunction
 
 
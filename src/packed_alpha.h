@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef PACKED_ALPHA_H_INCLUDED_
+#define PACKED_ALPHA_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <vigra/diff2d.hxx>
+#include <vigra/tuple.hxx>
+
+#include "common.h"
+#include "openmp_def.h"
+
+
+namespace enblend
+{
+    // Bit-packed alpha channel
+    //
+    // One bit per pixel, 64 pixels to a word; pixel x of a row is bit
+    // x % 64 of word x / 64.  The bits past the width of a row are
+    // always zero.  The packed form answers the questions about whole
+    // alpha channels -- do they overlap, where are they, are there
+    // holes -- with word operations on an eighth of the memory.
+
+    class PackedAlpha
+    {
+    public:
+        typedef uint64_t word_type;
+        enum {word_bits = 64};
+
+        PackedAlpha(int a_width, int a_height) :
+            width_(a_width), height_(a_height), words_(words_for(a_width)),
+            bits_(static_cast<size_t>(words_) * static_cast<size_t>(a_height), word_type())
+        {}
+
+        // Pack the alpha channel from SRC_UPPERLEFT to SRC_LOWERRIGHT;
+        // every non-zero pixel is opaque.
+        template <typename SrcIterator, typename SrcAccessor>
+        PackedAlpha(SrcIterator src_upperleft, SrcIterator src_lowerright, SrcAccessor sa) :
+            PackedAlpha(src_lowerright.x - src_upperleft.x, src_lowerright.y - src_upperleft.y)
+        {
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (int y = 0; y < height_; ++y) {
+                SrcIterator sx(src_upperleft + vigra::Diff2D(0, y));
+                word_type* row = this->row(y);
+
+                for (int i = 0; i < words_; ++i) {
+                    const int n = std::min(static_cast<int>(word_bits), width_ - i * word_bits);
+                    word_type w = 0U;
+                    for (int b = 0; b < n; ++b, ++sx.x) {
+                        w |= static_cast<word_type>(sa(sx) != 0) << b;
+                    }
+                    row[i] = w;
+                }
+            }
+        }
+
+        template <typename SrcIterator, typename SrcAccessor>
+        explicit PackedAlpha(vigra::triple<SrcIterator, SrcIterator, SrcAccessor> src) :
+            PackedAlpha(src.first, src.second, src.third)
+        {}
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+        vigra::Size2D size() const {return vigra::Size2D(width_, height_);}
+        int words_per_row() const {return words_;}
+
+        word_type* row(int y) {return &bits_[static_cast<size_t>(y) * words_];}
+        const word_type* row(int y) const {return &bits_[static_cast<size_t>(y) * words_];}
+
+        bool operator()(int x, int y) const
+        {
+            return (row(y)[x / word_bits] >> (x % word_bits)) & 1U;
+        }
+
+        // Answer the bits of row Y from X to X + 63, where bits
+        // outside of the row are zero.
+        word_type bits_at(int x, int y) const
+        {
+            const word_type* r = row(y);
+            const int i = floor_divide(x);
+            const int shift = x - i * word_bits;
+            const word_type lo = i >= 0 && i < words_ ? r[i] : 0U;
+
+            if (shift == 0) {
+                return lo;
+            }
+
+            const word_type hi = i + 1 >= 0 && i + 1 < words_ ? r[i + 1] : 0U;
+            return (lo >> shift) | (hi << (word_bits - shift));
+        }
+
+        // Answer whether this alpha and AN_ALPHA, whose upper left
+        // corner sits at A_POSITION, share an opaque pixel.
+        bool intersects(const PackedAlpha& an_alpha, const vigra::Diff2D& a_position) const
+        {
+            const int top = std::max(0, a_position.y);
+            const int bottom = std::min(height_, a_position.y + an_alpha.height());
+            const int left = std::max(0, a_position.x);
+            const int right = std::min(width_, a_position.x + an_alpha.width());
+            bool found = false;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static) reduction(||: found)
+#endif
+            for (int y = top; y < bottom; ++y) {
+                for (int x = left; x < right && !found; x += word_bits) {
+                    found = (bits_at(x, y) & an_alpha.bits_at(x - a_position.x, y - a_position.y)) != 0U;
+                }
+            }
+
+            return found;
+        }
+
+        // Make every pixel opaque that is opaque in AN_ALPHA, whose
+        // upper left corner sits at A_POSITION.
+        void merge(const PackedAlpha& an_alpha, const vigra::Diff2D& a_position)
+        {
+            const int top = std::max(0, a_position.y);
+            const int bottom = std::min(height_, a_position.y + an_alpha.height());
+            const int first = std::max(0, a_position.x) / word_bits;
+            const int last = words_for(std::min(width_, a_position.x + an_alpha.width()));
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (int y = top; y < bottom; ++y) {
+                word_type* r = row(y);
+                for (int i = first; i < last; ++i) {
+                    r[i] |= an_alpha.bits_at(i * word_bits - a_position.x, y - a_position.y);
+                }
+                clear_tail(r);
+            }
+        }
+
+        // Answer the bounding box of all opaque pixels.
+        vigra::Rect2D bounding_box() const
+        {
+            vigra::Rect2D box;
+
+            for (int y = 0; y < height_; ++y) {
+                const word_type* r = row(y);
+                int first = 0;
+                while (first < words_ && r[first] == 0U) {
+                    ++first;
+                }
+                if (first == words_) {
+                    continue;
+                }
+                int last = words_ - 1;
+                while (r[last] == 0U) {
+                    --last;
+                }
+
+                box |= vigra::Rect2D(first * word_bits + lowest_bit(r[first]), y,
+                                     last * word_bits + highest_bit(r[last]) + 1, y + 1);
+            }
+
+            return box;
+        }
+
+        // Answer the number of transparent pixels off the edges that
+        // have eight opaque neighbors.
+        unsigned isolated_points() const
+        {
+            unsigned count = 0U;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static) reduction(+: count)
+#endif
+            for (int y = 1; y < height_ - 1; ++y) {
+                const word_type* up = row(y - 1);
+                const word_type* center = row(y);
+                const word_type* down = row(y + 1);
+
+                for (int i = 0; i < words_; ++i) {
+                    const word_type u = up[i];
+                    const word_type d = down[i];
+                    const word_type ul = left_neighbors(up, i);
+                    const word_type ur = right_neighbors(up, i);
+                    const word_type cl = left_neighbors(center, i);
+                    const word_type cr = right_neighbors(center, i);
+                    const word_type dl = left_neighbors(down, i);
+                    const word_type dr = right_neighbors(down, i);
+
+                    word_type isolated = ~center[i] & u & ul & ur & cl & cr & d & dl & dr;
+                    // Skip the first and the last column.
+                    if (i == 0) {
+                        isolated &= ~word_type(1U);
+                    }
+                    isolated &= inner_mask(i);
+                    count += population_count(isolated);
+                }
+            }
+
+            return count;
+        }
+
+    private:
+        static int words_for(int a_width)
+        {
+            return (a_width + word_bits - 1) / word_bits;
+        }
+
+        static int floor_divide(int x)
+        {
+            return x >= 0 ? x / word_bits : -((-x + word_bits - 1) / word_bits);
+        }
+
+        // Opaque bits at x for pixels whose left (right) neighbor x - 1
+        // (x + 1) is opaque
+        word_type left_neighbors(const word_type* r, int i) const
+        {
+            return (r[i] << 1) | (i > 0 ? r[i - 1] >> (word_bits - 1) : 0U);
+        }
+
+        word_type right_neighbors(const word_type* r, int i) const
+        {
+            return (r[i] >> 1) | (i + 1 < words_ ? r[i + 1] << (word_bits - 1) : 0U);
+        }
+
+        // Bits of word I that lie in the row, but not in its last column
+        word_type inner_mask(int i) const
+        {
+            const int n = width_ - 1 - i * word_bits;
+            return n >= word_bits ? ~word_type() : (n <= 0 ? 0U : (word_type(1U) << n) - 1U);
+        }
+
+        void clear_tail(word_type* r) const
+        {
+            const int n = width_ - (words_ - 1) * word_bits;
+            if (words_ != 0 && n < word_bits) {
+                r[words_ - 1] &= (word_type(1U) << n) - 1U;
+            }
+        }
+
+        static unsigned population_count(word_type w)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_popcountll(w));
+#else
+            unsigned n = 0U;
+            for (; w != 0U; w &= w - 1U) {
+                ++n;
+            }
+            return n;
+#endif
+        }
+
+        static int lowest_bit(word_type w)
+        {
+            int b = 0;
+            while (!((w >> b) & 1U)) {
+                ++b;
+            }
+            return b;
+        }
+
+        static int highest_bit(word_type w)
+        {
+            int b = word_bits - 1;
+            while (!((w >> b) & 1U)) {
+                --b;
+            }
+            return b;
+        }
+
+        int width_;
+        int height_;
+        int words_;
+        std::vector<word_type> bits_;
+    };
+
+
+    // Characterize the overlap of A_BLACK and A_WHITE, whose upper
+    // left corner sits at A_POSITION in A_BLACK, like
+    // inspectOverlap(), but 64 pixels at a time.  Only the rows of
+    // A_WHITE are scanned, and the scan stops as soon as it has found
+    // a shared pixel and a pixel of A_WHITE alone.
+    inline Overlap
+    inspectOverlap(const PackedAlpha& a_black, const PackedAlpha& a_white, const vigra::Diff2D& a_position)
+    {
+        bool found_overlap = false;
+        bool found_distinct_white = false;
+
+        for (int y = 0; y < a_white.height(); ++y) {
+            const int black_y = y + a_position.y;
+            const bool is_inside = black_y >= 0 && black_y < a_black.height();
+            const PackedAlpha::word_type* white = a_white.row(y);
+
+            for (int i = 0; i < a_white.words_per_row(); ++i) {
+                if (white[i] == 0U) {
+                    continue;
+                }
+
+                const PackedAlpha::word_type black =
+                    is_inside ? a_black.bits_at(i * PackedAlpha::word_bits + a_position.x, black_y) : 0U;
+                found_overlap = found_overlap || (black & white[i]) != 0U;
+                found_distinct_white = found_distinct_white || (white[i] & ~black) != 0U;
+                if (found_overlap && found_distinct_white) {
+                    return PartialOverlap;
+                }
+            }
+        }
+
+        return found_overlap ? CompleteOverlap : NoOverlap;
+    }
+} // namespace enblend
+
+
+#endif // PACKED_ALPHA_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef PREVIEW_H_INCLUDED_
+#define PREVIEW_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <memory>
+#include <type_traits>
+
+#include <vigra/numerictraits.hxx>
+
+#include "fixmath.h"
+#include "numerictraits.h"
+#include "openmp_vigra.h"
+#include "pyramid.h"
+#include "rect2d.hxx"
+
+
+namespace enblend
+{
+    // Preview mode
+    //
+    // Option --preview=LEVELS shrinks every input image by 2^LEVELS
+    // right after import and then runs the unchanged pipeline on the
+    // proxies.  The shrinking is the Gaussian reduction of pyramid.h,
+    // so level l of the preview's pyramids is level l + LEVELS of the
+    // full-resolution pyramids up to the different framing of the
+    // input images.  All preview grids are anchored at the canvas
+    // origin, which keeps the proxies of overlapping images aligned.
+
+
+    inline static int
+    floorDivide(int x, int a_divisor)
+    {
+        return x >= 0 ? x / a_divisor : -((-x + a_divisor - 1) / a_divisor);
+    }
+
+
+    // Answer A_RECT of the canvas in pixels of the preview scaled down
+    // by 2^A_LEVELS.
+    inline vigra::Rect2D
+    previewRect(const vigra::Rect2D& a_rect, unsigned a_levels)
+    {
+        const int scale = 1 << a_levels;
+
+        return vigra::Rect2D(floorDivide(a_rect.left(), scale),
+                             floorDivide(a_rect.top(), scale),
+                             -floorDivide(-a_rect.right(), scale),
+                             -floorDivide(-a_rect.bottom(), scale));
+    }
+
+
+    // Replace AN_IMAGE and AN_ALPHA, which sit at A_POSITION of the
+    // canvas, with their preview scaled down by 2^A_LEVELS.
+    template <typename ImageType, typename AlphaType>
+    void
+    reduceToPreview(unsigned a_levels, bool a_wraparound, const vigra::Point2D& a_position,
+                    std::unique_ptr<ImageType>& an_image, std::unique_ptr<AlphaType>& an_alpha)
+    {
+        typedef typename ImageType::value_type ImagePixelType;
+        typedef EnblendNumericTraits<ImagePixelType> Traits;
+        typedef typename Traits::ImagePyramidType PyramidType;
+        typedef typename PyramidType::value_type PyramidPixelType;
+        typedef typename Traits::SKIPSMImagePixelType SKIPSMImagePixelType;
+        typedef typename Traits::SKIPSMAlphaPixelType SKIPSMAlphaPixelType;
+
+        enum {IntegerBits = Traits::ImagePyramidIntegerBits};
+        enum {FractionBits = Traits::ImagePyramidFractionBits};
+
+        typedef typename vigra::NumericTraits<ImagePixelType>::isScalar is_scalar;
+        typedef typename std::conditional<is_scalar::asBool,
+                                          ConvertScalarToPyramidFunctor<ImagePixelType, PyramidPixelType,
+                                                                        IntegerBits, FractionBits>,
+                                          ConvertVectorToPyramidFunctor<ImagePixelType, PyramidPixelType,
+                                                                        IntegerBits, FractionBits> >::type
+            ToPyramid;
+        typedef typename std::conditional<is_scalar::asBool,
+                                          ConvertPyramidToScalarFunctor<ImagePixelType, PyramidPixelType,
+                                                                        IntegerBits, FractionBits>,
+                                          ConvertPyramidToVectorFunctor<ImagePixelType, PyramidPixelType,
+                                                                        IntegerBits, FractionBits> >::type
+            FromPyramid;
+
+        const int scale = 1 << a_levels;
+        const vigra::Rect2D preview(previewRect(vigra::Rect2D(a_position, an_image->size()), a_levels));
+
+        // Frame the image so that it starts on the preview grid and
+        // its size is a multiple of the scale.  Then every reduction
+        // halves the size exactly and the padding, being transparent,
+        // does not contribute.
+        const vigra::Diff2D offset(a_position.x - preview.left() * scale,
+                                   a_position.y - preview.top() * scale);
+        const vigra::Size2D framed_size(preview.width() * scale, preview.height() * scale);
+        const bool wraparound =
+            a_wraparound && offset == vigra::Diff2D(0, 0) && framed_size.x == an_image->width();
+
+        std::unique_ptr<PyramidType> level(new PyramidType(framed_size.x, framed_size.y));
+        std::unique_ptr<AlphaType> level_alpha(new AlphaType(framed_size));
+        vigra::omp::transformImage(srcImageRange(*an_image),
+                                   vigra::destIter(level->upperLeft() + offset, level->accessor()),
+                                   ToPyramid());
+        vigra::omp::copyImage(srcImageRange(*an_alpha),
+                              vigra::destIter(level_alpha->upperLeft() + offset, level_alpha->accessor()));
+        an_image.reset();
+        an_alpha.reset();
+
+        for (unsigned l = 0U; l != a_levels; ++l) {
+            const int width = (level->width() + 1) >> 1;
+            const int height = (level->height() + 1) >> 1;
+            std::unique_ptr<PyramidType> next(new PyramidType(width, height));
+            std::unique_ptr<AlphaType> next_alpha(new AlphaType(width, height));
+
+            reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                (wraparound,
+                 srcImageRange(*level), maskImage(*level_alpha),
+                 destImageRange(*next), destImageRange(*next_alpha));
+
+            level.swap(next);
+            level_alpha.swap(next_alpha);
+        }
+
+        an_image.reset(new ImageType(level->width(), level->height()));
+        vigra::omp::transformImage(srcImageRange(*level), destImage(*an_image), FromPyramid());
+        an_alpha.swap(level_alpha);
+    }
+} // namespace enblend
+
+
+#endif // PREVIEW_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
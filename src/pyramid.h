@@ -26,6 +26,7 @@
 #endif
 
 #include <functional>
+#include <type_traits>
 #include <vector>
 
 #include <vigra/convolution.hxx>
@@ -37,6 +38,8 @@
 #include <vigra/transformimage.hxx>
 
 #include "fixmath.h"
+#include "pyramid_pool.h"
+#include "skipsm_simd.h"
 
 
 namespace enblend
@@ -71,6 +74,161 @@ filterHalfWidth(const unsigned int levels)
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+/** Horizontal pass of reduce() for one row of an image with an
+ *  alpha channel.
+ *
+ *  Gather the row with all invisible pixels replaced by zero, pad
+ *  it with two pixels on either side, and apply the 1-4-6-4-1 filter
+ *  centered on every other pixel.  The result in IH[1..dst_w] and
+ *  AH[1..dst_w] equals what the SKIPSM row state machine delivers
+ *  at the even source pixels; index 0 is unused.  IROW and AROW
+ *  must hold src_w + 4 elements.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor>
+inline static void
+reduceRow(bool wraparound, int src_w, int dst_w,
+          SrcImageIterator sx, SrcAccessor sa,
+          AlphaIterator ax, AlphaAccessor aa,
+          SKIPSMImagePixelType* irow, SKIPSMAlphaPixelType* arow,
+          SKIPSMImagePixelType* ih, SKIPSMAlphaPixelType* ah)
+{
+    const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
+    const SKIPSMAlphaPixelType SKIPSMAlphaZero(vigra::NumericTraits<SKIPSMAlphaPixelType>::zero());
+    const SKIPSMAlphaPixelType SKIPSMAlphaOne(vigra::NumericTraits<SKIPSMAlphaPixelType>::one());
+
+    SKIPSMImagePixelType* const ir = irow + 2;
+    SKIPSMAlphaPixelType* const ar = arow + 2;
+
+    for (int x = 0; x < src_w; ++x, ++sx.x, ++ax.x) {
+        const bool visible = aa(ax);
+        ar[x] = visible ? SKIPSMAlphaOne : SKIPSMAlphaZero;
+        ir[x] = visible ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero;
+    }
+
+    if (wraparound) {
+        ir[-2] = ir[src_w - 2];
+        ir[-1] = ir[src_w - 1];
+        ir[src_w] = ir[0];
+        ir[src_w + 1] = ir[1];
+        ar[-2] = ar[src_w - 2];
+        ar[-1] = ar[src_w - 1];
+        ar[src_w] = ar[0];
+        ar[src_w + 1] = ar[1];
+    } else {
+        ir[-2] = ir[-1] = ir[src_w] = ir[src_w + 1] = SKIPSMImageZero;
+        ar[-2] = ar[-1] = ar[src_w] = ar[src_w + 1] = SKIPSMAlphaZero;
+    }
+
+    // The padding takes care of both boundary conditions, so every
+    // output pixel sees the same filter.  We keep the association of
+    // the terms of the state machine, which matters for
+    // floating-point SKIPSM types.
+    for (int k = 1; k <= dst_w; ++k) {
+        const SKIPSMImagePixelType* const r = ir + 2 * k - 4;
+        const SKIPSMAlphaPixelType* const a = ar + 2 * k - 4;
+        const SKIPSMImagePixelType isr1(r[0] + SKIPSMImagePixelType(r[1] * 4));
+        const SKIPSMAlphaPixelType asr1(a[0] + SKIPSMAlphaPixelType(a[1] * 4));
+
+        ih[k] = isr1 + imul6(r[2]) + SKIPSMImagePixelType(r[3] * 4) + r[4];
+        ah[k] = asr1 + amul6(a[2]) + SKIPSMAlphaPixelType(a[3] * 4) + a[4];
+    }
+}
+
+
+/** Horizontal pass of reduce() for one row of an image without an
+ *  alpha channel.
+ *
+ *  Like the version above, but without an alpha channel to carry
+ *  the missing weights an open boundary replicates the edge pixels
+ *  into the padding.  IROW must hold src_w + 4 elements.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor>
+inline static void
+reduceRow(bool wraparound, int src_w, int dst_w,
+          SrcImageIterator sx, SrcAccessor sa,
+          SKIPSMImagePixelType* irow, SKIPSMImagePixelType* ih)
+{
+    SKIPSMImagePixelType* const ir = irow + 2;
+
+    for (int x = 0; x < src_w; ++x, ++sx.x) {
+        ir[x] = SKIPSMImagePixelType(sa(sx));
+    }
+
+    if (wraparound) {
+        ir[-2] = ir[src_w - 2];
+        ir[-1] = ir[src_w - 1];
+        ir[src_w] = ir[0];
+        ir[src_w + 1] = ir[1];
+    } else {
+        ir[-2] = ir[-1] = ir[0];
+        ir[src_w] = ir[src_w + 1] = ir[src_w - 1];
+    }
+
+    for (int k = 1; k <= dst_w; ++k) {
+        const SKIPSMImagePixelType* const r = ir + 2 * k - 4;
+        const SKIPSMImagePixelType isr1(r[0] + SKIPSMImagePixelType(r[1] * 4));
+
+        ih[k] = isr1 + imul6(r[2]) + SKIPSMImagePixelType(r[3] * 4) + r[4];
+    }
+}
+
+
+/** Normalize one output row of reduce() by the alpha weights AP and
+ *  write it along with the output alpha.  The weights act as a mask:
+ *  pixels with zero weight come out as zero.  Pixel types that
+ *  consist of 32-bit integers use the vectorized division of
+ *  skipsm_simd.h with DEN as scratch space for lanes * dst_w
+ *  elements.  IP gets overwritten.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline static void
+reduceNormalizeRow(int dst_w,
+                   SKIPSMImagePixelType* ip, const SKIPSMAlphaPixelType* ap, skipsm::lane_t* den,
+                   DestImageIterator dx, DestAccessor da,
+                   DestAlphaIterator dax, DestAlphaAccessor daa)
+{
+    typedef typename DestAccessor::value_type DestPixelType;
+    typedef typename DestAlphaAccessor::value_type DestAlphaPixelType;
+    typedef skipsm::Int32Lanes<SKIPSMImagePixelType> ImageLanes;
+
+    const DestPixelType DestImageZero(vigra::NumericTraits<DestPixelType>::zero());
+    const DestAlphaPixelType DestAlphaZero(vigra::NumericTraits<DestAlphaPixelType>::zero());
+    const DestAlphaPixelType DestAlphaMax(vigra::NumericTraits<DestAlphaPixelType>::max());
+
+    if (ImageLanes::value != 0) {
+        const int lanes = ImageLanes::value;
+
+        for (int k = 1; k <= dst_w; ++k) {
+            for (int c = 0; c < lanes; ++c) {
+                den[lanes * (k - 1) + c] = static_cast<skipsm::lane_t>(ap[k]);
+            }
+        }
+        skipsm::kernels().divide(lanes * dst_w, skipsm::lanes(ip + 1), den, skipsm::lanes(ip + 1));
+
+        for (int k = 1; k <= dst_w; ++k, ++dx.x, ++dax.x) {
+            da.set(DestPixelType(ip[k]), dx);
+            daa.set(ap[k] ? DestAlphaMax : DestAlphaZero, dax);
+        }
+    } else {
+        for (int k = 1; k <= dst_w; ++k, ++dx.x, ++dax.x) {
+            if (ap[k]) {
+                ip[k] /= SKIPSMImagePixelType(ap[k]);
+                da.set(DestPixelType(ip[k]), dx);
+                daa.set(DestAlphaMax, dax);
+            } else {
+                da.set(DestImageZero, dx);
+                daa.set(DestAlphaZero, dax);
+            }
+        }
+    }
+}
+
+
 /** This version is for images with alpha channels.
  *  Gaussian blur, downsampling, and extrapolation in one pass over
  *  the input image using SKIPSM-based algorithm.
@@ -182,394 +340,127 @@ reduce(bool wraparound,
        DestAlphaIterator dest_alpha_lowerright,
        DestAlphaAccessor daa)
 {
-    typedef typename DestAccessor::value_type DestPixelType;
-    typedef typename DestAlphaAccessor::value_type DestAlphaPixelType;
+    typedef skipsm::Int32Lanes<SKIPSMImagePixelType> ImageLanes;
 
-    int src_w = src_lowerright.x - src_upperleft.x;
-    int src_h = src_lowerright.y - src_upperleft.y;
-    int dst_w = dest_lowerright.x - dest_upperleft.x;
-    //int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+    //const int dst_h = dest_lowerright.y - dest_upperleft.y;
 
     vigra_precondition(src_w > 1 && src_h > 1,
                        "src image too small in reduce");
 
-    // State variables for source image pixel values
-    SKIPSMImagePixelType isr0, isr1, isrp;
-    SKIPSMImagePixelType* isc0 = new SKIPSMImagePixelType[dst_w + 1];
-    SKIPSMImagePixelType* isc1 = new SKIPSMImagePixelType[dst_w + 1];
-    SKIPSMImagePixelType* iscp = new SKIPSMImagePixelType[dst_w + 1];
+    // The rows follow the SKIPSM state machine sketched above.  Its
+    // horizontal part runs in reduceRow() and delivers the values
+    // that enter the column state variables.  The column updates are
+    // independent per output pixel, so we run them over whole rows.
+
+    // Masked source row with padding
+    PyramidScratchRow<SKIPSMImagePixelType> irow(src_w + 4);
+    PyramidScratchRow<SKIPSMAlphaPixelType> arow(src_w + 4);
+
+    // Horizontally filtered row, column state variables, and output
+    // row; index 0 is never used.
+    PyramidScratchRow<SKIPSMImagePixelType> ih(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> isc0(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> isc1(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> iscp(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> ip(dst_w + 1);
 
-    // State variables for source mask pixel values
-    SKIPSMAlphaPixelType asr0, asr1, asrp;
-    SKIPSMAlphaPixelType* asc0 = new SKIPSMAlphaPixelType[dst_w + 1];
-    SKIPSMAlphaPixelType* asc1 = new SKIPSMAlphaPixelType[dst_w + 1];
-    SKIPSMAlphaPixelType* ascp = new SKIPSMAlphaPixelType[dst_w + 1];
+    PyramidScratchRow<SKIPSMAlphaPixelType> ah(dst_w + 1);
+    PyramidScratchRow<SKIPSMAlphaPixelType> asc0(dst_w + 1);
+    PyramidScratchRow<SKIPSMAlphaPixelType> asc1(dst_w + 1);
+    PyramidScratchRow<SKIPSMAlphaPixelType> ascp(dst_w + 1);
+    PyramidScratchRow<SKIPSMAlphaPixelType> ap(dst_w + 1);
+
+    PyramidScratchRow<skipsm::lane_t> den(ImageLanes::value * dst_w);
 
     // Convenient constants
     const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
     const SKIPSMAlphaPixelType SKIPSMAlphaZero(vigra::NumericTraits<SKIPSMAlphaPixelType>::zero());
-    const SKIPSMAlphaPixelType SKIPSMAlphaOne(vigra::NumericTraits<SKIPSMAlphaPixelType>::one());
-    const DestPixelType DestImageZero(vigra::NumericTraits<DestPixelType>::zero());
-    const DestAlphaPixelType DestAlphaZero(vigra::NumericTraits<DestAlphaPixelType>::zero());
-    const DestAlphaPixelType DestAlphaMax(vigra::NumericTraits<DestAlphaPixelType>::max());
 
     DestImageIterator dy = dest_upperleft;
-    DestImageIterator dx = dy;
     SrcImageIterator sy = src_upperleft;
-    SrcImageIterator sx = sy;
     AlphaIterator ay = alpha_upperleft;
-    AlphaIterator ax = ay;
     DestAlphaIterator day = dest_alpha_upperleft;
-    DestAlphaIterator dax = day;
 
-    bool evenY = true;
-    bool evenX = true;
-    int srcy = 0;
-    int srcx = 0;
-    //int dsty = 0;
-    int dstx = 0;
-
-    // First row
-    {
-        if (wraparound) {
-            asr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-            asr1 = SKIPSMAlphaZero;
-            asrp = aa(ay, vigra::Diff2D(src_w - 1, 0)) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero;
-            isr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0))) : SKIPSMImageZero;
-            isr1 = SKIPSMImageZero;
-            isrp =
-                aa(ay, vigra::Diff2D(src_w - 1, 0)) ?
-                vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4) :
-                SKIPSMImageZero;
-        } else {
-            asr0 = SKIPSMAlphaZero;
-            asr1 = SKIPSMAlphaZero;
-            asrp = SKIPSMAlphaZero;
-            isr0 = SKIPSMImageZero;
-            isr1 = SKIPSMImageZero;
-            isrp = SKIPSMImageZero;
-        }
+    for (int srcy = 0; srcy < src_h; ++srcy, ++sy.y, ++ay.y) {
+        reduceRow(wraparound, src_w, dst_w, sy, sa, ay, aa, &irow[0], &arow[0], &ih[0], &ah[0]);
 
-        for (sx = sy, ax = ay, evenX = true, srcx = 0, dstx = 0;
-             srcx < src_w;
-             ++srcx, ++sx.x, ++ax.x) {
-            SKIPSMAlphaPixelType mcurrent(aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-            SKIPSMImagePixelType icurrent(aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
-            if (evenX) {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + amul6(asr0) + asrp + mcurrent;
-                asr1 = asr0 + asrp;
-                asr0 = mcurrent;
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + imul6(isr0) + isrp + icurrent;
-                isr1 = isr0 + isrp;
-                isr0 = icurrent;
-            } else {
-                asrp = mcurrent * 4;
-                isrp = icurrent * 4;
-                ++dstx;
+        if (srcy == 0) {
+            // First row
+            for (int k = 1; k <= dst_w; ++k) {
+                asc1[k] = SKIPSMAlphaZero;
+                asc0[k] = ah[k];
+                isc1[k] = SKIPSMImageZero;
+                isc0[k] = ih[k];
             }
-            evenX = !evenX;
-        }
-
-        // Last entries in first row
-        if (!evenX) {
-            // previous srcx was even
-            ++dstx;
-            if (wraparound) {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] =
-                    asr1 + amul6(asr0) +
-                    (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero) +
-                    (aa(ay, vigra::Diff2D(1,0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] =
-                    isr1 + imul6(isr0) +
-                    (aa(ay) ?
-                     vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
-                     SKIPSMImageZero) +
-                    (aa(ay, vigra::Diff2D(1, 0)) ?
-                     vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)))) :
-                     SKIPSMImageZero);
-            } else {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + amul6(asr0);
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + imul6(isr0);
+        } else if (srcy & 1) {
+            // Odd-numbered row
+            for (int k = 1; k <= dst_w; ++k) {
+                ascp[k] = ah[k] * 4;
+                iscp[k] = ih[k] * 4;
             }
         } else {
-            // previous srcx was odd
-            if (wraparound) {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + amul6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + imul6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero);
-            } else {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + amul6(asr0) + asrp;
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + imul6(isr0) + isrp;
+            // Even-numbered row
+            for (int k = 1; k <= dst_w; ++k) {
+                SKIPSMAlphaPixelType a = asc1[k] + amul6(asc0[k]) + ascp[k];
+                asc1[k] = asc0[k] + ascp[k];
+                asc0[k] = ah[k];
+                a += asc0[k];
+                ap[k] = a;
             }
-        }
-    }
-    ++sy.y;
-    ++ay.y;
-
-    // Main Rows
-    {
-        for (evenY = false, srcy = 1; srcy < src_h; ++srcy, ++sy.y, ++ay.y) {
-            if (wraparound) {
-                asr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-                asr1 = SKIPSMAlphaZero;
-                asrp = aa(ay, vigra::Diff2D(src_w - 1, 0)) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero;
-                isr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2,0))) : SKIPSMImageZero;
-                isr1 = SKIPSMImageZero;
-                isrp =
-                    aa(ay, vigra::Diff2D(src_w - 1, 0)) ?
-                    vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1,0))) * 4) :
-                    SKIPSMImageZero;
-            } else {
-                asr0 = SKIPSMAlphaZero;
-                asr1 = SKIPSMAlphaZero;
-                asrp = SKIPSMAlphaZero;
-                isr0 = SKIPSMImageZero;
-                isr1 = SKIPSMImageZero;
-                isrp = SKIPSMImageZero;
-            }
-
-            if (evenY) {
-                // Even-numbered row
-
-                // First entry in row
-                sx = sy;
-                ax = ay;
-                if (wraparound) {
-                    asr1 = asr0 + asrp;
-                    isr1 = isr0 + isrp;
-                }
-                asr0 = aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-                isr0 = aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero;
-                // isc*[0] are never used
-                ++sx.x;
-                ++ax.x;
-                dx = dy;
-                dax = day;
-
-                // Main entries in row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x, ++ax.x) {
-                    SKIPSMAlphaPixelType mcurrent(aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    SKIPSMImagePixelType icurrent(aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
-                    if (evenX) {
-                        SKIPSMAlphaPixelType ap = asc1[dstx] + amul6(asc0[dstx]) + ascp[dstx];
-                        asc1[dstx] = asc0[dstx] + ascp[dstx];
-                        asc0[dstx] = asr1 + amul6(asr0) + asrp + mcurrent;
-                        asr1 = asr0 + asrp;
-                        asr0 = mcurrent;
-                        ap += asc0[dstx];
-
-                        SKIPSMImagePixelType ip = isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx];
-                        isc1[dstx] = isc0[dstx] + iscp[dstx];
-                        isc0[dstx] = isr1 + imul6(isr0) + isrp + icurrent;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                        if (ap) {
-                            ip += isc0[dstx]; // OVERFLOW!!!
-                            ip /= SKIPSMImagePixelType(ap);
-                            da.set(DestPixelType(ip), dx);
-                            daa.set(DestAlphaMax, dax);
-                        } else {
-                            da.set(DestImageZero, dx);
-                            daa.set(DestAlphaZero, dax);
-                        }
-
-                        ++dx.x;
-                        ++dax.x;
-                    } else {
-                        asrp = mcurrent * 4;
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
 
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-
-                    SKIPSMAlphaPixelType ap = asc1[dstx] + amul6(asc0[dstx]) + ascp[dstx];
-                    asc1[dstx] = asc0[dstx] + ascp[dstx];
-                    if (wraparound) {
-                        asc0[dstx] = asr1 + amul6(asr0) + (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero) + (aa(ay, vigra::Diff2D(1,0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    } else {
-                        asc0[dstx] = asr1 + amul6(asr0);
-                    }
-                    ap += asc0[dstx];
-
-                    SKIPSMImagePixelType ip = isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] =
-                            isr1 + imul6(isr0) +
-                            (aa(ay) ?
-                             vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
-                             SKIPSMImageZero) +
-                            (aa(ay, vigra::Diff2D(1, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0))) : SKIPSMImageZero);
-                    } else {
-                        isc0[dstx] = isr1 + imul6(isr0);
-                    }
-                    if (ap) {
-                        ip += isc0[dstx];
-                        ip /= SKIPSMImagePixelType(ap);
-                        da.set(DestPixelType(ip), dx);
-                        daa.set(DestAlphaMax, dax);
-                    } else {
-                        da.set(DestImageZero, dx);
-                        daa.set(DestAlphaZero, dax);
-                    }
-                } else {
-                    // Previous srcx was odd
-                    SKIPSMAlphaPixelType ap = asc1[dstx] + amul6(asc0[dstx]) + ascp[dstx];
-                    asc1[dstx] = asc0[dstx] + ascp[dstx];
-                    if (wraparound) {
-                        asc0[dstx] = asr1 + amul6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    } else {
-                        asc0[dstx] = asr1 + amul6(asr0) + asrp;
-                    }
-                    ap += asc0[dstx];
-
-                    SKIPSMImagePixelType ip = isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] = isr1 + imul6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero);
-                    } else {
-                        isc0[dstx] = isr1 + imul6(isr0) + isrp;
-                    }
-                    if (ap) {
-                        ip += isc0[dstx];
-                        ip /= SKIPSMImagePixelType(ap);
-                        da.set(DestPixelType(ip), dx);
-                        daa.set(DestAlphaMax, dax);
-                    } else {
-                        da.set(DestImageZero, dx);
-                        daa.set(DestAlphaZero, dax);
-                    }
-                }
-
-                ++dy.y;
-                ++day.y;
+            if (ImageLanes::value != 0) {
+                skipsm::kernels().reduce_even_row(ImageLanes::value * dst_w,
+                                                  skipsm::lanes(&ih[1]),
+                                                  skipsm::lanes(&isc0[1]), skipsm::lanes(&isc1[1]),
+                                                  skipsm::lanes(&iscp[1]),
+                                                  skipsm::lanes(&ip[1]));
             } else {
-                // First entry in odd-numbered row
-                sx = sy;
-                ax = ay;
-                if (wraparound) {
-                    asr1 = asr0 + asrp;
-                    isr1 = isr0 + isrp;
-                }
-                asr0 = aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-                isr0 = aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero;
-                // isc*[0] are never used
-                ++sx.x;
-                ++ax.x;
-
-                // Main entries in odd-numbered row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x, ++ax.x) {
-                    SKIPSMAlphaPixelType mcurrent(aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    SKIPSMImagePixelType icurrent(aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
-                    if (evenX) {
-                        ascp[dstx] = (asr1 + amul6(asr0) + asrp + mcurrent) * 4;
-                        asr1 = asr0 + asrp;
-                        asr0 = mcurrent;
-                        iscp[dstx] = (isr1 + imul6(isr0) + isrp + icurrent) * 4;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                    } else {
-                        asrp = mcurrent * 4;
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
-
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-                    if (wraparound) {
-                        ascp[dstx] = (asr1 + amul6(asr0) + (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero)
-                                      + (aa(ay, vigra::Diff2D(1,0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero)) * 4;
-                        iscp[dstx] =
-                            (isr1 + imul6(isr0) +
-                             (aa(ay) ?
-                              vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
-                              SKIPSMImageZero) +
-                             (aa(ay, vigra::Diff2D(1, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0))) : SKIPSMImageZero)) * 4;
-                    } else {
-                        ascp[dstx] = (asr1 + amul6(asr0)) * 4;
-                        iscp[dstx] = (isr1 + imul6(isr0)) * 4;
-                    }
-                } else {
-                    // previous srcx was odd
-                    if (wraparound) {
-                        ascp[dstx] = (asr1 + amul6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero)) * 4;
-                        iscp[dstx] = (isr1 + imul6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero)) * 4;
-                    } else {
-                        ascp[dstx] = (asr1 + amul6(asr0) + asrp) * 4;
-                        iscp[dstx] = (isr1 + imul6(isr0) + isrp) * 4;
-                    }
+                for (int k = 1; k <= dst_w; ++k) {
+                    SKIPSMImagePixelType p = isc1[k] + imul6(isc0[k]) + iscp[k];
+                    isc1[k] = isc0[k] + iscp[k];
+                    isc0[k] = ih[k];
+                    p += isc0[k];
+                    ip[k] = p;
                 }
             }
-            evenY = !evenY;
+
+            reduceNormalizeRow(dst_w, &ip[0], &ap[0], ImageLanes::value != 0 ? &den[0] : nullptr,
+                               dy, da, day, daa);
+
+            ++dy.y;
+            ++day.y;
         }
     }
 
     // Last Rows
-    {
-        if (!evenY) {
-            // Last srcy was even
-            // odd row will set all iscp[] to zero
-            // even row will do:
-            //isc0[dstx] = 0;
-            //isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
-            //out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
-            for (dstx = 1, dx = dy, dax = day; dstx < dst_w + 1; ++dstx, ++dx.x, ++dax.x) {
-                SKIPSMAlphaPixelType ap = asc1[dstx] + amul6(asc0[dstx]);
-                if (ap) {
-                    SKIPSMImagePixelType ip = (isc1[dstx] + imul6(isc0[dstx])) / SKIPSMImagePixelType(ap);
-                    da.set(DestPixelType(ip), dx);
-                    daa.set(DestAlphaMax, dax);
-                } else {
-                    da.set(DestImageZero, dx);
-                    daa.set(DestAlphaZero, dax);
-                }
-            }
-        } else {
-            // Last srcy was odd
-            // even row will do:
-            // isc0[dstx] = 0;
-            // isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
-            // out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
-            for (dstx = 1, dx = dy, dax = day; dstx < dst_w + 1; ++dstx, ++dx.x, ++dax.x) {
-                SKIPSMAlphaPixelType ap = asc1[dstx] + amul6(asc0[dstx]) + ascp[dstx];
-                if (ap) {
-                    SKIPSMImagePixelType ip = (isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx]) / SKIPSMImagePixelType(ap);
-                    da.set(DestPixelType(ip), dx);
-                    daa.set(DestAlphaMax, dax);
-                } else {
-                    da.set(DestImageZero, dx);
-                    daa.set(DestAlphaZero, dax);
-                }
-            }
+    if (((src_h - 1) & 1) == 0) {
+        // Last srcy was even
+        // odd row will set all iscp[] to zero
+        // even row will do:
+        //isc0[dstx] = 0;
+        //isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
+        //out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
+        for (int k = 1; k <= dst_w; ++k) {
+            ap[k] = asc1[k] + amul6(asc0[k]);
+            ip[k] = isc1[k] + imul6(isc0[k]);
+        }
+    } else {
+        // Last srcy was odd
+        // even row will do:
+        // isc0[dstx] = 0;
+        // isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
+        // out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
+        for (int k = 1; k <= dst_w; ++k) {
+            ap[k] = asc1[k] + amul6(asc0[k]) + ascp[k];
+            ip[k] = isc1[k] + imul6(isc0[k]) + iscp[k];
         }
     }
 
-    delete [] isc0;
-    delete [] isc1;
-    delete [] iscp;
-
-    delete [] asc0;
-    delete [] asc1;
-    delete [] ascp;
+    reduceNormalizeRow(dst_w, &ip[0], &ap[0], ImageLanes::value != 0 ? &den[0] : nullptr,
+                       dy, da, day, daa);
 }
 
 
@@ -597,6 +488,11 @@ reduce(bool wraparound,
 
 /** The Burt & Adelson Reduce operation.
  *  This version is for images that do not have alpha channels.
+ *
+ *  The state machine is the same as in the version for images with
+ *  alpha channels: reduceRow() delivers the horizontally filtered
+ *  rows and the column updates run over whole rows.  The top and
+ *  bottom boundaries replicate the edge rows.
  */
 template <typename SKIPSMImagePixelType,
           typename SrcImageIterator, typename SrcAccessor,
@@ -611,6 +507,7 @@ reduce(bool wraparound,
        DestAccessor da)
 {
     typedef typename DestAccessor::value_type DestPixelType;
+    typedef skipsm::Int32Lanes<SKIPSMImagePixelType> ImageLanes;
 
     const int src_w = src_lowerright.x - src_upperleft.x;
     const int src_h = src_lowerright.y - src_upperleft.y;
@@ -620,231 +517,86 @@ reduce(bool wraparound,
     vigra_precondition(src_w > 1 && src_h > 1,
                        "src image too small in reduce");
 
-    // State variables for source image pixel values
-    SKIPSMImagePixelType isr0, isr1, isrp;
-    SKIPSMImagePixelType* isc0 = new SKIPSMImagePixelType[dst_w + 1];
-    SKIPSMImagePixelType* isc1 = new SKIPSMImagePixelType[dst_w + 1];
-    SKIPSMImagePixelType* iscp = new SKIPSMImagePixelType[dst_w + 1];
+    // Source row with padding
+    PyramidScratchRow<SKIPSMImagePixelType> irow(src_w + 4);
 
-    // Convenient constants
-    const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
+    // Horizontally filtered row, column state variables, and output
+    // row; index 0 is never used.
+    PyramidScratchRow<SKIPSMImagePixelType> ih(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> isc0(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> isc1(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> iscp(dst_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> ip(dst_w + 1);
 
     DestImageIterator dy = dest_upperleft;
-    DestImageIterator dx = dy;
     SrcImageIterator sy = src_upperleft;
-    SrcImageIterator sx = sy;
-
-    bool evenY = true;
-    bool evenX = true;
-    int srcy = 0;
-    int srcx = 0;
-    //int dsty = 0;
-    int dstx = 0;
 
-    // First row
-    {
-        if (wraparound) {
-            isr0 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0)));
-            isr1 = SKIPSMImageZero;
-            isrp = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4;
-        } else {
-            isr0 = SKIPSMImagePixelType(sa(sy));
-            isr1 = SKIPSMImageZero;
-            isrp = SKIPSMImagePixelType(sa(sy)) * 4;
-        }
+    for (int srcy = 0; srcy < src_h; ++srcy, ++sy.y) {
+        reduceRow(wraparound, src_w, dst_w, sy, sa, &irow[0], &ih[0]);
 
-        // Main pixels in first row
-        for (sx = sy, evenX = true, srcx = 0, dstx = 0;
-             srcx < src_w;
-             ++srcx, ++sx.x) {
-            SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
-            if (evenX) {
-                isc0[dstx] = isr1 + imul6(isr0) + isrp + icurrent;
-                isc1[dstx] = imul5(isc0[dstx]);
-                isr1 = isr0 + isrp;
-                isr0 = icurrent;
-            } else {
-                isrp = icurrent * 4;
-                ++dstx;
+        if (srcy == 0) {
+            // First row
+            for (int k = 1; k <= dst_w; ++k) {
+                isc0[k] = ih[k];
+                isc1[k] = imul5(isc0[k]);
             }
-            evenX = !evenX;
-        }
-
-        // Last entries in first row
-        if (!evenX) {
-            // previous srcx was even
-            ++dstx;
-            if (wraparound) {
-                isc0[dstx] = isr1 + imul6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
-                    + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)));
-                isc1[dstx] = imul5(isc0[dstx]);
-            } else {
-                isc0[dstx] = isr1 + imul11(isr0);
-                isc1[dstx] = imul5(isc0[dstx]);
+        } else if (srcy & 1) {
+            // Odd-numbered row
+            for (int k = 1; k <= dst_w; ++k) {
+                iscp[k] = ih[k] * 4;
             }
         } else {
-            // previous srcx was odd
-            if (wraparound) {
-                isc0[dstx] = isr1 + imul6(isr0) + isrp + SKIPSMImagePixelType(sa(sy));
-                isc1[dstx] = imul5(isc0[dstx]);
+            // Even-numbered row
+            if (ImageLanes::value != 0) {
+                skipsm::kernels().reduce_even_row(ImageLanes::value * dst_w,
+                                                  skipsm::lanes(&ih[1]),
+                                                  skipsm::lanes(&isc0[1]), skipsm::lanes(&isc1[1]),
+                                                  skipsm::lanes(&iscp[1]),
+                                                  skipsm::lanes(&ip[1]));
             } else {
-                isc0[dstx] = isr1 + imul6(isr0) + isrp + (isrp / 4);
-                isc1[dstx] = imul5(isc0[dstx]);
+                for (int k = 1; k <= dst_w; ++k) {
+                    SKIPSMImagePixelType p = isc1[k] + imul6(isc0[k]) + iscp[k];
+                    isc1[k] = isc0[k] + iscp[k];
+                    isc0[k] = ih[k];
+                    p += isc0[k];
+                    ip[k] = p;
+                }
             }
-        }
-    }
-    ++sy.y;
 
-    // Main Rows
-    {
-        for (evenY = false, srcy = 1; srcy < src_h; ++srcy, ++sy.y) {
-            if (wraparound) {
-                isr0 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0)));
-                isr1 = SKIPSMImageZero;
-                isrp = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4;
-            } else {
-                isr0 = SKIPSMImagePixelType(sa(sy));
-                isr1 = SKIPSMImageZero;
-                isrp = SKIPSMImagePixelType(sa(sy)) * 4;
+            DestImageIterator dx = dy;
+            for (int k = 1; k <= dst_w; ++k, ++dx.x) {
+                ip[k] /= 256;
+                da.set(DestPixelType(ip[k]), dx);
             }
 
-            if (evenY) {
-                // Even-numbered row
-
-                // First entry in row
-                sx = sy;
-                isr1 = isr0 + isrp;
-                isr0 = SKIPSMImagePixelType(sa(sx));
-                // isc*[0] are never used
-                ++sx.x;
-                dx = dy;
-
-                // Main entries in row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x) {
-                    SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
-                    if (evenX) {
-                        SKIPSMImagePixelType ip = isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx];
-                        isc1[dstx] = isc0[dstx] + iscp[dstx];
-                        isc0[dstx] = isr1 + imul6(isr0) + isrp + icurrent;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                        ip += isc0[dstx];
-                        ip /= 256;
-                        da.set(DestPixelType(ip), dx);
-                        ++dx.x;
-                    } else {
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
-
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-
-                    SKIPSMImagePixelType ip = isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] = isr1 + imul6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
-                            + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)));
-                    } else {
-                        isc0[dstx] = isr1 + imul11(isr0);
-                    }
-                    ip += isc0[dstx];
-                    ip /= 256;
-                    da.set(DestPixelType(ip), dx);
-                } else {
-                    // Previous srcx was odd
-                    SKIPSMImagePixelType ip = isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] = isr1 + imul6(isr0) + isrp + SKIPSMImagePixelType(sa(sy));
-                    } else {
-                        isc0[dstx] = isr1 + imul6(isr0) + isrp + (isrp / 4);
-                    }
-                    ip += isc0[dstx];
-                    ip /= 256;
-                    da.set(DestPixelType(ip), dx);
-                }
-
-                ++dy.y;
-            } else {
-                // First entry in odd-numbered row
-                sx = sy;
-                isr1 = isr0 + isrp;
-                isr0 = SKIPSMImagePixelType(sa(sx));
-                // isc*[0] are never used
-                ++sx.x;
-
-                // Main entries in odd-numbered row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x) {
-                    SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
-                    if (evenX) {
-                        iscp[dstx] = (isr1 + imul6(isr0) + isrp + icurrent) * 4;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                    } else {
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-                    if (wraparound) {
-                        iscp[dstx] = (isr1 + imul6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
-                                      + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)))
-                                      ) * 4;
-                    } else {
-                        iscp[dstx] = (isr1 + imul11(isr0)) * 4;
-                    }
-                } else {
-                    // previous srcx was odd
-                    if (wraparound) {
-                        iscp[dstx] = (isr1 + imul6(isr0) + isrp + SKIPSMImagePixelType(sa(sy))) * 4;
-                    } else {
-                        iscp[dstx] = (isr1 + imul6(isr0) + isrp + (isrp / 4)) * 4;
-                    }
-                }
-            }
-            evenY = !evenY;
+            ++dy.y;
         }
     }
 
     // Last Rows
-    {
-        if (!evenY) {
-            // Last srcy was even
-            // odd row will set all iscp[] to zero
-            // even row will do:
-            //isc0[dstx] = 0;
-            //isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
-            //out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
-            for (dstx = 1, dx = dy; dstx < dst_w + 1; ++dstx, ++dx.x) {
-                SKIPSMImagePixelType ip = (isc1[dstx] + imul11(isc0[dstx])) / 256;
-                da.set(DestPixelType(ip), dx);
-            }
-        } else {
-            // Last srcy was odd
-            // even row will do:
-            // isc0[dstx] = 0;
-            // isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
-            // out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
-            for (dstx = 1, dx = dy; dstx < dst_w + 1; ++dstx, ++dx.x) {
-                SKIPSMImagePixelType ip =
-                    (isc1[dstx] + imul6(isc0[dstx]) + iscp[dstx] + (iscp[dstx] / 4)) / 256;
-                da.set(DestPixelType(ip), dx);
-            }
+    DestImageIterator dx = dy;
+    if (((src_h - 1) & 1) == 0) {
+        // Last srcy was even
+        // odd row will set all iscp[] to zero
+        // even row will do:
+        //isc0[dstx] = 0;
+        //isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
+        //out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
+        for (int k = 1; k <= dst_w; ++k, ++dx.x) {
+            SKIPSMImagePixelType p = (isc1[k] + imul11(isc0[k])) / 256;
+            da.set(DestPixelType(p), dx);
+        }
+    } else {
+        // Last srcy was odd
+        // even row will do:
+        // isc0[dstx] = 0;
+        // isc1[dstx] = isc0[dstx] + 4*iscp[dstx]
+        // out = isc1[dstx] + 6*isc0[dstx] + 4*iscp[dstx] + newisc0[dstx]
+        for (int k = 1; k <= dst_w; ++k, ++dx.x) {
+            SKIPSMImagePixelType p = (isc1[k] + imul6(isc0[k]) + iscp[k] + (iscp[k] / 4)) / 256;
+            da.set(DestPixelType(p), dx);
         }
     }
-
-    delete [] isc0;
-    delete [] isc1;
-    delete [] iscp;
 }
 
 
@@ -870,172 +622,45 @@ reduce(bool wraparound,
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-// SKIPSM update routine used when visiting a pixel in the top two rows
-// and the left two rows.
-#define SKIPSM_EXPAND(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        current = SKIPSMImagePixelType(sa(sx));                     \
-        out00 = sc1a[srcx] + imul6(sc0a[srcx]);                     \
-        out10 = sc1b[srcx] + imul6(sc0b[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + imul6(sr0) + current;                    \
-        sc0b[srcx] = (sr0 + current) * 4;                           \
-        sr1 = sr0;                                                  \
-        sr0 = current;                                              \
-        out00 += sc0a[srcx];                                        \
-        out10 += sc0b[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out11 += sc0b[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out10 /= SKIPSMImagePixelType(SCALE_OUT10);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        out11 /= SKIPSMImagePixelType(SCALE_OUT11);                 \
-        da.set(cf(SKIPSMImagePixelType(da(dx)), out00), dx);        \
-        ++dx.x;                                                     \
-        da.set(cf(SKIPSMImagePixelType(da(dx)), out10), dx);        \
-        ++dx.x;                                                     \
-        da.set(cf(SKIPSMImagePixelType(da(dxx)), out01), dxx);      \
-        ++dxx.x;                                                    \
-        da.set(cf(SKIPSMImagePixelType(da(dxx)), out11), dxx);      \
-        ++dxx.x;                                                    \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra row under the main image body.
-#define SKIPSM_EXPAND_ROW_END(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + imul6(sc0a[srcx]);                     \
-        out10 = sc1b[srcx] + imul6(sc0b[srcx]);                     \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out10 /= SKIPSMImagePixelType(SCALE_OUT10);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        ++dx.x;                                                     \
-        da.set(cf(da(dx), out10), dx);                              \
-        ++dx.x;                                                     \
-        if (dst_h_even) {                                           \
-            out01 = sc0a[srcx];                                     \
-            out11 = sc0b[srcx];                                     \
-            out01 /= SKIPSMImagePixelType(SCALE_OUT01);             \
-            out11 /= SKIPSMImagePixelType(SCALE_OUT11);             \
-            da.set(cf(da(dxx), out01), dxx);                        \
-            ++dxx.x;                                                \
-            da.set(cf(da(dxx), out11), dxx);                        \
-            ++dxx.x;                                                \
-        }                                                           \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra column to the right
-// of the main image body.
-#define SKIPSM_EXPAND_COLUMN_END(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + imul6(sc0a[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out10 = sc1b[srcx] + imul6(sc0b[srcx]);                     \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + imul6(sr0);                              \
-        sc0b[srcx] = sr0 * 4;                                       \
-        out00 += sc0a[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        da.set(cf(da(dxx), out01), dxx);                            \
-        if (dst_w_even) {                                           \
-            ++dx.x;                                                 \
-            ++dxx.x;                                                \
-            out10 += sc0b[srcx];                                    \
-            out11 += sc0b[srcx];                                    \
-            out10 /= SKIPSMImagePixelType(SCALE_OUT10);             \
-            out11 /= SKIPSMImagePixelType(SCALE_OUT11);             \
-            da.set(cf(da(dx), out10), dx);                          \
-            da.set(cf(da(dxx), out11), dxx);                        \
-        }                                                           \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra column to the right
-// of the main image body, with wraparound boundary conditions.
-// This version is for the case where the dst image has even width.
-#define SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_EVEN(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + imul6(sc0a[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out10 = sc1b[srcx] + imul6(sc0b[srcx]);                     \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + imul6(sr0) + SKIPSMImagePixelType(sa(sy)); \
-        sc0b[srcx] = (sr0 + SKIPSMImagePixelType(sa(sy))) * 4;      \
-        out00 += sc0a[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        da.set(cf(da(dxx), out01), dxx);                            \
-        ++dx.x;                                                     \
-        ++dxx.x;                                                    \
-        out10 += sc0b[srcx];                                        \
-        out11 += sc0b[srcx];                                        \
-        out10 /= SKIPSMImagePixelType(SCALE_OUT10);                 \
-        out11 /= SKIPSMImagePixelType(SCALE_OUT11);                 \
-        da.set(cf(da(dx), out10), dx);                              \
-        da.set(cf(da(dxx), out11), dxx);                            \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra column to the right
-// of the main image body, with wraparound boundary conditions.
-// This version is for the case where the dst image has odd width.
-#define SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_ODD(SCALE_OUT00, SCALE_OUT01) \
-    do {                                                            \
-        out00 = sc1a[srcx] + imul6(sc0a[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out10 = sc1b[srcx] + imul6(sc0b[srcx]);                     \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + imul6(sr0) + imul4(SKIPSMImagePixelType(sa(sy))); \
-        sc0b[srcx] = (sr0 + SKIPSMImagePixelType(sa(sy))) * 4;      \
-        out00 += sc0a[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        da.set(cf(da(dxx), out01), dxx);                            \
-    } while (false)
-
-
-// SKIPSM update routine for the extra column to the right
-// of the extra row under the main image body.
-#define SKIPSM_EXPAND_ROW_COLUMN_END(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + imul6(sc0a[srcx]);                     \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        if (dst_w_even) {                                           \
-            out10 = sc1b[srcx] + imul6(sc0b[srcx]);                 \
-            out10 /= SKIPSMImagePixelType(SCALE_OUT10);             \
-            ++dx.x;                                                 \
-            da.set(cf(da(dx), out10), dx);                          \
-        }                                                           \
-        if (dst_h_even) {                                           \
-            out01 = sc0a[srcx];                                     \
-            out01 /= SKIPSMImagePixelType(SCALE_OUT01);             \
-            da.set(cf(da(dxx), out01), dxx);                        \
-            if (dst_w_even) {                                       \
-                out11 = sc0b[srcx];                                 \
-                out11 /= SKIPSMImagePixelType(SCALE_OUT11);         \
-                ++dxx.x;                                            \
-                da.set(cf(da(dxx), out11), dxx);                    \
-            }                                                       \
-        }                                                           \
-    } while (false)
+/** Horizontal pass of expand() for one source row.
+ *
+ *  Gather the row and pad it with one pixel on either side: zeros
+ *  for an open boundary, the pixels of the opposite edge for
+ *  wraparound.  Wrapped pixels of dst images with odd width count
+ *  four times to match the normalization of their edge columns.
+ *  HA[1..src_w] and HB[1..src_w] get the values that enter the
+ *  column state variables sc0a and sc0b of the SKIPSM state machine
+ *  explained below; index 0 is unused.  ROW must hold src_w + 2
+ *  elements.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor>
+inline static void
+expandRow(bool wraparound, bool dst_w_even, int src_w,
+          SrcImageIterator sx, SrcAccessor sa,
+          SKIPSMImagePixelType* row, SKIPSMImagePixelType* ha, SKIPSMImagePixelType* hb)
+{
+    SKIPSMImagePixelType* const r = row + 1;
+
+    for (int x = 0; x < src_w; ++x, ++sx.x) {
+        r[x] = SKIPSMImagePixelType(sa(sx));
+    }
+
+    if (!wraparound) {
+        r[-1] = r[src_w] = vigra::NumericTraits<SKIPSMImagePixelType>::zero();
+    } else if (dst_w_even) {
+        r[-1] = r[src_w - 1];
+        r[src_w] = r[0];
+    } else {
+        r[-1] = imul4(r[src_w - 1]);
+        r[src_w] = imul4(r[0]);
+    }
+
+    for (int x = 1; x <= src_w; ++x) {
+        ha[x] = r[x - 2] + imul6(r[x - 1]) + r[x];
+        hb[x] = (r[x - 1] + r[x]) * 4;
+    }
+}
 
 
 /** The Burt & Adelson Expand operation.
@@ -1098,11 +723,19 @@ reduce(bool wraparound,
  *  out(-2, -1) <= 4*sc0a[x] + 4*(new sc0a[x])
  *  out(-1, -1) <= 4*sc0b[x] + 4*(new sc0b[x])
  *
+ *  expandRow() runs the horizontal part of the state machine on a
+ *  padded row, which takes care of the left and right boundaries.
+ *  The column updates then run over whole rows with the
+ *  normalizations in per-column tables.
+ *
+ *  The dst rows get finished from top to bottom.  After each pair
+ *  rows_done is called with the number of dst rows that are final,
+ *  so that a consumer can pick them up while the expansion goes on.
  */
 template <typename SKIPSMImagePixelType,
           typename SrcImageIterator, typename SrcAccessor,
           typename DestImageIterator, typename DestAccessor,
-          typename CombineFunctor>
+          typename CombineFunctor, typename RowsDoneFunctor>
 void
 expand(bool add, bool wraparound,
        SrcImageIterator src_upperleft,
@@ -1111,311 +744,196 @@ expand(bool add, bool wraparound,
        DestImageIterator dest_upperleft,
        DestImageIterator dest_lowerright,
        DestAccessor da,
-       CombineFunctor cf)
+       CombineFunctor cf,
+       RowsDoneFunctor rows_done)
 {
-    int src_w = src_lowerright.x - src_upperleft.x;
-    int src_h = src_lowerright.y - src_upperleft.y;
-    int dst_w = dest_lowerright.x - dest_upperleft.x;
-    int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
 
     const bool dst_w_even = (dst_w & 1) == 0;
     const bool dst_h_even = (dst_h & 1) == 0;
 
-    // SKIPSM state variables
-    SKIPSMImagePixelType current;
-    SKIPSMImagePixelType out00, out10, out01, out11;
-    SKIPSMImagePixelType sr0, sr1;
-    SKIPSMImagePixelType* sc0a = new SKIPSMImagePixelType[src_w + 1];
-    SKIPSMImagePixelType* sc0b = new SKIPSMImagePixelType[src_w + 1];
-    SKIPSMImagePixelType* sc1a = new SKIPSMImagePixelType[src_w + 1];
-    SKIPSMImagePixelType* sc1b = new SKIPSMImagePixelType[src_w + 1];
+    // A single column has no neighbors to wrap around to.
+    const bool wrap = wraparound && src_w > 1;
+
+    // Padded source row
+    PyramidScratchRow<SKIPSMImagePixelType> row(src_w + 2);
+
+    // Horizontally filtered rows, column state variables,
+    // normalizations, and output rows; index 0 is never used.
+    PyramidScratchRow<SKIPSMImagePixelType> ha(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> hb(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> sc0a(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> sc0b(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> sc1a(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> sc1b(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> s00(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> s10(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> s01(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> s11(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> o00(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> o10(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> o01(src_w + 1);
+    PyramidScratchRow<SKIPSMImagePixelType> o11(src_w + 1);
 
     // Convenient constants
     const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
 
-    DestImageIterator dy = dest_upperleft;
-    DestImageIterator dyy = dest_upperleft;
-    DestImageIterator dx = dy;
-    DestImageIterator dxx = dyy;
-    SrcImageIterator sy = src_upperleft;
-    SrcImageIterator sx = sy;
-
-    int srcy = 0;
-    int srcx = 0;
-    //int dsty = 0;
-    //int dstx = 0;
-
-    // First row
-    {
-        // First column
-        srcx = 0;
-        sx = sy;
-        sr0 = SKIPSMImagePixelType(sa(sx));
-        if (wraparound) {
-            sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0)));
-            if (!dst_w_even) {
-                sr1 = imul4(sr1);
-            }
-        } else {
-            sr1 = SKIPSMImageZero;
+    const bool use_kernels = skipsm::Int32Lanes<SKIPSMImagePixelType>::value != 0;
+    const int lanes = skipsm::Int32Lanes<SKIPSMImagePixelType>::value;
+
+    // Each output is normalized by the weight of the filter taps
+    // inside the image, which is the product of a row factor and a
+    // column factor.  The interior columns have factor 8.  The edge
+    // columns lose taps at an open boundary and gain the fourfold
+    // wrapped pixels of odd-width dst images.
+    const int edge_a = src_w == 1 ? 6 : (wrap ? (dst_w_even ? 8 : 11) : 7);
+    const int last_b = wrap ? 8 : 4;
+
+    auto normalization = [&](int row_a, int row_b) {
+        for (int x = 1; x <= src_w; ++x) {
+            const int column_a = x == 1 || x == src_w ? edge_a : 8;
+            const int column_b = x == src_w ? last_b : 8;
+            s00[x] = SKIPSMImagePixelType(row_a * column_a);
+            s10[x] = SKIPSMImagePixelType(row_a * column_b);
+            s01[x] = SKIPSMImagePixelType(row_b * column_a);
+            s11[x] = SKIPSMImagePixelType(row_b * column_b);
         }
-        // sc*[0] are irrelevant
-
-        srcx = 1;
-        ++sx.x;
-
-        for (; srcx < src_w; ++srcx, ++sx.x) {
-            current = SKIPSMImagePixelType(sa(sx));
-            sc0a[srcx] = sr1 + imul6(sr0) + current;
-            sc0b[srcx] = (sr0 + current) * 4;
-            sc1a[srcx] = SKIPSMImageZero;
-            sc1b[srcx] = SKIPSMImageZero;
-            sr1 = sr0;
-            sr0 = current;
+    };
+
+    // Column updates for source columns FIRST to LAST with the
+    // horizontally filtered row in ha and hb
+    auto update = [&](int first, int last) {
+        for (int x = first; x <= last; ++x) {
+            SKIPSMImagePixelType out00 = sc1a[x] + imul6(sc0a[x]);
+            SKIPSMImagePixelType out10 = sc1b[x] + imul6(sc0b[x]);
+            SKIPSMImagePixelType out01 = sc0a[x];
+            SKIPSMImagePixelType out11 = sc0b[x];
+            sc1a[x] = sc0a[x];
+            sc1b[x] = sc0b[x];
+            sc0a[x] = ha[x];
+            sc0b[x] = hb[x];
+            out00 += sc0a[x];
+            out10 += sc0b[x];
+            out01 += sc0a[x];
+            out11 += sc0b[x];
+            out00 /= s00[x];
+            out10 /= s10[x];
+            out01 /= s01[x];
+            out11 /= s11[x];
+            o00[x] = out00;
+            o10[x] = out10;
+            o01[x] = out01;
+            o11[x] = out11;
         }
-
-        // extra column at end of first row
-        if (wraparound) {
-            current = SKIPSMImagePixelType(sa(sy));
-            if (dst_w_even) {
-                sc0a[srcx] = sr1 + imul6(sr0) + current;
-                sc0b[srcx] = (sr0 + current) * 4;
-            } else {
-                sc0a[srcx] = sr1 + imul6(sr0) + imul4(current);
-                // sc*b[srcx] are irrelevant for odd-sized dst images in wraparound mode.
-            }
-        } else {
-            sc0a[srcx] = sr1 + imul6(sr0);
-            sc0b[srcx] = sr0 * 4;
+    };
+
+    // Combine one dst row with the outputs A of the even and B of the
+    // odd columns.  Only dst images of even width have an odd column
+    // for the last source column.
+    auto store = [&](DestImageIterator dx, const SKIPSMImagePixelType* a, const SKIPSMImagePixelType* b) {
+        for (int x = 1; x < src_w; ++x) {
+            da.set(cf(SKIPSMImagePixelType(da(dx)), a[x]), dx);
+            ++dx.x;
+            da.set(cf(SKIPSMImagePixelType(da(dx)), b[x]), dx);
+            ++dx.x;
         }
-        sc1a[srcx] = SKIPSMImageZero;
-        sc1b[srcx] = SKIPSMImageZero;
-    }
-
-    // dy  = row 0
-    // dyy = row 1
-    ++dyy.y;
-    // sy = row 1
-    srcy = 1;
-    ++sy.y;
-
-    // Second row
-    if (src_h > 1) {
-        // First column
-        srcx = 0;
-        sx = sy;
-        sr0 = SKIPSMImagePixelType(sa(sx));
-        if (wraparound) {
-            sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0)));
-            if (!dst_w_even) {
-                sr1 = imul4(sr1);
-            }
-        } else {
-            sr1 = SKIPSMImageZero;
-        }
-        // sc*[0] are irrelevant
-
-        srcx = 1;
-        ++sx.x;
-        dx = dy;
-        dxx = dyy;
-
-        // Second column
-        if (src_w > 1) {
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND(56, 56, 16, 16);
-                } else {
-                    SKIPSM_EXPAND(77, 56, 22, 16);
-                }
-            } else {
-                SKIPSM_EXPAND(49, 56, 14, 16);
-            }
-
-            // Main columns
-            for (srcx = 2, ++sx.x; srcx < src_w; ++srcx, ++sx.x) {
-                SKIPSM_EXPAND(56, 56, 16, 16);
-            }
-
-            // extra column at end of second row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_EVEN(56, 56, 16, 16);
-                } else {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_ODD(77, 22);
-                }
-            } else {
-                SKIPSM_EXPAND_COLUMN_END(49, 28, 14, 8);
-            }
-        } else {
-            // Math works out exactly the same for wraparound and no wraparound when src_w ==1
-            SKIPSM_EXPAND_COLUMN_END(42, 28, 12, 8);
-        }
-    } else {
-        // No Second Row
-        // First Column
-        srcx = 0;
-        sr0 = SKIPSMImageZero;
-        sr1 = SKIPSMImageZero;
-
-        dx = dy;
-        dxx = dyy;
-
-        if (src_w > 1) {
-            // Second Column
-            srcx = 1;
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_END(48, 48, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_END(66, 48, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_END(42, 48, 7, 8);
-            }
-
-            // Main columns
-            for (srcx = 2; srcx < src_w; ++srcx) {
-                SKIPSM_EXPAND_ROW_END(48, 48, 8, 8);
-            }
-
-            // extra column at end of row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(48, 48, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(66, 48, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_COLUMN_END(42, 24, 7, 4);
-            }
-        } else {
-            // No Second Column
-            // dst_w, dst_h must be at least 2
-            SKIPSM_EXPAND_ROW_COLUMN_END(36, 24, 6, 4);
+        da.set(cf(SKIPSMImagePixelType(da(dx)), a[src_w]), dx);
+        if (dst_w_even) {
+            ++dx.x;
+            da.set(cf(SKIPSMImagePixelType(da(dx)), b[src_w]), dx);
         }
+    };
 
-        delete [] sc0a;
-        delete [] sc0b;
-        delete [] sc1a;
-        delete [] sc1b;
+    SrcImageIterator sy = src_upperleft;
+    DestImageIterator dy = dest_upperleft;
 
-        return;
+    // First row
+    expandRow(wrap, dst_w_even, src_w, sy, sa, &row[0], &ha[0], &hb[0]);
+    for (int x = 1; x <= src_w; ++x) {
+        sc0a[x] = ha[x];
+        sc0b[x] = hb[x];
+        sc1a[x] = SKIPSMImageZero;
+        sc1b[x] = SKIPSMImageZero;
     }
-
-    // dy = row 2
-    // dyy = row 3
-    dy.y += 2;
-    dyy.y += 2;
-    // sy = row 2
-    srcy = 2;
     ++sy.y;
 
-    // Main Rows
-    for (srcy = 2, sx = sy; srcy < src_h; ++srcy, ++sy.y, dy.y += 2, dyy.y += 2) {
-        // First column
-        srcx = 0;
-        sx = sy;
-        sr0 = SKIPSMImagePixelType(sa(sx));
-        if (wraparound) {
-            sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w-1,0)));
-            if (!dst_w_even) {
-                sr1 = imul4(sr1);
-            }
-        } else {
-            sr1 = SKIPSMImageZero;
+    // Second row and main rows
+    for (int srcy = 1; srcy < src_h; ++srcy, ++sy.y, dy.y += 2) {
+        if (srcy <= 2) {
+            // The second row lacks the taps above the image.
+            normalization(srcy == 1 ? 7 : 8, 2);
         }
-        // sc*[0] are irrelevant
-
-        srcx = 1;
-        ++sx.x;
-        dx = dy;
-        dxx = dyy;
-
-        // Second column
-        if (src_w > 1) {
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND(64, 64, 16, 16);
-                } else {
-                    SKIPSM_EXPAND(88, 64, 22, 16);
-                }
-            } else {
-                SKIPSM_EXPAND(56, 64, 14, 16);
-            }
 
-            // Main columns
-            for (srcx = 2, ++sx.x; srcx < src_w; ++srcx, ++sx.x) {
-                SKIPSM_EXPAND(64, 64, 16, 16);
-            }
-
-            // extra column at end of row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_EVEN(64, 64, 16, 16);
-                } else {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_ODD(88, 22);
-                }
-            } else {
-                SKIPSM_EXPAND_COLUMN_END(56, 32, 14, 8);
-            }
-        }
-        else {
-            // No second column
-            // dst_w must be at least 2
-            // Math works out exactly the same for wraparound and no wraparound when src_w == 1
-            SKIPSM_EXPAND_COLUMN_END(48, 32, 12, 8);
+        expandRow(wrap, dst_w_even, src_w, sy, sa, &row[0], &ha[0], &hb[0]);
+
+        if (use_kernels && srcy >= 2 && src_w > 2) {
+            update(1, 1);
+            skipsm::kernels().expand_row(lanes * (src_w - 2),
+                                         skipsm::lanes(&ha[2]), skipsm::lanes(&hb[2]),
+                                         skipsm::lanes(&sc0a[2]), skipsm::lanes(&sc0b[2]),
+                                         skipsm::lanes(&sc1a[2]), skipsm::lanes(&sc1b[2]),
+                                         skipsm::lanes(&o00[2]), skipsm::lanes(&o10[2]),
+                                         skipsm::lanes(&o01[2]), skipsm::lanes(&o11[2]));
+            update(src_w, src_w);
+        } else {
+            update(1, src_w);
         }
-    }
 
-    // Extra row at end
-    {
-        srcx = 0;
-        sr0 = SKIPSMImageZero;
-        sr1 = SKIPSMImageZero;
-
-        dx = dy;
-        dxx = dyy;
-
-        if (src_w > 1) {
-            // Second Column
-            srcx = 1;
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_END(56, 56, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_END(77, 56, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_END(49, 56, 7, 8);
-            }
+        DestImageIterator dyy(dy);
+        ++dyy.y;
+        store(dy, &o00[0], &o10[0]);
+        store(dyy, &o01[0], &o11[0]);
+        rows_done(2 * srcy);
+    }
 
-            // Main columns
-            for (srcx = 2; srcx < src_w; ++srcx) {
-                SKIPSM_EXPAND_ROW_END(56, 56, 8, 8);
-            }
+    // Extra row at end, which lacks the taps below the image
+    normalization(src_h > 1 ? 7 : 6, 1);
+    for (int x = 1; x <= src_w; ++x) {
+        SKIPSMImagePixelType out00 = sc1a[x] + imul6(sc0a[x]);
+        SKIPSMImagePixelType out10 = sc1b[x] + imul6(sc0b[x]);
+        SKIPSMImagePixelType out01 = sc0a[x];
+        SKIPSMImagePixelType out11 = sc0b[x];
+        out00 /= s00[x];
+        out10 /= s10[x];
+        out01 /= s01[x];
+        out11 /= s11[x];
+        o00[x] = out00;
+        o10[x] = out10;
+        o01[x] = out01;
+        o11[x] = out11;
+    }
 
-            // extra column at end of row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(56, 56, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(77, 56, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_COLUMN_END(49, 28, 7, 4);
-            }
-        } else {
-            // No Second Column
-            // dst_w, dst_h must be at least 2
-            SKIPSM_EXPAND_ROW_COLUMN_END(42, 28, 6, 4);
-        }
+    store(dy, &o00[0], &o10[0]);
+    if (dst_h_even) {
+        DestImageIterator dyy(dy);
+        ++dyy.y;
+        store(dyy, &o01[0], &o11[0]);
     }
+    rows_done(dst_h);
+}
 
-    delete [] sc0a;
-    delete [] sc0b;
-    delete [] sc1a;
-    delete [] sc1b;
+
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename CombineFunctor>
+inline void
+expand(bool add, bool wraparound,
+       SrcImageIterator src_upperleft,
+       SrcImageIterator src_lowerright,
+       SrcAccessor sa,
+       DestImageIterator dest_upperleft,
+       DestImageIterator dest_lowerright,
+       DestAccessor da,
+       CombineFunctor cf)
+{
+    expand<SKIPSMImagePixelType>(add, wraparound,
+                                 src_upperleft, src_lowerright, sa,
+                                 dest_upperleft, dest_lowerright, da,
+                                 cf, [](int) {});
 }
 
 
@@ -1435,11 +953,13 @@ struct FromPromotePlusFunctorWrapper :
 // Version using argument object factories.
 template <typename SKIPSMImagePixelType,
           typename SrcImageIterator, typename SrcAccessor,
-          typename DestImageIterator, typename DestAccessor>
+          typename DestImageIterator, typename DestAccessor,
+          typename RowsDoneFunctor>
 inline static void
 expand(bool add, bool wraparound,
        vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
-       vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest)
+       vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+       RowsDoneFunctor rows_done)
 {
     typedef typename DestAccessor::value_type DestPixelType;
 
@@ -1447,16 +967,30 @@ expand(bool add, bool wraparound,
         expand<SKIPSMImagePixelType>(add, wraparound,
                                      src.first, src.second, src.third,
                                      dest.first, dest.second, dest.third,
-                                     FromPromotePlusFunctorWrapper<DestPixelType, SKIPSMImagePixelType, DestPixelType>());
+                                     FromPromotePlusFunctorWrapper<DestPixelType, SKIPSMImagePixelType, DestPixelType>(),
+                                     rows_done);
     } else {
         expand<SKIPSMImagePixelType>(add, wraparound,
                                      src.first, src.second, src.third,
                                      dest.first, dest.second, dest.third,
-                                     std::minus<SKIPSMImagePixelType>());
+                                     std::minus<SKIPSMImagePixelType>(),
+                                     rows_done);
     }
 }
 
 
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor>
+inline static void
+expand(bool add, bool wraparound,
+       vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+       vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest)
+{
+    expand<SKIPSMImagePixelType>(add, wraparound, src, dest, [](int) {});
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Gaussian Pyramid
@@ -1747,6 +1281,48 @@ laplacianPyramid(const char* exportName, unsigned int numLevels,
 }
 
 
+/** Turn the Gaussian pyramid gp into a Laplacian pyramid level by
+ *  level, finest level first, and hand each level to consume as soon
+ *  as it is final.  consume(l, level) takes over the level, so gp
+ *  ends up empty and only the Gaussian levels not yet turned into
+ *  Laplacian levels are alive at any time. */
+template <typename SKIPSMImagePixelType, typename PyramidImageType, typename LevelConsumer>
+void
+consumeLaplacianLevels(bool wraparound, std::vector<PyramidImageType*>* gp, LevelConsumer consume)
+{
+    const unsigned int numLevels = gp->size();
+
+    if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+        std::cerr << command << ": info: generating Laplacian pyramid:";
+        std::cerr.flush();
+    }
+
+    for (unsigned int l = 0; l < numLevels; l++) {
+        if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+            std::cerr << " l" << l;
+            std::cerr.flush();
+        }
+
+        // Level l + 1 is still Gaussian, because we go from fine to
+        // coarse.
+        if (l + 1 < numLevels) {
+            expand<SKIPSMImagePixelType>(false, wraparound,
+                                         srcImageRange(*((*gp)[l+1])),
+                                         destImageRange(*((*gp)[l])));
+        }
+
+        consume(l, (*gp)[l]);
+        (*gp)[l] = nullptr;
+    }
+
+    if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+        std::cerr << std::endl;
+    }
+
+    gp->clear();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Export pyramids to (TIFF) file
@@ -1754,34 +1330,165 @@ laplacianPyramid(const char* exportName, unsigned int numLevels,
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-/** Collapse the given Laplacian pyramid. */
-template <typename SKIPSMImagePixelType, typename PyramidImageType>
-void
-collapsePyramid(bool wraparound, std::vector<PyramidImageType*>* p)
+// Answer the sum of x and y rounded to single precision in A_SUM and
+// the rounding error in AN_ERROR.  We get the error from a
+// double-precision evaluation, which -- unlike Knuth's TwoSum -- is
+// immune to the reassociation allowed by -ffast-math.
+inline static void
+two_sum(float x, float y, float* a_sum, float* an_error)
 {
-    if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
-        std::cerr << command << ": info: collapsing Laplacian pyramid: "
-             << "l" << p->size() - 1;
-        std::cerr.flush();
+    const float sum = x + y;
+    *a_sum = sum;
+    *an_error = static_cast<float>((static_cast<double>(x) + static_cast<double>(y)) - static_cast<double>(sum));
+}
+
+
+template <typename T>
+inline static void
+two_sum(const vigra::RGBValue<T>& x, const vigra::RGBValue<T>& y,
+        vigra::RGBValue<T>* a_sum, vigra::RGBValue<T>* an_error)
+{
+    for (unsigned i = 0U; i != 3U; ++i) {
+        two_sum(x[i], y[i], &(*a_sum)[i], &(*an_error)[i]);
     }
+}
 
+
+template <typename SKIPSMImagePixelType, typename PyramidImageType, typename RowsDoneFunctor>
+void
+collapsePyramid(bool wraparound, std::vector<PyramidImageType*>* p, std::false_type,
+                RowsDoneFunctor rows_done)
+{
     // For each level, add the expansion of the next level.
-    // Work backwards from the smallest level to the largest.
+    // Work backwards from the smallest level to the largest.  Only
+    // the rows of level 0 are reported to the caller.
+    for (int l = (p->size()-2); l >= 0; l--) {
+        if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+            std::cerr << " l" << l;
+            std::cerr.flush();
+        }
+
+        if (l == 0) {
+            expand<SKIPSMImagePixelType>(true, wraparound,
+                                         srcImageRange(*((*p)[1])),
+                                         destImageRange(*((*p)[0])),
+                                         rows_done);
+        } else {
+            expand<SKIPSMImagePixelType>(true, wraparound,
+                                         srcImageRange(*((*p)[l + 1])),
+                                         destImageRange(*((*p)[l])));
+        }
+    }
+
+    if (p->size() == 1U) {
+        rows_done((*p)[0]->height());
+    }
+}
+
+
+// Compensated collapse of a single-precision pyramid
+//
+// Adding the expansion of the next level to the current one loses the
+// low-order bits of the smaller summand.  We catch these rounding
+// errors in a residual image, expand it alongside the next level's
+// sum, and fold it into the Laplacian of the current level before we
+// add the expansion.  Because expand() is linear this is Kahan's
+// summation carried through the pyramid.  It needs one level-sized
+// image of the residual and one of the expansion at a time.
+template <typename SKIPSMImagePixelType, typename PyramidImageType, typename RowsDoneFunctor>
+void
+collapsePyramid(bool wraparound, std::vector<PyramidImageType*>* p, std::true_type,
+                RowsDoneFunctor rows_done)
+{
+    typedef typename PyramidImageType::value_type PyramidPixelType;
+
+    PyramidImageType* residual = nullptr;
+
     for (int l = (p->size()-2); l >= 0; l--) {
         if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
             std::cerr << " l" << l;
             std::cerr.flush();
         }
 
+        PyramidImageType* level = (*p)[l];
+
+        if (residual) {
+            expand<SKIPSMImagePixelType>(true, wraparound,
+                                         srcImageRange(*residual),
+                                         destImageRange(*level));
+            delete residual;
+        }
+
+        PyramidImageType* expansion = new PyramidImageType(level->size());
         expand<SKIPSMImagePixelType>(true, wraparound,
                                      srcImageRange(*((*p)[l + 1])),
-                                     destImageRange(*((*p)[l])));
+                                     destImageRange(*expansion));
+
+        const int n = level->width() * level->height();
+        PyramidPixelType* const sum = level->data();
+        PyramidPixelType* const error = expansion->data();
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < n; ++i) {
+            two_sum(sum[i], error[i], &sum[i], &error[i]);
+        }
+
+        residual = expansion;
+    }
+
+    // The residual of the last level is below the resolution of the
+    // result.
+    delete residual;
+
+    rows_done((*p)[0]->height());
+}
+
+
+/** Collapse the given Laplacian pyramid.
+ *
+ *  The rows of level 0 become final from top to bottom; rows_done
+ *  gets called with the number of final rows as they accumulate,
+ *  last with the height of level 0.  This lets the caller convert
+ *  and write level 0 in bands while the last expansion is still
+ *  running.
+ *
+ *  Expert parameter "compensated-collapse" turns on the compensated
+ *  summation for single-precision pyramids.  Its level 0 only gets
+ *  final at the very end. */
+template <typename SKIPSMImagePixelType, typename PyramidImageType, typename RowsDoneFunctor>
+void
+collapsePyramid(bool wraparound, std::vector<PyramidImageType*>* p, RowsDoneFunctor rows_done)
+{
+    typedef typename vigra::NumericTraits<typename PyramidImageType::value_type>::ValueType PyramidComponentType;
+
+    if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+        std::cerr << command << ": info: collapsing Laplacian pyramid: "
+             << "l" << p->size() - 1;
+        std::cerr.flush();
+    }
+
+    if (std::is_same<PyramidComponentType, float>::value &&
+        parameter::as_boolean("compensated-collapse", false)) { //< compensated-collapse 0
+        collapsePyramid<SKIPSMImagePixelType>(wraparound, p,
+                                              std::integral_constant<bool, std::is_same<PyramidComponentType, float>::value>(),
+                                              rows_done);
+    } else {
+        collapsePyramid<SKIPSMImagePixelType>(wraparound, p, std::false_type(), rows_done);
     }
 
     if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
         std::cerr << std::endl;
     }
- }
+}
+
+
+template <typename SKIPSMImagePixelType, typename PyramidImageType>
+inline void
+collapsePyramid(bool wraparound, std::vector<PyramidImageType*>* p)
+{
+    collapsePyramid<SKIPSMImagePixelType>(wraparound, p, [](int) {});
+}
 
 
 // Export a scalar pyramid as a set of UINT16 tiff files.
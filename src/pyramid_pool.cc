@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+
+#include "parameter.h"
+#include "pyramid_pool.h"
+
+
+namespace enblend
+{
+    PyramidPool&
+    PyramidPool::instance()
+    {
+        static PyramidPool pool(parameter::as_boolean("pyramid-pool", true)); //< pyramid-pool 1
+        return pool;
+    }
+
+
+    PyramidPool::PyramidPool(bool is_enabled) : enabled_(is_enabled) {}
+
+
+    PyramidPool::~PyramidPool()
+    {
+        release_unlocked();
+    }
+
+
+    size_t
+    PyramidPool::size_class(size_t a_size)
+    {
+        if (a_size < minimum_pooled_size)
+        {
+            return a_size;
+        }
+
+        unsigned exponent = 0U;
+        while ((a_size >> exponent) >= 16U)
+        {
+            ++exponent;
+        }
+        // Now 8 <= ceil(a_size / 2^exponent) <= 16.
+        const size_t step = size_t(1) << exponent;
+
+        return (a_size + step - 1U) & ~(step - 1U);
+    }
+
+
+    void*
+    PyramidPool::allocate(size_t a_size)
+    {
+        if (!enabled_ || a_size < minimum_pooled_size)
+        {
+            void* const block = std::malloc(std::max(a_size, size_t(1)));
+            if (!block)
+            {
+                throw std::bad_alloc();
+            }
+            return block;
+        }
+
+        const size_t size = size_class(a_size);
+        omp::scoped_lock<omp::lock> guard(lock_);
+
+        ++statistics_.allocations;
+
+        free_lists_t::iterator free_list = free_lists_.find(size);
+        if (free_list != free_lists_.end() && !free_list->second.empty())
+        {
+            void* const block = free_list->second.back();
+            free_list->second.pop_back();
+            statistics_.cached -= size;
+            statistics_.in_use += size;
+            ++statistics_.reuses;
+            return block;
+        }
+
+        void* const block = allocate_fresh(size);
+        statistics_.in_use += size;
+        statistics_.in_use_high_water = std::max(statistics_.in_use_high_water, statistics_.in_use);
+        statistics_.footprint_high_water =
+            std::max(statistics_.footprint_high_water, statistics_.in_use + statistics_.cached);
+
+        return block;
+    }
+
+
+    void
+    PyramidPool::deallocate(void* a_block, size_t a_size)
+    {
+        if (!a_block)
+        {
+            return;
+        }
+
+        if (!enabled_ || a_size < minimum_pooled_size)
+        {
+            std::free(a_block);
+            return;
+        }
+
+        const size_t size = size_class(a_size);
+        omp::scoped_lock<omp::lock> guard(lock_);
+
+        free_lists_[size].push_back(a_block);
+        statistics_.in_use -= size;
+        statistics_.cached += size;
+    }
+
+
+    void
+    PyramidPool::release()
+    {
+        omp::scoped_lock<omp::lock> guard(lock_);
+        release_unlocked();
+    }
+
+
+    PyramidPool::Statistics
+    PyramidPool::statistics()
+    {
+        omp::scoped_lock<omp::lock> guard(lock_);
+        return statistics_;
+    }
+
+
+    void
+    PyramidPool::report(std::ostream& an_output_stream, const std::string& a_prefix)
+    {
+        const Statistics s(statistics());
+        const double mebibyte = 1048576.0;
+
+        if (!enabled_)
+        {
+            an_output_stream << a_prefix << ": info: pyramid pool disabled" << std::endl;
+            return;
+        }
+
+        an_output_stream <<
+            a_prefix << ": info: pyramid pool: " << s.reuses << " of " << s.allocations <<
+            " allocations served from the pool\n" <<
+            a_prefix << ": info: pyramid pool: high-water marks " <<
+            std::fixed << std::setprecision(1) <<
+            s.in_use_high_water / mebibyte << " MiB in use, " <<
+            s.footprint_high_water / mebibyte << " MiB including cached blocks" << std::endl;
+    }
+
+
+    // Precondition: lock_ is held and a_size is the size of a class.
+    void*
+    PyramidPool::allocate_fresh(size_t a_size)
+    {
+        evict_for(a_size);
+
+        void* block = std::malloc(a_size);
+        if (!block)
+        {
+            release_unlocked();
+            block = std::malloc(a_size);
+            if (!block)
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        return block;
+    }
+
+
+    // Release cached blocks, largest first, until in-use plus cached
+    // blocks plus a new block of A_SIZE bytes do not exceed the
+    // high-water mark of in-use memory that the new block produces.
+    void
+    PyramidPool::evict_for(size_t a_size)
+    {
+        const size_t limit = std::max(statistics_.in_use_high_water, statistics_.in_use + a_size);
+
+        free_lists_t::reverse_iterator free_list = free_lists_.rbegin();
+        while (statistics_.in_use + statistics_.cached + a_size > limit && free_list != free_lists_.rend())
+        {
+            if (free_list->second.empty())
+            {
+                ++free_list;
+            }
+            else
+            {
+                std::free(free_list->second.back());
+                free_list->second.pop_back();
+                statistics_.cached -= free_list->first;
+            }
+        }
+    }
+
+
+    void
+    PyramidPool::release_unlocked()
+    {
+        for (auto& free_list : free_lists_)
+        {
+            for (auto block : free_list.second)
+            {
+                std::free(block);
+            }
+            statistics_.cached -= free_list.first * free_list.second.size();
+            free_list.second.clear();
+        }
+    }
+} // namespace enblend
+
+// Local Variables:
+// mode: c++
+// End:
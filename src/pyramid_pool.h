@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef PYRAMID_POOL_H_INCLUDED_
+#define PYRAMID_POOL_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>             // std::forward
+#include <vector>
+
+#include <vigra/basicimage.hxx>
+
+#include "openmp_lock.h"
+
+
+namespace enblend
+{
+    // Pool of memory blocks for pyramid levels and SKIPSM scratch
+    // rows.
+    //
+    // Each iteration of Enblend and each input image of Enfuse builds
+    // and tears down pyramids of (nearly) the same geometry.  The pool
+    // keeps the blocks it gets back in free lists of geometric size
+    // classes -- eight classes per power of two -- so that the next
+    // pyramid reuses them instead of going through the system
+    // allocator, which returns large blocks to the OS and then pays
+    // for page faults and zeroing when it gets them back.
+    //
+    // The pool never grows the memory footprint beyond the largest
+    // amount of memory that has been in use at the same time, this
+    // is, the peak of an unpooled run: before it allocates a fresh
+    // block it releases cached blocks of other sizes as necessary.
+    //
+    // Blocks below minimum_pooled_size bypass the pool.
+    class PyramidPool
+    {
+    public:
+        struct Statistics
+        {
+            Statistics() :
+                allocations(0U), reuses(0U),
+                in_use(0U), cached(0U),
+                in_use_high_water(0U), footprint_high_water(0U) {}
+
+            size_t allocations;  //< number of pooled allocations
+            size_t reuses;       //< number of allocations served from a free list
+            size_t in_use;       //< bytes currently handed out
+            size_t cached;       //< bytes currently held in free lists
+            size_t in_use_high_water;    //< maximum of in_use
+            size_t footprint_high_water; //< maximum of in_use + cached
+        };
+
+        static const size_t minimum_pooled_size = 65536U;
+
+        static PyramidPool& instance();
+
+        explicit PyramidPool(bool is_enabled);
+        ~PyramidPool();
+
+        PyramidPool(const PyramidPool&) = delete;
+        PyramidPool& operator=(const PyramidPool&) = delete;
+
+        void* allocate(size_t a_size);
+        void deallocate(void* a_block, size_t a_size);
+
+        // Give all cached blocks back to the system.
+        void release();
+
+        Statistics statistics();
+        void report(std::ostream& an_output_stream, const std::string& a_prefix);
+
+        // Answer the size of the class that holds blocks of A_SIZE bytes.
+        static size_t size_class(size_t a_size);
+
+    private:
+        typedef std::map<size_t, std::vector<void*> > free_lists_t;
+
+        void* allocate_fresh(size_t a_size);
+        void evict_for(size_t a_size);
+        void release_unlocked();
+
+        const bool enabled_;
+        omp::lock lock_;
+        free_lists_t free_lists_;
+        Statistics statistics_;
+    };
+
+
+    /** Standard allocator that draws from the PyramidPool.  It
+     *  serves as the allocator of the pyramid images and of the
+     *  SKIPSM scratch rows. */
+    template <class T>
+    class PyramidPoolAllocator
+    {
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+
+        template <class U>
+        struct rebind
+        {
+            typedef PyramidPoolAllocator<U> other;
+        };
+
+        PyramidPoolAllocator() noexcept {}
+        template <class U> PyramidPoolAllocator(const PyramidPoolAllocator<U>&) noexcept {}
+
+        pointer allocate(size_type n, const void* = nullptr)
+        {
+            if (n > max_size())
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<pointer>(PyramidPool::instance().allocate(n * sizeof(T)));
+        }
+
+        void deallocate(pointer p, size_type n)
+        {
+            PyramidPool::instance().deallocate(p, n * sizeof(T));
+        }
+
+        size_type max_size() const noexcept {return std::numeric_limits<size_type>::max() / sizeof(T);}
+
+        template <class U, class... Arguments>
+        void construct(U* p, Arguments&&... arguments)
+        {
+            ::new (static_cast<void*>(p)) U(std::forward<Arguments>(arguments)...);
+        }
+
+        template <class U>
+        void destroy(U* p) {p->~U();}
+    };
+
+
+    template <class T, class U>
+    inline bool
+    operator==(const PyramidPoolAllocator<T>&, const PyramidPoolAllocator<U>&)
+    {
+        return true;
+    }
+
+
+    template <class T, class U>
+    inline bool
+    operator!=(const PyramidPoolAllocator<T>&, const PyramidPoolAllocator<U>&)
+    {
+        return false;
+    }
+
+
+    /** Image type of all pyramid levels.  It has the interface of
+     *  vigra::BasicImage, so vigra::BasicImageView can wrap its
+     *  data. */
+    template <class PixelType>
+    using PyramidImage = vigra::BasicImage<PixelType, PyramidPoolAllocator<PixelType> >;
+
+
+    /** Width of the blocks of pixels in a row of a pyramid image that
+     *  share their storage format.  Threads that write to the same
+     *  image must not split such a block between them.  The pixels
+     *  of a PyramidImage are independent of each other. */
+    template <class PyramidImageType>
+    struct PyramidBlockWidth
+    {
+        enum {value = 1};
+    };
+
+
+    /** Scratch row of SKIPSM state variables */
+    template <class T>
+    using PyramidScratchRow = std::vector<T, PyramidPoolAllocator<T> >;
+} // namespace enblend
+
+
+#endif // PYRAMID_POOL_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
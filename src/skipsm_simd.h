@@ -0,0 +1,697 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef SKIPSM_SIMD_H_INCLUDED_
+#define SKIPSM_SIMD_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vigra/rgbvalue.hxx>
+#include <vigra/sized_int.hxx>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SKIPSM_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define SKIPSM_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "parameter.h"
+
+
+// Vectorized inner loops of the SKIPSM-based reduce() and expand()
+// operations for pyramids whose SKIPSM type consists of 32-bit
+// integers, this is, the pyramids of 8-bit and 16-bit images.
+//
+// All kernels work on flat arrays of int32 lanes; an RGB pixel
+// contributes three consecutive lanes.  Each kernel exists in a
+// generic version and in versions for the instruction sets that we
+// can select at runtime.  Every version computes exactly the same
+// integers as the state machines in pyramid.h.
+
+namespace enblend
+{
+namespace skipsm
+{
+    typedef std::int32_t lane_t;
+
+
+    /** Number of int32 lanes in a SKIPSM pixel of type T; zero if
+     *  the kernels do not apply to T. */
+    template <typename T>
+    struct Int32Lanes
+    {
+        enum {value = 0};
+    };
+
+    template <>
+    struct Int32Lanes<vigra::Int32>
+    {
+        enum {value = 1};
+    };
+
+    template <>
+    struct Int32Lanes<vigra::RGBValue<vigra::Int32, 0, 1, 2> >
+    {
+        enum {value = 3};
+    };
+
+    static_assert(sizeof(vigra::Int32) == sizeof(lane_t), "vigra::Int32 is no 32-bit integer");
+    static_assert(sizeof(vigra::RGBValue<vigra::Int32, 0, 1, 2>) == 3U * sizeof(lane_t),
+                  "vigra::RGBValue<vigra::Int32> is not tightly packed");
+
+
+    template <typename T>
+    inline static lane_t*
+    lanes(T* a_pointer)
+    {
+        return reinterpret_cast<lane_t*>(a_pointer);
+    }
+
+
+    enum InstructionSet {GenericInstructions, SSE42Instructions, AVX2Instructions, AVX512Instructions, NEONInstructions};
+
+
+    namespace detail
+    {
+        ////////////////////////////////////////////////////////////////////////
+        //
+        // Generic kernels
+        //
+        ////////////////////////////////////////////////////////////////////////
+
+        // Column update of reduce() for an even source row.
+        //     out <- c1 + 6 * c0 + cp + h
+        //     c1  <- c0 + cp
+        //     c0  <- h
+        inline void
+        reduce_even_row_generic(size_t n,
+                                const lane_t* h, lane_t* c0, lane_t* c1, const lane_t* cp, lane_t* out)
+        {
+            for (size_t i = 0U; i != n; ++i)
+            {
+                out[i] = c1[i] + 6 * c0[i] + cp[i] + h[i];
+                c1[i] = c0[i] + cp[i];
+                c0[i] = h[i];
+            }
+        }
+
+
+        // Normalization of reduce(), where the denominator is the
+        // weight of the alpha channel.  A zero weight masks out the
+        // lane.  NUM and Q may be the same array.
+        //     q <- den != 0 ? num / den : 0
+        inline void
+        divide_generic(size_t n, const lane_t* num, const lane_t* den, lane_t* q)
+        {
+            for (size_t i = 0U; i != n; ++i)
+            {
+                q[i] = den[i] != 0 ? num[i] / den[i] : 0;
+            }
+        }
+
+
+        // Column update of expand() for the interior of a main row.
+        //     o00 <- (c1a + 6 * c0a + ha) / 64    o10 <- (c1b + 6 * c0b + hb) / 64
+        //     o01 <- (c0a + ha) / 16              o11 <- (c0b + hb) / 16
+        //     c1a <- c0a, c1b <- c0b, c0a <- ha, c0b <- hb
+        inline void
+        expand_row_generic(size_t n,
+                           const lane_t* ha, const lane_t* hb,
+                           lane_t* c0a, lane_t* c0b, lane_t* c1a, lane_t* c1b,
+                           lane_t* o00, lane_t* o10, lane_t* o01, lane_t* o11)
+        {
+            for (size_t i = 0U; i != n; ++i)
+            {
+                const lane_t a = c0a[i];
+                const lane_t b = c0b[i];
+
+                o00[i] = (c1a[i] + 6 * a + ha[i]) / 64;
+                o10[i] = (c1b[i] + 6 * b + hb[i]) / 64;
+                o01[i] = (a + ha[i]) / 16;
+                o11[i] = (b + hb[i]) / 16;
+                c1a[i] = a;
+                c1b[i] = b;
+                c0a[i] = ha[i];
+                c0b[i] = hb[i];
+            }
+        }
+
+
+#ifdef SKIPSM_SIMD_X86
+        ////////////////////////////////////////////////////////////////////////
+        //
+        // SSE4.2
+        //
+        ////////////////////////////////////////////////////////////////////////
+
+        __attribute__((target("sse4.2"))) inline __m128i
+        times6_sse42(__m128i x)
+        {
+            return _mm_add_epi32(_mm_slli_epi32(x, 2), _mm_slli_epi32(x, 1));
+        }
+
+
+        // Signed division by 2^S, which truncates towards zero like C++.
+        template <int S>
+        __attribute__((target("sse4.2"))) inline __m128i
+        divide_pow2_sse42(__m128i x)
+        {
+            const __m128i bias = _mm_srli_epi32(_mm_srai_epi32(x, 31), 32 - S);
+            return _mm_srai_epi32(_mm_add_epi32(x, bias), S);
+        }
+
+
+        __attribute__((target("sse4.2"))) inline void
+        reduce_even_row_sse42(size_t n,
+                              const lane_t* h, lane_t* c0, lane_t* c1, const lane_t* cp, lane_t* out)
+        {
+            size_t i = 0U;
+
+            for (; i + 4U <= n; i += 4U)
+            {
+                const __m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+                const __m128i vc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0 + i));
+                const __m128i vc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1 + i));
+                const __m128i vcp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cp + i));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                                 _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(vc1, times6_sse42(vc0)), vcp), vh));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c1 + i), _mm_add_epi32(vc0, vcp));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c0 + i), vh);
+            }
+
+            reduce_even_row_generic(n - i, h + i, c0 + i, c1 + i, cp + i, out + i);
+        }
+
+
+        // The quotient of two int32 is exact in double precision and
+        // the truncating conversion rounds like the integer division.
+        __attribute__((target("sse4.2"))) inline void
+        divide_sse42(size_t n, const lane_t* num, const lane_t* den, lane_t* q)
+        {
+            size_t i = 0U;
+
+            for (; i + 4U <= n; i += 4U)
+            {
+                const __m128i vnum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(num + i));
+                const __m128i vden = _mm_loadu_si128(reinterpret_cast<const __m128i*>(den + i));
+                const __m128i zero_mask = _mm_cmpeq_epi32(vden, _mm_setzero_si128());
+                const __m128i safe_den = _mm_sub_epi32(vden, zero_mask); // 0 -> 1
+
+                const __m128i q_lo =
+                    _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(vnum), _mm_cvtepi32_pd(safe_den)));
+                const __m128i q_hi =
+                    _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(vnum, vnum)),
+                                                _mm_cvtepi32_pd(_mm_unpackhi_epi64(safe_den, safe_den))));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(q + i),
+                                 _mm_andnot_si128(zero_mask, _mm_unpacklo_epi64(q_lo, q_hi)));
+            }
+
+            divide_generic(n - i, num + i, den + i, q + i);
+        }
+
+
+        __attribute__((target("sse4.2"))) inline void
+        expand_row_sse42(size_t n,
+                         const lane_t* ha, const lane_t* hb,
+                         lane_t* c0a, lane_t* c0b, lane_t* c1a, lane_t* c1b,
+                         lane_t* o00, lane_t* o10, lane_t* o01, lane_t* o11)
+        {
+            size_t i = 0U;
+
+            for (; i + 4U <= n; i += 4U)
+            {
+                const __m128i na = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ha + i));
+                const __m128i nb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hb + i));
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0a + i));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0b + i));
+                const __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1a + i));
+                const __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1b + i));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(o00 + i),
+                                 divide_pow2_sse42<6>(_mm_add_epi32(_mm_add_epi32(pa, times6_sse42(a)), na)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(o10 + i),
+                                 divide_pow2_sse42<6>(_mm_add_epi32(_mm_add_epi32(pb, times6_sse42(b)), nb)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(o01 + i), divide_pow2_sse42<4>(_mm_add_epi32(a, na)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(o11 + i), divide_pow2_sse42<4>(_mm_add_epi32(b, nb)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c1a + i), a);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c1b + i), b);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c0a + i), na);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(c0b + i), nb);
+            }
+
+            expand_row_generic(n - i, ha + i, hb + i, c0a + i, c0b + i, c1a + i, c1b + i,
+                               o00 + i, o10 + i, o01 + i, o11 + i);
+        }
+
+
+        ////////////////////////////////////////////////////////////////////////
+        //
+        // AVX2
+        //
+        ////////////////////////////////////////////////////////////////////////
+
+        __attribute__((target("avx2"))) inline __m256i
+        times6_avx2(__m256i x)
+        {
+            return _mm256_add_epi32(_mm256_slli_epi32(x, 2), _mm256_slli_epi32(x, 1));
+        }
+
+
+        template <int S>
+        __attribute__((target("avx2"))) inline __m256i
+        divide_pow2_avx2(__m256i x)
+        {
+            const __m256i bias = _mm256_srli_epi32(_mm256_srai_epi32(x, 31), 32 - S);
+            return _mm256_srai_epi32(_mm256_add_epi32(x, bias), S);
+        }
+
+
+        __attribute__((target("avx2"))) inline void
+        reduce_even_row_avx2(size_t n,
+                             const lane_t* h, lane_t* c0, lane_t* c1, const lane_t* cp, lane_t* out)
+        {
+            size_t i = 0U;
+
+            for (; i + 8U <= n; i += 8U)
+            {
+                const __m256i vh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+                const __m256i vc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + i));
+                const __m256i vc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1 + i));
+                const __m256i vcp = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cp + i));
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                                    _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(vc1, times6_avx2(vc0)), vcp), vh));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(c1 + i), _mm256_add_epi32(vc0, vcp));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(c0 + i), vh);
+            }
+
+            reduce_even_row_generic(n - i, h + i, c0 + i, c1 + i, cp + i, out + i);
+        }
+
+
+        __attribute__((target("avx2"))) inline void
+        divide_avx2(size_t n, const lane_t* num, const lane_t* den, lane_t* q)
+        {
+            size_t i = 0U;
+
+            for (; i + 8U <= n; i += 8U)
+            {
+                const __m256i vnum = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(num + i));
+                const __m256i vden = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(den + i));
+                const __m256i zero_mask = _mm256_cmpeq_epi32(vden, _mm256_setzero_si256());
+                const __m256i safe_den = _mm256_sub_epi32(vden, zero_mask); // 0 -> 1
+
+                const __m128i q_lo =
+                    _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(vnum)),
+                                                      _mm256_cvtepi32_pd(_mm256_castsi256_si128(safe_den))));
+                const __m128i q_hi =
+                    _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(vnum, 1)),
+                                                      _mm256_cvtepi32_pd(_mm256_extracti128_si256(safe_den, 1))));
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(q + i),
+                                    _mm256_andnot_si256(zero_mask,
+                                                        _mm256_inserti128_si256(_mm256_castsi128_si256(q_lo), q_hi, 1)));
+            }
+
+            divide_generic(n - i, num + i, den + i, q + i);
+        }
+
+
+        __attribute__((target("avx2"))) inline void
+        expand_row_avx2(size_t n,
+                        const lane_t* ha, const lane_t* hb,
+                        lane_t* c0a, lane_t* c0b, lane_t* c1a, lane_t* c1b,
+                        lane_t* o00, lane_t* o10, lane_t* o01, lane_t* o11)
+        {
+            size_t i = 0U;
+
+            for (; i + 8U <= n; i += 8U)
+            {
+                const __m256i na = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ha + i));
+                const __m256i nb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hb + i));
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0a + i));
+                const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0b + i));
+                const __m256i pa = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1a + i));
+                const __m256i pb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1b + i));
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(o00 + i),
+                                    divide_pow2_avx2<6>(_mm256_add_epi32(_mm256_add_epi32(pa, times6_avx2(a)), na)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(o10 + i),
+                                    divide_pow2_avx2<6>(_mm256_add_epi32(_mm256_add_epi32(pb, times6_avx2(b)), nb)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(o01 + i), divide_pow2_avx2<4>(_mm256_add_epi32(a, na)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(o11 + i), divide_pow2_avx2<4>(_mm256_add_epi32(b, nb)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(c1a + i), a);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(c1b + i), b);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(c0a + i), na);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(c0b + i), nb);
+            }
+
+            expand_row_generic(n - i, ha + i, hb + i, c0a + i, c0b + i, c1a + i, c1b + i,
+                               o00 + i, o10 + i, o01 + i, o11 + i);
+        }
+
+
+        ////////////////////////////////////////////////////////////////////////
+        //
+        // AVX-512
+        //
+        ////////////////////////////////////////////////////////////////////////
+
+        __attribute__((target("avx512f"))) inline __m512i
+        times6_avx512(__m512i x)
+        {
+            return _mm512_add_epi32(_mm512_slli_epi32(x, 2), _mm512_slli_epi32(x, 1));
+        }
+
+
+        template <int S>
+        __attribute__((target("avx512f"))) inline __m512i
+        divide_pow2_avx512(__m512i x)
+        {
+            const __m512i bias = _mm512_srli_epi32(_mm512_srai_epi32(x, 31), 32 - S);
+            return _mm512_srai_epi32(_mm512_add_epi32(x, bias), S);
+        }
+
+
+        __attribute__((target("avx512f"))) inline void
+        reduce_even_row_avx512(size_t n,
+                               const lane_t* h, lane_t* c0, lane_t* c1, const lane_t* cp, lane_t* out)
+        {
+            size_t i = 0U;
+
+            for (; i + 16U <= n; i += 16U)
+            {
+                const __m512i vh = _mm512_loadu_si512(h + i);
+                const __m512i vc0 = _mm512_loadu_si512(c0 + i);
+                const __m512i vc1 = _mm512_loadu_si512(c1 + i);
+                const __m512i vcp = _mm512_loadu_si512(cp + i);
+
+                _mm512_storeu_si512(out + i,
+                                    _mm512_add_epi32(_mm512_add_epi32(_mm512_add_epi32(vc1, times6_avx512(vc0)), vcp), vh));
+                _mm512_storeu_si512(c1 + i, _mm512_add_epi32(vc0, vcp));
+                _mm512_storeu_si512(c0 + i, vh);
+            }
+
+            reduce_even_row_generic(n - i, h + i, c0 + i, c1 + i, cp + i, out + i);
+        }
+
+
+        __attribute__((target("avx512f"))) inline void
+        divide_avx512(size_t n, const lane_t* num, const lane_t* den, lane_t* q)
+        {
+            size_t i = 0U;
+
+            for (; i + 16U <= n; i += 16U)
+            {
+                const __m512i vnum = _mm512_loadu_si512(num + i);
+                const __m512i vden = _mm512_loadu_si512(den + i);
+                const __mmask16 nonzero = _mm512_test_epi32_mask(vden, vden);
+                const __m512i safe_den = _mm512_mask_blend_epi32(nonzero, _mm512_set1_epi32(1), vden);
+
+                const __m256i q_lo =
+                    _mm512_cvttpd_epi32(_mm512_div_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(vnum)),
+                                                      _mm512_cvtepi32_pd(_mm512_castsi512_si256(safe_den))));
+                const __m256i q_hi =
+                    _mm512_cvttpd_epi32(_mm512_div_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(vnum, 1)),
+                                                      _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(safe_den, 1))));
+
+                _mm512_storeu_si512(q + i,
+                                    _mm512_maskz_mov_epi32(nonzero,
+                                                           _mm512_inserti64x4(_mm512_castsi256_si512(q_lo), q_hi, 1)));
+            }
+
+            divide_generic(n - i, num + i, den + i, q + i);
+        }
+
+
+        __attribute__((target("avx512f"))) inline void
+        expand_row_avx512(size_t n,
+                          const lane_t* ha, const lane_t* hb,
+                          lane_t* c0a, lane_t* c0b, lane_t* c1a, lane_t* c1b,
+                          lane_t* o00, lane_t* o10, lane_t* o01, lane_t* o11)
+        {
+            size_t i = 0U;
+
+            for (; i + 16U <= n; i += 16U)
+            {
+                const __m512i na = _mm512_loadu_si512(ha + i);
+                const __m512i nb = _mm512_loadu_si512(hb + i);
+                const __m512i a = _mm512_loadu_si512(c0a + i);
+                const __m512i b = _mm512_loadu_si512(c0b + i);
+                const __m512i pa = _mm512_loadu_si512(c1a + i);
+                const __m512i pb = _mm512_loadu_si512(c1b + i);
+
+                _mm512_storeu_si512(o00 + i, divide_pow2_avx512<6>(_mm512_add_epi32(_mm512_add_epi32(pa, times6_avx512(a)), na)));
+                _mm512_storeu_si512(o10 + i, divide_pow2_avx512<6>(_mm512_add_epi32(_mm512_add_epi32(pb, times6_avx512(b)), nb)));
+                _mm512_storeu_si512(o01 + i, divide_pow2_avx512<4>(_mm512_add_epi32(a, na)));
+                _mm512_storeu_si512(o11 + i, divide_pow2_avx512<4>(_mm512_add_epi32(b, nb)));
+                _mm512_storeu_si512(c1a + i, a);
+                _mm512_storeu_si512(c1b + i, b);
+                _mm512_storeu_si512(c0a + i, na);
+                _mm512_storeu_si512(c0b + i, nb);
+            }
+
+            expand_row_generic(n - i, ha + i, hb + i, c0a + i, c0b + i, c1a + i, c1b + i,
+                               o00 + i, o10 + i, o01 + i, o11 + i);
+        }
+#endif // SKIPSM_SIMD_X86
+
+
+#ifdef SKIPSM_SIMD_NEON
+        ////////////////////////////////////////////////////////////////////////
+        //
+        // NEON (AArch64 only, because we need double-precision vectors)
+        //
+        ////////////////////////////////////////////////////////////////////////
+
+        inline int32x4_t
+        times6_neon(int32x4_t x)
+        {
+            return vaddq_s32(vshlq_n_s32(x, 2), vshlq_n_s32(x, 1));
+        }
+
+
+        template <int S>
+        inline int32x4_t
+        divide_pow2_neon(int32x4_t x)
+        {
+            const int32x4_t bias =
+                vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(vshrq_n_s32(x, 31)), 32 - S));
+            return vshrq_n_s32(vaddq_s32(x, bias), S);
+        }
+
+
+        inline int32x2_t
+        divide_half_neon(int32x2_t num, int32x2_t den)
+        {
+            return vmovn_s64(vcvtq_s64_f64(vdivq_f64(vcvtq_f64_s64(vmovl_s32(num)),
+                                                     vcvtq_f64_s64(vmovl_s32(den)))));
+        }
+
+
+        inline void
+        reduce_even_row_neon(size_t n,
+                             const lane_t* h, lane_t* c0, lane_t* c1, const lane_t* cp, lane_t* out)
+        {
+            size_t i = 0U;
+
+            for (; i + 4U <= n; i += 4U)
+            {
+                const int32x4_t vh = vld1q_s32(h + i);
+                const int32x4_t vc0 = vld1q_s32(c0 + i);
+                const int32x4_t vc1 = vld1q_s32(c1 + i);
+                const int32x4_t vcp = vld1q_s32(cp + i);
+
+                vst1q_s32(out + i, vaddq_s32(vaddq_s32(vaddq_s32(vc1, times6_neon(vc0)), vcp), vh));
+                vst1q_s32(c1 + i, vaddq_s32(vc0, vcp));
+                vst1q_s32(c0 + i, vh);
+            }
+
+            reduce_even_row_generic(n - i, h + i, c0 + i, c1 + i, cp + i, out + i);
+        }
+
+
+        inline void
+        divide_neon(size_t n, const lane_t* num, const lane_t* den, lane_t* q)
+        {
+            size_t i = 0U;
+
+            for (; i + 4U <= n; i += 4U)
+            {
+                const int32x4_t vnum = vld1q_s32(num + i);
+                const int32x4_t vden = vld1q_s32(den + i);
+                const uint32x4_t zero_mask = vceqq_s32(vden, vdupq_n_s32(0));
+                const int32x4_t safe_den = vsubq_s32(vden, vreinterpretq_s32_u32(zero_mask)); // 0 -> 1
+
+                const int32x4_t quotient =
+                    vcombine_s32(divide_half_neon(vget_low_s32(vnum), vget_low_s32(safe_den)),
+                                 divide_half_neon(vget_high_s32(vnum), vget_high_s32(safe_den)));
+
+                vst1q_s32(q + i, vbicq_s32(quotient, vreinterpretq_s32_u32(zero_mask)));
+            }
+
+            divide_generic(n - i, num + i, den + i, q + i);
+        }
+
+
+        inline void
+        expand_row_neon(size_t n,
+                        const lane_t* ha, const lane_t* hb,
+                        lane_t* c0a, lane_t* c0b, lane_t* c1a, lane_t* c1b,
+                        lane_t* o00, lane_t* o10, lane_t* o01, lane_t* o11)
+        {
+            size_t i = 0U;
+
+            for (; i + 4U <= n; i += 4U)
+            {
+                const int32x4_t na = vld1q_s32(ha + i);
+                const int32x4_t nb = vld1q_s32(hb + i);
+                const int32x4_t a = vld1q_s32(c0a + i);
+                const int32x4_t b = vld1q_s32(c0b + i);
+                const int32x4_t pa = vld1q_s32(c1a + i);
+                const int32x4_t pb = vld1q_s32(c1b + i);
+
+                vst1q_s32(o00 + i, divide_pow2_neon<6>(vaddq_s32(vaddq_s32(pa, times6_neon(a)), na)));
+                vst1q_s32(o10 + i, divide_pow2_neon<6>(vaddq_s32(vaddq_s32(pb, times6_neon(b)), nb)));
+                vst1q_s32(o01 + i, divide_pow2_neon<4>(vaddq_s32(a, na)));
+                vst1q_s32(o11 + i, divide_pow2_neon<4>(vaddq_s32(b, nb)));
+                vst1q_s32(c1a + i, a);
+                vst1q_s32(c1b + i, b);
+                vst1q_s32(c0a + i, na);
+                vst1q_s32(c0b + i, nb);
+            }
+
+            expand_row_generic(n - i, ha + i, hb + i, c0a + i, c0b + i, c1a + i, c1b + i,
+                               o00 + i, o10 + i, o01 + i, o11 + i);
+        }
+#endif // SKIPSM_SIMD_NEON
+
+
+        inline InstructionSet
+        detect_instruction_set()
+        {
+#if defined(SKIPSM_SIMD_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+            {
+                return AVX512Instructions;
+            }
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return AVX2Instructions;
+            }
+            if (__builtin_cpu_supports("sse4.2"))
+            {
+                return SSE42Instructions;
+            }
+#elif defined(SKIPSM_SIMD_NEON)
+            return NEONInstructions;
+#endif
+            return GenericInstructions;
+        }
+    } // namespace detail
+
+
+    /** The kernels for the instruction set of the host. */
+    struct Kernels
+    {
+        typedef void (*ReduceEvenRowFunction)(size_t,
+                                              const lane_t*, lane_t*, lane_t*, const lane_t*, lane_t*);
+        typedef void (*DivideFunction)(size_t, const lane_t*, const lane_t*, lane_t*);
+        typedef void (*ExpandRowFunction)(size_t,
+                                          const lane_t*, const lane_t*,
+                                          lane_t*, lane_t*, lane_t*, lane_t*,
+                                          lane_t*, lane_t*, lane_t*, lane_t*);
+
+        explicit Kernels(InstructionSet an_instruction_set) :
+            instruction_set(an_instruction_set),
+            reduce_even_row(detail::reduce_even_row_generic),
+            divide(detail::divide_generic),
+            expand_row(detail::expand_row_generic)
+        {
+            switch (instruction_set)
+            {
+#ifdef SKIPSM_SIMD_X86
+            case SSE42Instructions:
+                reduce_even_row = detail::reduce_even_row_sse42;
+                divide = detail::divide_sse42;
+                expand_row = detail::expand_row_sse42;
+                break;
+            case AVX2Instructions:
+                reduce_even_row = detail::reduce_even_row_avx2;
+                divide = detail::divide_avx2;
+                expand_row = detail::expand_row_avx2;
+                break;
+            case AVX512Instructions:
+                reduce_even_row = detail::reduce_even_row_avx512;
+                divide = detail::divide_avx512;
+                expand_row = detail::expand_row_avx512;
+                break;
+#endif
+#ifdef SKIPSM_SIMD_NEON
+            case NEONInstructions:
+                reduce_even_row = detail::reduce_even_row_neon;
+                divide = detail::divide_neon;
+                expand_row = detail::expand_row_neon;
+                break;
+#endif
+            default:
+                instruction_set = GenericInstructions;
+                break;
+            }
+        }
+
+        InstructionSet instruction_set;
+        ReduceEvenRowFunction reduce_even_row;
+        DivideFunction divide;
+        ExpandRowFunction expand_row;
+    };
+
+
+    /** Answer the kernels selected for this run.  The expert
+     *  parameter "skipsm-simd" switches off the vectorized kernels,
+     *  which is useful to compare against the generic ones. */
+    inline const Kernels&
+    kernels()
+    {
+        static const Kernels selected(parameter::as_boolean("skipsm-simd", true) ? //< skipsm-simd 1
+                                      detail::detect_instruction_set() :
+                                      GenericInstructions);
+        return selected;
+    }
+} // namespace skipsm
+} // namespace enblend
+
+
+#endif // SKIPSM_SIMD_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
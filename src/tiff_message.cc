@@ -31,6 +31,7 @@
 #endif
 
 #include "global.h"
+#include "openmp_def.h"
 #include "tiff_message.h"
 
 
@@ -67,13 +68,19 @@ flush_buffers()
  *  For the messages tend to occur repeatedly, we keep track of every
  *  message and only pass on their first appearance.  The library
  *  always includes the name of the offending TIFF file, thus we get
- *  each message once for each file. */
+ *  each message once for each file.
+ *
+ *  The input headers get read concurrently, so the bookkeeping and the
+ *  output are serialized. */
 static void
 tiff_message(const char* message_class,
              const char* /* module */, const char* format, va_list arguments)
 {
     const std::string message(interpolate_format(format, arguments));
 
+#ifdef OPENMP
+#pragma omp critical (tiff_message)
+#endif
     if (tiff_messages.count(message) == 0)
     {
         tiff_messages.insert(message);
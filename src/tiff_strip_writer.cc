@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "parameter.h"
+#include "tiff_strip_writer.h"
+
+
+// Files larger than this get written as BigTIFF.
+#define BIGTIFF_THRESHOLD (size_t(4000) << 20)
+
+
+namespace enblend
+{
+    namespace
+    {
+        uint16_t
+        compression_of_string(const std::string& a_compression)
+        {
+            // The default of vigra's TIFF encoder is LZW.
+            if (a_compression.empty() || a_compression == "LZW")
+            {
+                return COMPRESSION_LZW;
+            }
+            else if (a_compression == "NONE")
+            {
+                return COMPRESSION_NONE;
+            }
+            else if (a_compression == "DEFLATE")
+            {
+                return COMPRESSION_ADOBE_DEFLATE;
+            }
+            else if (a_compression == "PACKBITS")
+            {
+                return COMPRESSION_PACKBITS;
+            }
+            else
+            {
+                return 0U;
+            }
+        }
+
+
+        // In-memory file for libtiff's client interface
+        struct MemoryFile
+        {
+            MemoryFile() : position(0U) {}
+
+            TiffStripWriter::buffer data;
+            toff_t position;
+        };
+
+
+        tmsize_t
+        memory_read(thandle_t a_handle, void* a_buffer, tmsize_t a_size)
+        {
+            MemoryFile* file = static_cast<MemoryFile*>(a_handle);
+            const toff_t end = std::min(static_cast<toff_t>(file->data.size()),
+                                        file->position + static_cast<toff_t>(a_size));
+            const tmsize_t size = end > file->position ? static_cast<tmsize_t>(end - file->position) : 0;
+
+            if (size > 0)
+            {
+                std::memcpy(a_buffer, &file->data[file->position], size);
+                file->position += size;
+            }
+
+            return size;
+        }
+
+
+        tmsize_t
+        memory_write(thandle_t a_handle, void* a_buffer, tmsize_t a_size)
+        {
+            MemoryFile* file = static_cast<MemoryFile*>(a_handle);
+            const toff_t end = file->position + static_cast<toff_t>(a_size);
+
+            if (end > file->data.size())
+            {
+                file->data.resize(end);
+            }
+            if (a_size > 0)
+            {
+                std::memcpy(&file->data[file->position], a_buffer, a_size);
+            }
+            file->position = end;
+
+            return a_size;
+        }
+
+
+        toff_t
+        memory_seek(thandle_t a_handle, toff_t an_offset, int a_whence)
+        {
+            MemoryFile* file = static_cast<MemoryFile*>(a_handle);
+
+            switch (a_whence)
+            {
+            case SEEK_SET:
+                file->position = an_offset;
+                break;
+            case SEEK_CUR:
+                file->position += an_offset;
+                break;
+            case SEEK_END:
+                file->position = file->data.size() + an_offset;
+                break;
+            }
+
+            return file->position;
+        }
+
+
+        int memory_close(thandle_t) {return 0;}
+
+
+        toff_t
+        memory_size(thandle_t a_handle)
+        {
+            return static_cast<MemoryFile*>(a_handle)->data.size();
+        }
+
+
+        int memory_map(thandle_t, void**, toff_t*) {return 0;}
+
+
+        void memory_unmap(thandle_t, void*, toff_t) {}
+    } // namespace
+
+
+    bool
+    TiffStripWriter::supports_compression(const std::string& a_compression)
+    {
+        return compression_of_string(a_compression) != 0U;
+    }
+
+
+    TiffStripWriter::TiffStripWriter(const vigra::ImageExportInfo& an_info, const Layout& a_layout) :
+        tiff_(nullptr),
+        filename_(an_info.getFileName()),
+        layout_(a_layout),
+        compression_(compression_of_string(an_info.getCompression())),
+        row_size_(size_t(a_layout.width) * a_layout.samples_per_pixel * a_layout.bits_per_sample / 8U),
+        rows_per_strip_(1U)
+    {
+        if (compression_ == 0U)
+        {
+            throw std::runtime_error("TiffStripWriter: unsupported compression \"" +
+                                     std::string(an_info.getCompression()) + "\"");
+        }
+
+        // Strips of about a megabyte amortize the set-up of the
+        // in-memory TIFF and still leave many more strips than
+        // threads for all but tiny images.
+        const size_t strip_size =
+            std::max(1, parameter::as_integer("tiff-strip-size", 1048576)); //< tiff-strip-size 1048576
+        rows_per_strip_ = static_cast<uint32_t>(std::max(size_t(1U),
+                                                         std::min(strip_size / std::max(row_size_, size_t(1U)),
+                                                                  size_t(layout_.height))));
+
+        const bool is_big = row_size_ * layout_.height > BIGTIFF_THRESHOLD;
+        tiff_ = TIFFOpen(filename_.c_str(), is_big ? "w8" : "w");
+        if (tiff_ == nullptr)
+        {
+            throw std::runtime_error("TiffStripWriter: cannot open \"" + filename_ + "\" for writing");
+        }
+
+        set_layout_tags(tiff_, layout_.height, rows_per_strip_);
+        TIFFSetField(tiff_, TIFFTAG_COMPRESSION, compression_);
+
+        const float x_resolution = an_info.getXResolution();
+        const float y_resolution = an_info.getYResolution();
+        if (x_resolution > 0.0f)
+        {
+            TIFFSetField(tiff_, TIFFTAG_XRESOLUTION, x_resolution);
+        }
+        if (y_resolution > 0.0f)
+        {
+            TIFFSetField(tiff_, TIFFTAG_YRESOLUTION, y_resolution);
+        }
+        if (x_resolution > 0.0f || y_resolution > 0.0f)
+        {
+            TIFFSetField(tiff_, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+        }
+
+        const vigra::Diff2D position(an_info.getPosition());
+        if (position.x >= 0 && position.y >= 0 && x_resolution > 0.0f && y_resolution > 0.0f)
+        {
+            TIFFSetField(tiff_, TIFFTAG_XPOSITION, position.x / x_resolution);
+            TIFFSetField(tiff_, TIFFTAG_YPOSITION, position.y / y_resolution);
+        }
+
+        const vigra::Size2D canvas_size(an_info.getCanvasSize());
+        if (canvas_size.x > 0 && canvas_size.y > 0)
+        {
+            TIFFSetField(tiff_, TIFFTAG_PIXAR_IMAGEFULLWIDTH, static_cast<uint32_t>(canvas_size.x));
+            TIFFSetField(tiff_, TIFFTAG_PIXAR_IMAGEFULLLENGTH, static_cast<uint32_t>(canvas_size.y));
+        }
+
+        const vigra::ImageExportInfo::ICCProfile& icc_profile(an_info.getICCProfile());
+        if (!icc_profile.empty())
+        {
+            TIFFSetField(tiff_, TIFFTAG_ICCPROFILE,
+                         static_cast<uint32_t>(icc_profile.size()), icc_profile.begin());
+        }
+    }
+
+
+    TiffStripWriter::~TiffStripWriter()
+    {
+        if (tiff_ != nullptr)
+        {
+            TIFFClose(tiff_);
+        }
+    }
+
+
+    void
+    TiffStripWriter::set_layout_tags(TIFF* a_tiff, uint32_t a_height, uint32_t a_rows_per_strip) const
+    {
+        TIFFSetField(a_tiff, TIFFTAG_IMAGEWIDTH, layout_.width);
+        TIFFSetField(a_tiff, TIFFTAG_IMAGELENGTH, a_height);
+        TIFFSetField(a_tiff, TIFFTAG_ROWSPERSTRIP, a_rows_per_strip);
+        TIFFSetField(a_tiff, TIFFTAG_SAMPLESPERPIXEL, layout_.samples_per_pixel);
+        TIFFSetField(a_tiff, TIFFTAG_BITSPERSAMPLE, layout_.bits_per_sample);
+        TIFFSetField(a_tiff, TIFFTAG_SAMPLEFORMAT, layout_.sample_format);
+        TIFFSetField(a_tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(a_tiff, TIFFTAG_PHOTOMETRIC,
+                     layout_.samples_per_pixel - layout_.extra_samples >= 3 ?
+                     PHOTOMETRIC_RGB :
+                     PHOTOMETRIC_MINISBLACK);
+        if (layout_.extra_samples != 0U)
+        {
+            const uint16_t extra_sample_types[] = {EXTRASAMPLE_ASSOCALPHA};
+            TIFFSetField(a_tiff, TIFFTAG_EXTRASAMPLES, 1U, extra_sample_types);
+        }
+    }
+
+
+    unsigned
+    TiffStripWriter::number_of_strips() const
+    {
+        return (layout_.height + rows_per_strip_ - 1U) / rows_per_strip_;
+    }
+
+
+    unsigned
+    TiffStripWriter::rows_of_strip(unsigned a_strip) const
+    {
+        return std::min(rows_per_strip_, layout_.height - a_strip * rows_per_strip_);
+    }
+
+
+    void
+    TiffStripWriter::encode(unsigned a_strip, const buffer& a_raw_strip, buffer* an_encoded_strip) const
+    {
+        if (compression_ == COMPRESSION_NONE)
+        {
+            *an_encoded_strip = a_raw_strip;
+            return;
+        }
+
+        // Encode the strip as the only strip of an in-memory TIFF of
+        // the same layout and pick up the bytes the codec produced.
+        MemoryFile file;
+        TIFF* tiff = TIFFClientOpen("tiff-strip-writer", "wm", static_cast<thandle_t>(&file),
+                                    memory_read, memory_write, memory_seek, memory_close,
+                                    memory_size, memory_map, memory_unmap);
+        if (tiff == nullptr)
+        {
+            throw std::runtime_error("TiffStripWriter: cannot open in-memory TIFF");
+        }
+
+        const uint32_t rows = rows_of_strip(a_strip);
+        set_layout_tags(tiff, rows, rows);
+        TIFFSetField(tiff, TIFFTAG_COMPRESSION, compression_);
+
+        uint64_t* offsets = nullptr;
+        uint64_t* byte_counts = nullptr;
+        if (TIFFWriteEncodedStrip(tiff, 0U, const_cast<unsigned char*>(&a_raw_strip[0]),
+                                  static_cast<tmsize_t>(a_raw_strip.size())) == -1 ||
+            TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &offsets) != 1 ||
+            TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &byte_counts) != 1)
+        {
+            TIFFClose(tiff);
+            throw std::runtime_error("TiffStripWriter: cannot encode strip");
+        }
+
+        an_encoded_strip->assign(file.data.begin() + offsets[0],
+                                 file.data.begin() + offsets[0] + byte_counts[0]);
+        TIFFClose(tiff);
+    }
+
+
+    void
+    TiffStripWriter::write(unsigned a_strip, const buffer& an_encoded_strip)
+    {
+        const tmsize_t size = static_cast<tmsize_t>(an_encoded_strip.size());
+
+        if (TIFFWriteRawStrip(tiff_, a_strip, const_cast<unsigned char*>(&an_encoded_strip[0]), size) != size)
+        {
+            throw std::runtime_error("TiffStripWriter: cannot write strip to \"" + filename_ + "\"");
+        }
+    }
+
+
+    void
+    TiffStripWriter::close()
+    {
+        const int status = TIFFFlush(tiff_);
+
+        TIFFClose(tiff_);
+        tiff_ = nullptr;
+
+        if (status != 1)
+        {
+            throw std::runtime_error("TiffStripWriter: cannot finish \"" + filename_ + "\"");
+        }
+    }
+} // namespace enblend
+
+
+// Local Variables:
+// mode: c++
+// End:
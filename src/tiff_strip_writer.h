@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef TIFF_STRIP_WRITER_H_INCLUDED_
+#define TIFF_STRIP_WRITER_H_INCLUDED_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <exception>
+#include <string>
+#include <utility>             // std::pair
+#include <vector>
+
+#include <tiffio.h>
+
+#include <vigra/error.hxx>
+#include <vigra/imageinfo.hxx>
+#include <vigra/rgbvalue.hxx>
+#include <vigra/sized_int.hxx>
+#include <vigra/utilities.hxx>
+
+#include "openmp_def.h"
+
+
+namespace enblend
+{
+    // Writer of striped (Big)TIFF files whose strips get compressed
+    // in parallel.
+    //
+    // libtiff compresses and writes strip after strip in the calling
+    // thread, which makes the output of large images with LZW or
+    // Deflate compression a long serial tail.  TiffStripWriter
+    // instead runs each strip through the codec of a private,
+    // in-memory TIFF -- which libtiff allows to do concurrently -- and
+    // appends the encoded bytes to the output file with
+    // TIFFWriteRawStrip() in strip order.  The file is identical to
+    // one libtiff writes by itself with the same strip layout.
+    class TiffStripWriter
+    {
+    public:
+        struct Layout
+        {
+            Layout() :
+                width(0U), height(0U),
+                samples_per_pixel(1U), extra_samples(0U),
+                bits_per_sample(8U), sample_format(SAMPLEFORMAT_UINT) {}
+
+            uint32_t width;
+            uint32_t height;
+            uint16_t samples_per_pixel; //< including extra samples
+            uint16_t extra_samples;     //< 0 or 1 (alpha)
+            uint16_t bits_per_sample;
+            uint16_t sample_format;
+        };
+
+        typedef std::vector<unsigned char> buffer;
+
+        // Answer whether we can write files with compression
+        // A_COMPRESSION, given as for vigra::ImageExportInfo.
+        static bool supports_compression(const std::string& a_compression);
+
+        // Open the file described by AN_INFO for an image of A_LAYOUT
+        // and write all tags.  Throw std::runtime_error on failure.
+        TiffStripWriter(const vigra::ImageExportInfo& an_info, const Layout& a_layout);
+        ~TiffStripWriter();
+
+        TiffStripWriter(const TiffStripWriter&) = delete;
+        TiffStripWriter& operator=(const TiffStripWriter&) = delete;
+
+        size_t row_size() const {return row_size_;}
+        unsigned rows_per_strip() const {return rows_per_strip_;}
+        unsigned number_of_strips() const;
+        unsigned rows_of_strip(unsigned a_strip) const;
+
+        // Encode the raw rows of A_STRIP in A_RAW_STRIP into
+        // AN_ENCODED_STRIP.  Thread-safe.
+        void encode(unsigned a_strip, const buffer& a_raw_strip, buffer* an_encoded_strip) const;
+
+        // Append AN_ENCODED_STRIP as strip A_STRIP.  Not thread-safe;
+        // call in strip order.
+        void write(unsigned a_strip, const buffer& an_encoded_strip);
+
+        // Write the directory and close the file.
+        void close();
+
+    private:
+        void set_layout_tags(TIFF* a_tiff, uint32_t a_height, uint32_t a_rows_per_strip) const;
+
+        TIFF* tiff_;
+        const std::string filename_;
+        const Layout layout_;
+        const uint16_t compression_;
+        size_t row_size_;
+        uint32_t rows_per_strip_;
+    };
+
+
+    template <typename T> struct TiffSampleTraits;
+
+#define TIFF_SAMPLE_TRAITS(m_type, m_format, m_name)                    \
+    template <> struct TiffSampleTraits<m_type>                         \
+    {                                                                   \
+        static const uint16_t bits = 8U * sizeof(m_type);               \
+        static const uint16_t format = m_format;                        \
+        static const char* name() {return m_name;}                      \
+    }
+
+    TIFF_SAMPLE_TRAITS(vigra::UInt8, SAMPLEFORMAT_UINT, "UINT8");
+    TIFF_SAMPLE_TRAITS(vigra::Int8, SAMPLEFORMAT_INT, "INT8");
+    TIFF_SAMPLE_TRAITS(vigra::UInt16, SAMPLEFORMAT_UINT, "UINT16");
+    TIFF_SAMPLE_TRAITS(vigra::Int16, SAMPLEFORMAT_INT, "INT16");
+    TIFF_SAMPLE_TRAITS(vigra::UInt32, SAMPLEFORMAT_UINT, "UINT32");
+    TIFF_SAMPLE_TRAITS(vigra::Int32, SAMPLEFORMAT_INT, "INT32");
+    TIFF_SAMPLE_TRAITS(float, SAMPLEFORMAT_IEEEFP, "FLOAT");
+    TIFF_SAMPLE_TRAITS(double, SAMPLEFORMAT_IEEEFP, "DOUBLE");
+
+#undef TIFF_SAMPLE_TRAITS
+
+
+    template <typename T>
+    struct TiffPixelTraits
+    {
+        typedef T component_type;
+        template <typename U> using rebind = U;
+        static const uint16_t samples = 1U;
+        static component_type sample(const T& a_pixel, int) {return a_pixel;}
+    };
+
+
+    template <typename T>
+    struct TiffPixelTraits<vigra::RGBValue<T, 0, 1, 2> >
+    {
+        typedef T component_type;
+        template <typename U> using rebind = vigra::RGBValue<U, 0, 1, 2>;
+        static const uint16_t samples = 3U;
+        static component_type sample(const vigra::RGBValue<T, 0, 1, 2>& a_pixel, int a_channel)
+        {
+            return a_pixel[a_channel];
+        }
+    };
+
+
+    /** Answer whether the strip writer can produce the file AN_INFO
+     *  describes from samples of OUTPUT_COMPONENT_TYPE.  The caller
+     *  makes sure that AN_INFO names a TIFF file.  We leave JPEG
+     *  compression and conversions of the pixel type to vigra. */
+    template <typename OutputComponentType>
+    inline bool
+    canExportInStrips(const vigra::ImageExportInfo& an_info)
+    {
+        const std::string pixel_type(an_info.getPixelType());
+
+        return
+            TiffStripWriter::supports_compression(an_info.getCompression()) &&
+            (pixel_type.empty() || pixel_type == TiffSampleTraits<OutputComponentType>::name());
+    }
+
+
+    /** Encode and append a band of rows of the output image.
+     *
+     *  The band covers the rows A_FIRST_ROW up to A_FIRST_ROW plus its
+     *  height.  A_FIRST_ROW must be a multiple of the rows per strip
+     *  and the band must end on a strip boundary or at the bottom of
+     *  the image.  A_PIXEL_FUNCTOR maps each pixel of the band to an
+     *  output pixel with components of OUTPUT_COMPONENT_TYPE; the
+     *  alpha values get cast to OUTPUT_COMPONENT_TYPE.  Strips get
+     *  encoded in parallel and written in order.  Throw
+     *  std::runtime_error if writing fails. */
+    template <class OutputComponentType,
+              class SrcIterator, class SrcAccessor, class AlphaIterator, class AlphaAccessor,
+              class PixelFunctor>
+    void
+    writeBandInStrips(TiffStripWriter& a_writer, unsigned a_first_row,
+                      vigra::triple<SrcIterator, SrcIterator, SrcAccessor> a_band,
+                      std::pair<AlphaIterator, AlphaAccessor> an_alpha,
+                      PixelFunctor a_pixel_functor)
+    {
+        typedef TiffPixelTraits<typename SrcAccessor::value_type> source_traits;
+        typedef typename source_traits::template rebind<OutputComponentType> output_pixel_type;
+        typedef TiffPixelTraits<output_pixel_type> output_traits;
+
+        const vigra::Diff2D size(a_band.second - a_band.first);
+        const int rows_per_strip = static_cast<int>(a_writer.rows_per_strip());
+
+        vigra_precondition(a_first_row % rows_per_strip == 0,
+                           "writeBandInStrips: band does not start on a strip boundary");
+
+        const int first_strip = static_cast<int>(a_first_row) / rows_per_strip;
+        const int end_strip = (static_cast<int>(a_first_row) + size.y + rows_per_strip - 1) / rows_per_strip;
+        std::exception_ptr error;
+
+#ifdef OPENMP
+#pragma omp parallel for ordered schedule(dynamic)
+#endif
+        for (int strip = first_strip; strip < end_strip; ++strip)
+        {
+            TiffStripWriter::buffer encoded;
+            std::exception_ptr strip_error;
+
+            try
+            {
+                const int first_row = (strip - first_strip) * rows_per_strip;
+                const int rows = static_cast<int>(a_writer.rows_of_strip(strip));
+                TiffStripWriter::buffer raw(rows * a_writer.row_size());
+                OutputComponentType* out = reinterpret_cast<OutputComponentType*>(&raw[0]);
+
+                vigra_precondition(first_row + rows <= size.y,
+                                   "writeBandInStrips: band does not end on a strip boundary");
+
+                for (int y = first_row; y < first_row + rows; ++y)
+                {
+                    SrcIterator x = a_band.first + vigra::Diff2D(0, y);
+                    AlphaIterator a = an_alpha.first + vigra::Diff2D(0, y);
+                    const SrcIterator x_end = x + vigra::Diff2D(size.x, 0);
+
+                    for (; x.x != x_end.x; ++x.x, ++a.x)
+                    {
+                        const output_pixel_type pixel(a_pixel_functor(a_band.third(x)));
+                        for (int channel = 0; channel != output_traits::samples; ++channel)
+                        {
+                            *out++ = output_traits::sample(pixel, channel);
+                        }
+                        *out++ = static_cast<OutputComponentType>(an_alpha.second(a));
+                    }
+                }
+
+                a_writer.encode(strip, raw, &encoded);
+            }
+            catch (...)
+            {
+                strip_error = std::current_exception();
+            }
+
+            // No exception must leave the parallel loop and every
+            // iteration must pass the ordered region.  Only the
+            // ordered region touches ERROR, which keeps the first
+            // failure in strip order.
+#ifdef OPENMP
+#pragma omp ordered
+#endif
+            {
+                if (!error && strip_error)
+                {
+                    error = strip_error;
+                }
+                else if (!error)
+                {
+                    try
+                    {
+                        a_writer.write(strip, encoded);
+                    }
+                    catch (...)
+                    {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+
+    /** Answer the strip layout of an image of A_SIZE pixels of
+     *  PIXEL_TYPE plus alpha written with OUTPUT_COMPONENT_TYPE
+     *  samples. */
+    template <class OutputComponentType, class PixelType>
+    inline TiffStripWriter::Layout
+    stripLayout(const vigra::Diff2D& a_size)
+    {
+        TiffStripWriter::Layout layout;
+
+        layout.width = a_size.x;
+        layout.height = a_size.y;
+        layout.samples_per_pixel = TiffPixelTraits<PixelType>::samples + 1U;
+        layout.extra_samples = 1U;
+        layout.bits_per_sample = TiffSampleTraits<OutputComponentType>::bits;
+        layout.sample_format = TiffSampleTraits<OutputComponentType>::format;
+
+        return layout;
+    }
+
+
+    /** Export an image and its alpha channel as a striped TIFF file
+     *  with parallel compression, mapping each pixel with
+     *  A_PIXEL_FUNCTOR to OUTPUT_COMPONENT_TYPE samples.
+     *
+     *  The caller makes sure that AN_INFO names a TIFF file.  Answer
+     *  false without touching the file system if
+     *  canExportInStrips() says no.  Throw std::runtime_error if
+     *  writing fails. */
+    template <class OutputComponentType,
+              class SrcIterator, class SrcAccessor, class AlphaIterator, class AlphaAccessor,
+              class PixelFunctor>
+    bool
+    exportImageAlphaInStrips(vigra::triple<SrcIterator, SrcIterator, SrcAccessor> an_image,
+                             std::pair<AlphaIterator, AlphaAccessor> an_alpha,
+                             const vigra::ImageExportInfo& an_info,
+                             PixelFunctor a_pixel_functor)
+    {
+        if (!canExportInStrips<OutputComponentType>(an_info))
+        {
+            return false;
+        }
+
+        TiffStripWriter writer(an_info,
+                               stripLayout<OutputComponentType, typename SrcAccessor::value_type>
+                               (an_image.second - an_image.first));
+        writeBandInStrips<OutputComponentType>(writer, 0U, an_image, an_alpha, a_pixel_functor);
+        writer.close();
+
+        return true;
+    }
+
+
+    /** Export an image and its alpha channel as a striped TIFF file
+     *  without any conversion of the pixel values. */
+    template <class SrcIterator, class SrcAccessor, class AlphaIterator, class AlphaAccessor>
+    bool
+    exportImageAlphaInStrips(vigra::triple<SrcIterator, SrcIterator, SrcAccessor> an_image,
+                             std::pair<AlphaIterator, AlphaAccessor> an_alpha,
+                             const vigra::ImageExportInfo& an_info)
+    {
+        typedef typename SrcAccessor::value_type pixel_type;
+
+        return exportImageAlphaInStrips<typename TiffPixelTraits<pixel_type>::component_type>
+            (an_image, an_alpha, an_info, [](const pixel_type& x) {return x;});
+    }
+} // namespace enblend
+
+
+#endif // TIFF_STRIP_WRITER_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,141 @@
+// Precision and throughput of single- vs. double-precision pyramids
+//
+// Build the Laplacian pyramid of a synthetic HDR image and collapse
+// it again, once with float pyramid pixels and float SKIPSM state and
+// once with double/double, which are the traits for FLOAT images
+// without PREFER_FLOAT_TO_DOUBLE_AS_PYRAMID_TYPE.  Report the error
+// of the single-precision round trip against the double-precision
+// one, with and without compensated collapse, along with the
+// pyramids' memory and the time of each round trip.
+//
+// Build in the src directory with e.g.
+//     g++ -std=c++17 -O3 -ffast-math -I. -I.. ../test/float_pyramid_precision.cc \
+//         parameter.cc pyramid_pool.cc -lvigraimpex -llcms2 -lgsl -lgslcblas
+// Usage: float_pyramid_precision [WIDTH [HEIGHT [LEVELS]]]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <lcms2.h>
+
+#include "vigra/stdimage.hxx"
+
+#include "global.h"
+#include "parameter.h"
+
+const std::string command("float_pyramid_precision");
+int Verbose = 0;
+
+cmsHPROFILE InputProfile = nullptr;
+cmsHTRANSFORM InputToXYZTransform = nullptr;
+cmsHTRANSFORM XYZToInputTransform = nullptr;
+cmsHTRANSFORM InputToLabTransform = nullptr;
+cmsHTRANSFORM LabToInputTransform = nullptr;
+cmsHANDLE CIECAMTransform = nullptr;
+
+#include "common.h"
+#include "pyramid.h"
+
+using namespace enblend;
+
+
+struct Result
+{
+    vigra::DImage image;
+    double seconds;
+    size_t bytes;
+};
+
+
+template <typename PyramidPixelType, typename SKIPSMImagePixelType>
+Result
+round_trip(const vigra::FImage& an_image, const vigra::BImage& an_alpha, unsigned levels)
+{
+    typedef PyramidImage<PyramidPixelType> PyramidImageType;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<PyramidImageType*>* lp =
+        laplacianPyramid<vigra::FImage, vigra::BImage, PyramidImageType, 8, 0,
+                         SKIPSMImagePixelType, vigra::Int16>("lp", levels, false,
+                                                             srcImageRange(an_image), srcImage(an_alpha));
+    collapsePyramid<SKIPSMImagePixelType>(false, lp);
+    const auto stop = std::chrono::steady_clock::now();
+
+    Result result;
+    result.seconds = std::chrono::duration<double>(stop - start).count();
+    result.bytes = 0U;
+    for (auto level : *lp) {
+        result.bytes += level->width() * level->height() * sizeof(PyramidPixelType);
+    }
+    result.image.resize(an_image.size());
+    vigra::copyImage(srcImageRange(*(*lp)[0]), destImage(result.image));
+
+    for (auto level : *lp) {
+        delete level;
+    }
+    delete lp;
+
+    return result;
+}
+
+
+void
+report(const char* a_label, const Result& a_result, const Result& a_reference)
+{
+    double maximum_relative_error = 0.0;
+    double sum_squared_relative_error = 0.0;
+    const int n = a_result.image.width() * a_result.image.height();
+
+    for (int i = 0; i < n; ++i) {
+        const double reference = a_reference.image.data()[i];
+        const double relative_error = std::fabs(a_result.image.data()[i] - reference) / std::fabs(reference);
+        maximum_relative_error = std::max(maximum_relative_error, relative_error);
+        sum_squared_relative_error += relative_error * relative_error;
+    }
+
+    std::cout <<
+        a_label << ": " <<
+        "max. rel. error " << maximum_relative_error <<
+        ", rms rel. error " << std::sqrt(sum_squared_relative_error / n) <<
+        " (float epsilon " << std::numeric_limits<float>::epsilon() << "), " <<
+        a_result.bytes / 1048576.0 << " MiB, " <<
+        a_result.seconds << " s\n";
+}
+
+
+int main(int argc, char** argv)
+{
+    const int width = argc >= 2 ? std::atoi(argv[1]) : 4096;
+    const int height = argc >= 3 ? std::atoi(argv[2]) : 4096;
+    const unsigned levels = argc >= 4 ? std::atoi(argv[3]) : 10U;
+
+    // Radiance spans six orders of magnitude across the image with
+    // a 1% noise on top.
+    vigra::FImage image(width, height);
+    vigra::BImage alpha(width, height, vigra::UInt8(255));
+    std::mt19937 generator(20170919U);
+    std::normal_distribution<float> noise(1.0f, 0.01f);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const double t = double(x + y) / double(width + height);
+            image(x, y) = std::pow(10.0, 6.0 * t - 3.0) * noise(generator);
+        }
+    }
+
+    const Result reference = round_trip<double, double>(image, alpha, levels);
+    report("double/double", reference, reference);
+
+    parameter::insert("compensated-collapse", "0");
+    report("float/float", round_trip<float, float>(image, alpha, levels), reference);
+
+    parameter::insert("compensated-collapse", "1");
+    report("float/float, compensated", round_trip<float, float>(image, alpha, levels), reference);
+
+    return 0;
+}